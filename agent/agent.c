@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -49,14 +50,57 @@
 #include "event.h"
 #include "atomic.h"
 #include "policy.h"
+#include "shaping.h"
+#include "flightrec.h"
+#include "healthcheck.h"
+#include "drain.h"
+#include "loadaware.h"
+#include "localcheck.h"
+#include "plugin.h"
+#include "appload.h"
+#include "svcindex.h"
+#include "resync.h"
+#include "zkjournal.h"
+#include "svcmanifest.h"
 
 #define NLB_AGENT_ROUTE_DATA_HASH_LEN 107
+#define NLB_ATTACH_THREADS      (8)     /* 启动时并行加载本地业务的最大线程数 */
+#define NLB_ATTACH_BATCH        (64)    /* 每个加载线程至少分到的业务数 */
+
+/* 启动时待加载的本地业务 */
+struct attach_item {
+    char     name[NLB_SERVICE_NAME_LEN];    /* 业务名 */
+    int32_t  result;                        /* 加载结果，<0 失败 */
+    uint32_t mmaplen[3];                    /* 元数据和两份服务器数据的映射长度 */
+    void    *meta;
+    void    *server_data[2];
+    const struct svc_manifest_entry *entry; /* 清单中的记录，不是来自清单时为NULL */
+};
+
+/* 待加载的本地业务列表 */
+struct attach_list {
+    struct attach_item *items;
+    uint32_t num;
+    uint32_t cap;
+    uint32_t next;                          /* 下一个待加载的业务，加载线程共享 */
+    char   (*loaded)[NLB_SERVICE_NAME_LEN]; /* 已加载的业务名，按名字排序，后台扫描时跳过 */
+    uint32_t loaded_num;
+};
+
+/* 后台目录扫描状态 */
+enum {
+    NLB_SCAN_IDLE    = 0,
+    NLB_SCAN_RUNNING = 1,
+    NLB_SCAN_DONE    = 2,
+};
 
 static struct list_head agent_rdata_hash[NLB_AGENT_ROUTE_DATA_HASH_LEN];  /* 使用业务名计算hash */
 static struct list_head agent_rdata_list;                                 /* agent路由数据链表  */
-
-/* 多阶hash模数，20000个节点，15阶 */
-static uint32_t mhash_mods[MAX_ROW_COUNT] = {4621, 3557, 2741, 2111, 1627, 1259, 971, 751, 577, 443, 347, 269, 211, 163, 352};
+static struct servers_delta agent_servers_delta;                          /* 配置变更的服务器列表差异 */
+static struct attach_list scan_list;                                      /* 后台目录扫描的业务列表 */
+static pthread_t scan_tid;                                                /* 后台目录扫描线程 */
+static uint32_t  scan_state = NLB_SCAN_IDLE;                              /* 后台目录扫描状态 */
+static uint64_t  scan_start_time;
 
 /**
  * @brief 获取agent路由数据链表
@@ -72,6 +116,7 @@ struct list_head *get_rdata_list(void)
 struct agent_local_rdata *add_local_rdata(const char *name, struct shm_meta *meta,
                      struct shm_servers *s0, struct shm_servers *s1)
 {
+    uint32_t i;
     uint32_t hash = gen_hash_key(name)%NLB_AGENT_ROUTE_DATA_HASH_LEN;
     struct agent_local_rdata *rdata = malloc(sizeof(struct agent_local_rdata));
     if (NULL == rdata) {
@@ -85,10 +130,20 @@ struct agent_local_rdata *add_local_rdata(const char *name, struct shm_meta *met
     rdata->servs_data[1]    = s1;
     rdata->watcher_flag     = FALSE;
     rdata->update_time      = get_time_ms();
+    rdata->traffic          = 0;
+    rdata->access_time      = 0;
 
     list_add(&rdata->hash_node, &agent_rdata_hash[hash]);
     list_add_tail(&rdata->list_node, &agent_rdata_list);
     INIT_LIST_HEAD(&rdata->event_list);
+    INIT_LIST_HEAD(&rdata->index_list);
+    for (i = 0; i < NLB_EVENT_HASH_LEN; i++) {
+        INIT_LIST_HEAD(&rdata->event_hash[i]);
+    }
+
+    /* 建立服务器到业务的反向索引 */
+    svcindex_update(rdata, rdata->servs_data[meta->index]);
+    svcmanifest_touch();
 
     return rdata;
 }
@@ -134,473 +189,26 @@ void clean_services_watching(void)
 void delete_local_rdata(const char *name)
 {
     uint32_t hash = gen_hash_key(name)%NLB_AGENT_ROUTE_DATA_HASH_LEN;
-    struct agent_local_rdata *rdata;
+    struct agent_local_rdata *rdata, *tmp;
 
-    list_for_each_entry(rdata, &agent_rdata_hash[hash], hash_node)
+    list_for_each_entry_safe(rdata, tmp, &agent_rdata_hash[hash], hash_node)
     {
         if (!strncmp(name, rdata->name, NLB_SERVICE_NAME_LEN)) {
+            svcindex_remove(rdata);
             list_del(&rdata->hash_node);
             list_del(&rdata->list_node);
             free(rdata);
+            svcmanifest_touch();
         }
     }
 }
 
-/**
- * @brief 重新初始化多阶索引
- */
-void calc_servers_hash(struct shm_servers *servers)
-{
-    uint32_t base, hash;
-    int32_t  i, j;
-    struct server_info *server;
-
-    servers->mhash_order = MAX_ROW_COUNT;
-    memcpy(servers->mhash_mods, mhash_mods, sizeof(mhash_mods));
-    memset(servers->mhash_idx, 0xff, sizeof(servers->mhash_idx));
-
-    for (i = 0; i < servers->server_num; i++) {
-        server = &servers->svrs[i];
-        base   = 0;
-
-        for (j = 0; j < MAX_ROW_COUNT; j++) {
-            hash = server->server_ip%servers->mhash_mods[j];
-
-            if (servers->mhash_idx[base + hash] == 0xffffffff) {
-                servers->mhash_idx[base + hash] = i;
-                break;
-            }
-
-            base += servers->mhash_mods[j];
-        }
-    }
-}
-
-/**
- * @brief 清空服务器统计数据
- * @info  包括时延、成功数、失败数，清空后可以写入共享内存
- */
-void clean_servers_stat(struct shm_servers *servers)
-{
-    uint32_t i;
-    uint32_t svr_num = servers->server_num;
-    struct server_info *server;
-
-
-    servers->cost_total    = 0;
-    servers->fail_total    = 0;
-    servers->success_total = 0;
-
-    for (i = 0; i < svr_num; i++) {
-        server = &servers->svrs[i];
-
-        server->failed  = 0;
-        server->success = 0;
-        server->cost    = 0;
-    }
-}
-
-/**
- * @brief 交换两个server的信息
- */
-void swap_server_info(struct server_info *server1, struct server_info *server2)
-{
-    struct server_info server_tmp;
-
-    /* 相同地址，直接返回 */
-    if (server1 == server2) {
-        return;
-    }
-
-    memcpy(&server_tmp, server1, sizeof(struct server_info));
-    memcpy(server1, server2, sizeof(struct server_info));
-    memcpy(server2, &server_tmp, sizeof(struct server_info));
-}
-
-/**
- * @brief 计算服务器的权重信息
- */
-void calc_servers_weight(struct shm_servers *servers)
-{
-    uint32_t i;
-    uint32_t weight, base = 0;
-    uint32_t dead_retrys;
-    struct server_info *server;
-
-    /* 设置每个服务器的权重基数 */
-    for (i = 0; i < servers->server_num; i++) {
-        server = &servers->svrs[i];
-        if (server->dead_time) {
-            break;
-        }
-
-        server->weight_base = base;
-        base += server->weight_dynamic;
-    }
-
-    servers->dead_num         = servers->server_num - i;
-    servers->weight_total     = base;
-    servers->weight_dead_base = base;
-    servers->dead_retry_times = 0;
-
-    /* 计算死机服务器可以分配的权重，死机机器统一一个权重，随机选择一个 */
-    if (servers->dead_num != 0) {
-        weight      = (uint32_t)(servers->weight_total * servers->dead_retry_ratio + 1);
-        dead_retrys = (uint32_t)((servers->success_total + servers->fail_total)*servers->dead_retry_ratio);
-        servers->weight_total      += max(weight, (uint32_t)1);
-        servers->dead_retry_times   = max(dead_retrys, (uint32_t)1);
-    }
-}
-
-void _shaping_servers(struct shm_servers *servers, double success_ratio_base, BOOL weight_dec)
-{
-    int32_t  begin, end;
-    uint16_t weight;
-    uint32_t svr_num = servers->server_num;
-    uint64_t single_req_total;
-    double   single_success_ratio, ratio;
-
-    struct server_info *server;
-
-    /* 计算每一个服务器权重和死机状态 */
-    end   = (int32_t)svr_num - 1;
-    begin = 0;
-    while ((begin <= end) && (end >= 0)) {
-        server              = &servers->svrs[begin];
-        single_req_total    = server->failed + server->success;
-
-        /* 如果没有处理过请求，权重信息保持不变 */
-        if (!single_req_total) {
-            if (server->dead_time) {
-                server->weight_dynamic = 0;
-                swap_server_info(server, &servers->svrs[end]);
-                end--;
-            } else {
-                begin++;
-            }
-            continue;
-        }
-
-        single_success_ratio = ((double)server->success)/single_req_total;
-
-        /* 单机成功率大于基准成功率 */
-        if (single_success_ratio >= success_ratio_base) {
-            /* 死机机器，重新修改权重 */
-            if (server->dead_time) {
-                server->dead_time = 0;
-                weight            = (uint16_t)(server->weight_static * servers->resume_weight_ratio);
-                server->weight_dynamic  = max(weight, (uint16_t)1);
-                begin++;
-                continue;
-            }
-
-            /* 如果大于基准成功率，增加权重 */
-            if (server->weight_static != server->weight_dynamic) {
-                weight = (uint16_t)(server->weight_static * servers->weight_incr_ratio);
-                weight = max(weight, (uint16_t)1);
-                server->weight_dynamic += weight;
-                server->weight_dynamic  = min(server->weight_static, server->weight_dynamic);
-            }
-
-            begin++;
-
-            continue;
-        }
-
-        /* 单机成功率为0 */
-        if (single_success_ratio <= 0.00001) {
-            if (server->dead_time == 0) {
-                server->dead_time = get_time_ms();
-            }
-
-            server->weight_dynamic  = 0;
-            swap_server_info(server, &servers->svrs[end]);
-            end--;
-            continue;
-        }
-
-        if (!weight_dec) {
-            begin++;
-            continue;
-        }
-
-        /* 单机成功率低于平均成功率,减小权重 */
-        ratio = single_success_ratio;
-        ratio = ratio * ratio;
-        server->weight_dynamic = (uint16_t)(server->weight_dynamic * ratio);
-
-        /* 降低权重后，权重为零 */
-        if (0 == server->weight_dynamic) {
-            if (0 == server->dead_time) {
-                server->dead_time = get_time_ms();
-            }
-
-            swap_server_info(server, &servers->svrs[end]);
-            end--;
-            continue;
-        }
-
-        begin++;
-    }
-}
-
-uint32_t calc_weight_low_num(struct shm_servers *servers)
-{
-    struct server_info *info;
-    float water_mark = servers->weight_low_watermark;
-    uint32_t idx, cnt = 0;
-
-    for (idx = 0; idx < servers->server_num; idx ++) {
-        info = servers->svrs + idx;
-        if (((float)info->weight_dynamic)/info->weight_static < water_mark) {
-            cnt++;
-        }
-    }
-
-    return cnt;
-}
-
-/**
- * @brief 对服务器信息做调整
- * @info  包括调整动态权重，死机等信息
- */
-void shaping_servers(struct shm_servers *servers)
-{
-    uint32_t svr_num = servers->server_num;
-    uint64_t req_total;
-    double   success_rate;
-    float    weight_low_real_ratio;
-
-    /* 没有服务器，不用计算 */
-    if (!svr_num) {
-        return;
-    }
-
-    weight_low_real_ratio = ((float)servers->weight_low_num)/svr_num;
-    if (weight_low_real_ratio <= servers->weight_low_ratio) {
-        _shaping_servers(servers, servers->success_ratio_base, TRUE);
-    } else {
-        /* 计算平均成功率，用平均成功率计算权重 */
-        req_total = servers->fail_total + servers->success_total;
-        if (req_total == 0) {
-            success_rate = 100.0;
-        } else {
-            success_rate = ((double)servers->success_total)/req_total;
-        }
-
-        success_rate = min(success_rate, (double)servers->success_ratio_base);
-        _shaping_servers(servers, success_rate, FALSE);
-    }
-
-    servers->weight_low_num = calc_weight_low_num(servers);
-}
-
-/**
- * @brief 拷贝服务器信息数据
- * @info  拷贝服务器数据的同时，计算统计数据
- */
-void copy_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower)
-{
-    uint32_t i, j;
-    uint32_t svr_num = src_svrs->server_num;
-    struct server_info *dst_svr;
-    struct server_info *src_svr;
-
-    dst_svrs->cost_total    = 0;
-    dst_svrs->fail_total    = 0;
-    dst_svrs->success_total = 0;
-
-    if (src_svrs->version == NLB_SHM_VERSION1) {
-        dst_svrs->server_num            = svr_num;
-        dst_svrs->policy                = src_svrs->policy;
-        dst_svrs->weight_total          = src_svrs->weight_total;
-        dst_svrs->weight_static_total   = src_svrs->weight_static_total;
-        dst_svrs->shaping_request_min   = src_svrs->shaping_request_min;
-        dst_svrs->success_ratio_base    = src_svrs->success_ratio_base;
-        dst_svrs->success_ratio_min     = src_svrs->success_ratio_min;
-        dst_svrs->resume_weight_ratio   = src_svrs->resume_weight_ratio;
-        dst_svrs->dead_retry_ratio      = src_svrs->dead_retry_ratio;
-        dst_svrs->weight_low_watermark  = src_svrs->weight_low_watermark;
-        dst_svrs->weight_low_ratio      = src_svrs->weight_low_ratio;
-        dst_svrs->weight_incr_ratio     = src_svrs->weight_incr_ratio;
-        dst_svrs->version               = NLB_SHM_VERSION1;
-        dst_svrs->weight_low_num        = src_svrs->weight_low_num;
-    } else {
-        dst_svrs->server_num            = svr_num;
-        dst_svrs->policy                = src_svrs->policy;
-        dst_svrs->weight_total          = src_svrs->weight_total;
-        dst_svrs->weight_static_total   = 0;
-        dst_svrs->shaping_request_min   = NLB_SHAPING_REQUEST_MIN;
-        dst_svrs->success_ratio_base    = NLB_SUCCESS_RATIO_BASE;
-        dst_svrs->success_ratio_min     = NLB_SUCCESS_RATIO_MIN;
-        dst_svrs->resume_weight_ratio   = NLB_RESUME_WEIGHT_RATIO;
-        dst_svrs->dead_retry_ratio      = NLB_DEAD_RETRY_RATIO;
-        dst_svrs->weight_low_watermark  = NLB_WEIGHT_LOW_WATERMARK;
-        dst_svrs->weight_low_ratio      = NLB_WEIGHT_LOW_RATIO;
-        dst_svrs->weight_incr_ratio     = NLB_WEIGHT_INCR_RATIO;
-        dst_svrs->version               = NLB_SHM_VERSION1;
-        dst_svrs->weight_low_num        = src_svrs->weight_low_num;
-    }
-
-    for (i = 0; i < svr_num; i++) {
-        dst_svr = &dst_svrs->svrs[i];
-        src_svr = &src_svrs->svrs[i];
-
-        dst_svr->server_ip      = src_svr->server_ip;
-        dst_svr->weight_static  = src_svr->weight_static;
-        dst_svr->weight_dynamic = src_svr->weight_dynamic;
-        dst_svr->port_type      = src_svr->port_type;
-        dst_svr->port_num       = src_svr->port_num;
-
-        dst_svr->dead_time      = src_svr->dead_time;
-        if ((dst_svr->dead_time != 0) || ((src_svr->failed + src_svr->success) >= lower)) {
-            dst_svr->failed     = return_and_set(&src_svr->failed, (uint32_t)0);
-            dst_svr->success    = return_and_set(&src_svr->success, (uint32_t)0);
-            dst_svr->cost       = return_and_set_8(&src_svr->cost, (uint64_t)0);
-        } else {
-            dst_svr->failed     = 0;
-            dst_svr->success    = 0;
-            dst_svr->cost       = 0;
-        }
-
-        for (j = 0; j < src_svr->port_num; j++) {
-            dst_svr->port[j]    = src_svr->port[j];
-        }
-
-        dst_svrs->cost_total   += dst_svr->cost;
-        dst_svrs->fail_total   += dst_svr->failed;
-        dst_svrs->success_total+= dst_svr->success;
-    }
-}
-
-
-/**
- * @brief 拷贝指定的服务器信息数据
- * @info  拷贝指定的服务器数据的同时，计算统计数据
- */
-void copy_specified_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower)
-{
-    uint32_t i;
-    uint32_t svr_num = dst_svrs->server_num;
-    struct server_info *dst_svr;
-    struct server_info *src_svr;
-
-    dst_svrs->cost_total    = 0;
-    dst_svrs->fail_total    = 0;
-    dst_svrs->success_total = 0;
-    dst_svrs->weight_low_num= 0;
-
-    for (i = 0; i < svr_num; i++) {
-        dst_svr = &dst_svrs->svrs[i];
-        src_svr = get_server_info(dst_svr->server_ip, src_svrs);
-        if (NULL == src_svr) {
-            dst_svr->cost       = 0;
-            dst_svr->failed     = 0;
-            dst_svr->success    = 0;
-            dst_svr->dead_time  = 0;
-            dst_svr->weight_dynamic = dst_svr->weight_static;
-            continue;
-        }
-
-        dst_svr->dead_time      = src_svr->dead_time;
-
-        if ((dst_svr->dead_time != 0) || ((src_svr->failed + src_svr->success) >= lower)) {
-            dst_svr->failed     = return_and_set(&src_svr->failed, (uint32_t)0);
-            dst_svr->success    = return_and_set(&src_svr->success, (uint32_t)0);
-            dst_svr->cost       = return_and_set_8(&src_svr->cost, (uint64_t)0);
-        } else {
-            dst_svr->failed     = 0;
-            dst_svr->success    = 0;
-            dst_svr->cost       = 0;
-        }
-        dst_svr->weight_dynamic = src_svr->weight_dynamic;
-
-        dst_svrs->cost_total   += dst_svr->cost;
-        dst_svrs->fail_total   += dst_svr->failed;
-        dst_svrs->success_total+= dst_svr->success;
-    }
-}
-
-
-
-/**
- * @brief 通过IP获取服务器信息
- */
-struct server_info *get_server_info(uint32_t ip, struct shm_servers *servers)
-{
-    uint32_t i;
-    uint32_t hash, idx, base = 0;
-    struct server_info *server;
-
-    for (i = 0; i < servers->mhash_order; i++) {
-        hash    = ip % servers->mhash_mods[i];
-        idx     = servers->mhash_idx[hash + base];
-        if (idx == 0xffffffff) {
-            continue;
-        }
-
-        if (idx >= NLB_SERVER_MAX) {
-            NLOG_ERROR("Invalid service local config");
-            return NULL;
-        }
-
-        server  = &servers->svrs[idx];
-        if (server->server_ip == ip) {
-            return server;
-        }
-
-        base += servers->mhash_mods[i];
-    }
-
-    return NULL;
-}
-
-/**
- * @brief 合并统计数据
- */
-void merge_servers_stat(struct shm_servers *dst_svrs, struct shm_servers *src_svrs)
-{
-    uint32_t i;
-    uint32_t svr_num = dst_svrs->server_num;
-    struct server_info *dst_svr;
-    struct server_info *src_svr;
-
-    for (i = 0; i < svr_num; i++) {
-        dst_svr = &dst_svrs->svrs[i];
-        src_svr = get_server_info(dst_svr->server_ip, src_svrs);
-
-        if (NULL == src_svr) {
-            continue;
-        }
-
-        fetch_and_add(&dst_svr->failed, src_svr->failed);
-        fetch_and_add(&dst_svr->success, src_svr->success);
-        fetch_and_add_8(&dst_svr->cost, src_svr->cost);
-    }
-}
-
-/**
- * @brief 检查服务器是否真死了
- */
-BOOL check_server_real_dead(struct server_info *server, float success_ratio)
-{
-    uint32_t total = server->success + server->failed;
-
-    if (total == 0) {
-        return TRUE;
-    }
-
-    if ((server->success*1.0)/total < success_ratio) {
-        return TRUE;
-    }
-
-    return FALSE;
-}
 
 /**
  * @brief 处理节点事件
  * @info  如果节点死机，清除统计信息并设置死机标记(死机时间戳)
  * @      如果节点恢复，清除统计信息和死机标记，并将统计信息清零，权重设置为10%
+ * @      如果节点撤销排空，恢复被排空降低的权重
  */
 void handle_node_events(struct shm_servers *shm_servers, struct list_head *event_list)
 {
@@ -636,12 +244,16 @@ void handle_node_events(struct shm_servers *shm_servers, struct list_head *event
         } else if (event->type == NLB_EVENT_TYPE_NODE_RESUME) {
             NLOG_DEBUG("process node resume event, [%s]", inet_ntoa(*(struct in_addr *)&ip));
             if (server->dead_time) {
-                server->dead_time = 0;
-                server->weight_dynamic = max((uint16_t)1, (uint16_t)(server->weight_static*shm_servers->resume_weight_ratio));
+                resume_server(shm_servers, server);
             } else { /* 可能有连续两次事件导致不一致，可以忽略 */
                 delete_event(event, FALSE);
                 continue;
             }
+        } else if (event->type == NLB_EVENT_TYPE_NODE_UNDRAIN) {
+            NLOG_DEBUG("process node undrain event, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+            undrain_server(shm_servers, server);
+            delete_event(event, FALSE);
+            continue;
         } else {
             NLOG_ERROR("unkown events, [%d]", event->type);
             //delete_event(event, FALSE);
@@ -703,6 +315,37 @@ void dumpinfo(struct agent_local_rdata *rdata)
     dumpservers(rdata->servs_data[rdata->route_meta->index]);
 }
 
+/**
+ * @brief  按服务器列表差异增量更新业务配置
+ * @info   有未处理的节点事件时需要全量更新，由全量更新的流程处理事件
+ * @return =0 成功 <0 不能增量更新
+ */
+static int32_t patch_rdata(struct agent_local_rdata *rdata, struct shm_servers *new_shm_servers)
+{
+    uint32_t i;
+    struct servers_delta *delta = &agent_servers_delta;
+    struct shm_meta *meta = rdata->route_meta;
+
+    if (!list_empty(&rdata->event_list)
+        || calc_servers_delta(new_shm_servers, rdata->servs_data[meta->index], delta) < 0
+        || patch_servers(meta, rdata->servs_data, new_shm_servers, delta) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < delta->del_num; i++) {
+        svcindex_del(rdata, delta->del[i]);
+    }
+
+    for (i = 0; i < delta->add_num; i++) {
+        svcindex_add(rdata, new_shm_servers->svrs[delta->add[i]].server_ip);
+    }
+
+    NLOG_DEBUG("patch service [%s] config, add [%u] del [%u] mod [%u]",
+               rdata->name, delta->add_num, delta->del_num, delta->mod_num);
+
+    return 0;
+}
+
 /**
  * @brief 更新业务配置
  * @param new_shm_servers --> 新加载的服务器信息
@@ -710,18 +353,15 @@ void dumpinfo(struct agent_local_rdata *rdata)
  */
 int32_t update_rdata_by_zk_service_nodes(struct agent_local_rdata *rdata, struct shm_servers *new_shm_servers, uint64_t mtime)
 {
-    uint32_t idx, new_idx, server_num;
+    uint32_t idx, server_num;
     uint32_t data_len;
     struct shm_servers *cur_shm_servers;
-    struct shm_servers *next_shm_servers;
     struct shm_servers *servers;
     struct shm_meta *meta = rdata->route_meta;
     struct list_head *event_list;
 
     idx              = meta->index;
-    new_idx          = (idx+1)%2;
     cur_shm_servers  = rdata->servs_data[idx];
-    next_shm_servers = rdata->servs_data[new_idx];
     event_list       = &rdata->event_list;
 
     //dumpinfo(rdata);
@@ -731,9 +371,14 @@ int32_t update_rdata_by_zk_service_nodes(struct agent_local_rdata *rdata, struct
     /* new_shm_servers非空，表示新加载的配置服务器信息，需要拷贝指定服务器的数据信息 */
     if (new_shm_servers) {
         servers     = new_shm_servers;
-        server_num  = servers->server_num;
-        data_len    = sizeof(struct shm_servers) + sizeof(struct server_info) * server_num;
         meta->mtime = mtime;
+        svcmanifest_touch();
+
+        /* 只有少量服务器变化时，增量更新，不重新调整权重 */
+        if (!patch_rdata(rdata, new_shm_servers)) {
+            return 0;
+        }
+
         copy_specified_servers(servers, cur_shm_servers, servers->shaping_request_min);
     } else {
         server_num  = cur_shm_servers->server_num;
@@ -752,6 +397,13 @@ int32_t update_rdata_by_zk_service_nodes(struct agent_local_rdata *rdata, struct
             free(servers);
             return 0;
         }
+
+        /* 记录业务请求量，重新同步时按热度排序 */
+        rdata->traffic = (rdata->traffic * 3 + servers->success_total + servers->fail_total) / 4;
+        if (servers->success_total + servers->fail_total) {
+            rdata->access_time = get_time_s();
+            svcmanifest_touch();
+        }
     }
 
     /* 处理节点事件 */
@@ -762,27 +414,13 @@ int32_t update_rdata_by_zk_service_nodes(struct agent_local_rdata *rdata, struct
         handle_node_events(servers, &rdata->event_list);
     }
 
-    /* 计算动态权重和死机信息 */
-    shaping_servers(servers);
+    /* 调整权重和死机信息，写入共享内存并切换 */
+    reshape_servers(meta, rdata->servs_data, servers);
 
-    /* 清除统计数据 */
-    clean_servers_stat(servers);
-
-    /* 统一计算每一个服务器的权重基数，以及死机机器的权重 */
-    calc_servers_weight(servers);
-
-    /* 计算多阶hash */
-    calc_servers_hash(servers);
-
-    /* 拷贝新服务器数据到共享内存 */
-    memcpy(next_shm_servers, servers, data_len);
-
-    /* 设置新寻址服务器数据 */
-    mb();
-    meta->index = new_idx;
-
-    /* 合并统计数据到新服务器数据里面 */
-    merge_servers_stat(next_shm_servers, cur_shm_servers);
+    /* 服务器列表变化，重建反向索引 */
+    if (new_shm_servers) {
+        svcindex_update(rdata, servers);
+    }
 
     //dumpinfo(rdata);
 
@@ -835,18 +473,6 @@ static int32_t handle_get_service_nodes_event(struct agent_local_rdata *rdata)
     return 0;
 }
 
-/**
- * @brief 设置监视事件
- */
-void set_services_watcher(void)
-{
-    struct agent_local_rdata *rdata;
-
-    list_for_each_entry(rdata, &agent_rdata_list, list_node) {
-        set_service_watcher(rdata);
-    }
-}
-
 /**
  * @brief 处理业务的配置,定时调用
  */
@@ -875,62 +501,282 @@ void loop_handle_rdata_event_list(void)
 }
 
 /**
- * @brief 加载本地业务到agent私有内存
+ * @brief 按权重上限重新计算业务的权重，不做成功率调整
  */
-int32_t load_local_service(const char *name)
+static int32_t reweight_rdata(struct agent_local_rdata *rdata)
+{
+    uint32_t data_len;
+    struct shm_servers *cur_shm_servers;
+    struct shm_servers *servers;
+    struct shm_meta *meta = rdata->route_meta;
+
+    cur_shm_servers = rdata->servs_data[meta->index];
+    data_len        = sizeof(struct shm_servers) + sizeof(struct server_info) * cur_shm_servers->server_num;
+
+    servers = (struct shm_servers *)malloc(data_len);
+    if (NULL == servers) {
+        NLOG_ERROR("No memory");
+        return -1;
+    }
+
+    memcpy(servers, cur_shm_servers, data_len);
+    reweight_servers(meta, rdata->servs_data, servers);
+    free(servers);
+
+    return 0;
+}
+
+/**
+ * @brief 排空中的服务器按排空进度降低权重，定时调用
+ * @info  只处理有服务器权重超过上限的业务
+ */
+void loop_handle_rdata_drain(void)
 {
-    int32_t  result;
-    uint32_t mmaplen, mmaplen0, mmaplen1;
-    void *meta         = NULL;
-    void *server_data0 = NULL ;
-    void *server_data1 = NULL;
+    static uint64_t last_time;
+    uint64_t now;
+    struct shm_servers *servers;
+    struct agent_local_rdata *rdata;
 
-    NLOG_INFO("load local service (%s)", name);
+    if (!get_drain_num()) {
+        return;
+    }
+
+    now = get_time_ms();
+    if (now < last_time + NLB_DRAIN_TICK) {
+        return;
+    }
+    last_time = now;
+
+    list_for_each_entry(rdata, &agent_rdata_list, list_node) {
+        servers = rdata->servs_data[rdata->route_meta->index];
+        if (!check_need_heartbeat(servers->policy) || !check_servers_capped(servers)) {
+            continue;
+        }
+
+        reweight_rdata(rdata);
+    }
+}
+
+/**
+ * @brief  映射本地业务的元数据和服务器数据文件
+ * @info   不修改agent数据，不输出日志，可以在加载线程中调用
+ * @return =0 成功 <0 失败，已经映射的文件全部解除映射
+ */
+static int32_t attach_local_service(struct attach_item *item)
+{
+    int32_t result;
+
+    item->meta           = NULL;
+    item->server_data[0] = NULL;
+    item->server_data[1] = NULL;
 
     /* 加载元数据信息 */
-    meta = load_meta_data(name, &mmaplen);
-    if (NULL == meta) {
-        NLOG_ERROR("Load meta data for %s failed", name);
+    item->meta = load_meta_data(item->name, &item->mmaplen[0]);
+    if (NULL == item->meta) {
         result = -1;
         goto ERR_EXIT;
     }
 
     /* 加载server信息 */
-    server_data0 = load_server_data(name, 0, &mmaplen0);
-    if (NULL == server_data0) {
-        NLOG_ERROR("Load server data for %s failed", name);
+    item->server_data[0] = load_server_data(item->name, 0, &item->mmaplen[1]);
+    if (NULL == item->server_data[0]) {
         result = -2;
         goto ERR_EXIT;
     }
 
-    server_data1 = load_server_data(name, 1, &mmaplen1);
-    if (NULL == server_data1) {
-        NLOG_ERROR("Load server data for %s failed", name);
+    item->server_data[1] = load_server_data(item->name, 1, &item->mmaplen[2]);
+    if (NULL == item->server_data[1]) {
         result = -3;
         goto ERR_EXIT;
     }
 
-    /* 添加信息到agent本地数据管理 */
-    add_local_rdata(name, meta, server_data0, server_data1);
-
     return 0;
 
 ERR_EXIT:
 
-    if (meta)
-        munmap(meta, mmaplen);
-    if (server_data0)
-        munmap(server_data0, mmaplen0);
-    if (server_data1)
-        munmap(server_data1, mmaplen1);
+    if (item->meta)
+        munmap(item->meta, item->mmaplen[0]);
+    if (item->server_data[0])
+        munmap(item->server_data[0], item->mmaplen[1]);
+    if (item->server_data[1])
+        munmap(item->server_data[1], item->mmaplen[2]);
 
     return result;
 }
 
 /**
- * @brief 加载某个一级业务名下的所有二级目录业务
+ * @brief  映射完成的业务添加到agent本地数据
+ * @return =0 成功 <0 失败
+ */
+static int32_t register_local_service(struct attach_item *item)
+{
+    struct agent_local_rdata *rdata;
+
+    if (item->result < 0) {
+        if (item->result == -1) {
+            NLOG_ERROR("Load meta data for %s failed", item->name);
+        } else {
+            NLOG_ERROR("Load server data for %s failed", item->name);
+        }
+        return item->result;
+    }
+
+    /* 添加信息到agent本地数据管理，清单中重复的业务只添加一次 */
+    rdata = get_local_rdata(item->name) ? NULL
+            : add_local_rdata(item->name, item->meta, item->server_data[0], item->server_data[1]);
+    if (NULL == rdata) {
+        munmap(item->meta, item->mmaplen[0]);
+        munmap(item->server_data[0], item->mmaplen[1]);
+        munmap(item->server_data[1], item->mmaplen[2]);
+        return -4;
+    }
+
+    /* 清单中的请求量作为重新同步的优先级 */
+    if (item->entry) {
+        rdata->traffic     = item->entry->traffic;
+        rdata->access_time = item->entry->access_time;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 加载本地业务到agent私有内存
+ */
+int32_t load_local_service(const char *name)
+{
+    struct attach_item item;
+
+    NLOG_INFO("load local service (%s)", name);
+
+    memset(&item, 0, sizeof(item));
+    strncpy(item.name, name, NLB_SERVICE_NAME_LEN - 1);
+    item.result = attach_local_service(&item);
+
+    return register_local_service(&item);
+}
+
+/* 按业务名排序 */
+static int32_t service_name_cmp(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+/**
+ * @brief  待加载列表增加一个业务，已加载业务名快照中的业务不重复添加
+ * @info   可能在后台扫描线程中调用，不能访问agent本地数据；重复的业务在添加到本地数据时跳过
+ * @return =0 成功 <0 内存不足
+ */
+static int32_t attach_list_add(struct attach_list *list, const char *name,
+                               const struct svc_manifest_entry *entry)
+{
+    uint32_t cap;
+    struct attach_item *items;
+
+    if (list->loaded_num
+        && bsearch(name, list->loaded, list->loaded_num, NLB_SERVICE_NAME_LEN, service_name_cmp)) {
+        return 0;
+    }
+
+    if (list->num >= list->cap) {
+        cap   = list->cap ? list->cap * 2 : 1024;
+        items = (struct attach_item *)realloc(list->items, sizeof(struct attach_item) * cap);
+        if (NULL == items) {
+            NLOG_ERROR("No memory");
+            return -1;
+        }
+
+        list->items = items;
+        list->cap   = cap;
+    }
+
+    memset(&list->items[list->num], 0, sizeof(struct attach_item));
+    strncpy(list->items[list->num].name, name, NLB_SERVICE_NAME_LEN - 1);
+    list->items[list->num].entry = entry;
+    list->num++;
+
+    return 0;
+}
+
+/* 加载线程，和主线程一起按顺序领取待加载的业务 */
+static void *attach_worker(void *arg)
+{
+    uint32_t idx;
+    struct attach_list *list = (struct attach_list *)arg;
+
+    while ((idx = fetch_and_add(&list->next, 1)) < list->num) {
+        list->items[idx].result = attach_local_service(&list->items[idx]);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 并行映射待加载的本地业务
+ * @info  每个业务需要加锁、打开和映射三个文件，业务多时串行加载很慢；
+ *        映射在多个线程中进行，不修改agent数据
+ */
+static void attach_local_services(struct attach_list *list)
+{
+    uint32_t i, threads;
+    pthread_t tids[NLB_ATTACH_THREADS];
+
+    /* 加载主要是文件锁和映射，等待磁盘时不占CPU，线程数不按CPU数限制 */
+    threads = min((list->num + NLB_ATTACH_BATCH - 1) / NLB_ATTACH_BATCH, (uint32_t)NLB_ATTACH_THREADS);
+
+    /* 主线程也参与加载，创建线程失败时由剩下的线程完成 */
+    list->next = 0;
+    for (i = 0; i + 1 < threads; i++) {
+        if (pthread_create(&tids[i], NULL, attach_worker, list)) {
+            NLOG_ERROR("Create attach thread failed, [%m]");
+            break;
+        }
+    }
+
+    threads = i;
+    attach_worker(list);
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/**
+ * @brief  映射完成的业务按列表顺序添加到agent本地数据，只在主线程中调用
+ * @param  queue --> 是否指定新添加的业务优先重新同步，重新同步轮次开始之后添加的业务需要指定
+ * @return 添加成功的业务数
+ */
+static uint32_t register_local_services(struct attach_list *list, BOOL queue)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < list->num; i++) {
+        if (register_local_service(&list->items[i]) < 0) {
+            continue;
+        }
+
+        if (queue) {
+            resync_queue(list->items[i].name);
+        }
+        num++;
+    }
+
+    return num;
+}
+
+/**
+ * @brief  并行映射待加载的本地业务，再按列表顺序添加到agent本地数据
+ * @return 加载成功的业务数
  */
-int32_t load_2_level_services(const char *base, const char *lvl_1_name)
+static uint32_t load_local_services(struct attach_list *list)
+{
+    attach_local_services(list);
+    return register_local_services(list, FALSE);
+}
+
+/**
+ * @brief 收集某个一级业务名下的所有二级目录业务
+ */
+static int32_t load_2_level_services(const char *base, const char *lvl_1_name, struct attach_list *list)
 {
     int32_t ret;
     DIR *dir;
@@ -938,7 +784,7 @@ int32_t load_2_level_services(const char *base, const char *lvl_1_name)
     char path[NLB_PATH_MAX_LEN];
     char name[NLB_SERVICE_NAME_LEN];
 
-    if (NULL == path || NULL == lvl_1_name) {
+    if (NULL == base || NULL == lvl_1_name) {
         NLOG_DEBUG("Invalid input parameter for load_2_level_services.");
         return -1;
     }
@@ -969,8 +815,8 @@ int32_t load_2_level_services(const char *base, const char *lvl_1_name)
                 continue;
             }
 
-            /* 加载某个指定业务的本地数据 */
-            load_local_service(name);
+            /* 记录没有加载的业务，之后统一并行加载 */
+            attach_list_add(list, name, NULL);
         //}
     }
 
@@ -980,9 +826,10 @@ int32_t load_2_level_services(const char *base, const char *lvl_1_name)
 }
 
 /**
- * @brief 加载所有本地业务数据
+ * @brief  扫描目录收集所有没有加载的本地业务
+ * @return =0 成功 <0 失败
  */
-int32_t load_1_level_services(void)
+static int32_t collect_local_services(struct attach_list *list)
 {
     DIR *dir;
     struct dirent *ptr;
@@ -995,22 +842,163 @@ int32_t load_1_level_services(void)
         return -1;
     }
 
-    /* 循环读取所有一级目录 */
+    /* 循环读取所有一级目录，跳过清单等agent自己的文件 */
     while ((ptr = readdir(dir)) != NULL) {
-        if ((strcmp(ptr->d_name,".") == 0) || (strcmp(ptr->d_name,"..") == 0)) {
+        if (ptr->d_name[0] == '.') {
             continue;
         }
 
         //if (ptr->d_type == DT_DIR) {
-            /* 加载一级目录下所有二级目录 */
-            load_2_level_services(path, ptr->d_name);
+            /* 收集一级目录下所有二级目录 */
+            load_2_level_services(path, ptr->d_name, list);
         //}
     }
 
     closedir(dir);
+
     return 0;
 }
 
+/**
+ * @brief  扫描目录加载所有本地业务数据
+ * @info   没有可用的清单时在启动流程中同步调用
+ * @return >=0 加载的业务数 <0 失败
+ */
+int32_t load_1_level_services(void)
+{
+    uint32_t num;
+    struct attach_list list;
+
+    memset(&list, 0, sizeof(list));
+    if (collect_local_services(&list) < 0) {
+        return -1;
+    }
+
+    num = load_local_services(&list);
+    free(list.items);
+
+    return (int32_t)num;
+}
+
+/* 后台扫描线程，收集并映射清单之外的业务，添加到agent本地数据由主线程完成 */
+static void *scan_worker(void *arg)
+{
+    struct attach_list *list = (struct attach_list *)arg;
+
+    if (collect_local_services(list) == 0) {
+        attach_local_services(list);
+    }
+
+    fetch_and_add(&scan_state, NLB_SCAN_DONE - NLB_SCAN_RUNNING);
+    return NULL;
+}
+
+/**
+ * @brief 就绪后在后台扫描目录，补充清单之外的业务(例如清单保存之前新增的业务)
+ * @info  已加载的业务名做成快照，扫描线程据此跳过，不访问agent本地数据
+ */
+static void start_service_scan(void)
+{
+    uint32_t num = 0;
+    struct agent_local_rdata *rdata;
+
+    memset(&scan_list, 0, sizeof(scan_list));
+    list_for_each_entry(rdata, &agent_rdata_list, list_node) {
+        num++;
+    }
+
+    scan_list.loaded = calloc(num + 1, NLB_SERVICE_NAME_LEN);
+    if (NULL == scan_list.loaded) {
+        NLOG_ERROR("No memory");
+        return;
+    }
+
+    list_for_each_entry(rdata, &agent_rdata_list, list_node) {
+        memcpy(scan_list.loaded[scan_list.loaded_num++], rdata->name, NLB_SERVICE_NAME_LEN);
+    }
+    qsort(scan_list.loaded, scan_list.loaded_num, NLB_SERVICE_NAME_LEN, service_name_cmp);
+
+    scan_start_time = get_time_ms();
+    scan_state      = NLB_SCAN_RUNNING;
+    if (pthread_create(&scan_tid, NULL, scan_worker, &scan_list)) {
+        NLOG_ERROR("Create scan thread failed, [%m]");
+        scan_state = NLB_SCAN_IDLE;
+        free(scan_list.loaded);
+        scan_list.loaded = NULL;
+    }
+}
+
+/**
+ * @brief 后台扫描完成后，把找到的业务添加到agent本地数据
+ * @info  重新同步轮次已经开始，新添加的业务指定优先重新同步，设置监视并检查配置
+ */
+static void check_service_scan(void)
+{
+    uint32_t num;
+
+    if (!compare_and_swap(&scan_state, NLB_SCAN_DONE, NLB_SCAN_IDLE)) {
+        return;
+    }
+
+    pthread_join(scan_tid, NULL);
+    num = register_local_services(&scan_list, TRUE);
+
+    NLOG_INFO("directory scan done in [%lu]ms, services not in manifest [%u]",
+              get_time_ms() - scan_start_time, num);
+
+    /* 清单和本地业务不一致时立即保存 */
+    if (num) {
+        svcmanifest_save();
+    }
+
+    free(scan_list.items);
+    free(scan_list.loaded);
+    memset(&scan_list, 0, sizeof(scan_list));
+}
+
+/**
+ * @brief  按本地业务清单加载业务，最近访问的业务在前
+ * @return >=0 加载的业务数 <0 没有可用的清单
+ */
+static int32_t load_manifest_services(uint32_t *stale)
+{
+    int32_t  i, num;
+    uint32_t loaded;
+    struct attach_list list;
+    struct svc_manifest_entry *entries = NULL;
+    struct agent_local_rdata *rdata;
+
+    memset(&list, 0, sizeof(list));
+
+    num = svcmanifest_load(&entries);
+    if (num < 0) {
+        NLOG_INFO("No valid service manifest, ret [%d]", num);
+        return num;
+    }
+
+    for (i = 0; i < num; i++) {
+        attach_list_add(&list, entries[i].name, &entries[i]);
+    }
+
+    loaded = load_local_services(&list);
+
+    /* 清单保存之后配置有变化或者加载失败的业务，指定优先重新同步 */
+    *stale = 0;
+    for (i = 0; i < (int32_t)list.num; i++) {
+        rdata = get_local_rdata(list.items[i].name);
+        if ((NULL == rdata) || (rdata->route_meta->mtime != list.items[i].entry->mtime)
+            || (rdata->servs_data[rdata->route_meta->index]->server_num != list.items[i].entry->server_num)) {
+            resync_queue(list.items[i].name);
+            (*stale)++;
+        }
+    }
+
+    free(list.items);
+    free(entries);
+
+    return (int32_t)loaded;
+}
+
 /**
  * @brief 把服务器配置和元数据配置写入文件
  */
@@ -1107,13 +1095,24 @@ ERR_RET:
 }
 
 
+/**
+ * @brief 客户端服务器权重上限，取排空进度和负载权重上限的较小值
+ */
+static uint32_t client_weight_cap(const struct shm_servers *servers, const struct server_info *server)
+{
+    return min(drain_weight_cap(servers, server), loadaware_weight_cap(servers, server));
+}
+
 /**
  * @brief 初始化客户端agent
  */
 int32_t init_client_agent(void)
 {
-    int32_t ret;
-    int32_t i;
+    int32_t  ret;
+    int32_t  i;
+    int32_t  manifest;
+    uint32_t stale = 0;
+    uint64_t boot_time;
 
     /* 初始化全局变量 */
     for (i = 0; i < NLB_AGENT_ROUTE_DATA_HASH_LEN; i++) {
@@ -1125,36 +1124,80 @@ int32_t init_client_agent(void)
     /* 初始化路由任务 */
     init_route_task();
 
-    /* load所有本地业务配置 */
-    ret = load_1_level_services();
-    if (ret < 0) {
-        NLOG_ERROR("Load client agent services failed, ret [%d]", ret);
-        return -1;
+    /* 按清单并行加载本地业务，没有可用的清单时同步扫描目录 */
+    boot_time = get_time_ms();
+    manifest  = load_manifest_services(&stale);
+    if (manifest < 0) {
+        ret = load_1_level_services();
+        if (ret < 0) {
+            NLOG_ERROR("Load client agent services failed, ret [%d]", ret);
+            return -1;
+        }
+
+        svcmanifest_save();
     }
 
+    NLOG_INFO("local services ready in [%lu]ms, manifest [%d] stale [%u], directory scan [%s]",
+              get_time_ms() - boot_time, manifest, stale, (manifest < 0) ? "done" : "background");
+
     /* 初始化节点监视 */
     heartbeat_data_init();
+    loadaware_init();
 
-    /* 设置业务监视事件 */
-    set_services_watcher();
+    /* 排空中的服务器按排空进度限制权重，异构策略业务按服务器负载限制权重 */
+    set_weight_cap_handler(client_weight_cap, loadaware_prepare);
+
+    /* 连接建立后按热度流水线设置业务监视，并拉取有变化的业务配置 */
+    resync_start();
+
+    /* 清单之外的业务在后台扫描补充 */
+    if (manifest >= 0) {
+        start_service_scan();
+    }
 
     return 0;
 }
 
 /**
  * @brief 初始化服务端agent
+ * @return =0 成功 <0 失败
  */
-void init_server_agent(void)
+int32_t init_server_agent(void)
 {
+    int32_t ret;
+
     /* 初始化系统信息，做CPU/MEM分析上报 */
-    init_sysinfo();
+    init_sysinfo(get_local_ip());
+
+    /* 排空命令socket失败时仍然可以用信号排空 */
+    ret = drain_init();
+    if (ret) {
+        NLOG_ERROR("Init drain socket failed, ret [%d]", ret);
+    }
 
-    /* 创建心跳临时节点 */
-    create_heartbeat_node(get_local_ip());
+    /* 本地健康检查配置错误时不启动，避免心跳节点永远不创建 */
+    ret = localcheck_init(get_local_check(), get_local_interval(), get_local_timeout(),
+                          get_local_rise(), get_local_fall());
+    if (ret) {
+        NLOG_ERROR("Init local check failed, ret [%d]", ret);
+        return -1;
+    }
+
+    /* 创建心跳临时节点，开启本地健康检查时检查通过后才创建 */
+    if (localcheck_healthy()) {
+        create_heartbeat_node(get_local_ip());
+    }
+
+    /* 应用负载共享内存失败时只上报系统负载 */
+    ret = appload_init();
+    if (ret) {
+        NLOG_ERROR("Init app load failed, ret [%d]", ret);
+    }
 
     /* 创建负载上报节点 */
     create_loadreport_node(get_local_ip());
 
+    return 0;
 }
 
 /**
@@ -1174,16 +1217,33 @@ int32_t init(void)
 
     /* 初始化服务提供方 */
     if (mode == SERVER_MODE || mode == MIX_MODE) {
-        init_server_agent();
+        ret = init_server_agent();
+        if (ret) {
+            NLOG_ERROR("Init server agent failed, ret [%d]", ret);
+            return -2;
+        }
     }
 
     /* 初始化服务使用方 */
     if (mode == CLIENT_MODE || mode == MIX_MODE) {
+        /* 调整记录只用于事后分析，失败不影响运行 */
+        ret = flightrec_init(get_flightrec_size());
+        if (ret) {
+            NLOG_ERROR("Init flight recorder failed, ret [%d]", ret);
+        }
+
         ret = init_client_agent();
         if (ret) {
             NLOG_ERROR("Init client agent failed, ret [%d]", ret);
             return -3;
         }
+
+        /* 健康检查只加快死机服务器恢复，失败不影响运行 */
+        ret = healthcheck_init(get_health_check(), get_health_interval(),
+                               get_health_timeout(), get_health_concurrency());
+        if (ret) {
+            NLOG_ERROR("Init health check failed, ret [%d]", ret);
+        }
     }
 
     NLOG_DEBUG("Agent[%d] init success...\n", getpid());
@@ -1204,6 +1264,14 @@ void run(void)
     /* 检查是否需要退出 */
     if (quit()) {
         NLOG_ERROR("Agent recevice quit signal...");
+        if ((get_worker_mode() == CLIENT_MODE) || (get_worker_mode() == MIX_MODE)) {
+            svcmanifest_save();
+        }
+        healthcheck_close();
+        drain_close();
+        localcheck_close();
+        appload_close();
+        plugin_close();
         network_close();
         nlb_zk_close();
         exit(0);
@@ -1217,21 +1285,43 @@ void run(void)
     /* 客户模式: 定时处理业务配置变更 */
     if ((get_worker_mode() == CLIENT_MODE)
         || (get_worker_mode() == MIX_MODE)) {
+        resync_run();
+        service_journal_run();
         loop_handle_rdata_event_list();
+        loop_handle_rdata_drain();
+        healthcheck_run();
+        check_service_scan();
+        svcmanifest_run();
     }
 
     /* 服务模式 */
     now = get_time_s();
     if ((get_worker_mode() == SERVER_MODE)
         || (get_worker_mode() == MIX_MODE)) {
-        if (now >= last_time + 20) {
-            /* 上报负载 */
-            load_report(get_local_ip());
+        /* 发布排空状态 */
+        drain_run();
+
+        /* 本地服务健康检查，状态变化时立即更新心跳节点 */
+        localcheck_run();
+
+        /* 系统负载采样 */
+        sysinfo_run();
+
+        /* 上报负载，负载变化或者超过最长上报间隔时才写zookeeper */
+        load_report(get_local_ip());
 
-            /* 检查心跳节点是否创建 */
-            //if (!check_heartbeat_created()) {
+        if (now >= last_time + 20) {
+            /* 检查心跳节点是否创建，已经创建时只检查节点还存在；
+               本地服务不健康时只在状态变化时删除，没有确认删除时重试 */
+            if (!localcheck_healthy()) {
+                if (!check_heartbeat_deleted()) {
+                    delete_heartbeat_node(get_local_ip());
+                }
+            } else if (!check_heartbeat_created()) {
                 create_heartbeat_node(get_local_ip());
-            //}
+            } else {
+                verify_heartbeat_node(get_local_ip());
+            }
 
             last_time = now;
         }
@@ -24,6 +24,8 @@
 #include "list.h"
 #include "commtype.h"
 #include "commstruct.h"
+#include "shaping.h"
+#include "event.h"
 
 /* agent本地路由数据 */
 struct agent_local_rdata
@@ -31,10 +33,14 @@ struct agent_local_rdata
     struct list_head hash_node;         /* hash链表节点 */
     struct list_head list_node;         /* 链表节点     */
     struct list_head event_list;        /* 事件列表     */
+    struct list_head event_hash[NLB_EVENT_HASH_LEN]; /* 节点事件按IP的hash */
+    struct list_head index_list;        /* IP反向索引节点 */
 
     char name[NLB_SERVICE_NAME_LEN];    /* 业务名       */
     uint64_t update_time;               /* 更新时间戳   */
     BOOL     watcher_flag;              /* 是否设置监视 */
+    uint64_t traffic;                   /* 最近每周期的请求量，平滑值 */
+    uint64_t access_time;               /* 最近有请求的时间(s) */
     struct shm_meta * route_meta;       /* 元数据信息   */
     struct shm_servers * servs_data[2]; /* 服务器信息   */
 };
@@ -49,11 +55,6 @@ struct list_head *get_rdata_list(void);
  */
 struct agent_local_rdata *get_local_rdata(const char *name);
 
-/**
- * @brief 通过IP获取服务器信息
- */
-struct server_info *get_server_info(uint32_t ip, struct shm_servers *servers);
-
 /**
  * @brief 清除所有业务的watch标记
  */
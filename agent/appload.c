@@ -0,0 +1,134 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+/**
+ * @filename appload.c
+ * @info     应用负载汇总
+ */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include "commtype.h"
+#include "commdef.h"
+#include "commstruct.h"
+#include "nlbfile.h"
+#include "nlbtime.h"
+#include "atomic.h"
+#include "log.h"
+#include "config.h"
+#include "plugin.h"
+#include "appload.h"
+
+static struct shm_app_load *app_load = NULL;    /* 应用负载共享内存 */
+static uint32_t app_load_len;                   /* 共享内存长度 */
+static nlb_app_load_func plugin_app_load = NULL;/* 插件应用负载函数 */
+
+/**
+ * @brief  初始化应用负载共享内存，获取插件的应用负载函数
+ * @info   插件没有加载或者没有导出应用负载函数时只使用共享内存
+ * @return =0 成功 <0 失败
+ */
+int32_t appload_init(void)
+{
+    app_load = (struct shm_app_load *)init_and_load_app_load(get_app_load_gid(), &app_load_len);
+    if (NULL == app_load) {
+        NLOG_ERROR("Init app load shm (%s) failed, [%m]", NLB_APP_LOAD_PATH);
+        return -1;
+    }
+
+    if (plugin_load(get_nlb_plugin()) == 0) {
+        plugin_app_load = (nlb_app_load_func)plugin_symbol(NLB_APP_LOAD_SYMBOL);
+    }
+
+    NLOG_INFO("Init app load success, plugin app load [%s]", plugin_app_load ? "yes" : "no");
+    return 0;
+}
+
+/* 检查进程是否已经退出 */
+static BOOL check_process_exit(uint32_t pid)
+{
+    return (kill((pid_t)pid, 0) == -1) && (errno == ESRCH);
+}
+
+/**
+ * @brief  汇总本机应用负载
+ * @info   忽略超过NLB_APP_LOAD_STALE_TIME没有更新的槽，释放已经退出进程的槽
+ * @return =0 有负载数据 <0 没有业务进程或插件提供负载
+ */
+int32_t appload_collect(struct nlb_app_load *load)
+{
+    uint32_t i, pid;
+    uint64_t now = get_time_ms();
+    BOOL     found = FALSE;
+    struct app_load_slot *slot;
+    struct nlb_app_load plugin_load_data;
+
+    memset(load, 0, sizeof(*load));
+
+    for (i = 0; app_load && i < NLB_APP_LOAD_SLOTS; i++) {
+        slot = &app_load->slots[i];
+        pid  = slot->pid;
+        if (!pid) {
+            continue;
+        }
+
+        if (slot->update_time + NLB_APP_LOAD_STALE_TIME <= now) {
+            if (check_process_exit(pid)) {
+                compare_and_swap((uint32_t *)&slot->pid, pid, 0);
+            }
+            continue;
+        }
+
+        load->queue    += slot->queue;
+        load->inflight += slot->inflight;
+        load->busy     += slot->busy;
+        load->workers  += slot->workers;
+        found = TRUE;
+    }
+
+    if (plugin_app_load) {
+        memset(&plugin_load_data, 0, sizeof(plugin_load_data));
+        if (plugin_app_load(&plugin_load_data) == 0) {
+            load->queue    += plugin_load_data.queue;
+            load->inflight += plugin_load_data.inflight;
+            load->busy     += plugin_load_data.busy;
+            load->workers  += plugin_load_data.workers;
+            found = TRUE;
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
+/**
+ * @brief 解除应用负载共享内存映射
+ */
+void appload_close(void)
+{
+    if (app_load) {
+        munmap(app_load, app_load_len);
+        app_load = NULL;
+    }
+
+    plugin_app_load = NULL;
+}
+
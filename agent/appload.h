@@ -0,0 +1,52 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+/**
+ * @filename appload.h
+ * @info     应用负载汇总
+ *           服务端agent创建应用负载共享内存，业务进程通过nlb_report_load写入各自的槽，
+ *           负载上报时汇总所有进程和插件nlb_app_load提供的负载，随/loadreport/ip发布
+ */
+
+#ifndef _APPLOAD_H_
+#define _APPLOAD_H_
+
+#include <stdint.h>
+#include "plugin.h"
+
+/**
+ * @brief  初始化应用负载共享内存，获取插件的应用负载函数
+ * @info   插件没有加载或者没有导出应用负载函数时只使用共享内存
+ * @return =0 成功 <0 失败
+ */
+int32_t appload_init(void);
+
+/**
+ * @brief  汇总本机应用负载
+ * @info   忽略超过NLB_APP_LOAD_STALE_TIME没有更新的槽，释放已经退出进程的槽
+ * @return =0 有负载数据 <0 没有业务进程或插件提供负载
+ */
+int32_t appload_collect(struct nlb_app_load *load);
+
+/**
+ * @brief 解除应用负载共享内存映射
+ */
+void appload_close(void);
+
+#endif
+
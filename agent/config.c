@@ -23,12 +23,19 @@
 #include <unistd.h>
 #include <string.h>
 #include <getopt.h>
+#include <grp.h>
 #include "config.h"
 #include "zookeeper.h"
 #include "version.h"
 #include "utils.h"
 #include "commdef.h"
 #include "log.h"
+#include "flightrec.h"
+#include "healthcheck.h"
+#include "localcheck.h"
+#include "zkloadreport.h"
+#include "zkheartbeat.h"
+#include "zkjournal.h"
 
 struct config g_agent_config;
 
@@ -56,6 +63,50 @@ static void print_usage(const char *name)
     printf("        -i  --interface     Set server agent network interface, default eth0\n");
     printf("        -p  --plugin        Set plugin dynamic libary path\n");
     printf("        -l  --log-level     Set agent log level (ERROR/WARN/INFO/DEBUG), default ERROR\n");
+    printf("        -r  --flight-recorder Set shaping flight recorder size in MB, 0 to disable, default %d\n",
+           NLB_FLIGHTREC_DEFAULT_SIZE);
+    printf("        -c  --health-check  Set dead server health check [off|auto|tcp|udp|plugin.so], default auto\n");
+    printf("            --health-interval     Set health check interval in ms, default %d\n", NLB_HC_DEFAULT_INTERVAL);
+    printf("            --health-timeout      Set health check timeout in ms, default %d\n", NLB_HC_DEFAULT_TIMEOUT);
+    printf("            --health-concurrency  Set max concurrent health checks, default %d\n",
+           NLB_HC_DEFAULT_CONCURRENCY);
+    printf("        -L  --local-check   Set local service check gating heartbeat\n"
+           "                            [off|tcp:port|udp:port|http:port[/path]|plugin], default off\n");
+    printf("            --local-interval      Set local check interval in ms, default %d\n", NLB_LC_DEFAULT_INTERVAL);
+    printf("            --local-timeout       Set local check timeout in ms, default %d\n", NLB_LC_DEFAULT_TIMEOUT);
+    printf("            --local-rise          Set successes to become healthy, default %d\n", NLB_LC_DEFAULT_RISE);
+    printf("            --local-fall          Set failures to become unhealthy, default %d\n", NLB_LC_DEFAULT_FALL);
+    printf("            --load-delta          Set load change in percent points that triggers a report, default %d\n",
+           NLB_LR_DEFAULT_DELTA);
+    printf("            --load-keepalive      Set max seconds between load reports, default %d\n",
+           NLB_LR_DEFAULT_KEEPALIVE);
+    printf("        -w  --heartbeat-watch Set server heartbeat watching [node|children|shard], default node\n"
+           "                            shard servers also publish " NLB_HEARTBEAT_SHARD_PATH "/a.b.c/ip\n");
+    printf("            --service-watch       Set service config watching [exists|journal], default exists\n"
+           "                            journal watches " NLB_CHANGE_JOURNAL_PATH " shards instead of every service\n");
+    printf("            --app-load-group      Set group allowed to report app load, default agent group\n");
+}
+
+/**
+ * @brief 解析非负整数选项值，非法时退出
+ */
+static uint32_t parse_uint_option(int32_t argc, char **argv, int32_t index, uint32_t min_value, uint32_t max_value)
+{
+    long value;
+    char *end = NULL;
+
+    if (index == (argc - 1)) {
+        printf("Invalid %s option!\n", argv[index]);
+        exit(1);
+    }
+
+    value = strtol(argv[index + 1], &end, 10);
+    if (end == argv[index + 1] || *end != '\0' || value < min_value || value > max_value) {
+        printf("Invalid %s value: %s\n", argv[index], argv[index + 1]);
+        exit(1);
+    }
+
+    return (uint32_t)value;
 }
 
 /**
@@ -70,6 +121,22 @@ void parse_args(int32_t argc, char **argv)
     int32_t  index;
     char *   host;
     char *   plugin = "msec_rpc.so";
+    int32_t  flightrec_size = NLB_FLIGHTREC_DEFAULT_SIZE;
+    char *   health_check = "auto";
+    uint32_t health_interval = NLB_HC_DEFAULT_INTERVAL;
+    uint32_t health_timeout = NLB_HC_DEFAULT_TIMEOUT;
+    uint32_t health_concurrency = NLB_HC_DEFAULT_CONCURRENCY;
+    char *   local_check = "off";
+    uint32_t local_interval = NLB_LC_DEFAULT_INTERVAL;
+    uint32_t local_timeout = NLB_LC_DEFAULT_TIMEOUT;
+    uint32_t local_rise = NLB_LC_DEFAULT_RISE;
+    uint32_t local_fall = NLB_LC_DEFAULT_FALL;
+    uint32_t load_delta = NLB_LR_DEFAULT_DELTA;
+    uint32_t load_keepalive = NLB_LR_DEFAULT_KEEPALIVE;
+    int32_t  heartbeat_watch = NLB_HB_WATCH_NODE;
+    int32_t  service_watch = NLB_SVC_WATCH_EXISTS;
+    gid_t    app_load_gid = (gid_t)-1;
+    struct group *grp;
 #if 0
     const char *short_opts = "vht:s:m:p:i:l:";
     const struct option long_opts[] = {
@@ -199,6 +266,159 @@ void parse_args(int32_t argc, char **argv)
             continue;
         }
 
+        if (!strcmp(argv[index], "-r")
+            || !strcmp(argv[index], "--flight-recorder")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            flightrec_size = atoi(argv[index + 1]);
+            if (flightrec_size < 0 || flightrec_size > 1024) {
+                printf("Invalid flight recorder size: %s\n", argv[index + 1]);
+                exit(1);
+            }
+
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "-c")
+            || !strcmp(argv[index], "--health-check")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            health_check = strdup(argv[index + 1]);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--health-interval")) {
+            health_interval = parse_uint_option(argc, argv, index, 100, 3600000);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--health-timeout")) {
+            health_timeout = parse_uint_option(argc, argv, index, 10, 60000);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--health-concurrency")) {
+            health_concurrency = parse_uint_option(argc, argv, index, 1, NLB_HC_PROBE_MAX);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "-L")
+            || !strcmp(argv[index], "--local-check")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            local_check = strdup(argv[index + 1]);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--local-interval")) {
+            local_interval = parse_uint_option(argc, argv, index, 10, 60000);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--local-timeout")) {
+            local_timeout = parse_uint_option(argc, argv, index, 10, 60000);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--local-rise")) {
+            local_rise = parse_uint_option(argc, argv, index, 1, 100);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--local-fall")) {
+            local_fall = parse_uint_option(argc, argv, index, 1, 100);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--load-delta")) {
+            load_delta = parse_uint_option(argc, argv, index, 1, 100);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--load-keepalive")) {
+            load_keepalive = parse_uint_option(argc, argv, index, 1, 3600);
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "-w")
+            || !strcmp(argv[index], "--heartbeat-watch")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            if (!strcmp(argv[index + 1], "node")) {
+                heartbeat_watch = NLB_HB_WATCH_NODE;
+            } else if (!strcmp(argv[index + 1], "children")) {
+                heartbeat_watch = NLB_HB_WATCH_CHILDREN;
+            } else if (!strcmp(argv[index + 1], "shard")) {
+                heartbeat_watch = NLB_HB_WATCH_SHARD;
+            } else {
+                printf("Invalid heartbeat watch: %s\n", argv[index + 1]);
+                exit(1);
+            }
+
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--service-watch")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            if (!strcmp(argv[index + 1], "exists")) {
+                service_watch = NLB_SVC_WATCH_EXISTS;
+            } else if (!strcmp(argv[index + 1], "journal")) {
+                service_watch = NLB_SVC_WATCH_JOURNAL;
+            } else {
+                printf("Invalid service watch: %s\n", argv[index + 1]);
+                exit(1);
+            }
+
+            index = index + 2;
+            continue;
+        }
+
+        if (!strcmp(argv[index], "--app-load-group")) {
+            if (index == (argc - 1)) {
+                printf("Invalid %s option!\n", argv[index]);
+                exit(1);
+            }
+
+            grp = getgrnam(argv[index + 1]);
+            if (NULL == grp) {
+                printf("Invalid app load group: %s\n", argv[index + 1]);
+                exit(1);
+            }
+
+            app_load_gid = grp->gr_gid;
+            index = index + 2;
+            continue;
+        }
+
         printf("Error: unknown option '%s'\n", argv[index]);
         print_usage(argv[0]);
         exit(1);
@@ -218,6 +438,21 @@ void parse_args(int32_t argc, char **argv)
     g_agent_config.log_level= log_levl;
     g_agent_config.host     = host;
     g_agent_config.plugin   = plugin;
+    g_agent_config.flightrec_size = flightrec_size;
+    g_agent_config.health_check   = health_check;
+    g_agent_config.health_interval= health_interval;
+    g_agent_config.health_timeout = health_timeout;
+    g_agent_config.health_concurrency = health_concurrency;
+    g_agent_config.local_check    = local_check;
+    g_agent_config.local_interval = local_interval;
+    g_agent_config.local_timeout  = local_timeout;
+    g_agent_config.local_rise     = local_rise;
+    g_agent_config.local_fall     = local_fall;
+    g_agent_config.load_delta     = load_delta;
+    g_agent_config.load_keepalive = load_keepalive;
+    g_agent_config.heartbeat_watch= heartbeat_watch;
+    g_agent_config.service_watch  = service_watch;
+    g_agent_config.app_load_gid   = app_load_gid;
 
     print_version();
     printf("    mode        : %-16d (1:SERVER_MODE 2:CLIENT_MODE 3:MIX_MODE)\n", mode);
@@ -225,6 +460,14 @@ void parse_args(int32_t argc, char **argv)
     printf("    port        : %-16d (nlb agent listen port)\n", NLB_AGENT_LISTEN_PORT);
     printf("    local addr  : %-16s (local interface address)\n", inet_ntoa(*(struct in_addr *)&ip));
     printf("    log level   : %-16d (1: ERROR 2: WARN 3: INFO 4:DEBUG)\n", log_levl);
+    printf("    flight rec  : %-16d (shaping flight recorder size, MB)\n", flightrec_size);
+    printf("    health check: %-16s (dead server health check, interval %ums timeout %ums)\n",
+           health_check, health_interval, health_timeout);
+    printf("    local check : %-16s (local service check, interval %ums timeout %ums)\n",
+           local_check, local_interval, local_timeout);
+    printf("    load report : %-16u (load change to report, percent, keepalive %us)\n", load_delta, load_keepalive);
+    printf("    hb watch    : %-16d (0: NODE 1: CHILDREN 2: SHARD)\n", heartbeat_watch);
+    printf("    svc watch   : %-16d (0: EXISTS 1: JOURNAL)\n", service_watch);
     printf("    zk host     : %s (zookeeper server host)\n", host);
 }
 
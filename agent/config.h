@@ -21,6 +21,7 @@
 #define _CONFIG_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include "log.h"
 #include "commtype.h"
 
@@ -32,6 +33,7 @@ enum {
 
 struct config {
     BOOL     quit;           /* 退出程序标记 */
+    BOOL     drain;          /* 排空标记，服务端通知客户端不再分配请求 */
     uint16_t port;           /* CLIENT_MODE监听端口 */
     uint32_t local_ip;       /* 本机IP地址 */
     int32_t  mode;           /* agent工作模式 */
@@ -39,6 +41,21 @@ struct config {
     int32_t  log_level;      /* 日志级别 */
     char *   host;           /* zookeeper服务器列表 */
     char *   plugin;         /* agent插件，获取进程信息 */
+    uint32_t flightrec_size; /* 权重调整记录文件大小，MB，0表示关闭 */
+    char *   health_check;   /* 死机服务器健康检查方式: off/auto/tcp/udp/插件路径 */
+    uint32_t health_interval;/* 健康检查间隔，毫秒 */
+    uint32_t health_timeout; /* 健康检查超时，毫秒 */
+    uint32_t health_concurrency; /* 健康检查最大并发 */
+    char *   local_check;    /* 本地服务健康检查方式: off/tcp:端口/udp:端口/http:端口[/路径]/plugin */
+    uint32_t local_interval; /* 本地健康检查间隔，毫秒 */
+    uint32_t local_timeout;  /* 本地健康检查超时，毫秒 */
+    uint32_t local_rise;     /* 连续成功次数，达到后认为健康 */
+    uint32_t local_fall;     /* 连续失败次数，达到后认为不健康 */
+    uint32_t load_delta;     /* 负载变化超过该值时上报，百分点 */
+    uint32_t load_keepalive; /* 负载没有变化时的最长上报间隔，秒 */
+    int32_t  heartbeat_watch;/* 服务器心跳监视方式: NLB_HB_WATCH_NODE/CHILDREN/SHARD */
+    int32_t  service_watch;  /* 业务配置监视方式: NLB_SVC_WATCH_EXISTS/JOURNAL */
+    gid_t    app_load_gid;   /* 可以写入应用负载共享内存的组，(gid_t)-1表示agent所在的组 */
 };
 
 extern struct config g_agent_config;
@@ -78,6 +95,81 @@ static inline int32_t get_log_level(void) {
     return g_agent_config.log_level;
 }
 
+/* 获取权重调整记录文件大小 */
+static inline uint32_t get_flightrec_size(void) {
+    return g_agent_config.flightrec_size;
+}
+
+/* 获取健康检查方式 */
+static inline const char *get_health_check(void) {
+    return g_agent_config.health_check;
+}
+
+/* 获取健康检查间隔 */
+static inline uint32_t get_health_interval(void) {
+    return g_agent_config.health_interval;
+}
+
+/* 获取健康检查超时 */
+static inline uint32_t get_health_timeout(void) {
+    return g_agent_config.health_timeout;
+}
+
+/* 获取健康检查最大并发 */
+static inline uint32_t get_health_concurrency(void) {
+    return g_agent_config.health_concurrency;
+}
+
+/* 获取本地健康检查方式 */
+static inline const char *get_local_check(void) {
+    return g_agent_config.local_check;
+}
+
+/* 获取本地健康检查间隔 */
+static inline uint32_t get_local_interval(void) {
+    return g_agent_config.local_interval;
+}
+
+/* 获取本地健康检查超时 */
+static inline uint32_t get_local_timeout(void) {
+    return g_agent_config.local_timeout;
+}
+
+/* 获取本地健康检查连续成功次数 */
+static inline uint32_t get_local_rise(void) {
+    return g_agent_config.local_rise;
+}
+
+/* 获取本地健康检查连续失败次数 */
+static inline uint32_t get_local_fall(void) {
+    return g_agent_config.local_fall;
+}
+
+/* 获取负载上报变化阈值 */
+static inline uint32_t get_load_delta(void) {
+    return g_agent_config.load_delta;
+}
+
+/* 获取负载最长上报间隔 */
+static inline uint32_t get_load_keepalive(void) {
+    return g_agent_config.load_keepalive;
+}
+
+/* 获取服务器心跳监视方式 */
+static inline int32_t get_heartbeat_watch(void) {
+    return g_agent_config.heartbeat_watch;
+}
+
+/* 获取业务配置监视方式 */
+static inline int32_t get_service_watch(void) {
+    return g_agent_config.service_watch;
+}
+
+/* 获取应用负载共享内存属组 */
+static inline gid_t get_app_load_gid(void) {
+    return g_agent_config.app_load_gid;
+}
+
 /* 设置退出标记 */
 static inline void set_quit(void) {
     g_agent_config.quit = TRUE;
@@ -88,6 +180,16 @@ static inline BOOL quit(void) {
     return g_agent_config.quit;
 }
 
+/* 设置排空标记 */
+static inline void set_drain(BOOL drain) {
+    g_agent_config.drain = drain;
+}
+
+/* 检查是否排空 */
+static inline BOOL draining(void) {
+    return g_agent_config.drain;
+}
+
 /**
  * @brief 处理命令行参数
  */
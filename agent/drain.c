@@ -0,0 +1,340 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename drain.c
+ * @info     服务器排空
+ *           服务端通过本地unix socket或SIGUSR2信号进入排空状态，发布/serverdrain/ip临时节点；
+ *           客户端记录排空开始时间，调整权重时按排空窗口把权重上限从静态权重线性降到0
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "commdef.h"
+#include "log.h"
+#include "nlbtime.h"
+#include "hash.h"
+#include "config.h"
+#include "event.h"
+#include "networking.h"
+#include "zkplugin.h"
+#include "zkheartbeat.h"
+#include "drain.h"
+
+#define NLB_DRAIN_REPUBLISH_TIME    (20000)     /* 排空中重新创建排空节点的间隔，毫秒 */
+#define NLB_DRAIN_CMD_LEN           (64)
+#define NLB_DRAIN_HASH_LEN          (NLB_DRAIN_NODE_MAX * 2)    /* 排空服务器索引槽数，2的幂 */
+
+/* 客户端记录的排空服务器 */
+struct drain_node {
+    uint32_t ip;                    /* IP地址，网络字节序 */
+    uint64_t start_time;            /* 开始排空时间，毫秒 */
+};
+
+/* 排空管理数据 */
+struct drain_mng {
+    int32_t  fd;                    /* 服务端排空命令socket */
+    BOOL     published;             /* 服务端已经发布排空节点 */
+    uint64_t publish_time;          /* 服务端上次发布时间 */
+
+    uint32_t node_num;
+    struct drain_node nodes[NLB_DRAIN_NODE_MAX];
+    uint16_t slots[NLB_DRAIN_HASH_LEN];     /* 按IP hash的开放寻址索引，节点下标加1，0表示空 */
+};
+
+static struct drain_mng dm = {
+    .fd = -1,
+};
+
+/**
+ * @brief 处理一个排空命令
+ * @return 回复的状态字符串
+ */
+static const char *process_drain_cmd(char *cmd)
+{
+    cmd[strcspn(cmd, "\r\n ")] = '\0';
+
+    if (!strcmp(cmd, "drain")) {
+        NLOG_INFO("recevice drain command");
+        set_drain(TRUE);
+    } else if (!strcmp(cmd, "undrain")) {
+        NLOG_INFO("recevice undrain command");
+        set_drain(FALSE);
+    } else if (strcmp(cmd, "status")) {
+        return "unknown command\n";
+    }
+
+    return draining() ? "draining\n" : "serving\n";
+}
+
+/**
+ * @brief 排空命令socket可读处理函数
+ * @info  命令方需要bind自己的地址才能收到回复
+ */
+static void drain_process(int32_t fd, uint32_t nlb_events)
+{
+    ssize_t len;
+    char    cmd[NLB_DRAIN_CMD_LEN];
+    const char *reply;
+    struct sockaddr_un from;
+    socklen_t from_len;
+
+    while (TRUE) {
+        from_len = sizeof(from);
+        len = recvfrom(fd, cmd, sizeof(cmd) - 1, 0, (struct sockaddr *)&from, &from_len);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                NLOG_ERROR("Receive drain command failed, [%m]");
+            }
+            return;
+        }
+
+        cmd[len] = '\0';
+        reply    = process_drain_cmd(cmd);
+
+        /* 排空状态改变立即发布 */
+        drain_run();
+
+        if (from_len > sizeof(sa_family_t)) {
+            sendto(fd, reply, strlen(reply), MSG_DONTWAIT, (struct sockaddr *)&from, from_len);
+        }
+    }
+}
+
+/**
+ * @brief  初始化服务端排空命令socket
+ * @return =0 成功 <0 失败
+ */
+int32_t drain_init(void)
+{
+    int32_t ret;
+    struct sockaddr_un addr;
+
+    dm.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (dm.fd < 0) {
+        NLOG_ERROR("Create drain socket failed, [%m]");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", NLB_DRAIN_SOCK_PATH);
+
+    /* 单例运行，上次遗留的socket文件直接删除 */
+    unlink(NLB_DRAIN_SOCK_PATH);
+    if (bind(dm.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        NLOG_ERROR("Bind drain socket (%s) failed, [%m]", NLB_DRAIN_SOCK_PATH);
+        ret = -2;
+        goto ERR_RET;
+    }
+    chmod(NLB_DRAIN_SOCK_PATH, 0600);
+
+    ret = network_add_fd(dm.fd, drain_process);
+    if (ret < 0) {
+        NLOG_ERROR("Register drain socket failed, ret [%d]", ret);
+        ret = -3;
+        goto ERR_RET;
+    }
+
+    return 0;
+
+ERR_RET:
+    close(dm.fd);
+    dm.fd = -1;
+    unlink(NLB_DRAIN_SOCK_PATH);
+
+    return ret;
+}
+
+/**
+ * @brief 服务端发布排空状态，主循环中调用
+ * @info  zookeeper没有连接时不做处理，连接后再发布
+ */
+void drain_run(void)
+{
+    int32_t  ret;
+    uint64_t now;
+    BOOL     drain = draining();
+
+    if (!zk_connected()) {
+        return;
+    }
+
+    now = get_time_ms();
+    if (drain == dm.published && (!drain || now < dm.publish_time + NLB_DRAIN_REPUBLISH_TIME)) {
+        return;
+    }
+
+    if (drain) {
+        ret = create_drain_node(get_local_ip());
+    } else {
+        ret = delete_drain_node(get_local_ip());
+    }
+
+    if (ret < 0) {
+        NLOG_ERROR("Publish drain state (%d) failed, ret [%d]", drain, ret);
+        return;
+    }
+
+    dm.published    = drain;
+    dm.publish_time = now;
+}
+
+/**
+ * @brief 关闭排空命令socket
+ */
+void drain_close(void)
+{
+    if (dm.fd < 0) {
+        return;
+    }
+
+    network_del_fd(dm.fd);
+    close(dm.fd);
+    dm.fd = -1;
+    unlink(NLB_DRAIN_SOCK_PATH);
+}
+
+/**
+ * @brief 把排空服务器的下标加入索引，线性探测
+ */
+static void index_drain_node(uint32_t idx)
+{
+    uint32_t slot = hash_ip(dm.nodes[idx].ip) & (NLB_DRAIN_HASH_LEN - 1);
+
+    while (dm.slots[slot]) {
+        slot = (slot + 1) & (NLB_DRAIN_HASH_LEN - 1);
+    }
+
+    dm.slots[slot] = (uint16_t)(idx + 1);
+}
+
+/**
+ * @brief 查找排空服务器
+ * @info  索引槽数是节点上限的2倍，遇到空槽即可结束查找
+ */
+static struct drain_node *find_drain_node(uint32_t ip)
+{
+    uint32_t slot = hash_ip(ip) & (NLB_DRAIN_HASH_LEN - 1);
+    struct drain_node *node;
+
+    while (dm.slots[slot]) {
+        node = &dm.nodes[dm.slots[slot] - 1];
+        if (node->ip == ip) {
+            return node;
+        }
+        slot = (slot + 1) & (NLB_DRAIN_HASH_LEN - 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 客户端记录服务器开始排空
+ */
+void drain_begin(uint32_t ip)
+{
+    struct drain_node *node;
+
+    if (find_drain_node(ip)) {
+        return;
+    }
+
+    if (dm.node_num >= NLB_DRAIN_NODE_MAX) {
+        NLOG_ERROR("Too many draining servers, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    NLOG_INFO("Server (%s) draining", inet_ntoa(*(struct in_addr *)&ip));
+
+    node = &dm.nodes[dm.node_num];
+    node->ip         = ip;
+    node->start_time = get_time_ms();
+    index_drain_node(dm.node_num++);
+}
+
+/**
+ * @brief 客户端记录服务器结束排空，添加撤销排空事件恢复权重
+ * @info  没有排空的服务器直接忽略；删除后最后一个节点移到空位，撤销排空很少发生，直接重建索引
+ */
+void drain_end(uint32_t ip)
+{
+    uint32_t i;
+    struct drain_node *node = find_drain_node(ip);
+
+    if (NULL == node) {
+        return;
+    }
+
+    NLOG_INFO("Server (%s) drain end", inet_ntoa(*(struct in_addr *)&ip));
+
+    *node = dm.nodes[--dm.node_num];
+    memset(dm.slots, 0, sizeof(dm.slots));
+    for (i = 0; i < dm.node_num; i++) {
+        index_drain_node(i);
+    }
+
+    add_node_event(ip, NLB_EVENT_TYPE_NODE_UNDRAIN);
+}
+
+/**
+ * @brief 获取排空中的服务器数
+ */
+uint32_t get_drain_num(void)
+{
+    return dm.node_num;
+}
+
+/**
+ * @brief  按排空进度计算服务器的权重上限
+ * @info   排空窗口内从1000线性降到0，窗口为0时直接为0
+ * @return 静态权重的千分比，1000表示不限制
+ */
+uint32_t drain_weight_cap(const struct shm_servers *servers, const struct server_info *server)
+{
+    uint64_t elapsed, window;
+    struct drain_node *node;
+
+    if (!dm.node_num) {
+        return 1000;
+    }
+
+    node = find_drain_node(server->server_ip);
+    if (NULL == node) {
+        return 1000;
+    }
+
+    window  = (uint64_t)servers->drain_window * 1000;
+    elapsed = get_time_ms() - node->start_time;
+    if (elapsed >= window) {
+        return 0;
+    }
+
+    return (uint32_t)(1000 - elapsed * 1000 / window);
+}
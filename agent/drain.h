@@ -0,0 +1,78 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename drain.h
+ * @info     服务器排空
+ *           服务端: 收到SIGUSR2信号或本地排空命令后创建/serverdrain/ip临时节点，
+ *                   撤销排空后删除节点，进程退出时节点随会话删除
+ *           客户端: 监视服务器的排空节点，在排空窗口内把服务器的动态权重平滑降到0，
+ *                   先于心跳节点删除把请求转移到其它服务器
+ */
+
+#ifndef _DRAIN_H_
+#define _DRAIN_H_
+
+#include <stdint.h>
+#include "commstruct.h"
+
+#define NLB_DRAIN_SOCK_PATH     NLB_NAME_BASE_PATH"/.drain.sock"    /* 本地排空命令socket */
+#define NLB_DRAIN_NODE_MAX      (4096)      /* 客户端同时记录的排空服务器数 */
+#define NLB_DRAIN_TICK          (1000)      /* 客户端降低排空服务器权重的间隔，毫秒 */
+
+/**
+ * @brief  初始化服务端排空命令socket
+ * @info   unix数据报socket，命令: drain 排空，undrain 撤销排空，status 查询，回复当前状态
+ * @return =0 成功 <0 失败
+ */
+int32_t drain_init(void);
+
+/**
+ * @brief 服务端发布排空状态，主循环中调用
+ * @info  排空状态变化时创建或删除排空节点，排空中定时重新创建，防止会话过期后节点丢失
+ */
+void drain_run(void);
+
+/**
+ * @brief 关闭排空命令socket
+ */
+void drain_close(void);
+
+/**
+ * @brief 客户端记录服务器开始排空
+ */
+void drain_begin(uint32_t ip);
+
+/**
+ * @brief 客户端记录服务器结束排空，添加撤销排空事件恢复权重
+ */
+void drain_end(uint32_t ip);
+
+/**
+ * @brief 获取排空中的服务器数
+ */
+uint32_t get_drain_num(void);
+
+/**
+ * @brief  按排空进度计算服务器的权重上限
+ * @return 静态权重的千分比，1000表示不限制
+ */
+uint32_t drain_weight_cap(const struct shm_servers *servers, const struct server_info *server);
+
+#endif
@@ -24,8 +24,10 @@
 #include "commtype.h"
 #include "list.h"
 #include "event.h"
+#include "hash.h"
 #include "log.h"
 #include "agent.h"
+#include "svcindex.h"
 
 /**
  * @brief 创建任务
@@ -41,13 +43,14 @@ struct event *create_event(int32_t type, const char *name, void *ctx)
     event->type = type;
     event->ctx  = ctx;
     strncpy(event->name, name, NLB_SERVICE_NAME_LEN);
+    INIT_LIST_HEAD(&event->hash_node);
     return event;
 }
 
 /**
  * @brief 直接添加事件到链表
  */
-void add_event(struct list_head *event_list, int32_t type, const char *name, void *ctx, BOOL tail)
+struct event *add_event(struct list_head *event_list, int32_t type, const char *name, void *ctx, BOOL tail)
 {
     struct event *event;
 
@@ -55,7 +58,7 @@ void add_event(struct list_head *event_list, int32_t type, const char *name, voi
     event = create_event(type, name, ctx);
     if (NULL == event) {
         NLOG_ERROR("create_event failed");
-        return;
+        return NULL;
     }
 
     if (tail) {
@@ -64,47 +67,57 @@ void add_event(struct list_head *event_list, int32_t type, const char *name, voi
         list_add(&event->list_node, event_list);
     }
 
-    return;
+    return event;
+}
+
+/* 节点事件的hash桶 */
+static inline uint32_t event_hash_key(void *ctx)
+{
+    return hash_ip((uint32_t)(long)ctx) % NLB_EVENT_HASH_LEN;
 }
 
 /**
  * @brief 合并新任务
+ * @info  节点事件按IP在业务的事件hash中查找重复，不遍历事件链表
  */
-void merge_new_event(struct list_head *event_list, int32_t type, const char *name, void *ctx)
+void merge_new_event(struct agent_local_rdata *rdata, int32_t type, void *ctx)
 {
     //struct event_node_ctx *node_ctx;
+    struct list_head *event_list = &rdata->event_list;
+    struct list_head *bucket;
     struct event *event_first;
     struct event *event;
 
-    /* 如果当前没有事件，直接添加事件 */
-    if (list_empty(event_list)) {
-        add_event(event_list, type, name, ctx, FALSE);
-        return;
-    }
-
     /* 重新load配置的事件，判断是否有重复，重新load的事件总是放在链表头 */
-    event_first = list_first_entry(event_list, struct event, list_node);
     if (type == NLB_EVENT_TYPE_GET_SERVICE_NODES) {
-        if (event_first->type == type) {
-            return;
+        if (!list_empty(event_list)) {
+            event_first = list_first_entry(event_list, struct event, list_node);
+            if (event_first->type == type) {
+                return;
+            }
         }
 
-        add_event(event_list, type, name, ctx, FALSE);
+        add_event(event_list, type, rdata->name, ctx, FALSE);
         return;
     }
 
     /* 节点死机和节点恢复的事件，需要查找是否有重复，如果重复，直接覆盖事件类型 */
-    list_for_each_entry(event, event_list, list_node)
+    bucket = &rdata->event_hash[event_hash_key(ctx)];
+    list_for_each_entry(event, bucket, hash_node)
     {
-        /* 比较IP地址是否相同 */
+        /* 比较IP地址是否相同，撤销排空不覆盖死机和恢复事件 */
         if (event->ctx == ctx) {
-            event->type = type;
+            if (type != NLB_EVENT_TYPE_NODE_UNDRAIN) {
+                event->type = type;
+            }
             return;
         }
     }
 
-    add_event(event_list, type, name, ctx, TRUE);
-    return;
+    event = add_event(event_list, type, rdata->name, ctx, TRUE);
+    if (event) {
+        list_add(&event->hash_node, bucket);
+    }
 }
 
 /**
@@ -114,7 +127,6 @@ void merge_new_event(struct list_head *event_list, int32_t type, const char *nam
 void add_service_event(const char *name)
 {
     struct agent_local_rdata *rdata;
-    struct list_head *event_list;
 
     if (NULL == name) {
         return;
@@ -125,30 +137,48 @@ void add_service_event(const char *name)
         return;
     }
 
-    event_list = &rdata->event_list;
-
-    merge_new_event(event_list, NLB_EVENT_TYPE_GET_SERVICE_NODES, name, NULL);
+    merge_new_event(rdata, NLB_EVENT_TYPE_GET_SERVICE_NODES, NULL);
 }
 
 /**
  * @brief 添加节点事件
+ * @info  只添加到包含该服务器的业务
  */
 void add_node_event(uint32_t ip, int32_t type)
 {
-    struct agent_local_rdata *rdata;
-    struct list_head *rdata_list = get_rdata_list();
+    struct svc_index_node *node;
 
     if ((type != NLB_EVENT_TYPE_NODE_DEAD)
-        && (type != NLB_EVENT_TYPE_NODE_RESUME)) {
+        && (type != NLB_EVENT_TYPE_NODE_RESUME)
+        && (type != NLB_EVENT_TYPE_NODE_UNDRAIN)) {
         NLOG_ERROR("invalid node event type (%d)", type);
         return;
     }
 
-    /* 循环所有的业务，如果存在该服务器，就需要添加事件 */
-    list_for_each_entry(rdata, rdata_list, list_node) {
-        if (get_server_info(ip, rdata->servs_data[rdata->route_meta->index])) {
-            merge_new_event(&rdata->event_list, type, rdata->name, (void *)(long)ip);
+    /* 通过反向索引找到包含该服务器的业务添加事件 */
+    for (node = svcindex_find(ip); node; node = svcindex_next(node)) {
+        merge_new_event(node->rdata, type, (void *)(long)ip);
+    }
+}
+
+/**
+ * @brief 添加指定端口的节点事件
+ * @info  只添加到该服务器首个端口为port的业务，同一IP其他端口的业务不受影响
+ */
+void add_node_port_event(uint32_t ip, uint16_t port, int32_t type)
+{
+    struct svc_index_node *node;
+    struct server_info *server;
+    struct agent_local_rdata *rdata;
+
+    for (node = svcindex_find(ip); node; node = svcindex_next(node)) {
+        rdata  = node->rdata;
+        server = get_server_info(ip, rdata->servs_data[rdata->route_meta->index]);
+        if (NULL == server || !server->port_num || server->port[0] != port) {
+            continue;
         }
+
+        merge_new_event(rdata, type, (void *)(long)ip);
     }
 }
 
@@ -158,6 +188,7 @@ void add_node_event(uint32_t ip, int32_t type)
 void delete_event(struct event *event, BOOL free_ctx)
 {
     list_del(&event->list_node);
+    list_del(&event->hash_node);
     if (free_ctx && (event->ctx != NULL)) {
         free(event->ctx);
     }
@@ -29,11 +29,15 @@ enum {
     NLB_EVENT_TYPE_GET_SERVICE_NODES = 1,
     NLB_EVENT_TYPE_NODE_DEAD    = 2,
     NLB_EVENT_TYPE_NODE_RESUME  = 3,
+    NLB_EVENT_TYPE_NODE_UNDRAIN = 4,
 };
 
+#define NLB_EVENT_HASH_LEN          (64)    /* 业务节点事件按IP的hash桶数 */
+
 /* 事件数据结构 */
 struct event {
     struct list_head list_node;
+    struct list_head hash_node;     /* 节点事件的hash链表节点 */
     int32_t type;
     void *ctx;
     char name[NLB_SERVICE_NAME_LEN];
@@ -47,9 +51,16 @@ void add_service_event(const char *name);
 
 /**
  * @brief 添加节点事件
+ * @info  只添加到包含该服务器的业务
  */
 void add_node_event(uint32_t ip, int32_t type);
 
+/**
+ * @brief 添加指定端口的节点事件
+ * @info  只添加到该服务器首个端口为port的业务，同一IP其他端口的业务不受影响
+ */
+void add_node_port_event(uint32_t ip, uint16_t port, int32_t type);
+
 /**
  * @brief 删除一个事件
  */
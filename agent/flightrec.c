@@ -0,0 +1,264 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename flightrec.c
+ * @info     权重调整记录器
+ *           环形数据区使用单调递增的逻辑偏移，物理位置为逻辑偏移对数据区长度取模；
+ *           记录不跨越环尾，放不下时写入填充记录；写入前先推进head回收旧记录，
+ *           写完数据后再推进tail，读取方只解析[head, tail)之间的记录。
+ *           每次调整只做一次快照拷贝和一次顺序写，开销和服务器数成正比
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "atomic.h"
+#include "nlbtime.h"
+#include "utils.h"
+#include "log.h"
+#include "shaping.h"
+#include "flightrec.h"
+
+#define ALIGN8(x)   (((x) + 7) & ~((uint64_t)7))
+
+static struct flightrec_header *fr_header;      /* 文件头，NULL表示关闭 */
+static char     *fr_data;                       /* 环形数据区 */
+static struct flightrec_server *fr_snap;        /* 调整前快照 */
+static uint32_t  fr_snap_num;
+static uint32_t  fr_weight_low_num;
+
+/**
+ * @brief 初始化调整记录文件
+ * @info  文件已经存在且格式一致时继续追加，否则重新初始化
+ * @param size_mb: 数据区大小，MB，0表示关闭记录
+ * @return 0 成功 <0 失败
+ */
+int32_t flightrec_init(uint32_t size_mb)
+{
+    int32_t  fd = -1;
+    uint64_t data_size = (uint64_t)size_mb << 20;
+    uint64_t file_size = NLB_FLIGHTREC_DATA_OFFSET + data_size;
+    void    *addr;
+    struct stat buf;
+    struct flightrec_header *header;
+
+    if (!size_mb) {
+        return 0;
+    }
+
+    fr_snap = calloc(NLB_SERVER_MAX, sizeof(struct flightrec_server));
+    if (NULL == fr_snap) {
+        NLOG_ERROR("No memory for flight recorder");
+        goto ERR_RET;
+    }
+
+    fd = open(NLB_FLIGHTREC_PATH, O_RDWR | O_CREAT, 0640);
+    if (fd < 0) {
+        NLOG_ERROR("Open flight recorder file (%s) failed, [%m]", NLB_FLIGHTREC_PATH);
+        goto ERR_RET;
+    }
+
+    /* 只有agent可以写入，旧版本创建的文件同样收回写权限 */
+    if (fchmod(fd, 0640) < 0) {
+        NLOG_ERROR("Chmod flight recorder file (%s) failed, [%m]", NLB_FLIGHTREC_PATH);
+        goto ERR_RET;
+    }
+
+    if (fstat(fd, &buf) < 0) {
+        NLOG_ERROR("Stat flight recorder file (%s) failed, [%m]", NLB_FLIGHTREC_PATH);
+        goto ERR_RET;
+    }
+
+    if ((uint64_t)buf.st_size != file_size && ftruncate(fd, file_size) < 0) {
+        NLOG_ERROR("Truncate flight recorder file (%s) failed, [%m]", NLB_FLIGHTREC_PATH);
+        goto ERR_RET;
+    }
+
+    addr = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        NLOG_ERROR("Mmap flight recorder file (%s) failed, [%m]", NLB_FLIGHTREC_PATH);
+        goto ERR_RET;
+    }
+
+    close(fd);
+
+    header = (struct flightrec_header *)addr;
+    if (header->magic != NLB_FLIGHTREC_MAGIC || header->version != NLB_FLIGHTREC_VERSION
+        || header->data_size != data_size || header->head > header->tail
+        || header->tail - header->head > data_size) {
+        memset(header, 0, sizeof(*header));
+        header->version   = NLB_FLIGHTREC_VERSION;
+        header->data_size = data_size;
+        mb();
+        header->magic     = NLB_FLIGHTREC_MAGIC;
+    }
+
+    fr_data   = (char *)addr + NLB_FLIGHTREC_DATA_OFFSET;
+    fr_header = header;
+
+    NLOG_INFO("Flight recorder init success, size [%u]MB, records [%lu]", size_mb, header->records);
+    return 0;
+
+ERR_RET:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    free(fr_snap);
+    fr_snap = NULL;
+
+    return -1;
+}
+
+/**
+ * @brief 调整前保存服务器状态快照，记录关闭时直接返回
+ */
+void flightrec_begin(struct shm_servers *servers)
+{
+    uint32_t i;
+    struct server_info *server;
+    struct flightrec_server *snap;
+
+    if (NULL == fr_header) {
+        return;
+    }
+
+    fr_snap_num       = min(servers->server_num, (uint32_t)NLB_SERVER_MAX);
+    fr_weight_low_num = servers->weight_low_num;
+
+    for (i = 0; i < fr_snap_num; i++) {
+        server = &servers->svrs[i];
+        snap   = &fr_snap[i];
+
+        snap->ip            = server->server_ip;
+        snap->success       = server->success;
+        snap->failed        = server->failed;
+        snap->cost          = server->cost;
+        snap->weight_old    = server->weight_dynamic;
+        snap->weight_static = server->weight_static;
+        snap->dead_old      = server->dead_time ? 1 : 0;
+        snap->reserved      = 0;
+    }
+}
+
+/**
+ * @brief 回收旧记录，保证从逻辑偏移tail开始有len字节空间
+ */
+static void flightrec_reclaim(uint64_t tail, uint64_t len)
+{
+    uint64_t head = fr_header->head;
+    struct flightrec_record *record;
+
+    while (tail + len - head > fr_header->data_size) {
+        record = (struct flightrec_record *)(fr_data + head % fr_header->data_size);
+        if (record->length < sizeof(uint64_t) || record->length > fr_header->data_size) {
+            /* 数据损坏，丢弃所有记录 */
+            head = tail;
+            break;
+        }
+        head += record->length;
+    }
+
+    fr_header->head = min(head, tail);
+    mb();
+}
+
+/**
+ * @brief 调整后对比快照，追加一条记录
+ * @param name:   业务名
+ *        servers:调整后的服务器数据，多阶hash已经计算
+ *        branch: 调整分支
+ *        ratio:  本次使用的基准成功率
+ */
+void flightrec_commit(const char *name, struct shm_servers *servers, int32_t branch, float ratio)
+{
+    uint32_t i, num, name_len;
+    uint64_t len, pos, tail, size;
+    struct flightrec_record *record;
+    struct flightrec_server *rec_svrs;
+    struct server_info      *server;
+
+    if (NULL == fr_header) {
+        return;
+    }
+
+    size     = fr_header->data_size;
+    name_len = strnlen(name, NLB_SERVICE_NAME_LEN);
+    num      = fr_snap_num;
+
+    /* 单条记录不超过数据区的一半，超出时截断服务器列表 */
+    len = ALIGN8(sizeof(*record) + name_len) + (uint64_t)num * sizeof(struct flightrec_server);
+    if (len > size / 2) {
+        num = (size / 2 - ALIGN8(sizeof(*record) + name_len)) / sizeof(struct flightrec_server);
+        len = ALIGN8(sizeof(*record) + name_len) + (uint64_t)num * sizeof(struct flightrec_server);
+    }
+
+    /* 环尾放不下，写入填充记录 */
+    tail = fr_header->tail;
+    pos  = tail % size;
+    if (pos + len > size) {
+        flightrec_reclaim(tail, size - pos);
+        record = (struct flightrec_record *)(fr_data + pos);
+        record->type   = NLB_FLIGHTREC_TYPE_PAD;
+        record->length = (uint32_t)(size - pos);
+        tail += size - pos;
+        pos   = 0;
+    }
+
+    flightrec_reclaim(tail, len);
+
+    record = (struct flightrec_record *)(fr_data + pos);
+    record->type           = NLB_FLIGHTREC_TYPE_RECORD;
+    record->name_len       = name_len;
+    record->length         = (uint32_t)len;
+    record->time           = get_time_ms();
+    record->branch         = (uint8_t)branch;
+    record->truncated      = (num != fr_snap_num);
+    record->reserved       = 0;
+    record->server_num     = num;
+    record->success_ratio  = ratio;
+    record->weight_low_num = fr_weight_low_num;
+    memcpy(record + 1, name, name_len);
+
+    rec_svrs = (struct flightrec_server *)((char *)record + ALIGN8(sizeof(*record) + name_len));
+    for (i = 0; i < num; i++) {
+        rec_svrs[i] = fr_snap[i];
+        server = get_server_info(fr_snap[i].ip, servers);
+        if (server) {
+            rec_svrs[i].weight_new = server->weight_dynamic;
+            rec_svrs[i].dead_new   = server->dead_time ? 1 : 0;
+        } else {
+            rec_svrs[i].weight_new = 0;
+            rec_svrs[i].dead_new   = 0;
+        }
+    }
+
+    /* 数据写完后再发布 */
+    mb();
+    fr_header->tail = tail + len;
+    fr_header->records++;
+}
@@ -0,0 +1,109 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename flightrec.h
+ * @info     权重调整记录器
+ *           每次调整业务权重时，追加一条二进制记录到固定大小的mmap环形文件中，
+ *           记录调整前后的权重、死机状态变化和统计数据，便于事后分析摘除原因
+ */
+
+#ifndef _FLIGHTREC_H_
+#define _FLIGHTREC_H_
+
+#include <stdint.h>
+#include "commtype.h"
+#include "commstruct.h"
+
+#define NLB_FLIGHTREC_PATH          "/var/nlb/flightrec.dat"
+#define NLB_FLIGHTREC_MAGIC         (0x46424C4E)    /* "NLBF" */
+#define NLB_FLIGHTREC_VERSION       (1)
+#define NLB_FLIGHTREC_DATA_OFFSET   (4096)          /* 数据区在文件中的偏移 */
+#define NLB_FLIGHTREC_DEFAULT_SIZE  (16)            /* 默认数据区大小，MB */
+
+enum {
+    NLB_FLIGHTREC_TYPE_RECORD = 1,  /* 调整记录 */
+    NLB_FLIGHTREC_TYPE_PAD    = 2,  /* 环尾填充 */
+};
+
+#pragma pack(push, 1)
+
+/* 文件头 */
+struct flightrec_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size;             /* 环形数据区长度 */
+    volatile uint64_t head;         /* 最早一条记录的逻辑偏移 */
+    volatile uint64_t tail;         /* 下一条记录的逻辑偏移 */
+    volatile uint64_t records;      /* 累计写入记录数 */
+    uint64_t reserved[3];
+};
+
+/* 记录头，后面跟8字节对齐的业务名和server_num个flightrec_server */
+struct flightrec_record {
+    uint16_t type;                  /* 记录类型 */
+    uint16_t name_len;              /* 业务名长度 */
+    uint32_t length;                /* 记录总长度，8字节对齐 */
+    uint64_t time;                  /* 调整时间，毫秒 */
+    uint8_t  branch;                /* 调整分支，NLB_SHAPING_XXX */
+    uint8_t  truncated;             /* 服务器数过多被截断 */
+    uint16_t reserved;
+    uint32_t server_num;            /* 记录的服务器数 */
+    float    success_ratio;         /* 本次使用的基准成功率 */
+    uint32_t weight_low_num;        /* 调整前低权重机器数 */
+};
+
+/* 单个服务器的调整记录 */
+struct flightrec_server {
+    uint32_t ip;
+    uint32_t success;               /* 周期内成功数 */
+    uint32_t failed;                /* 周期内失败数 */
+    uint16_t weight_old;            /* 调整前动态权重 */
+    uint16_t weight_new;            /* 调整后动态权重 */
+    uint64_t cost;                  /* 周期内时延总和 */
+    uint16_t weight_static;         /* 静态权重 */
+    uint8_t  dead_old;              /* 调整前是否死机 */
+    uint8_t  dead_new;              /* 调整后是否死机 */
+    uint32_t reserved;
+};
+
+#pragma pack(pop)
+
+/**
+ * @brief 初始化调整记录文件
+ * @param size_mb: 数据区大小，MB，0表示关闭记录
+ * @return 0 成功 <0 失败
+ */
+int32_t flightrec_init(uint32_t size_mb);
+
+/**
+ * @brief 调整前保存服务器状态快照，记录关闭时直接返回
+ */
+void flightrec_begin(struct shm_servers *servers);
+
+/**
+ * @brief 调整后对比快照，追加一条记录
+ * @param name:   业务名
+ *        servers:调整后的服务器数据，多阶hash已经计算
+ *        branch: 调整分支
+ *        ratio:  本次使用的基准成功率
+ */
+void flightrec_commit(const char *name, struct shm_servers *servers, int32_t branch, float ratio);
+
+#endif
@@ -0,0 +1,564 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename healthcheck.c
+ * @info     死机服务器主动健康检查
+ *           每秒扫描一次所有业务的当前服务器数据，为死机服务器建立探测目标(IP+端口)，
+ *           探测目标按间隔加随机抖动调度，并发数受限；探测socket挂在健康检查自己的epoll fd上，
+ *           该epoll fd再注册到主循环，不阻塞路由请求和zookeeper处理
+ */
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "list.h"
+#include "log.h"
+#include "nlbtime.h"
+#include "nlbrand.h"
+#include "atomic.h"
+#include "utils.h"
+#include "nlbapi.h"
+#include "agent.h"
+#include "event.h"
+#include "networking.h"
+#include "healthcheck.h"
+
+#define NLB_HC_HASH_LEN         1021        /* 探测目标hash桶数 */
+#define NLB_HC_SCAN_INTERVAL    1000        /* 扫描死机服务器的间隔，毫秒 */
+#define NLB_HC_EVENT_NUM        64          /* 单次处理的就绪事件数 */
+#define NLB_HC_UDP_PAYLOAD      "nlb health check"
+
+/* 探测方式 */
+enum {
+    NLB_HC_OFF    = 0,
+    NLB_HC_AUTO   = 1,
+    NLB_HC_TCP    = 2,
+    NLB_HC_UDP    = 3,
+    NLB_HC_PLUGIN = 4,
+};
+
+/* 探测目标 */
+struct hc_target {
+    struct list_head hash_node;     /* hash链表节点 */
+    struct list_head list_node;     /* 所有目标链表节点 */
+    uint32_t ip;                    /* IP地址，网络字节序 */
+    uint16_t port;                  /* 端口，本机字节序 */
+    uint16_t type;                  /* 端口类型 */
+    int32_t  fd;                    /* 探测中的fd，-1表示没有探测 */
+    uint32_t scan_gen;              /* 最近一次扫描到的扫描编号 */
+    uint32_t successes;             /* 连续成功次数 */
+    uint64_t start_time;            /* 本次探测开始时间 */
+    uint64_t next_time;             /* 下次探测时间 */
+};
+
+/* 健康检查管理数据 */
+struct hc_mng {
+    int32_t  method;
+    int32_t  epfd;
+    uint32_t interval;
+    uint32_t timeout;
+    uint32_t concurrency;
+    uint32_t active;                /* 进行中的探测数 */
+    uint32_t scan_gen;              /* 扫描编号 */
+    uint64_t scan_time;             /* 上次扫描时间 */
+
+    void *dl_handle;                /* 探测插件 */
+    nlb_probe_start_func probe_start;
+    nlb_probe_check_func probe_check;
+
+    struct list_head hash[NLB_HC_HASH_LEN];
+    struct list_head list;
+};
+
+static struct hc_mng hc = {
+    .method = NLB_HC_OFF,
+    .epfd   = -1,
+};
+
+/**
+ * @brief 查找探测目标
+ */
+static struct hc_target *find_target(uint32_t ip, uint16_t port)
+{
+    struct hc_target *target;
+
+    list_for_each_entry(target, &hc.hash[(ip ^ port) % NLB_HC_HASH_LEN], hash_node) {
+        if (target->ip == ip && target->port == port) {
+            return target;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 添加探测目标，首次探测时间在一个间隔内随机打散
+ */
+static struct hc_target *add_target(uint32_t ip, uint16_t port, uint16_t type)
+{
+    struct hc_target *target = calloc(1, sizeof(*target));
+
+    if (NULL == target) {
+        NLOG_ERROR("No memory");
+        return NULL;
+    }
+
+    target->ip        = ip;
+    target->port      = port;
+    target->type      = type;
+    target->fd        = -1;
+    target->next_time = get_time_ms() + nlb_rand() % hc.interval;
+
+    list_add(&target->hash_node, &hc.hash[(ip ^ port) % NLB_HC_HASH_LEN]);
+    list_add_tail(&target->list_node, &hc.list);
+
+    return target;
+}
+
+/**
+ * @brief 删除探测目标
+ */
+static void delete_target(struct hc_target *target)
+{
+    if (target->fd >= 0) {
+        epoll_ctl(hc.epfd, EPOLL_CTL_DEL, target->fd, NULL);
+        close(target->fd);
+        hc.active--;
+    }
+
+    list_del(&target->hash_node);
+    list_del(&target->list_node);
+    free(target);
+}
+
+/**
+ * @brief 选择探测使用的端口类型
+ */
+static uint16_t select_probe_type(uint16_t port_type)
+{
+    if (hc.method == NLB_HC_TCP) {
+        return NLB_PORT_TYPE_TCP;
+    }
+
+    if (hc.method == NLB_HC_UDP) {
+        return NLB_PORT_TYPE_UDP;
+    }
+
+    return (port_type == NLB_PORT_TYPE_UDP) ? NLB_PORT_TYPE_UDP : NLB_PORT_TYPE_TCP;
+}
+
+/**
+ * @brief 扫描所有业务的死机服务器，更新探测目标
+ * @info  不再死机或者已经删除的服务器，空闲时删除探测目标
+ */
+static void scan_dead_servers(void)
+{
+    uint32_t i;
+    struct agent_local_rdata *rdata;
+    struct shm_servers *servers;
+    struct server_info *server;
+    struct hc_target *target, *tmp;
+
+    hc.scan_gen++;
+
+    list_for_each_entry(rdata, get_rdata_list(), list_node) {
+        servers = rdata->servs_data[rdata->route_meta->index];
+
+        for (i = 0; i < servers->server_num; i++) {
+            server = servers->svrs + i;
+            if (!server->dead_time || !server->port_num) {
+                continue;
+            }
+
+            target = find_target(server->server_ip, server->port[0]);
+            if (NULL == target) {
+                target = add_target(server->server_ip, server->port[0], select_probe_type(server->port_type));
+                if (NULL == target) {
+                    continue;
+                }
+            }
+
+            target->scan_gen = hc.scan_gen;
+        }
+    }
+
+    list_for_each_entry_safe(target, tmp, &hc.list, list_node) {
+        if (target->scan_gen != hc.scan_gen && target->fd < 0) {
+            delete_target(target);
+        }
+    }
+}
+
+/**
+ * @brief 探测结果计入所有包含该服务器的业务的统计数据
+ * @info  只更新仍然死机的服务器，权重调整时按成功率判断是否恢复
+ */
+static void feed_servers_stat(struct hc_target *target, BOOL ok, uint64_t cost)
+{
+    struct agent_local_rdata *rdata;
+    struct server_info *server;
+
+    list_for_each_entry(rdata, get_rdata_list(), list_node) {
+        server = get_server_info(target->ip, rdata->servs_data[rdata->route_meta->index]);
+        if (NULL == server || !server->dead_time || !server->port_num || server->port[0] != target->port) {
+            continue;
+        }
+
+        if (ok) {
+            fetch_and_add(&server->success, (uint32_t)1);
+            fetch_and_add_8(&server->cost, cost);
+        } else {
+            fetch_and_add(&server->failed, (uint32_t)1);
+        }
+    }
+}
+
+/**
+ * @brief 结束一次探测
+ * @info  关闭探测fd，上报结果，连续成功达到阈值时对首个端口为探测端口的业务触发节点恢复事件，
+ *        并安排下次探测
+ */
+static void finish_probe(struct hc_target *target, BOOL ok)
+{
+    uint64_t now  = get_time_ms();
+    uint64_t cost = now - target->start_time;
+
+    if (target->fd >= 0) {
+        epoll_ctl(hc.epfd, EPOLL_CTL_DEL, target->fd, NULL);
+        close(target->fd);
+        target->fd = -1;
+        hc.active--;
+    }
+
+    feed_servers_stat(target, ok, cost);
+
+    if (!ok) {
+        target->successes = 0;
+    } else if (++target->successes >= NLB_HC_HEALTHY_THRESHOLD) {
+        NLOG_INFO("health check ok, resume node [%s:%u]",
+                  inet_ntoa(*(struct in_addr *)&target->ip), target->port);
+        add_node_port_event(target->ip, target->port, NLB_EVENT_TYPE_NODE_RESUME);
+        target->successes = 0;
+    }
+
+    /* 间隔上下抖动10%，避免多个agent同时探测 */
+    target->next_time = now + hc.interval - hc.interval / 10 + nlb_rand() % (hc.interval / 5 + 1);
+}
+
+/**
+ * @brief 创建TCP或者UDP探测socket
+ * @return >=0 fd，events输出需要等待的事件 <0 失败
+ */
+static int32_t create_probe_socket(struct hc_target *target, uint32_t *events)
+{
+    int32_t fd, ret;
+    struct sockaddr_in addr;
+    int32_t type = (target->type == NLB_PORT_TYPE_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+
+    fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        NLOG_ERROR("create probe socket failed, [%m]");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = target->ip;
+    addr.sin_port        = htons(target->port);
+
+    ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -2;
+    }
+
+    if (type == SOCK_STREAM) {
+        *events = NLB_POLLOUT;
+        return fd;
+    }
+
+    /* UDP回显探测，需要对端回包 */
+    if (send(fd, NLB_HC_UDP_PAYLOAD, sizeof(NLB_HC_UDP_PAYLOAD) - 1, 0) < 0) {
+        close(fd);
+        return -3;
+    }
+
+    *events = NLB_POLLIN;
+    return fd;
+}
+
+/**
+ * @brief 发起一次探测
+ */
+static void start_probe(struct hc_target *target)
+{
+    int32_t  fd;
+    uint32_t events = 0;
+    struct epoll_event ev;
+
+    target->start_time = get_time_ms();
+
+    if (hc.method == NLB_HC_PLUGIN) {
+        fd = hc.probe_start(target->ip, target->port, target->type, &events);
+    } else {
+        fd = create_probe_socket(target, &events);
+    }
+
+    if (fd < 0) {
+        finish_probe(target, FALSE);
+        return;
+    }
+
+    ev.data.ptr = target;
+    ev.events   = 0;
+    if (events & NLB_POLLIN) {
+        ev.events |= EPOLLIN;
+    }
+    if (events & NLB_POLLOUT) {
+        ev.events |= EPOLLOUT;
+    }
+
+    if (epoll_ctl(hc.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        NLOG_ERROR("epoll_ctl_add probe fd failed, [%m]");
+        close(fd);
+        finish_probe(target, FALSE);
+        return;
+    }
+
+    target->fd = fd;
+    hc.active++;
+}
+
+/**
+ * @brief 检查TCP或者UDP探测结果
+ * @return NLB_PROBE_OK 成功 NLB_PROBE_PENDING 继续等待 <0 失败
+ */
+static int32_t check_probe_socket(struct hc_target *target)
+{
+    int32_t   err = 0;
+    socklen_t len = sizeof(err);
+    char      buff[64];
+
+    if (target->type != NLB_PORT_TYPE_UDP) {
+        if (getsockopt(target->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            return -1;
+        }
+        return NLB_PROBE_OK;
+    }
+
+    if (recv(target->fd, buff, sizeof(buff), 0) >= 0) {
+        return NLB_PROBE_OK;
+    }
+
+    return (errno == EAGAIN || errno == EINTR) ? NLB_PROBE_PENDING : -1;
+}
+
+/**
+ * @brief 健康检查epoll fd就绪处理，由主循环回调
+ */
+static void healthcheck_process(int32_t fd, uint32_t nlb_events)
+{
+    int32_t  i, ready, ret;
+    uint32_t events;
+    struct epoll_event evlist[NLB_HC_EVENT_NUM];
+    struct hc_target *target;
+
+    ready = epoll_wait(hc.epfd, evlist, NLB_HC_EVENT_NUM, 0);
+    for (i = 0; i < ready; i++) {
+        target = evlist[i].data.ptr;
+
+        events = 0;
+        if (evlist[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            events |= NLB_POLLIN;
+        }
+        if (evlist[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            events |= NLB_POLLOUT;
+        }
+
+        if (hc.method == NLB_HC_PLUGIN) {
+            ret = hc.probe_check(target->fd, events);
+        } else {
+            ret = check_probe_socket(target);
+        }
+
+        if (ret == NLB_PROBE_PENDING) {
+            continue;
+        }
+
+        finish_probe(target, ret == NLB_PROBE_OK);
+    }
+}
+
+/**
+ * @brief 加载探测插件
+ * @return =0 成功 <0 失败
+ */
+static int32_t load_probe_plugin(const char *path)
+{
+    hc.dl_handle = dlopen(path, RTLD_NOW);
+    if (NULL == hc.dl_handle) {
+        NLOG_ERROR("Load health check plugin (%s) failed, [%s]", path, dlerror());
+        return -1;
+    }
+
+    hc.probe_start = (nlb_probe_start_func)dlsym(hc.dl_handle, NLB_PROBE_START_SYMBOL);
+    hc.probe_check = (nlb_probe_check_func)dlsym(hc.dl_handle, NLB_PROBE_CHECK_SYMBOL);
+    if (NULL == hc.probe_start || NULL == hc.probe_check) {
+        NLOG_ERROR("Health check plugin (%s) has no probe symbols", path);
+        dlclose(hc.dl_handle);
+        hc.dl_handle = NULL;
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  初始化健康检查
+ * @return =0 成功 <0 失败
+ */
+int32_t healthcheck_init(const char *method, uint32_t interval, uint32_t timeout, uint32_t concurrency)
+{
+    int32_t i, ret;
+
+    for (i = 0; i < NLB_HC_HASH_LEN; i++) {
+        INIT_LIST_HEAD(&hc.hash[i]);
+    }
+    INIT_LIST_HEAD(&hc.list);
+
+    hc.interval    = max(interval, (uint32_t)1);
+    hc.timeout     = timeout;
+    hc.concurrency = min(concurrency, (uint32_t)NLB_HC_PROBE_MAX);
+
+    if (NULL == method || !strcmp(method, "off")) {
+        hc.method = NLB_HC_OFF;
+        return 0;
+    } else if (!strcmp(method, "auto")) {
+        hc.method = NLB_HC_AUTO;
+    } else if (!strcmp(method, "tcp")) {
+        hc.method = NLB_HC_TCP;
+    } else if (!strcmp(method, "udp")) {
+        hc.method = NLB_HC_UDP;
+    } else {
+        ret = load_probe_plugin(method);
+        if (ret < 0) {
+            return -1;
+        }
+        hc.method = NLB_HC_PLUGIN;
+    }
+
+    hc.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (hc.epfd < 0) {
+        NLOG_ERROR("Create health check epoll failed, [%m]");
+        ret = -2;
+        goto ERR_RET;
+    }
+
+    ret = network_add_fd(hc.epfd, healthcheck_process);
+    if (ret < 0) {
+        NLOG_ERROR("Register health check epoll failed, ret [%d]", ret);
+        ret = -3;
+        goto ERR_RET;
+    }
+
+    return 0;
+
+ERR_RET:
+    if (hc.epfd >= 0) {
+        close(hc.epfd);
+        hc.epfd = -1;
+    }
+
+    if (hc.dl_handle) {
+        dlclose(hc.dl_handle);
+        hc.dl_handle = NULL;
+    }
+
+    hc.method = NLB_HC_OFF;
+    return ret;
+}
+
+/**
+ * @brief 健康检查调度，主循环中定时调用
+ */
+void healthcheck_run(void)
+{
+    uint64_t now;
+    struct hc_target *target, *tmp;
+
+    if (hc.method == NLB_HC_OFF) {
+        return;
+    }
+
+    now = get_time_ms();
+    if (now >= hc.scan_time + NLB_HC_SCAN_INTERVAL) {
+        scan_dead_servers();
+        hc.scan_time = now;
+    }
+
+    list_for_each_entry_safe(target, tmp, &hc.list, list_node) {
+        if (target->fd >= 0) {
+            if (now >= target->start_time + hc.timeout) {
+                finish_probe(target, FALSE);
+            }
+            continue;
+        }
+
+        if (target->next_time <= now && hc.active < hc.concurrency) {
+            start_probe(target);
+        }
+    }
+}
+
+/**
+ * @brief 关闭健康检查，释放所有探测
+ */
+void healthcheck_close(void)
+{
+    struct hc_target *target, *tmp;
+
+    if (hc.method == NLB_HC_OFF) {
+        return;
+    }
+
+    list_for_each_entry_safe(target, tmp, &hc.list, list_node) {
+        delete_target(target);
+    }
+
+    network_del_fd(hc.epfd);
+    close(hc.epfd);
+    hc.epfd   = -1;
+    hc.method = NLB_HC_OFF;
+
+    if (hc.dl_handle) {
+        dlclose(hc.dl_handle);
+        hc.dl_handle = NULL;
+    }
+}
@@ -0,0 +1,85 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename healthcheck.h
+ * @info     死机服务器主动健康检查
+ *           agent定期对本机使用的业务中已判死(dead_time非0)的服务器发起探测，
+ *           支持TCP连接、UDP回显和插件探测，使用独立的epoll fd非阻塞调度，
+ *           探测结果计入统计数据参与权重调整，连续成功后触发节点恢复事件
+ */
+
+#ifndef _HEALTHCHECK_H_
+#define _HEALTHCHECK_H_
+
+#include <stdint.h>
+
+#define NLB_HC_DEFAULT_INTERVAL     (3000)  /* 默认探测间隔，毫秒 */
+#define NLB_HC_DEFAULT_TIMEOUT      (1000)  /* 默认探测超时，毫秒 */
+#define NLB_HC_DEFAULT_CONCURRENCY  (32)    /* 默认最大并发探测数 */
+#define NLB_HC_PROBE_MAX            (1024)  /* 最大并发探测数上限 */
+#define NLB_HC_HEALTHY_THRESHOLD    (2)     /* 连续探测成功次数达到该值，触发节点恢复 */
+
+/* 探测插件结果 */
+enum {
+    NLB_PROBE_OK      = 0,      /* 探测成功 */
+    NLB_PROBE_PENDING = 1,      /* 探测未完成，继续等待事件 */
+};
+
+/**
+ * 探测插件接口，插件为动态库，导出以下两个符号:
+ *
+ * @brief 发起一次探测
+ * @param ip:     服务器IP地址，网络字节序
+ *        port:   服务器端口，本机字节序
+ *        type:   端口类型 NLB_PORT_TYPE_UDP/NLB_PORT_TYPE_TCP
+ *        events: 输出参数，需要等待的事件 NLB_POLLIN/NLB_POLLOUT
+ * @return >=0 非阻塞fd，由agent关闭 <0 失败
+ */
+typedef int32_t (*nlb_probe_start_func)(uint32_t ip, uint16_t port, uint16_t type, uint32_t *events);
+#define NLB_PROBE_START_SYMBOL "nlb_probe_start"
+
+/**
+ * @brief fd就绪后检查探测结果
+ * @param fd:     nlb_probe_start返回的fd
+ *        events: 就绪事件 NLB_POLLIN/NLB_POLLOUT
+ * @return NLB_PROBE_OK 成功 NLB_PROBE_PENDING 继续等待 <0 失败
+ */
+typedef int32_t (*nlb_probe_check_func)(int32_t fd, uint32_t events);
+#define NLB_PROBE_CHECK_SYMBOL "nlb_probe_check"
+
+/**
+ * @brief  初始化健康检查
+ * @info   method: off/auto/tcp/udp/插件路径，auto按服务器端口类型选择TCP或UDP
+ * @return =0 成功 <0 失败
+ */
+int32_t healthcheck_init(const char *method, uint32_t interval, uint32_t timeout, uint32_t concurrency);
+
+/**
+ * @brief 健康检查调度，主循环中定时调用
+ * @info  扫描死机服务器，发起到期的探测，处理超时的探测
+ */
+void healthcheck_run(void);
+
+/**
+ * @brief 关闭健康检查，释放所有探测
+ */
+void healthcheck_close(void);
+
+#endif
@@ -0,0 +1,193 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename ipset.c
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "ipset.h"
+
+/* IP的hash槽位 */
+static inline uint32_t ipset_slot(const struct ipset *set, uint32_t ip)
+{
+    return hash_ip(ip) & set->mask;
+}
+
+/**
+ * @brief 初始化空集合，不分配内存
+ */
+void ipset_init(struct ipset *set)
+{
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief 释放集合内存
+ */
+void ipset_free(struct ipset *set)
+{
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief 清空集合，保留内存
+ */
+void ipset_clear(struct ipset *set)
+{
+    if (set->slots) {
+        memset(set->slots, 0, (set->mask + 1) * sizeof(uint32_t));
+    }
+
+    set->count = 0;
+}
+
+/**
+ * @brief  检查IP是否在集合中
+ */
+BOOL ipset_has(const struct ipset *set, uint32_t ip)
+{
+    uint32_t idx;
+
+    if (!set->count || !ip) {
+        return FALSE;
+    }
+
+    for (idx = ipset_slot(set, ip); set->slots[idx]; idx = (idx + 1) & set->mask) {
+        if (set->slots[idx] == ip) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* 不检查容量直接插入 */
+static BOOL ipset_insert(struct ipset *set, uint32_t ip)
+{
+    uint32_t idx;
+
+    for (idx = ipset_slot(set, ip); set->slots[idx]; idx = (idx + 1) & set->mask) {
+        if (set->slots[idx] == ip) {
+            return FALSE;
+        }
+    }
+
+    set->slots[idx] = ip;
+    return TRUE;
+}
+
+/**
+ * @brief  扩容到new_size个槽位，重新插入所有IP
+ * @return =0 成功 <0 内存不足
+ */
+static int32_t ipset_resize(struct ipset *set, uint32_t new_size)
+{
+    uint32_t i;
+    struct ipset old = *set;
+
+    set->slots = calloc(new_size, sizeof(uint32_t));
+    if (NULL == set->slots) {
+        *set = old;
+        return -1;
+    }
+
+    set->mask = new_size - 1;
+    for (i = 0; old.slots && i <= old.mask; i++) {
+        if (old.slots[i]) {
+            ipset_insert(set, old.slots[i]);
+        }
+    }
+
+    free(old.slots);
+    return 0;
+}
+
+/**
+ * @brief  添加IP
+ * @return =0 成功 <0 内存不足
+ */
+int32_t ipset_add(struct ipset *set, uint32_t ip)
+{
+    uint32_t size = set->slots ? (set->mask + 1) : 0;
+
+    if (!ip) {
+        return 0;
+    }
+
+    /* 装载率不超过一半，保证探测长度短 */
+    if ((set->count + 1) * 2 > size) {
+        if (ipset_resize(set, size ? size * 2 : NLB_IPSET_MIN_SIZE) < 0) {
+            return -1;
+        }
+    }
+
+    if (ipset_insert(set, ip)) {
+        set->count++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 删除IP
+ * @info  后续同一探测链上的IP前移，不使用删除标记
+ */
+void ipset_del(struct ipset *set, uint32_t ip)
+{
+    uint32_t idx, next, home;
+
+    if (!set->count || !ip) {
+        return;
+    }
+
+    for (idx = ipset_slot(set, ip); set->slots[idx] != ip; idx = (idx + 1) & set->mask) {
+        if (!set->slots[idx]) {
+            return;
+        }
+    }
+
+    set->slots[idx] = 0;
+    set->count--;
+
+    for (next = (idx + 1) & set->mask; set->slots[next]; next = (next + 1) & set->mask) {
+        home = ipset_slot(set, set->slots[next]);
+
+        /* home不在(idx, next]区间内时可以移到空位 */
+        if (((next - home) & set->mask) >= ((next - idx) & set->mask)) {
+            set->slots[idx]  = set->slots[next];
+            set->slots[next] = 0;
+            idx = next;
+        }
+    }
+}
+
+/**
+ * @brief 交换两个集合的内容
+ */
+void ipset_swap(struct ipset *a, struct ipset *b)
+{
+    struct ipset tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
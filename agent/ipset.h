@@ -0,0 +1,82 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename ipset.h
+ * @info     IP地址集合
+ *           开放寻址线性探测的hash表，只保存4字节IP，装载率超过一半时扩容，
+ *           用于对比zookeeper子节点列表和已知的服务器状态
+ */
+
+#ifndef _IPSET_H_
+#define _IPSET_H_
+
+#include <stdint.h>
+#include "commtype.h"
+
+#define NLB_IPSET_MIN_SIZE      (64)        /* 初始槽位数，2的幂 */
+
+struct ipset {
+    uint32_t *slots;            /* 槽位，0表示空闲 */
+    uint32_t  mask;             /* 槽位数-1 */
+    uint32_t  count;            /* IP个数 */
+};
+
+/* 遍历集合中的IP */
+#define ipset_for_each(set, i, ip) \
+    for ((i) = 0; (set)->slots && (i) <= (set)->mask; (i)++) \
+        if (((ip) = (set)->slots[(i)]) != 0)
+
+/**
+ * @brief 初始化空集合，不分配内存
+ */
+void ipset_init(struct ipset *set);
+
+/**
+ * @brief 释放集合内存
+ */
+void ipset_free(struct ipset *set);
+
+/**
+ * @brief 清空集合，保留内存
+ */
+void ipset_clear(struct ipset *set);
+
+/**
+ * @brief  检查IP是否在集合中
+ */
+BOOL ipset_has(const struct ipset *set, uint32_t ip);
+
+/**
+ * @brief  添加IP
+ * @return =0 成功 <0 内存不足
+ */
+int32_t ipset_add(struct ipset *set, uint32_t ip);
+
+/**
+ * @brief 删除IP
+ */
+void ipset_del(struct ipset *set, uint32_t ip);
+
+/**
+ * @brief 交换两个集合的内容
+ */
+void ipset_swap(struct ipset *a, struct ipset *b);
+
+#endif
@@ -24,10 +24,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "jansson.h"
 #include "commstruct.h"
 #include "comm.h"
+#include "commtype.h"
 #include "policy.h"
+#include "jsonparser.h"
+#include "svcproto.h"
 
 int32_t json_parse_server(json_t *json, struct server_info *server)
 {
@@ -95,9 +101,159 @@ int32_t json_parse_server(json_t *json, struct server_info *server)
     return 0;
 }
 
-int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
+/* 业务可选参数，按校验顺序排列 */
+enum {
+    NLB_JSON_POLICY = 0,
+    NLB_JSON_SHAPING_REQUEST_MIN,
+    NLB_JSON_SUCCESS_RATIO_BASE,
+    NLB_JSON_SUCCESS_RATIO_MIN,
+    NLB_JSON_RESUME_WEIGHT_RATIO,
+    NLB_JSON_DEAD_RETRY_RATIO,
+    NLB_JSON_WEIGHT_LOW_WATERMARK,
+    NLB_JSON_WEIGHT_LOW_RATIO,
+    NLB_JSON_WEIGHT_INCR_RATIO,
+    NLB_JSON_RETRY_BUDGET_RATIO,
+    NLB_JSON_RETRY_BUDGET_MIN,
+    NLB_JSON_RETRY_BUDGET_MAX,
+    NLB_JSON_CONC_LIMIT_MAX,
+    NLB_JSON_CONC_LIMIT_MIN,
+    NLB_JSON_CONC_LIMIT_INIT,
+    NLB_JSON_CONC_REROLL_TIMES,
+    NLB_JSON_CONC_TOLERANCE,
+    NLB_JSON_CONC_SMOOTHING,
+    NLB_JSON_SLOW_START_WINDOW,
+    NLB_JSON_SLOW_START_FLOOR,
+    NLB_JSON_SLOW_START_AGGRESSION,
+    NLB_JSON_DRAIN_WINDOW,
+    NLB_JSON_EJECT_CONSECUTIVE,
+    NLB_JSON_EJECT_BURST,
+    NLB_JSON_EJECT_BURST_WINDOW,
+    NLB_JSON_EJECT_BASE_TIME,
+    NLB_JSON_EJECT_MAX_TIME,
+    NLB_JSON_PARAM_MAX,
+};
+
+static const char *json_param_keys[NLB_JSON_PARAM_MAX] = {
+    "Policy",
+    "shaping_request_min",
+    "success_ratio_base",
+    "success_ratio_min",
+    "resume_weight_ratio",
+    "dead_retry_ratio",
+    "weight_low_watermark",
+    "weight_low_ratio",
+    "weight_incr_ratio",
+    "retry_budget_ratio",
+    "retry_budget_min",
+    "retry_budget_max",
+    "conc_limit_max",
+    "conc_limit_min",
+    "conc_limit_init",
+    "conc_reroll_times",
+    "conc_tolerance",
+    "conc_smoothing",
+    "slow_start_window",
+    "slow_start_floor",
+    "slow_start_aggression",
+    "drain_window",
+    "eject_consecutive",
+    "eject_burst",
+    "eject_burst_window",
+    "eject_base_time",
+    "eject_max_time",
+};
+
+/* 参数值类型 */
+enum {
+    NLB_JSON_VAL_NONE   = 0,    /* 不存在 */
+    NLB_JSON_VAL_INT    = 1,    /* 整数 */
+    NLB_JSON_VAL_STRING = 2,    /* 字符串 */
+    NLB_JSON_VAL_OTHER  = 3,    /* 其它类型 */
+    NLB_JSON_VAL_FLOAT  = 4,    /* 浮点数，只来自二进制配置 */
+};
+
+/* 参数值，字符串不一定以'\0'结尾 */
+struct json_value {
+    int32_t     type;
+    uint32_t    len;            /* 字符串长度 */
+    int64_t     num;            /* 整数值 */
+    float       real;           /* 浮点数 */
+    const char *str;            /* 字符串 */
+};
+
+/**
+ * @brief 拷贝字符串参数到缓冲区，超长截断
+ */
+static const char *json_value_cstr(const struct json_value *val, char *buff, uint32_t size)
 {
-    json_t *val;
+    uint32_t len = (val->len < size) ? val->len : (size - 1);
+
+    memcpy(buff, val->str, len);
+    buff[len] = '\0';
+
+    return buff;
+}
+
+/**
+ * @brief 获取无符号整数类型的参数，参数不存在时保持默认值
+ * @return <0 类型错误或超出范围 =0 成功
+ */
+static int32_t json_get_uint_param(const struct json_value *params, int32_t id, uint32_t max_value, uint32_t *value)
+{
+    const struct json_value *val = &params[id];
+
+    if (val->type == NLB_JSON_VAL_NONE) {
+        return 0;
+    }
+
+    if (val->type != NLB_JSON_VAL_INT) {
+        return -1;
+    }
+
+    if (val->num < 0 || val->num > max_value) {
+        return -2;
+    }
+
+    *value = (uint32_t)val->num;
+
+    return 0;
+}
+
+/**
+ * @brief 获取字符串格式的浮点参数
+ * @return <0 类型错误 =0 不存在 >0 成功
+ */
+static int32_t json_get_float_param(const struct json_value *params, int32_t id, float *value)
+{
+    char buff[64];
+    const struct json_value *val = &params[id];
+
+    if (val->type == NLB_JSON_VAL_NONE) {
+        return 0;
+    }
+
+    if (val->type == NLB_JSON_VAL_FLOAT) {
+        *value = val->real;
+        return 1;
+    }
+
+    if (val->type != NLB_JSON_VAL_STRING) {
+        return -1;
+    }
+
+    *value = (float)atof(json_value_cstr(val, buff, sizeof(buff)));
+
+    return 1;
+}
+
+/**
+ * @brief 校验业务可选参数，写入业务配置
+ * @return <0 失败 =0 成功
+ */
+static int32_t json_check_service_param(const struct json_value *params, struct shm_servers *shm_servers)
+{
+    int32_t ret;
+    char    buff[64];
     int32_t policy                  = NLB_POLICY_STANDARD;
     int32_t shaping_request_min     = NLB_SHAPING_REQUEST_MIN;      // 统计周期最小请求数,默认10个
     float   success_ratio_base      = NLB_SUCCESS_RATIO_BASE;       // 成功率基准，一般较高，默认98%
@@ -107,16 +263,33 @@ int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
     float   weight_low_watermark    = NLB_WEIGHT_LOW_WATERMARK;     // 低于该值，只会增加权重，给所有大于平均成功率的加权重
     float   weight_low_ratio        = NLB_WEIGHT_LOW_RATIO;         // 低权重机器总数低于该值，不降低权重，只给大于平均成功率的机器加权重
     float   weight_incr_ratio       = NLB_WEIGHT_INCR_RATIO;        // 每次增加权重的比例
+    uint32_t eject_consecutive      = NLB_EJECT_CONSECUTIVE;        // 客户端连续失败多少次立即摘除，0表示不启用
+    uint32_t eject_burst            = NLB_EJECT_BURST;              // 统计窗口内失败多少次立即摘除，0表示不启用
+    uint32_t eject_burst_window     = NLB_EJECT_BURST_WINDOW;       // 失败突发统计窗口，单位毫秒
+    uint32_t eject_base_time        = NLB_EJECT_BASE_TIME;          // 摘除基准时间，单位毫秒
+    uint32_t eject_max_time         = NLB_EJECT_MAX_TIME;           // 摘除最长时间，单位毫秒
+    float    retry_budget_ratio     = NLB_RETRY_BUDGET_RATIO;       // 每次成功调用补充的重试令牌数，0表示不限制
+    uint32_t retry_budget_min       = NLB_RETRY_BUDGET_MIN;         // 令牌不足时每秒保底重试次数
+    uint32_t retry_budget_max       = NLB_RETRY_BUDGET_MAX;         // 重试令牌桶容量
+    uint32_t conc_limit_min         = NLB_CONC_LIMIT_MIN;           // 并发上限的最小值
+    uint32_t conc_limit_max         = NLB_CONC_LIMIT_MAX;           // 并发上限的最大值，0表示不限制并发
+    uint32_t conc_limit_init        = NLB_CONC_LIMIT_INIT;          // 初始并发上限
+    uint32_t conc_reroll_times      = NLB_CONC_REROLL_TIMES;        // 并发已满时重新选择的次数
+    float    conc_tolerance         = NLB_CONC_TOLERANCE;           // 时延相对最小时延的容忍倍数
+    float    conc_smoothing         = NLB_CONC_SMOOTHING;           // 并发上限调整的平滑系数
+    uint32_t slow_start_window      = NLB_SLOW_START_WINDOW;        // 预热时间，秒，0表示不预热
+    float    slow_start_floor       = NLB_SLOW_START_FLOOR;         // 预热开始时的权重比例
+    float    slow_start_aggression  = NLB_SLOW_START_AGGRESSION;    // 预热曲线系数
+    uint32_t drain_window           = NLB_DRAIN_WINDOW;             // 排空时权重降到0的时间，秒
 
 
     /* 获取策略 */
-    val = json_object_get(json, "Policy");
-    if (val) {
-        if (!json_is_string(val)) {
+    if (params[NLB_JSON_POLICY].type != NLB_JSON_VAL_NONE) {
+        if (params[NLB_JSON_POLICY].type != NLB_JSON_VAL_STRING) {
             return -201;
         }
 
-        policy = str2policy(json_string_value(val));
+        policy = str2policy(json_value_cstr(&params[NLB_JSON_POLICY], buff, sizeof(buff)));
 
         if (policy == NLB_POLICY_UNKOWN) {
             return -201;
@@ -124,13 +297,12 @@ int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
     }
 
     /* 获取统计周期最小请求数 */
-    val = json_object_get(json, "shaping_request_min");
-    if (val) {
-        if (!json_is_integer(val)) {
+    if (params[NLB_JSON_SHAPING_REQUEST_MIN].type != NLB_JSON_VAL_NONE) {
+        if (params[NLB_JSON_SHAPING_REQUEST_MIN].type != NLB_JSON_VAL_INT) {
             return -202;
         }
 
-        shaping_request_min = (int32_t)json_integer_value(val);
+        shaping_request_min = (int32_t)params[NLB_JSON_SHAPING_REQUEST_MIN].num;
 
         if (shaping_request_min < 0) {
             return -202;
@@ -138,101 +310,133 @@ int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
     }
 
     /* 获取基准成功率 */
-    val = json_object_get(json, "success_ratio_base");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -204;
-        }
+    ret = json_get_float_param(params, NLB_JSON_SUCCESS_RATIO_BASE, &success_ratio_base);
+    if (ret < 0 || (ret > 0 && (success_ratio_base > 1.0 || success_ratio_base <= 0.00001))) {
+        return -204;
+    }
 
-        success_ratio_base = (float)atof(json_string_value(val));
+    /* 获取最小成功率 */
+    ret = json_get_float_param(params, NLB_JSON_SUCCESS_RATIO_MIN, &success_ratio_min);
+    if (ret < 0 || (ret > 0 && (success_ratio_min > success_ratio_base || success_ratio_min <= 0.00001))) {
+        return -205;
+    }
 
-        if (success_ratio_base > 1.0 || success_ratio_base <= 0.00001) {
-            return -204;
-        }
+    /* 获取死机恢复设置的权重比例 */
+    ret = json_get_float_param(params, NLB_JSON_RESUME_WEIGHT_RATIO, &resume_weight_ratio);
+    if (ret < 0 || (ret > 0 && (resume_weight_ratio > 1.0 || resume_weight_ratio <= 0.00001))) {
+        return -206;
     }
 
-    /* 获取最小成功率 */
-    val = json_object_get(json, "success_ratio_min");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -205;
-        }
+    /* 获取死机探测的请求比例 */
+    ret = json_get_float_param(params, NLB_JSON_DEAD_RETRY_RATIO, &dead_retry_ratio);
+    if (ret < 0 || (ret > 0 && (dead_retry_ratio > 1.0 || dead_retry_ratio <= 0.00001))) {
+        return -207;
+    }
 
-        success_ratio_min = (float)atof(json_string_value(val));
+    /* 获取低权重水平线 */
+    ret = json_get_float_param(params, NLB_JSON_WEIGHT_LOW_WATERMARK, &weight_low_watermark);
+    if (ret < 0 || (ret > 0 && (weight_low_watermark >= 1.0 || weight_low_watermark <= 0.00001))) {
+        return -208;
+    }
 
-        if (success_ratio_min > success_ratio_base || success_ratio_min <= 0.00001) {
-            return -205;
-        }
+    /* 获取低权重机器比率 */
+    ret = json_get_float_param(params, NLB_JSON_WEIGHT_LOW_RATIO, &weight_low_ratio);
+    if (ret < 0 || (ret > 0 && (weight_low_ratio >= 1.0 || weight_low_ratio <= 0.00001))) {
+        return -209;
     }
 
-    /* 获取死机恢复设置的权重比例 */
-    val = json_object_get(json, "resume_weight_ratio");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -206;
-        }
+    /* 获取每次增加权重的比例 */
+    ret = json_get_float_param(params, NLB_JSON_WEIGHT_INCR_RATIO, &weight_incr_ratio);
+    if (ret < 0 || (ret > 0 && (weight_incr_ratio >= 1.0 || weight_incr_ratio <= 0.00001))) {
+        return -210;
+    }
 
-        resume_weight_ratio = (float)atof(json_string_value(val));
+    /* 获取重试预算比例 */
+    ret = json_get_float_param(params, NLB_JSON_RETRY_BUDGET_RATIO, &retry_budget_ratio);
+    if (ret < 0 || (ret > 0 && (retry_budget_ratio > 1.0 || retry_budget_ratio < 0.0))) {
+        return -216;
+    }
 
-        if (resume_weight_ratio > 1.0 || resume_weight_ratio <= 0.00001) {
-            return -206;
-        }
+    if (json_get_uint_param(params, NLB_JSON_RETRY_BUDGET_MIN, UINT16_MAX, &retry_budget_min)) {
+        return -217;
     }
 
-    /* 获取死机探测的请求比例 */
-    val = json_object_get(json, "dead_retry_ratio");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -207;
-        }
+    if (json_get_uint_param(params, NLB_JSON_RETRY_BUDGET_MAX, UINT16_MAX, &retry_budget_max)
+        || !retry_budget_max) {
+        return -218;
+    }
 
-        dead_retry_ratio = (float)atof(json_string_value(val));
+    /* 获取并发限制参数 */
+    if (json_get_uint_param(params, NLB_JSON_CONC_LIMIT_MAX, UINT16_MAX, &conc_limit_max)) {
+        return -219;
+    }
 
-        if (dead_retry_ratio > 1.0 || dead_retry_ratio <= 0.00001) {
-            return -207;
-        }
+    if (json_get_uint_param(params, NLB_JSON_CONC_LIMIT_MIN, UINT16_MAX, &conc_limit_min)
+        || !conc_limit_min || (conc_limit_max && conc_limit_min > conc_limit_max)) {
+        return -220;
     }
 
-    /* 获取低权重水平线 */
-    val = json_object_get(json, "weight_low_watermark");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -208;
-        }
+    if (json_get_uint_param(params, NLB_JSON_CONC_LIMIT_INIT, UINT16_MAX, &conc_limit_init)
+        || conc_limit_init < conc_limit_min || (conc_limit_max && conc_limit_init > conc_limit_max)) {
+        return -221;
+    }
 
-        weight_low_watermark = (float)atof(json_string_value(val));
+    if (json_get_uint_param(params, NLB_JSON_CONC_REROLL_TIMES, 16, &conc_reroll_times)) {
+        return -222;
+    }
 
-        if (weight_low_watermark >= 1.0 || weight_low_watermark <= 0.00001) {
-            return -208;
-        }
+    ret = json_get_float_param(params, NLB_JSON_CONC_TOLERANCE, &conc_tolerance);
+    if (ret < 0 || (ret > 0 && conc_tolerance < 1.0)) {
+        return -223;
     }
 
-    /* 获取低权重机器比率 */
-    val = json_object_get(json, "weight_low_ratio");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -209;
-        }
+    ret = json_get_float_param(params, NLB_JSON_CONC_SMOOTHING, &conc_smoothing);
+    if (ret < 0 || (ret > 0 && (conc_smoothing > 1.0 || conc_smoothing <= 0.00001))) {
+        return -224;
+    }
 
-        weight_low_ratio = (float)atof(json_string_value(val));
+    /* 获取预热参数 */
+    if (json_get_uint_param(params, NLB_JSON_SLOW_START_WINDOW, 3600, &slow_start_window)) {
+        return -225;
+    }
 
-        if (weight_low_ratio >= 1.0 || weight_low_ratio <= 0.00001) {
-            return -209;
-        }
+    ret = json_get_float_param(params, NLB_JSON_SLOW_START_FLOOR, &slow_start_floor);
+    if (ret < 0 || (ret > 0 && (slow_start_floor > 1.0 || slow_start_floor < 0.0))) {
+        return -226;
     }
 
-    /* 获取每次增加权重的比例 */
-    val = json_object_get(json, "weight_incr_ratio");
-    if (val) {
-        if (!json_is_string(val)) {
-            return -210;
-        }
+    ret = json_get_float_param(params, NLB_JSON_SLOW_START_AGGRESSION, &slow_start_aggression);
+    if (ret < 0 || (ret > 0 && (slow_start_aggression > 100.0 || slow_start_aggression < 0.01))) {
+        return -227;
+    }
 
-        weight_incr_ratio = (float)atof(json_string_value(val));
+    /* 获取排空参数 */
+    if (json_get_uint_param(params, NLB_JSON_DRAIN_WINDOW, 3600, &drain_window)) {
+        return -228;
+    }
 
-        if (weight_incr_ratio >= 1.0 || weight_incr_ratio <= 0.00001) {
-            return -210;
-        }
+    /* 获取客户端摘除参数 */
+    if (json_get_uint_param(params, NLB_JSON_EJECT_CONSECUTIVE, 255, &eject_consecutive)) {
+        return -211;
+    }
+
+    if (json_get_uint_param(params, NLB_JSON_EJECT_BURST, 255, &eject_burst)) {
+        return -212;
+    }
+
+    if (json_get_uint_param(params, NLB_JSON_EJECT_BURST_WINDOW, UINT16_MAX, &eject_burst_window)
+        || !eject_burst_window) {
+        return -213;
+    }
+
+    if (json_get_uint_param(params, NLB_JSON_EJECT_BASE_TIME, UINT16_MAX, &eject_base_time)
+        || !eject_base_time) {
+        return -214;
+    }
+
+    if (json_get_uint_param(params, NLB_JSON_EJECT_MAX_TIME, INT32_MAX, &eject_max_time)
+        || eject_max_time < eject_base_time) {
+        return -215;
     }
 
     shm_servers->policy                 = policy;
@@ -244,30 +448,122 @@ int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
     shm_servers->weight_low_watermark   = weight_low_watermark;
     shm_servers->weight_low_ratio       = weight_low_ratio;
     shm_servers->weight_incr_ratio      = weight_incr_ratio;
+    shm_servers->eject_consecutive      = (uint16_t)eject_consecutive;
+    shm_servers->eject_burst            = (uint16_t)eject_burst;
+    shm_servers->eject_burst_window     = (uint16_t)eject_burst_window;
+    shm_servers->eject_base_time        = (uint16_t)eject_base_time;
+    shm_servers->eject_max_time         = eject_max_time;
+    shm_servers->retry_budget_ratio     = retry_budget_ratio;
+    shm_servers->retry_budget_min       = retry_budget_min;
+    shm_servers->retry_budget_max       = retry_budget_max;
+    shm_servers->conc_limit_min         = (uint16_t)conc_limit_min;
+    shm_servers->conc_limit_max         = (uint16_t)conc_limit_max;
+    shm_servers->conc_limit_init        = (uint16_t)conc_limit_init;
+    shm_servers->conc_reroll_times      = (uint16_t)conc_reroll_times;
+    shm_servers->conc_tolerance         = conc_tolerance;
+    shm_servers->conc_smoothing         = conc_smoothing;
+    shm_servers->slow_start_window      = (uint16_t)slow_start_window;
+    shm_servers->slow_start_floor       = slow_start_floor;
+    shm_servers->slow_start_aggression  = slow_start_aggression;
+    shm_servers->drain_window           = (uint16_t)drain_window;
 
     return 0;
 }
 
-int32_t json_parse_service(const char *json_buf, int32_t buf_len, struct shm_servers **svrs)
+/**
+ * @brief 从json对象获取业务可选参数
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_service_param(json_t *json, struct shm_servers *shm_servers)
+{
+    int32_t i;
+    json_t *val;
+    struct json_value params[NLB_JSON_PARAM_MAX];
+
+    memset(params, 0, sizeof(params));
+    for (i = 0; i < NLB_JSON_PARAM_MAX; i++) {
+        val = json_object_get(json, json_param_keys[i]);
+        if (NULL == val) {
+            continue;
+        }
+
+        if (json_is_integer(val)) {
+            params[i].type = NLB_JSON_VAL_INT;
+            params[i].num  = json_integer_value(val);
+        } else if (json_is_string(val)) {
+            params[i].type = NLB_JSON_VAL_STRING;
+            params[i].str  = json_string_value(val);
+            params[i].len  = (uint32_t)json_string_length(val);
+        } else {
+            params[i].type = NLB_JSON_VAL_OTHER;
+        }
+    }
+
+    return json_check_service_param(params, shm_servers);
+}
+
+/**
+ * @brief  解析IPInfo数组到服务器列表
+ * @return <0 失败 =0 成功
+ */
+static int32_t json_parse_ipinfo(json_t *aval, struct server_info *svrs, uint32_t *weight_static_total)
 {
     int32_t result;
-    int32_t len;
     size_t  index;
-    json_t *json = NULL;
-    json_t *val, *aval;
+    json_t *val;
+
+    json_array_foreach(aval, index, val)
+    {
+        if (json_typeof(val) != JSON_OBJECT) {
+            return -7;
+        }
+
+        result = json_parse_server(val, &svrs[index]);
+        if (result) {
+            return result;
+        }
+
+        *weight_static_total += svrs[index].weight_static;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  加载json字符串，兼容以'\0'结尾的节点数据
+ */
+static json_t *json_load_buff(const char *json_buf, int32_t buf_len)
+{
+    int32_t len;
     json_error_t error;
-    const char *buff = json_buf;
-    struct shm_servers *shm_svrs = NULL;
 
-    /* 确认json内容的长度 */
-    if (buff[buf_len - 1] == '\0') {
-        len = strlen(buff);
+    if (buf_len <= 0) {
+        return NULL;
+    }
+
+    if (json_buf[buf_len - 1] == '\0') {
+        len = strlen(json_buf);
     } else {
         len = buf_len;
     }
 
+    return json_loadb(json_buf, len, 0, &error);
+}
+
+/**
+ * @brief  用jansson解析业务配置
+ * @info   快速解析遇到转义字符等少见情况时使用，也作为快速解析的对比基准
+ * @return <0 失败 =0 成功
+ */
+static int32_t json_parse_service_dom(const char *json_buf, int32_t buf_len, struct shm_servers **svrs)
+{
+    int32_t result;
+    json_t *json = NULL;
+    json_t *aval;
+    struct shm_servers *shm_svrs = NULL;
+
     /* 加载json字符串到json对象 */
-    json = json_loadb(buff, len, 0, &error);
+    json = json_load_buff(json_buf, buf_len);
     if (!json) {
         result = -2;
         goto ERR_RET;
@@ -276,7 +572,7 @@ int32_t json_parse_service(const char *json_buf, int32_t buf_len, struct shm_ser
     /* 获取IPInfo json对象 */
     aval = json_object_get(json, "IPInfo");
     if (NULL == aval || !json_is_array(aval)) {
-        result = -4;
+        result = NLB_JSON_NO_IPINFO;
         goto ERR_RET;
     }
 
@@ -292,19 +588,9 @@ int32_t json_parse_service(const char *json_buf, int32_t buf_len, struct shm_ser
     }
 
     /* 循环获取所有IP信息 */
-    json_array_foreach(aval, index, val)
-    {
-        if (json_typeof(val) != JSON_OBJECT) {
-            result = -7;
-            goto ERR_RET;
-        }
-
-        result = json_parse_server(val, &shm_svrs->svrs[index]);
-        if (result) {
-            goto ERR_RET;
-        }
-
-        shm_svrs->weight_static_total += shm_svrs->svrs[index].weight_static;
+    result = json_parse_ipinfo(aval, shm_svrs->svrs, &shm_svrs->weight_static_total);
+    if (result) {
+        goto ERR_RET;
     }
 
     /* 加载业务可选配置参数 */
@@ -332,15 +618,1099 @@ ERR_RET:
     return result;
 }
 
-#if 0
-int main()
+/**
+ * @brief  解析分片业务的清单节点
+ * @info   清单格式为{"IPShards":[v0,v1,...], 业务参数...}，vN为第N个分片的版本，
+ *         分片节点为业务节点下的子节点0~N-1，格式为{"IPInfo":[...]}
+ * @param  params   --> 业务参数，不包含服务器
+ * @param  versions --> 分片版本，至少NLB_SERVICE_SHARD_MAX个
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_manifest(const char *json_buf, int32_t buf_len, struct shm_servers *params,
+                            uint64_t *versions, uint32_t *shard_num)
 {
-    int32_t ret;
-    struct shm_servers *servers;
-    char json_str[] = "{\"IPInfo\":[{\"IP\": \"1.1.1.1\", \"ports\": [1,2,3], \"t\":\"all\", \"w\":100}, {\"IP\":\"2.2.2.2\",\"ports\":[11],\"t\":\"all\", \"w\":200}]}";
-    ret = json_parse_service(json_str, sizeof(json_str), &servers);
+    int32_t result;
+    size_t  index;
+    json_t *json = NULL;
+    json_t *val, *aval;
+
+    json = json_load_buff(json_buf, buf_len);
+    if (!json) {
+        return -301;
+    }
+
+    aval = json_object_get(json, "IPShards");
+    if (NULL == aval || !json_is_array(aval)) {
+        result = -302;
+        goto ERR_RET;
+    }
+
+    if (json_array_size(aval) == 0 || json_array_size(aval) > NLB_SERVICE_SHARD_MAX) {
+        result = -303;
+        goto ERR_RET;
+    }
+
+    json_array_foreach(aval, index, val) {
+        if (!json_is_integer(val) || json_integer_value(val) < 0) {
+            result = -304;
+            goto ERR_RET;
+        }
+        versions[index] = (uint64_t)json_integer_value(val);
+    }
+
+    memset(params, 0, sizeof(*params));
+    result = json_parse_service_param(json, params);
+    if (result) {
+        goto ERR_RET;
+    }
+
+    params->version = NLB_SHM_VERSION1;
+    *shard_num      = json_array_size(aval);
+    json_decref(json);
+
+    return 0;
+
+ERR_RET:
+    json_decref(json);
+    return result;
+}
+
+/**
+ * @brief  用jansson解析分片业务的一个分片节点
+ * @info   分片可以为空，返回的服务器列表需要调用者释放
+ * @return <0 失败 =0 成功
+ */
+static int32_t json_parse_service_shard_dom(const char *json_buf, int32_t buf_len, struct server_info **svrs,
+                                            uint32_t *server_num, uint32_t *weight_static_total)
+{
+    int32_t result;
+    json_t *json = NULL;
+    json_t *aval;
+    struct server_info *servers = NULL;
+
+    json = json_load_buff(json_buf, buf_len);
+    if (!json) {
+        return -311;
+    }
+
+    aval = json_object_get(json, "IPInfo");
+    if (NULL == aval || !json_is_array(aval)) {
+        result = -312;
+        goto ERR_RET;
+    }
+
+    if (json_array_size(aval) >= NLB_SERVER_MAX) {
+        result = -313;
+        goto ERR_RET;
+    }
+
+    servers = calloc(json_array_size(aval) + 1, sizeof(struct server_info));
+    if (NULL == servers) {
+        result = -314;
+        goto ERR_RET;
+    }
+
+    *weight_static_total = 0;
+    result = json_parse_ipinfo(aval, servers, weight_static_total);
+    if (result) {
+        goto ERR_RET;
+    }
+
+    *svrs       = servers;
+    *server_num = json_array_size(aval);
+    json_decref(json);
+
+    return 0;
+
+ERR_RET:
+    json_decref(json);
+    free(servers);
+    return result;
+}
+
+/*
+ * 快速解析
+ * 按已知的业务配置格式单遍扫描json，服务器直接写入预分配的数组，不建立json对象。
+ * 空白和字符串用SSE2一次比较16字节，字符串不拷贝，只记录位置。
+ * 用到的字段含有转义字符，或者嵌套过深时，回退到jansson解析，两种方式结果一致。
+ * 不校验UTF-8编码，字符串值只用于已知的ASCII字段
+ */
+
+#define NLB_JSON_SCAN_DEPTH     (64)        /* 跳过未知字段时的最大嵌套深度 */
+#define NLB_JSON_SCAN_SYNTAX    (-2)        /* 语法错误，和json_loadb失败一致 */
+#define NLB_JSON_SCAN_FALLBACK  (1)         /* 需要回退到jansson解析 */
+
+/* 扫描状态 */
+struct json_scan {
+    const char *pos;                        /* 当前位置 */
+    const char *end;                        /* 结束位置 */
+    BOOL        fallback;                   /* 是否需要回退到jansson */
+    BOOL        ipinfo;                     /* 最后一个IPInfo是否为数组 */
+    uint32_t    server_num;                 /* IPInfo数组元素个数 */
+    int32_t     server_error;               /* 第一个错误服务器的错误码 */
+    uint32_t    weight_static_total;        /* 静态权重总和 */
+    struct server_info *svrs;               /* 预分配的服务器数组，NLB_SERVER_MAX个 */
+    struct json_value params[NLB_JSON_PARAM_MAX];
+};
+
+static struct server_info *json_scan_svrs = NULL;  /* 复用的服务器数组 */
+
+/* 字符串值附加标记: 含有转义字符 */
+#define NLB_JSON_VAL_ESCAPED    (0x100)
+
+static int32_t json_scan_value(struct json_scan *scan, struct json_value *val, int32_t depth);
+
+/**
+ * @brief 跳过空白字符
+ */
+static inline void json_scan_ws(struct json_scan *scan)
+{
+    const char *p   = scan->pos;
+    const char *end = scan->end;
+
+    /* 大部分情况下没有空白或者只有一个空格，缩进等长空白再用SIMD */
+    if (p >= end || (*p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')) {
+        return;
+    }
+
+    if (++p >= end || (*p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')) {
+        scan->pos = p;
+        return;
+    }
+
+#if defined(__SSE2__)
+    while (p + 16 <= end) {
+        __m128i  v  = _mm_loadu_si128((const __m128i *)p);
+        __m128i  ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(ws) ^ 0xFFFF;
+        if (mask) {
+            scan->pos = p + __builtin_ctz(mask);
+            return;
+        }
+        p += 16;
+    }
+#endif
+
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+    }
+
+    scan->pos = p;
+}
+
+/**
+ * @brief 查找字符串中第一个引号、反斜杠或者控制字符
+ */
+static inline const char *json_scan_string_special(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    while (p + 16 <= end) {
+        __m128i  v    = _mm_loadu_si128((const __m128i *)p);
+        __m128i  ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+        __m128i  spec = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))), ctrl);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(spec);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+
+    while (p < end && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20) {
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * @brief  扫描字符串，当前位置为开始的引号
+ * @info   只记录位置，含有转义字符时打上标记
+ * @return <0 语法错误 =0 成功
+ */
+static inline int32_t json_scan_string(struct json_scan *scan, struct json_value *val)
+{
+    int32_t     i, escaped = 0;
+    const char *start = scan->pos + 1;
+    const char *p     = start;
+    const char *end   = scan->end;
+
+    for (;;) {
+        p = json_scan_string_special(p, end);
+        if (p >= end || (uint8_t)*p < 0x20) {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+
+        if (*p == '"') {
+            break;
+        }
+
+        /* 转义字符 */
+        escaped = NLB_JSON_VAL_ESCAPED;
+        if (++p >= end) {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+
+        if (*p == 'u') {
+            if (p + 4 >= end) {
+                return NLB_JSON_SCAN_SYNTAX;
+            }
+            for (i = 1; i <= 4; i++) {
+                if (!((p[i] >= '0' && p[i] <= '9') || (p[i] >= 'a' && p[i] <= 'f') || (p[i] >= 'A' && p[i] <= 'F'))) {
+                    return NLB_JSON_SCAN_SYNTAX;
+                }
+            }
+            p += 5;
+        } else if (strchr("\"\\/bfnrt", *p) && *p) {
+            p++;
+        } else {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+    }
+
+    val->type = NLB_JSON_VAL_STRING | escaped;
+    val->str  = start;
+    val->len  = (uint32_t)(p - start);
+    scan->pos = p + 1;
+
+    return 0;
+}
+
+/**
+ * @brief  扫描数字，没有小数和指数部分的为整数
+ * @return <0 语法错误或者整数溢出 =0 成功
+ */
+static inline int32_t json_scan_number(struct json_scan *scan, struct json_value *val)
+{
+    BOOL        neg = FALSE, integer = TRUE, overflow = FALSE;
+    uint64_t    num = 0;
+    const char *p   = scan->pos;
+    const char *end = scan->end;
+
+    if (*p == '-') {
+        neg = TRUE;
+        p++;
+    }
+
+    if (p >= end || *p < '0' || *p > '9') {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (num > (UINT64_MAX - 9) / 10) {
+                overflow = TRUE;
+            } else {
+                num = num * 10 + (uint64_t)(*p - '0');
+            }
+            p++;
+        }
+    }
+
+    if (p < end && *p == '.') {
+        integer = FALSE;
+        p++;
+        if (p >= end || *p < '0' || *p > '9') {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integer = FALSE;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    scan->pos = p;
+
+    if (!integer) {
+        val->type = NLB_JSON_VAL_OTHER;
+        return 0;
+    }
+
+    /* 和jansson一致，超出long long范围为错误 */
+    if (overflow || num > (uint64_t)INT64_MAX + (neg ? 1 : 0)) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    val->type = NLB_JSON_VAL_INT;
+    val->num  = neg ? (int64_t)(0 - num) : (int64_t)num;
+
+    return 0;
+}
+
+/**
+ * @brief  扫描true/false/null
+ * @return <0 语法错误 =0 成功
+ */
+static int32_t json_scan_literal(struct json_scan *scan, const char *literal, uint32_t len)
+{
+    if ((uint32_t)(scan->end - scan->pos) < len || memcmp(scan->pos, literal, len)) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    scan->pos += len;
+
+    return 0;
+}
+
+/**
+ * @brief  扫描对象或者数组的下一个分隔符
+ * @return <0 语法错误 =0 还有元素 >0 结束
+ */
+static inline int32_t json_scan_next(struct json_scan *scan, char close)
+{
+    json_scan_ws(scan);
+    if (scan->pos >= scan->end) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    if (*scan->pos == ',') {
+        scan->pos++;
+        json_scan_ws(scan);
+        return 0;
+    }
+
+    if (*scan->pos == close) {
+        scan->pos++;
+        return 1;
+    }
+
+    return NLB_JSON_SCAN_SYNTAX;
+}
+
+/**
+ * @brief  扫描对象的键和冒号，当前位置为键的引号
+ * @return <0 语法错误 =0 成功
+ */
+static inline int32_t json_scan_key(struct json_scan *scan, struct json_value *key)
+{
+    if (scan->pos >= scan->end || *scan->pos != '"') {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    if (json_scan_string(scan, key) < 0) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    /* 转义的键无法直接比较 */
+    if (key->type & NLB_JSON_VAL_ESCAPED) {
+        scan->fallback = TRUE;
+    }
+
+    json_scan_ws(scan);
+    if (scan->pos >= scan->end || *scan->pos != ':') {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    scan->pos++;
+    json_scan_ws(scan);
+
+    return 0;
+}
+
+/* 比较键名 */
+static inline BOOL json_key_is(const struct json_value *key, const char *name, uint32_t len)
+{
+    return (key->len == len) && !memcmp(key->str, name, len);
+}
+
+/**
+ * @brief  扫描对象或者数组，不关心内容
+ * @return <0 语法错误 =0 成功
+ */
+static int32_t json_scan_container(struct json_scan *scan, int32_t depth)
+{
+    int32_t ret;
+    char    close = (*scan->pos == '{') ? '}' : ']';
+    struct json_value key, val;
+
+    if (depth >= NLB_JSON_SCAN_DEPTH) {
+        scan->fallback = TRUE;
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    scan->pos++;
+    json_scan_ws(scan);
+    if (scan->pos < scan->end && *scan->pos == close) {
+        scan->pos++;
+        return 0;
+    }
+
+    for (;;) {
+        if (close == '}' && json_scan_key(scan, &key) < 0) {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+
+        if (json_scan_value(scan, &val, depth + 1) < 0) {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+
+        ret = json_scan_next(scan, close);
+        if (ret) {
+            return (ret < 0) ? ret : 0;
+        }
+    }
+}
+
+/**
+ * @brief  扫描任意值，记录整数和字符串
+ * @return <0 语法错误 =0 成功
+ */
+static int32_t json_scan_value(struct json_scan *scan, struct json_value *val, int32_t depth)
+{
+    if (scan->pos >= scan->end) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    val->type = NLB_JSON_VAL_OTHER;
+
+    switch (*scan->pos) {
+        case '"':
+            return json_scan_string(scan, val);
+        case '{':
+        case '[':
+            return json_scan_container(scan, depth);
+        case 't':
+            return json_scan_literal(scan, "true", 4);
+        case 'f':
+            return json_scan_literal(scan, "false", 5);
+        case 'n':
+            return json_scan_literal(scan, "null", 4);
+        default:
+            return json_scan_number(scan, val);
+    }
+}
+
+/**
+ * @brief 严格的点分十进制IP解析，其它格式交给inet_aton
+ */
+static void json_scan_ip(const struct json_value *val, uint32_t *ip)
+{
+    uint32_t i, part = 0, dots = 0, digits = 0;
+    uint8_t  bytes[4];
+    char     buff[64];
+    const char *p = val->str;
+
+    for (i = 0; i < val->len; i++) {
+        if (p[i] >= '0' && p[i] <= '9') {
+            /* 以0开头的多位数inet_aton按八进制处理 */
+            if (digits && part == 0) {
+                goto SLOW_PATH;
+            }
+            part = part * 10 + (uint32_t)(p[i] - '0');
+            if (++digits > 3 || part > 255) {
+                goto SLOW_PATH;
+            }
+        } else if (p[i] == '.' && digits && dots < 3) {
+            bytes[dots++] = (uint8_t)part;
+            part   = 0;
+            digits = 0;
+        } else {
+            goto SLOW_PATH;
+        }
+    }
+
+    if (dots != 3 || !digits) {
+        goto SLOW_PATH;
+    }
+
+    bytes[3] = (uint8_t)part;
+    memcpy(ip, bytes, sizeof(bytes));
+    return;
+
+SLOW_PATH:
+    if (val->len < sizeof(buff)) {
+        inet_aton(json_value_cstr(val, buff, sizeof(buff)), (struct in_addr *)ip);
+    }
+}
+
+/**
+ * @brief  扫描一个服务器对象，字段检查顺序和json_parse_server一致
+ * @return <0 语法错误 =0 语法正确，字段错误记录在server_error
+ */
+static int32_t json_scan_server(struct json_scan *scan, struct server_info *server)
+{
+    int32_t  ret, result = 0;
+    uint32_t ports = 0;
+    BOOL     ports_array = FALSE, ports_bad = FALSE;
+    struct json_value key, val;
+    struct json_value w, t, ip;
+
+    memset(server, 0, sizeof(*server));
+    w.type = t.type = ip.type = NLB_JSON_VAL_NONE;
+
+    scan->pos++;
+    json_scan_ws(scan);
+    if (scan->pos < scan->end && *scan->pos == '}') {
+        scan->pos++;
+        goto CHECK;
+    }
+
+    for (;;) {
+        if (json_scan_key(scan, &key) < 0) {
+            return NLB_JSON_SCAN_SYNTAX;
+        }
+
+        if (json_key_is(&key, "ports", 5) && scan->pos < scan->end && *scan->pos == '[') {
+            /* 端口数组，重复的键以最后一个为准 */
+            ports_array = TRUE;
+            ports_bad   = FALSE;
+            ports       = 0;
+            memset(server->port, 0, sizeof(server->port));
+
+            scan->pos++;
+            json_scan_ws(scan);
+            if (scan->pos < scan->end && *scan->pos == ']') {
+                scan->pos++;
+            } else {
+                for (;;) {
+                    if (json_scan_value(scan, &val, 2) < 0) {
+                        return NLB_JSON_SCAN_SYNTAX;
+                    }
+
+                    if (val.type != NLB_JSON_VAL_INT) {
+                        ports_bad = TRUE;
+                    } else if (ports < NLB_PORT_MAX) {
+                        server->port[ports] = (uint16_t)val.num;
+                    }
+                    ports++;
+
+                    ret = json_scan_next(scan, ']');
+                    if (ret < 0) {
+                        return ret;
+                    } else if (ret > 0) {
+                        break;
+                    }
+                }
+            }
+        } else {
+            if (json_scan_value(scan, &val, 2) < 0) {
+                return NLB_JSON_SCAN_SYNTAX;
+            }
+
+            if (json_key_is(&key, "w", 1)) {
+                w = val;
+            } else if (json_key_is(&key, "t", 1)) {
+                t = val;
+            } else if (json_key_is(&key, "IP", 2)) {
+                ip = val;
+            } else if (json_key_is(&key, "ports", 5)) {
+                ports_array = FALSE;
+            }
+        }
+
+        ret = json_scan_next(scan, '}');
+        if (ret < 0) {
+            return ret;
+        } else if (ret > 0) {
+            break;
+        }
+    }
+
+CHECK:
+    /* 用到的字符串含有转义字符，交给jansson */
+    if ((t.type | ip.type) & NLB_JSON_VAL_ESCAPED) {
+        scan->fallback = TRUE;
+        return 0;
+    }
+
+    if (w.type != NLB_JSON_VAL_INT) {
+        result = -101;
+    } else if ((server->weight_static = (uint16_t)w.num) > NLB_WEIGHT_MAX
+               || server->weight_static < NLB_WEIGHT_MIN) {
+        result = -102;
+    } else if (t.type != NLB_JSON_VAL_STRING) {
+        result = -103;
+    } else if (json_key_is(&t, "udp", 3)) {
+        server->port_type = 1;
+    } else if (json_key_is(&t, "tcp", 3)) {
+        server->port_type = 2;
+    } else if (json_key_is(&t, "all", 3)) {
+        server->port_type = 3;
+    } else {
+        result = -104;
+    }
+
+    if (!result && ip.type != NLB_JSON_VAL_STRING) {
+        result = -105;
+    } else if (!result) {
+        json_scan_ip(&ip, &server->server_ip);
+    }
+
+    if (!result && !ports_array) {
+        result = -106;
+    } else if (!result && ports > NLB_PORT_MAX) {
+        result = -107;
+    } else if (!result && ports_bad) {
+        result = -108;
+    }
+
+    if (result) {
+        if (!scan->server_error) {
+            scan->server_error = result;
+        }
+        return 0;
+    }
+
+    server->port_num = (uint16_t)ports;
+    scan->weight_static_total += server->weight_static;
+
+    return 0;
+}
+
+/**
+ * @brief  扫描IPInfo数组，服务器写入预分配的数组
+ * @return <0 语法错误 =0 成功
+ */
+static int32_t json_scan_ipinfo(struct json_scan *scan)
+{
+    int32_t ret;
+    struct server_info dummy;
+    struct server_info *server;
+    struct json_value val;
+
+    scan->ipinfo              = TRUE;
+    scan->server_num          = 0;
+    scan->server_error        = 0;
+    scan->weight_static_total = 0;
+
+    scan->pos++;
+    json_scan_ws(scan);
+    if (scan->pos < scan->end && *scan->pos == ']') {
+        scan->pos++;
+        return 0;
+    }
+
+    for (;;) {
+        if (scan->pos < scan->end && *scan->pos == '{') {
+            /* 超过最大服务器数后只检查语法 */
+            server = (scan->server_num < NLB_SERVER_MAX) ? &scan->svrs[scan->server_num] : &dummy;
+            if (json_scan_server(scan, server) < 0) {
+                return NLB_JSON_SCAN_SYNTAX;
+            }
+        } else {
+            if (json_scan_value(scan, &val, 1) < 0) {
+                return NLB_JSON_SCAN_SYNTAX;
+            }
+            if (!scan->server_error) {
+                scan->server_error = -7;
+            }
+        }
+        scan->server_num++;
+
+        ret = json_scan_next(scan, ']');
+        if (ret) {
+            return (ret < 0) ? ret : 0;
+        }
+    }
+}
+
+/**
+ * @brief  扫描整个业务配置
+ * @return <0 语法错误 =0 成功 NLB_JSON_SCAN_FALLBACK 需要回退到jansson
+ */
+static int32_t json_scan_service(struct json_scan *scan, const char *json_buf, int32_t buf_len)
+{
+    int32_t i, ret;
+    struct json_value key, val;
+
+    if (NULL == json_scan_svrs) {
+        json_scan_svrs = (struct server_info *)malloc(sizeof(struct server_info) * NLB_SERVER_MAX);
+        if (NULL == json_scan_svrs) {
+            return NLB_JSON_SCAN_FALLBACK;
+        }
+    }
+
+    if (buf_len <= 0) {
+        return NLB_JSON_SCAN_SYNTAX;
+    }
+
+    memset(scan, 0, sizeof(*scan));
+    scan->svrs = json_scan_svrs;
+    scan->pos  = json_buf;
+    scan->end  = json_buf + ((json_buf[buf_len - 1] == '\0') ? strlen(json_buf) : (size_t)buf_len);
+
+    json_scan_ws(scan);
+    if (scan->pos >= scan->end || *scan->pos != '{') {
+        /* 非对象的合法json由jansson处理 */
+        scan->fallback = TRUE;
+        return NLB_JSON_SCAN_FALLBACK;
+    }
+
+    scan->pos++;
+    json_scan_ws(scan);
+    if (scan->pos < scan->end && *scan->pos == '}') {
+        scan->pos++;
+    } else {
+        for (;;) {
+            if (json_scan_key(scan, &key) < 0) {
+                goto SYNTAX;
+            }
+
+            if (json_key_is(&key, "IPInfo", 6)) {
+                if (scan->pos < scan->end && *scan->pos == '[') {
+                    ret = json_scan_ipinfo(scan);
+                } else {
+                    scan->ipinfo = FALSE;
+                    ret = json_scan_value(scan, &val, 1);
+                }
+            } else {
+                ret = json_scan_value(scan, &val, 1);
+                for (i = 0; i < NLB_JSON_PARAM_MAX && ret == 0; i++) {
+                    if (!strncmp(json_param_keys[i], key.str, key.len) && json_param_keys[i][key.len] == '\0') {
+                        if (val.type & NLB_JSON_VAL_ESCAPED) {
+                            scan->fallback = TRUE;
+                        }
+                        scan->params[i] = val;
+                        break;
+                    }
+                }
+            }
+
+            if (ret < 0) {
+                goto SYNTAX;
+            }
+
+            ret = json_scan_next(scan, '}');
+            if (ret < 0) {
+                goto SYNTAX;
+            } else if (ret > 0) {
+                break;
+            }
+        }
+    }
+
+    json_scan_ws(scan);
+    if (scan->pos != scan->end) {
+        goto SYNTAX;
+    }
+
+    return scan->fallback ? NLB_JSON_SCAN_FALLBACK : 0;
+
+SYNTAX:
+    return scan->fallback ? NLB_JSON_SCAN_FALLBACK : NLB_JSON_SCAN_SYNTAX;
+}
+
+/*
+ * 二进制格式
+ * 头部和校验和由svcproto校验，服务器和业务参数按json配置同样的规则校验
+ */
+
+#define BINARY_FLOAT_PARAM(id, v)   do { params[id].type = NLB_JSON_VAL_FLOAT; params[id].real = (v); } while (0)
+#define BINARY_INT_PARAM(id, v)     do { params[id].type = NLB_JSON_VAL_INT; params[id].num = (v); } while (0)
+
+/**
+ * @brief 二进制业务参数转换为参数表，之后和json配置走同样的校验
+ */
+static void binary_param_table(const struct service_proto_param *param, struct json_value *params)
+{
+    memset(params, 0, sizeof(struct json_value) * NLB_JSON_PARAM_MAX);
+
+    params[NLB_JSON_POLICY].type = NLB_JSON_VAL_STRING;
+    params[NLB_JSON_POLICY].str  = param->policy;
+    params[NLB_JSON_POLICY].len  = (uint32_t)strlen(param->policy);
+
+    BINARY_INT_PARAM(NLB_JSON_SHAPING_REQUEST_MIN, param->shaping_request_min);
+    BINARY_FLOAT_PARAM(NLB_JSON_SUCCESS_RATIO_BASE, param->success_ratio_base);
+    BINARY_FLOAT_PARAM(NLB_JSON_SUCCESS_RATIO_MIN, param->success_ratio_min);
+    BINARY_FLOAT_PARAM(NLB_JSON_RESUME_WEIGHT_RATIO, param->resume_weight_ratio);
+    BINARY_FLOAT_PARAM(NLB_JSON_DEAD_RETRY_RATIO, param->dead_retry_ratio);
+    BINARY_FLOAT_PARAM(NLB_JSON_WEIGHT_LOW_WATERMARK, param->weight_low_watermark);
+    BINARY_FLOAT_PARAM(NLB_JSON_WEIGHT_LOW_RATIO, param->weight_low_ratio);
+    BINARY_FLOAT_PARAM(NLB_JSON_WEIGHT_INCR_RATIO, param->weight_incr_ratio);
+    BINARY_FLOAT_PARAM(NLB_JSON_RETRY_BUDGET_RATIO, param->retry_budget_ratio);
+    BINARY_INT_PARAM(NLB_JSON_RETRY_BUDGET_MIN, param->retry_budget_min);
+    BINARY_INT_PARAM(NLB_JSON_RETRY_BUDGET_MAX, param->retry_budget_max);
+    BINARY_INT_PARAM(NLB_JSON_CONC_LIMIT_MAX, param->conc_limit_max);
+    BINARY_INT_PARAM(NLB_JSON_CONC_LIMIT_MIN, param->conc_limit_min);
+    BINARY_INT_PARAM(NLB_JSON_CONC_LIMIT_INIT, param->conc_limit_init);
+    BINARY_INT_PARAM(NLB_JSON_CONC_REROLL_TIMES, param->conc_reroll_times);
+    BINARY_FLOAT_PARAM(NLB_JSON_CONC_TOLERANCE, param->conc_tolerance);
+    BINARY_FLOAT_PARAM(NLB_JSON_CONC_SMOOTHING, param->conc_smoothing);
+    BINARY_INT_PARAM(NLB_JSON_SLOW_START_WINDOW, param->slow_start_window);
+    BINARY_FLOAT_PARAM(NLB_JSON_SLOW_START_FLOOR, param->slow_start_floor);
+    BINARY_FLOAT_PARAM(NLB_JSON_SLOW_START_AGGRESSION, param->slow_start_aggression);
+    BINARY_INT_PARAM(NLB_JSON_DRAIN_WINDOW, param->drain_window);
+    BINARY_INT_PARAM(NLB_JSON_EJECT_CONSECUTIVE, param->eject_consecutive);
+    BINARY_INT_PARAM(NLB_JSON_EJECT_BURST, param->eject_burst);
+    BINARY_INT_PARAM(NLB_JSON_EJECT_BURST_WINDOW, param->eject_burst_window);
+    BINARY_INT_PARAM(NLB_JSON_EJECT_BASE_TIME, param->eject_base_time);
+    BINARY_INT_PARAM(NLB_JSON_EJECT_MAX_TIME, param->eject_max_time);
+}
+
+/**
+ * @brief  校验二进制配置中的服务器，规则和json_parse_server一致
+ * @return <0 失败 =0 成功
+ */
+static int32_t binary_check_servers(const struct server_info *svrs, uint32_t server_num, uint32_t *weight_static_total)
+{
+    uint32_t i;
+
+    *weight_static_total = 0;
+    for (i = 0; i < server_num; i++) {
+        if (svrs[i].weight_static > NLB_WEIGHT_MAX || svrs[i].weight_static < NLB_WEIGHT_MIN) {
+            return -102;
+        }
+
+        if (svrs[i].port_type < 1 || svrs[i].port_type > 3) {
+            return -104;
+        }
+
+        if (svrs[i].port_num > NLB_PORT_MAX) {
+            return -107;
+        }
+
+        *weight_static_total += svrs[i].weight_static;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  解析二进制格式的业务配置
+ * @return <0 失败 =0 成功
+ */
+static int32_t binary_parse_service(const char *buff, int32_t blen, const struct service_proto_param *param,
+                                    uint32_t server_num, struct shm_servers **svrs)
+{
+    int32_t result;
+    struct json_value params[NLB_JSON_PARAM_MAX];
+    struct shm_servers *shm_svrs;
+
+    if (server_num == 0) {
+        return -5;
+    }
+
+    shm_svrs = (struct shm_servers *)malloc(sizeof(struct shm_servers) + server_num * sizeof(struct server_info));
+    if (NULL == shm_svrs) {
+        return -6;
+    }
+
+    memset(shm_svrs, 0, sizeof(struct shm_servers));
+    deserialize_service_servers(buff, shm_svrs->svrs, server_num);
+
+    result = binary_check_servers(shm_svrs->svrs, server_num, &shm_svrs->weight_static_total);
+    if (result) {
+        free(shm_svrs);
+        return result;
+    }
+
+    binary_param_table(param, params);
+    result = json_check_service_param(params, shm_svrs);
+    if (result) {
+        free(shm_svrs);
+        return result;
+    }
+
+    shm_svrs->server_num = server_num;
+    shm_svrs->version    = NLB_SHM_VERSION1;
+
+    *svrs = shm_svrs;
+
+    return 0;
+}
+
+/**
+ * @brief  解析业务配置
+ * @info   二进制格式按魔数识别；json快速解析，结果和jansson解析一致，只分配一次结果内存
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_service(const char *json_buf, int32_t buf_len, struct shm_servers **svrs)
+{
+    int32_t result;
+    uint32_t server_num;
+    struct json_scan scan;
+    struct shm_servers *shm_svrs;
+    struct service_proto_param param;
+
+    /* 按魔数识别二进制格式 */
+    result = deserialize_service_head(json_buf, buf_len, &param, &server_num);
+    if (result != -1) {
+        return (result < 0) ? (result - 400) : binary_parse_service(json_buf, buf_len, &param, server_num, svrs);
+    }
+
+    result = json_scan_service(&scan, json_buf, buf_len);
+    if (result == NLB_JSON_SCAN_FALLBACK) {
+        return json_parse_service_dom(json_buf, buf_len, svrs);
+    }
+
+    if (result < 0) {
+        return result;
+    }
+
+    if (!scan.ipinfo) {
+        return NLB_JSON_NO_IPINFO;
+    }
+
+    if (scan.server_num == 0 || scan.server_num >= NLB_SERVER_MAX) {
+        return -5;
+    }
+
+    if (scan.server_error) {
+        return scan.server_error;
+    }
+
+    shm_svrs = (struct shm_servers *)malloc(sizeof(struct shm_servers) + scan.server_num * sizeof(struct server_info));
+    if (NULL == shm_svrs) {
+        return -6;
+    }
+
+    memset(shm_svrs, 0, sizeof(struct shm_servers));
+    result = json_check_service_param(scan.params, shm_svrs);
+    if (result) {
+        free(shm_svrs);
+        return result;
+    }
+
+    memcpy(shm_svrs->svrs, scan.svrs, scan.server_num * sizeof(struct server_info));
+    shm_svrs->weight_static_total = scan.weight_static_total;
+    shm_svrs->server_num          = scan.server_num;
+    shm_svrs->version             = NLB_SHM_VERSION1;
+
+    *svrs = shm_svrs;
+
+    return 0;
+}
+
+/**
+ * @brief  解析分片业务的一个分片节点
+ * @info   快速解析，分片可以为空，返回的服务器列表需要调用者释放
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_service_shard(const char *json_buf, int32_t buf_len, struct server_info **svrs,
+                                 uint32_t *server_num, uint32_t *weight_static_total)
+{
+    int32_t result;
+    uint32_t num;
+    struct json_scan scan;
+    struct server_info *servers;
+    struct service_proto_param param;
+
+    /* 二进制格式的分片只使用服务器记录 */
+    result = deserialize_service_head(json_buf, buf_len, &param, &num);
+    if (result < -1) {
+        return result - 400;
+    } else if (result == 0) {
+        servers = (struct server_info *)malloc((num + 1) * sizeof(struct server_info));
+        if (NULL == servers) {
+            return -314;
+        }
+
+        deserialize_service_servers(json_buf, servers, num);
+        result = binary_check_servers(servers, num, weight_static_total);
+        if (result) {
+            free(servers);
+            return result;
+        }
+
+        *svrs       = servers;
+        *server_num = num;
+        return 0;
+    }
+
+    result = json_scan_service(&scan, json_buf, buf_len);
+    if (result == NLB_JSON_SCAN_FALLBACK) {
+        return json_parse_service_shard_dom(json_buf, buf_len, svrs, server_num, weight_static_total);
+    }
+
+    if (result < 0) {
+        return -311;
+    }
+
+    if (!scan.ipinfo) {
+        return -312;
+    }
+
+    if (scan.server_num >= NLB_SERVER_MAX) {
+        return -313;
+    }
+
+    if (scan.server_error) {
+        return scan.server_error;
+    }
+
+    servers = (struct server_info *)malloc((scan.server_num + 1) * sizeof(struct server_info));
+    if (NULL == servers) {
+        return -314;
+    }
+
+    memcpy(servers, scan.svrs, scan.server_num * sizeof(struct server_info));
+    *svrs                = servers;
+    *server_num          = scan.server_num;
+    *weight_static_total = scan.weight_static_total;
+
+    return 0;
+}
+
+#ifdef NLB_JSONPARSER_BENCH
+/*
+ * 快速解析和jansson解析的性能对比
+ * gcc -O2 -DNLB_JSONPARSER_BENCH -I../comm -I<jansson> jsonparser.c policy.c log.c ../comm/libcomm.a libjansson.a -lm
+ */
+#include <sys/time.h>
+
+static double bench_now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    int32_t  i, ret, loops = (argc > 2) ? atoi(argv[2]) : 50;
+    uint32_t servers = (argc > 1) ? (uint32_t)atoi(argv[1]) : 9999;
+    size_t   size = 256 + servers * 96, len;
+    char    *json = malloc(size);
+    double   start, dom_ms, scan_ms;
+    struct shm_servers *dom = NULL, *fast = NULL;
+
+    len = snprintf(json, size, "{\"Policy\": \"standard\", \"success_ratio_base\": \"0.95\", \"IPInfo\": [");
+    for (i = 0; i < (int32_t)servers; i++) {
+        len += snprintf(json + len, size - len, "%s\n  {\"IP\": \"10.%d.%d.%d\", \"ports\": [8080, 8081], \"t\": \"tcp\", \"w\": %d}",
+                        i ? "," : "", (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF, 100 + i % 900);
+    }
+    len += snprintf(json + len, size - len, "\n]}");
+
+    start = bench_now_ms();
+    for (i = 0; i < loops; i++) {
+        free(dom);
+        dom = NULL;
+        ret = json_parse_service_dom(json, len, &dom);
+    }
+    dom_ms = (bench_now_ms() - start) / loops;
+    printf("jansson: ret %d, %.3f ms\n", ret, dom_ms);
+
+    start = bench_now_ms();
+    for (i = 0; i < loops; i++) {
+        free(fast);
+        fast = NULL;
+        ret = json_parse_service(json, len, &fast);
+    }
+    scan_ms = (bench_now_ms() - start) / loops;
+    printf("scan   : ret %d, %.3f ms, %.1fx\n", ret, scan_ms, dom_ms / scan_ms);
 
-    printf("%d\n", ret);
+    printf("servers %u, bytes %zu, same result %s\n", servers, len,
+           (dom && fast && !memcmp(dom, fast, sizeof(struct shm_servers) + servers * sizeof(struct server_info)))
+           ? "yes" : "no");
 
     return 0;
 }
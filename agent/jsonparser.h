@@ -23,7 +23,26 @@
 #include <stdint.h>
 #include "commstruct.h"
 
+#define NLB_SERVICE_SHARD_MAX   (256)   /* 分片业务最大分片数 */
+#define NLB_JSON_NO_IPINFO      (-4)    /* 没有IPInfo，可能是分片业务清单 */
+
 int32_t json_parse_service(const char *json_buf, int32_t buf_len, struct shm_servers **svrs);
 
+/**
+ * @brief  解析分片业务的清单节点
+ * @info   清单格式为{"IPShards":[v0,v1,...], 业务参数...}，vN为第N个分片的版本
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_manifest(const char *json_buf, int32_t buf_len, struct shm_servers *params,
+                            uint64_t *versions, uint32_t *shard_num);
+
+/**
+ * @brief  解析分片业务的一个分片节点{"IPInfo":[...]}
+ * @info   分片可以为空，返回的服务器列表需要调用者释放
+ * @return <0 失败 =0 成功
+ */
+int32_t json_parse_service_shard(const char *json_buf, int32_t buf_len, struct server_info **svrs,
+                                 uint32_t *server_num, uint32_t *weight_static_total);
+
 #endif
 
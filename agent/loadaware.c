@@ -0,0 +1,341 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+/**
+ * @filename loadaware.c
+ * @info     负载感知权重
+ *           客户端按服务器上报的CPU、网卡和应用使用率(取最大值)计算空闲率，调整权重时以业务内
+ *           最空闲的服务器为基准，按空闲率的比例计算其它服务器的权重上限；
+ *           应用使用率为(忙碌线程数+排队数)/工作线程数，排队数增长时不等平滑直接按满负载处理
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "jansson.h"
+#include "commtype.h"
+#include "commdef.h"
+#include "hash.h"
+#include "log.h"
+#include "nlbtime.h"
+#include "utils.h"
+#include "policy.h"
+#include "loadproto.h"
+#include "loadaware.h"
+
+/* 服务器负载记录 */
+struct load_node {
+    uint32_t ip;                    /* IP地址，网络字节序，0表示空闲 */
+    uint16_t cpu;                   /* 平滑后的CPU使用率，千分比 */
+    uint16_t net;                   /* 平滑后的网卡使用率(发送接收较大值)，千分比 */
+    uint16_t app;                   /* 平滑后的应用使用率，千分比 */
+    uint16_t queue_growing;         /* 应用排队数在增长 */
+    uint32_t queue;                 /* 上次上报的应用排队数 */
+    uint32_t stale_time;            /* 记录过期时间，毫秒，按上报方的最长上报间隔计算 */
+    uint64_t update_time;           /* 本地收到上报的时间，毫秒 */
+};
+
+static uint32_t load_mod_cnt = MAX_ROW_COUNT;           /* 多阶hash阶数 */
+static uint32_t load_mods[MAX_ROW_COUNT];               /* 多阶hash模数 */
+static struct load_node load_nodes[NLB_LOAD_NODE_MAX];  /* 多阶hash数组 */
+static uint32_t load_idle_base;                         /* 当前业务最大空闲率，千分比，0表示不限制 */
+
+/**
+ * @brief 初始化负载记录
+ */
+void loadaware_init(void)
+{
+    calc_hash_mods(NLB_LOAD_NODE_MAX, &load_mod_cnt, load_mods);
+    memset(load_nodes, 0, sizeof(load_nodes));
+}
+
+/**
+ * @brief 查找服务器负载记录
+ * @param alloc 没有找到时是否分配空闲记录
+ */
+static struct load_node *find_load_node(uint32_t ip, BOOL alloc)
+{
+    uint32_t i;
+    uint32_t idx, base = 0;
+    struct load_node *empty = NULL;
+
+    for (i = 0; i < load_mod_cnt; i++) {
+        idx = ip%load_mods[i] + base;
+        if (load_nodes[idx].ip == ip) {
+            return &load_nodes[idx];
+        }
+
+        if ((NULL == empty) && (0 == load_nodes[idx].ip)) {
+            empty = &load_nodes[idx];
+        }
+
+        base += load_mods[i];
+    }
+
+    if (!alloc) {
+        return NULL;
+    }
+
+    if (NULL == empty) {
+        NLOG_ERROR("load node mhash is full, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+    }
+
+    return empty;
+}
+
+/* 指数平滑，新值占1/4，减少权重变化引起的负载振荡 */
+static uint16_t smooth_load(uint16_t old, uint32_t val)
+{
+    return (uint16_t)((old * 3 + val + 2) / 4);
+}
+
+/* 计算应用使用率，千分比，工作线程数未知时为0 */
+static uint32_t calc_app_used(const struct nlb_app_load *app)
+{
+    uint64_t used;
+
+    if ((NULL == app) || !app->workers) {
+        return 0;
+    }
+
+    used = ((uint64_t)app->busy + app->queue) * 1000 / app->workers;
+    return (uint32_t)min(used, (uint64_t)1000);
+}
+
+/**
+ * @brief 记录服务器上报的负载
+ * @info  和上次记录做指数平滑，记录时间为本地收到上报的时间
+ * @param cpu     CPU使用率，百分比
+ * @param net_snd 网卡发送使用率，千分比
+ * @param net_rcv 网卡接收使用率，千分比
+ * @param app     应用负载，没有上报时为NULL
+ * @param keepalive 上报方负载没有变化时的最长上报间隔，毫秒，0表示固定周期上报
+ */
+void loadaware_update(uint32_t ip, uint32_t cpu, uint32_t net_snd, uint32_t net_rcv,
+                      const struct nlb_app_load *app, uint32_t keepalive)
+{
+    uint64_t now = get_time_ms();
+    uint32_t net, app_used, queue;
+    struct load_node *node = find_load_node(ip, TRUE);
+
+    if (NULL == node) {
+        return;
+    }
+
+    cpu      = min(cpu * 10, (uint32_t)1000);
+    net      = min(max(net_snd, net_rcv), (uint32_t)1000);
+    app_used = calc_app_used(app);
+    queue    = app ? app->queue : 0;
+
+    /* 新记录或者过期记录直接使用上报值 */
+    if ((node->ip != ip) || (node->update_time + node->stale_time <= now)) {
+        node->ip            = ip;
+        node->cpu           = (uint16_t)cpu;
+        node->net           = (uint16_t)net;
+        node->app           = (uint16_t)app_used;
+        node->queue_growing = FALSE;
+    } else {
+        node->cpu           = smooth_load(node->cpu, cpu);
+        node->net           = smooth_load(node->net, net);
+        node->app           = smooth_load(node->app, app_used);
+        node->queue_growing = (queue > node->queue)
+                              && (queue >= max(app ? app->workers : 0, (uint32_t)NLB_LOAD_QUEUE_MIN));
+    }
+
+    /* 负载没有变化时不上报，至少容忍两个最长上报间隔 */
+    node->stale_time  = max(keepalive * 2, (uint32_t)NLB_LOAD_STALE_TIME);
+    node->queue       = queue;
+    node->update_time = now;
+
+    NLOG_DEBUG("Server (%s) load cpu [%u] net [%u] app [%u] queue [%u]",
+               inet_ntoa(*(struct in_addr *)&ip), node->cpu, node->net, node->app, queue);
+}
+
+/**
+ * @brief 删除服务器的负载记录
+ */
+void loadaware_remove(uint32_t ip)
+{
+    struct load_node *node = find_load_node(ip, FALSE);
+
+    if (node) {
+        memset(node, 0, sizeof(*node));
+    }
+}
+
+/**
+ * @brief 解析二进制格式的负载上报数据并记录
+ * @return =0 成功 -1 不是二进制格式 <-1 失败
+ */
+static int32_t loadaware_parse_binary(uint32_t ip, const char *data, int32_t len)
+{
+    int32_t ret;
+    struct load_report  report;
+    struct nlb_app_load app;
+
+    ret = deserialize_load_report(data, len, &report);
+    if (ret < 0) {
+        return ret;
+    }
+
+    app.queue    = report.app_queue;
+    app.inflight = report.app_inflight;
+    app.busy     = report.app_busy;
+    app.workers  = report.app_workers;
+    loadaware_update(ip, report.cpu, report.net_snd_ratio, report.net_rcv_ratio,
+                     (report.flags & NLB_LOAD_REPORT_APP) ? &app : NULL, report.keepalive);
+
+    return 0;
+}
+
+/**
+ * @brief 解析负载上报节点数据并记录
+ * @info  优先按二进制格式解析，兼容旧版本agent上报的json；
+ *        旧版本agent的net_snd_ratio/net_rcv_ratio是累计字节数和网卡速率之比，总是超过上限，
+ *        json上报只使用CPU和可选的应用负载，避免混合版本集群把流量从未升级的服务器上移走
+ * @return =0 成功 <0 失败
+ */
+int32_t loadaware_parse(uint32_t ip, const char *data, int32_t len)
+{
+    int32_t ret = 0;
+    json_t  *json, *cpu;
+    json_t  *queue, *inflight, *busy, *workers;
+    json_error_t error;
+    struct nlb_app_load app;
+    BOOL    has_app;
+
+    if ((NULL == data) || (len <= 0)) {
+        return -1;
+    }
+
+    ret = loadaware_parse_binary(ip, data, len);
+    if (ret == 0) {
+        return 0;
+    } else if (ret < -1) {
+        NLOG_ERROR("Parse binary load report failed, [%s] [%d]", inet_ntoa(*(struct in_addr *)&ip), ret);
+        return -4;
+    }
+
+    ret = 0;
+
+    json = json_loadb(data, (size_t)len, 0, &error);
+    if (NULL == json) {
+        NLOG_ERROR("Parse load report failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), error.text);
+        return -2;
+    }
+
+    cpu = json_object_get(json, "cpu");
+    if (!json_is_integer(cpu)) {
+        ret = -3;
+        goto ERR_RET;
+    }
+
+    /* 应用负载可选 */
+    queue    = json_object_get(json, "app_queue");
+    inflight = json_object_get(json, "app_inflight");
+    busy     = json_object_get(json, "app_busy");
+    workers  = json_object_get(json, "app_workers");
+    has_app  = json_is_integer(queue) && json_is_integer(inflight) && json_is_integer(busy) && json_is_integer(workers);
+    if (has_app) {
+        app.queue    = (uint32_t)json_integer_value(queue);
+        app.inflight = (uint32_t)json_integer_value(inflight);
+        app.busy     = (uint32_t)json_integer_value(busy);
+        app.workers  = (uint32_t)json_integer_value(workers);
+    }
+
+    loadaware_update(ip, (uint32_t)json_integer_value(cpu), 0, 0, has_app ? &app : NULL, 0);
+
+ERR_RET:
+    json_decref(json);
+    return ret;
+}
+
+/**
+ * @brief 查找服务器没有过期的负载记录，返回空闲率，千分比
+ * @return <0 没有记录或已经过期
+ */
+static int32_t get_load_idle(uint32_t ip, uint64_t now)
+{
+    uint32_t used;
+    struct load_node *node = find_load_node(ip, FALSE);
+
+    if ((NULL == node) || (node->update_time + node->stale_time <= now)) {
+        return -1;
+    }
+
+    /* 应用排队增长，按满负载处理 */
+    if (node->queue_growing) {
+        return 0;
+    }
+
+    used = max(node->cpu, node->net);
+    used = max(used, (uint32_t)node->app);
+    return 1000 - (int32_t)used;
+}
+
+/**
+ * @brief 计算业务内非死机服务器的最大空闲率，作为权重上限的基准
+ * @info  每次计算业务的权重上限前调用，非异构策略业务不限制
+ */
+void loadaware_prepare(const struct shm_servers *servers)
+{
+    uint32_t i;
+    int32_t  idle;
+    uint64_t now = get_time_ms();
+
+    load_idle_base = 0;
+    if (!check_need_loadreport(servers->policy)) {
+        return;
+    }
+
+    for (i = 0; i < servers->server_num; i++) {
+        if (servers->svrs[i].dead_time) {
+            continue;
+        }
+
+        idle = get_load_idle(servers->svrs[i].server_ip, now);
+        if (idle > (int32_t)load_idle_base) {
+            load_idle_base = (uint32_t)idle;
+        }
+    }
+}
+
+/**
+ * @brief  按负载计算服务器的权重上限
+ * @info   空闲率和业务最大空闲率之比，不低于下限；非异构策略业务、没有负载记录或记录过期时不限制
+ * @return 静态权重的千分比，1000表示不限制
+ */
+uint32_t loadaware_weight_cap(const struct shm_servers *servers, const struct server_info *server)
+{
+    int32_t idle;
+
+    if (!load_idle_base) {
+        return 1000;
+    }
+
+    idle = get_load_idle(server->server_ip, get_time_ms());
+    if (idle < 0) {
+        return 1000;
+    }
+
+    return max(min((uint32_t)idle * 1000 / load_idle_base, (uint32_t)1000), (uint32_t)NLB_LOAD_CAP_FLOOR);
+}
+
@@ -0,0 +1,82 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+/**
+ * @filename loadaware.h
+ * @info     负载感知权重
+ *           客户端监视异构策略业务服务器的/loadreport/ip负载上报节点，
+ *           对CPU、网卡和应用负载做平滑，调整权重时按服务器之间的空闲率比例计算权重上限，
+ *           不同硬件配置的服务器按实际处理能力分配请求，应用排队增长的服务器尽快降低权重
+ */
+
+#ifndef _LOADAWARE_H_
+#define _LOADAWARE_H_
+
+#include <stdint.h>
+#include "commstruct.h"
+#include "plugin.h"
+
+#define NLB_LOAD_NODE_MAX       (65536)     /* 客户端记录负载的服务器数 */
+#define NLB_LOAD_STALE_TIME     (60000)     /* 负载数据过期时间的下限，旧版本agent的3个上报周期，毫秒 */
+#define NLB_LOAD_CAP_FLOOR      (100)       /* 权重上限的下限，千分比，保证满负载服务器还有请求 */
+#define NLB_LOAD_QUEUE_MIN      (8)         /* 应用排队数增长且不小于该值和工作线程数时认为已经饱和 */
+
+/**
+ * @brief 初始化负载记录
+ */
+void loadaware_init(void);
+
+/**
+ * @brief 记录服务器上报的负载
+ * @info  和上次记录做指数平滑，记录时间为本地收到上报的时间
+ * @param cpu     CPU使用率，百分比
+ * @param net_snd 网卡发送使用率，千分比
+ * @param net_rcv 网卡接收使用率，千分比
+ * @param app     应用负载，没有上报时为NULL
+ * @param keepalive 上报方负载没有变化时的最长上报间隔，毫秒，0表示固定周期上报
+ */
+void loadaware_update(uint32_t ip, uint32_t cpu, uint32_t net_snd, uint32_t net_rcv,
+                      const struct nlb_app_load *app, uint32_t keepalive);
+
+/**
+ * @brief 删除服务器的负载记录
+ */
+void loadaware_remove(uint32_t ip);
+
+/**
+ * @brief 解析负载上报节点数据并记录
+ * @info  优先按二进制格式解析，兼容旧版本agent上报的json
+ * @return =0 成功 <0 失败
+ */
+int32_t loadaware_parse(uint32_t ip, const char *data, int32_t len);
+
+/**
+ * @brief 计算业务内非死机服务器的最大空闲率，作为权重上限的基准
+ * @info  每次计算业务的权重上限前调用，非异构策略业务不限制
+ */
+void loadaware_prepare(const struct shm_servers *servers);
+
+/**
+ * @brief  按负载计算服务器的权重上限
+ * @info   空闲率和业务最大空闲率之比，不低于下限；非异构策略业务、没有负载记录或记录过期时不限制
+ * @return 静态权重的千分比，1000表示不限制
+ */
+uint32_t loadaware_weight_cap(const struct shm_servers *servers, const struct server_info *server);
+
+#endif
+
@@ -0,0 +1,647 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename localcheck.c
+ * @info     服务端本地服务健康检查
+ *           同一时刻只有一个探测，探测socket挂在本模块的epoll fd上，该epoll fd注册到主循环；
+ *           插件探测可能阻塞，在独立线程中调用，结果通过管道通知主循环，超时同样按失败处理；
+ *           连续失败达到阈值时立即删除心跳节点，连续成功达到阈值时创建心跳节点
+ */
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "log.h"
+#include "nlbtime.h"
+#include "utils.h"
+#include "config.h"
+#include "networking.h"
+#include "zkheartbeat.h"
+#include "plugin.h"
+#include "localcheck.h"
+
+#define NLB_LC_UDP_PAYLOAD      "nlb local check"
+#define NLB_LC_PATH_LEN         (256)
+#define NLB_LC_REQUEST_LEN      (512)
+#define NLB_LC_RESPONSE_LEN     (16)        /* 只需要HTTP状态行的前12个字节 */
+
+/* 探测方式 */
+enum {
+    NLB_LC_OFF    = 0,
+    NLB_LC_TCP    = 1,
+    NLB_LC_UDP    = 2,
+    NLB_LC_HTTP   = 3,
+    NLB_LC_PLUGIN = 4,
+};
+
+/* 本地健康检查管理数据 */
+struct lc_mng {
+    int32_t  method;
+    uint16_t port;                  /* 探测端口，本机字节序 */
+    char     path[NLB_LC_PATH_LEN]; /* HTTP探测路径 */
+    uint32_t interval;
+    uint32_t timeout;
+    uint32_t rise;
+    uint32_t fall;
+
+    int32_t  epfd;
+    int32_t  fd;                    /* 探测中的fd，-1表示没有探测 */
+    BOOL     sent;                  /* HTTP请求已经发送 */
+    int32_t  recv_len;              /* HTTP已经收到的回复长度 */
+    char     response[NLB_LC_RESPONSE_LEN];
+    uint64_t start_time;            /* 本次探测开始时间 */
+    uint64_t next_time;             /* 下次探测时间 */
+
+    uint32_t successes;             /* 连续成功次数 */
+    uint32_t failures;              /* 连续失败次数 */
+    BOOL     healthy;
+
+    nlb_local_check_func local_check;
+    int32_t  req_pipe[2];           /* 插件探测请求管道，探测线程读 */
+    int32_t  rsp_pipe[2];           /* 插件探测结果管道，读端挂在epoll fd上 */
+    uint32_t plugin_seq;            /* 插件探测序号 */
+    BOOL     plugin_wait;           /* 等待本次插件探测结果 */
+    BOOL     plugin_busy;           /* 插件调用还没有返回 */
+};
+
+/* 插件探测结果 */
+struct lc_plugin_result {
+    uint32_t seq;
+    int32_t  ret;
+};
+
+static struct lc_mng lc = {
+    .method   = NLB_LC_OFF,
+    .epfd     = -1,
+    .fd       = -1,
+    .healthy  = TRUE,
+    .req_pipe = {-1, -1},
+    .rsp_pipe = {-1, -1},
+};
+
+/**
+ * @brief 健康状态变化，立即更新心跳节点
+ */
+static void set_healthy(BOOL healthy)
+{
+    if (lc.healthy == healthy) {
+        return;
+    }
+
+    lc.healthy = healthy;
+    if (healthy) {
+        NLOG_INFO("local service healthy, create heartbeat node");
+        create_heartbeat_node(get_local_ip());
+    } else {
+        NLOG_ERROR("local service unhealthy, delete heartbeat node");
+        delete_heartbeat_node(get_local_ip());
+    }
+}
+
+/**
+ * @brief 结束一次探测，按连续成功和失败次数更新健康状态
+ */
+static void finish_probe(BOOL ok)
+{
+    if (lc.fd >= 0) {
+        epoll_ctl(lc.epfd, EPOLL_CTL_DEL, lc.fd, NULL);
+        close(lc.fd);
+        lc.fd = -1;
+    }
+
+    lc.plugin_wait = FALSE;
+    lc.next_time   = lc.start_time + lc.interval;
+
+    if (ok) {
+        lc.failures = 0;
+        if (++lc.successes >= lc.rise) {
+            set_healthy(TRUE);
+        }
+        return;
+    }
+
+    lc.successes = 0;
+    if (++lc.failures >= lc.fall) {
+        set_healthy(FALSE);
+    }
+}
+
+/**
+ * @brief 创建探测socket并连接本机端口
+ * @return >=0 fd <0 失败
+ */
+static int32_t create_probe_socket(uint32_t *events)
+{
+    int32_t fd, ret;
+    struct sockaddr_in addr;
+    int32_t type = (lc.method == NLB_LC_UDP) ? SOCK_DGRAM : SOCK_STREAM;
+
+    fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        NLOG_ERROR("create local check socket failed, [%m]");
+        return -1;
+    }
+
+    make_inet_addr("127.0.0.1", lc.port, &addr);
+    ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -2;
+    }
+
+    if (type == SOCK_STREAM) {
+        *events = EPOLLOUT;
+        return fd;
+    }
+
+    /* UDP回显探测，需要服务回包 */
+    if (send(fd, NLB_LC_UDP_PAYLOAD, sizeof(NLB_LC_UDP_PAYLOAD) - 1, 0) < 0) {
+        close(fd);
+        return -3;
+    }
+
+    *events = EPOLLIN;
+    return fd;
+}
+
+/**
+ * @brief 插件探测线程
+ * @info  收到探测序号后调用插件，结果连同序号写回主循环，请求管道关闭后退出
+ */
+static void *plugin_probe_worker(void *arg)
+{
+    int32_t  req_fd = lc.req_pipe[0];
+    int32_t  rsp_fd = lc.rsp_pipe[1];
+    ssize_t  len;
+    struct lc_plugin_result result;
+
+    for (;;) {
+        len = read(req_fd, &result.seq, sizeof(result.seq));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len != sizeof(result.seq)) {
+            break;
+        }
+
+        result.ret = lc.local_check();
+        if (write(rsp_fd, &result, sizeof(result)) != sizeof(result)) {
+            break;
+        }
+    }
+
+    close(req_fd);
+    close(rsp_fd);
+    return NULL;
+}
+
+/**
+ * @brief 创建插件探测管道和线程
+ * @return =0 成功 <0 失败
+ */
+static int32_t start_plugin_worker(void)
+{
+    pthread_t tid;
+    pthread_attr_t attr;
+    struct epoll_event ev;
+
+    if (pipe2(lc.req_pipe, O_CLOEXEC) < 0 || pipe2(lc.rsp_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        NLOG_ERROR("Create local check pipe failed, [%m]");
+        return -1;
+    }
+
+    ev.data.fd = lc.rsp_pipe[0];
+    ev.events  = EPOLLIN;
+    if (epoll_ctl(lc.epfd, EPOLL_CTL_ADD, lc.rsp_pipe[0], &ev) < 0) {
+        NLOG_ERROR("epoll_ctl_add local check pipe failed, [%m]");
+        return -2;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, plugin_probe_worker, NULL) != 0) {
+        pthread_attr_destroy(&attr);
+        NLOG_ERROR("Create local check thread failed");
+        return -3;
+    }
+
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/* 关闭插件探测管道，探测线程读到请求管道关闭后退出并关闭另一端 */
+static void stop_plugin_worker(BOOL started)
+{
+    int32_t i;
+
+    for (i = 0; i < 2; i++) {
+        if (lc.req_pipe[i] >= 0 && (!started || i == 1)) {
+            close(lc.req_pipe[i]);
+        }
+
+        if (lc.rsp_pipe[i] >= 0 && (!started || i == 0)) {
+            close(lc.rsp_pipe[i]);
+        }
+
+        lc.req_pipe[i] = -1;
+        lc.rsp_pipe[i] = -1;
+    }
+}
+
+/**
+ * @brief 处理插件探测结果
+ * @info  超时后返回的旧结果只清除调用中标记
+ */
+static void process_plugin_result(void)
+{
+    struct lc_plugin_result result;
+
+    while (read(lc.rsp_pipe[0], &result, sizeof(result)) == sizeof(result)) {
+        lc.plugin_busy = FALSE;
+        if (lc.plugin_wait && result.seq == lc.plugin_seq) {
+            finish_probe(result.ret == 0);
+        }
+    }
+}
+
+/**
+ * @brief 发起插件探测
+ * @info  上次插件调用还没有返回时直接按失败处理，插件挂死期间每次探测都失败
+ */
+static void start_plugin_probe(void)
+{
+    if (lc.plugin_busy) {
+        finish_probe(FALSE);
+        return;
+    }
+
+    lc.plugin_seq++;
+    if (write(lc.req_pipe[1], &lc.plugin_seq, sizeof(lc.plugin_seq)) != sizeof(lc.plugin_seq)) {
+        NLOG_ERROR("send local check request failed, [%m]");
+        finish_probe(FALSE);
+        return;
+    }
+
+    lc.plugin_busy = TRUE;
+    lc.plugin_wait = TRUE;
+}
+
+/**
+ * @brief 发起一次探测
+ * @info  插件探测交给探测线程异步调用
+ */
+static void start_probe(void)
+{
+    int32_t  fd;
+    uint32_t events = 0;
+    struct epoll_event ev;
+
+    lc.start_time = get_time_ms();
+
+    if (lc.method == NLB_LC_PLUGIN) {
+        start_plugin_probe();
+        return;
+    }
+
+    fd = create_probe_socket(&events);
+    if (fd < 0) {
+        finish_probe(FALSE);
+        return;
+    }
+
+    ev.data.fd = fd;
+    ev.events  = events;
+    if (epoll_ctl(lc.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        NLOG_ERROR("epoll_ctl_add local check fd failed, [%m]");
+        close(fd);
+        finish_probe(FALSE);
+        return;
+    }
+
+    lc.fd       = fd;
+    lc.sent     = FALSE;
+    lc.recv_len = 0;
+}
+
+/**
+ * @brief 处理HTTP探测
+ * @info  连接成功后发送GET请求，收到状态行后判断是否为2xx
+ * @return >0 继续等待 =0 成功 <0 失败
+ */
+static int32_t check_http_probe(uint32_t events)
+{
+    int32_t ret, len;
+    char    request[NLB_LC_REQUEST_LEN];
+    struct epoll_event ev;
+
+    if (!lc.sent) {
+        if (!(events & EPOLLOUT)) {
+            return 1;
+        }
+
+        len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: 127.0.0.1\r\n"
+                       "User-Agent: nlb-agent\r\n\r\n", lc.path);
+        if (send(lc.fd, request, len, MSG_NOSIGNAL) != len) {
+            return -1;
+        }
+
+        ev.data.fd = lc.fd;
+        ev.events  = EPOLLIN;
+        if (epoll_ctl(lc.epfd, EPOLL_CTL_MOD, lc.fd, &ev) < 0) {
+            return -2;
+        }
+
+        lc.sent = TRUE;
+        return 1;
+    }
+
+    ret = recv(lc.fd, lc.response + lc.recv_len, sizeof(lc.response) - 1 - lc.recv_len, 0);
+    if (ret < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 1 : -3;
+    }
+
+    lc.recv_len += ret;
+    lc.response[lc.recv_len] = '\0';
+
+    /* 状态行 "HTTP/1.x 200" */
+    if (lc.recv_len < 12) {
+        return ret ? 1 : -4;
+    }
+
+    if (strncmp(lc.response, "HTTP/1.", 7) || lc.response[9] != '2') {
+        return -5;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 检查探测结果
+ * @return >0 继续等待 =0 成功 <0 失败
+ */
+static int32_t check_probe(uint32_t events)
+{
+    int32_t   err = 0;
+    socklen_t len = sizeof(err);
+    char      buff[64];
+
+    if (events & EPOLLERR) {
+        return -1;
+    }
+
+    if (lc.method == NLB_LC_UDP) {
+        if (recv(lc.fd, buff, sizeof(buff), 0) >= 0) {
+            return 0;
+        }
+        return (errno == EAGAIN || errno == EINTR) ? 1 : -2;
+    }
+
+    if (!lc.sent && (getsockopt(lc.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)) {
+        return -3;
+    }
+
+    if (lc.method == NLB_LC_TCP) {
+        return 0;
+    }
+
+    return check_http_probe(events);
+}
+
+/**
+ * @brief 本地健康检查epoll fd就绪处理，由主循环回调
+ */
+static void localcheck_process(int32_t fd, uint32_t nlb_events)
+{
+    int32_t ret;
+    struct epoll_event ev;
+
+    if (epoll_wait(lc.epfd, &ev, 1, 0) != 1) {
+        return;
+    }
+
+    if (lc.method == NLB_LC_PLUGIN && ev.data.fd == lc.rsp_pipe[0]) {
+        process_plugin_result();
+        return;
+    }
+
+    if (lc.fd < 0) {
+        return;
+    }
+
+    ret = check_probe(ev.events);
+    if (ret > 0) {
+        return;
+    }
+
+    finish_probe(ret == 0);
+}
+
+/**
+ * @brief 解析探测方式
+ * @return =0 成功 <0 失败
+ */
+static int32_t parse_method(const char *method)
+{
+    char *end = NULL;
+    long  port;
+
+    if (!strcmp(method, "off")) {
+        lc.method = NLB_LC_OFF;
+        return 0;
+    }
+
+    if (!strcmp(method, "plugin")) {
+        lc.method = NLB_LC_PLUGIN;
+        return 0;
+    }
+
+    if (!strncmp(method, "tcp:", 4)) {
+        lc.method = NLB_LC_TCP;
+        method += 4;
+    } else if (!strncmp(method, "udp:", 4)) {
+        lc.method = NLB_LC_UDP;
+        method += 4;
+    } else if (!strncmp(method, "http:", 5)) {
+        lc.method = NLB_LC_HTTP;
+        method += 5;
+    } else {
+        return -1;
+    }
+
+    port = strtol(method, &end, 10);
+    if (end == method || port <= 0 || port > 65535) {
+        return -2;
+    }
+    lc.port = (uint16_t)port;
+
+    if (*end == '\0' || lc.method != NLB_LC_HTTP) {
+        snprintf(lc.path, sizeof(lc.path), "/");
+        return (*end == '\0') ? 0 : -3;
+    }
+
+    if (*end != '/' || strlen(end) >= sizeof(lc.path) || strpbrk(end, " \r\n")) {
+        return -4;
+    }
+
+    snprintf(lc.path, sizeof(lc.path), "%s", end);
+    return 0;
+}
+
+/**
+ * @brief  初始化本地健康检查
+ * @return =0 成功 <0 失败
+ */
+int32_t localcheck_init(const char *method, uint32_t interval, uint32_t timeout, uint32_t rise, uint32_t fall)
+{
+    int32_t ret;
+
+    lc.interval = max(interval, (uint32_t)1);
+    lc.timeout  = timeout;
+    lc.rise     = max(rise, (uint32_t)1);
+    lc.fall     = max(fall, (uint32_t)1);
+    lc.healthy  = TRUE;
+
+    if (NULL == method || parse_method(method) < 0) {
+        NLOG_ERROR("Invalid local check method (%s)", method ? method : "null");
+        lc.method = NLB_LC_OFF;
+        return -1;
+    }
+
+    if (lc.method == NLB_LC_OFF) {
+        return 0;
+    }
+
+    if (lc.method == NLB_LC_PLUGIN) {
+        ret = plugin_load(get_nlb_plugin());
+        if (ret < 0) {
+            ret = -2;
+            goto ERR_RET;
+        }
+
+        lc.local_check = (nlb_local_check_func)plugin_symbol(NLB_LOCAL_CHECK_SYMBOL);
+        if (NULL == lc.local_check) {
+            NLOG_ERROR("Plugin (%s) has no %s symbol", get_nlb_plugin(), NLB_LOCAL_CHECK_SYMBOL);
+            ret = -3;
+            goto ERR_RET;
+        }
+    }
+
+    lc.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (lc.epfd < 0) {
+        NLOG_ERROR("Create local check epoll failed, [%m]");
+        ret = -4;
+        goto ERR_RET;
+    }
+
+    if (lc.method == NLB_LC_PLUGIN && start_plugin_worker() < 0) {
+        ret = -6;
+        goto ERR_RET;
+    }
+
+    ret = network_add_fd(lc.epfd, localcheck_process);
+    if (ret < 0) {
+        NLOG_ERROR("Register local check epoll failed, ret [%d]", ret);
+        ret = -5;
+        goto ERR_RET;
+    }
+
+    /* 检查通过之前不创建心跳节点 */
+    lc.healthy = FALSE;
+    return 0;
+
+ERR_RET:
+    /* 探测线程已经启动时由线程关闭它持有的管道端 */
+    stop_plugin_worker(lc.method == NLB_LC_PLUGIN && ret == -5);
+
+    if (lc.epfd >= 0) {
+        close(lc.epfd);
+        lc.epfd = -1;
+    }
+
+    lc.method = NLB_LC_OFF;
+    return ret;
+}
+
+/**
+ * @brief 本地健康检查调度，主循环中调用
+ * @info  处理超时的探测，发起到期的探测
+ */
+void localcheck_run(void)
+{
+    uint64_t now;
+
+    if (lc.method == NLB_LC_OFF) {
+        return;
+    }
+
+    now = get_time_ms();
+    if (lc.fd >= 0 || lc.plugin_wait) {
+        if (now >= lc.start_time + lc.timeout) {
+            finish_probe(FALSE);
+        }
+        return;
+    }
+
+    if (now >= lc.next_time) {
+        start_probe();
+    }
+}
+
+/**
+ * @brief 检查本地服务是否健康
+ */
+BOOL localcheck_healthy(void)
+{
+    return lc.healthy;
+}
+
+/**
+ * @brief 关闭本地健康检查
+ */
+void localcheck_close(void)
+{
+    if (lc.fd >= 0) {
+        close(lc.fd);
+        lc.fd = -1;
+    }
+
+    if (lc.method == NLB_LC_PLUGIN) {
+        stop_plugin_worker(TRUE);
+    }
+
+    if (lc.epfd >= 0) {
+        network_del_fd(lc.epfd);
+        close(lc.epfd);
+        lc.epfd = -1;
+    }
+
+    lc.method = NLB_LC_OFF;
+}
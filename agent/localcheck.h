@@ -0,0 +1,65 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename localcheck.h
+ * @info     服务端本地服务健康检查
+ *           服务端agent高频探测本机服务，只有健康时才创建心跳节点，
+ *           不健康时立即删除心跳节点，客户端不再把请求分配给假死的服务
+ */
+
+#ifndef _LOCALCHECK_H_
+#define _LOCALCHECK_H_
+
+#include <stdint.h>
+#include "commtype.h"
+
+#define NLB_LC_DEFAULT_INTERVAL     (200)   /* 默认探测间隔，毫秒 */
+#define NLB_LC_DEFAULT_TIMEOUT      (100)   /* 默认探测超时，毫秒 */
+#define NLB_LC_DEFAULT_RISE         (2)     /* 默认连续成功次数，达到后认为健康 */
+#define NLB_LC_DEFAULT_FALL         (1)     /* 默认连续失败次数，达到后认为不健康 */
+
+/**
+ * @brief  初始化本地健康检查
+ * @info   method: off 不检查，总是健康
+ *                 tcp:端口 TCP连接成功为健康
+ *                 udp:端口 发送探测包收到回复为健康
+ *                 http:端口[/路径] HTTP GET返回2xx为健康，默认路径为/
+ *                 plugin 在探测线程中调用-p插件的nlb_local_check函数
+ *         开启检查后初始为不健康，连续成功后才创建心跳节点
+ * @return =0 成功 <0 失败
+ */
+int32_t localcheck_init(const char *method, uint32_t interval, uint32_t timeout, uint32_t rise, uint32_t fall);
+
+/**
+ * @brief 本地健康检查调度，主循环中调用
+ */
+void localcheck_run(void);
+
+/**
+ * @brief 检查本地服务是否健康
+ */
+BOOL localcheck_healthy(void);
+
+/**
+ * @brief 关闭本地健康检查
+ */
+void localcheck_close(void);
+
+#endif
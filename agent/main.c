@@ -39,6 +39,12 @@ static void sig_quit(int sig)
     set_quit();
 }
 
+static void sig_drain(int sig)
+{
+    NLOG_DEBUG("recevice drain signal...");
+    set_drain(TRUE);
+}
+
 /* agent进程单例检查 */
 static BOOL singleton_check(void)
 {
@@ -83,6 +89,9 @@ static void daemon_init()
     /* 注册退出信号 */
     signal(SIGUSR1, sig_quit);
 
+    /* 注册排空信号，服务下线前通知客户端停止分配请求 */
+    signal(SIGUSR2, sig_drain);
+
     /* 后台运行 */
     // daemon(1, 1);
 }
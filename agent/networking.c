@@ -43,6 +43,13 @@
 #include "routeprocess.h"
 
 #define EVENT_NUM 64
+#define NLB_NET_HANDLER_MAX 8   /* 主循环最多注册的fd数 */
+
+/* 注册到主循环的fd */
+struct net_handler {
+    int32_t fd;
+    network_handler handler;
+};
 
 /* 网络管理数据结构 */
 struct netmng {
@@ -53,6 +60,9 @@ struct netmng {
     int ev_ready;
     int evlist_size;
     struct epoll_event *evlist;
+
+    int32_t handler_num;
+    struct net_handler handlers[NLB_NET_HANDLER_MAX];
 };
 
 static struct netmng net_mng = {
@@ -61,7 +71,8 @@ static struct netmng net_mng = {
     .epfd = 0,
     .ev_ready = 0,
     .evlist_size = 0,
-    .evlist = NULL
+    .evlist = NULL,
+    .handler_num = 0,
 };
 
 /* 获取agent监听套接字 */
@@ -175,6 +186,8 @@ FAILED:
  */
 void network_close(void)
 {
+    net_mng.handler_num = 0;
+
     if (net_mng.listen_fd > 0) {
         close(net_mng.listen_fd);
         net_mng.listen_fd = -1;
@@ -281,6 +294,70 @@ int32_t network_poll(void)
     return 0;
 }
 
+/**
+ * @brief  注册fd到主循环，可读时调用处理函数
+ * @return =0 成功 <0 失败
+ */
+int32_t network_add_fd(int32_t fd, network_handler handler)
+{
+    struct epoll_event ev;
+
+    if (fd < 0 || NULL == handler) {
+        return -1;
+    }
+
+    if (net_mng.handler_num >= NLB_NET_HANDLER_MAX) {
+        NLOG_ERROR("Too many network handlers");
+        return -2;
+    }
+
+    ev.data.fd = (int)fd;
+    ev.events  = EPOLLIN;
+    if (epoll_ctl(net_mng.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        NLOG_ERROR("epoll_ctl_add failed with: %m");
+        return -3;
+    }
+
+    net_mng.handlers[net_mng.handler_num].fd      = fd;
+    net_mng.handlers[net_mng.handler_num].handler = handler;
+    net_mng.handler_num++;
+
+    return 0;
+}
+
+/**
+ * @brief  从主循环删除注册的fd
+ */
+void network_del_fd(int32_t fd)
+{
+    int32_t i;
+    struct epoll_event ev;
+
+    for (i = 0; i < net_mng.handler_num; i++) {
+        if (net_mng.handlers[i].fd != fd) {
+            continue;
+        }
+
+        epoll_ctl(net_mng.epfd, EPOLL_CTL_DEL, fd, &ev);
+        net_mng.handlers[i] = net_mng.handlers[--net_mng.handler_num];
+        return;
+    }
+}
+
+/* 查找注册的fd处理函数 */
+static network_handler find_handler(int32_t fd)
+{
+    int32_t i;
+
+    for (i = 0; i < net_mng.handler_num; i++) {
+        if (net_mng.handlers[i].fd == fd) {
+            return net_mng.handlers[i].handler;
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * @brief 网络事件处理主函数
  */
@@ -289,6 +366,7 @@ int32_t network_process(void)
     uint32_t nlb_events = 0;
     int32_t listen_fd = net_mng.listen_fd;
     struct epoll_event *evlist = net_mng.evlist;
+    network_handler handler;
 
     /* Go over file descriptors that are ready */
     for (int32_t i = 0; i < net_mng.ev_ready; i++) {
@@ -301,7 +379,10 @@ int32_t network_process(void)
                 nlb_events |= NLB_POLLOUT;
             }
 
-            if (evlist[i].data.fd != listen_fd) {
+            handler = find_handler(evlist[i].data.fd);
+            if (handler) {
+                handler(evlist[i].data.fd, nlb_events);
+            } else if (evlist[i].data.fd != listen_fd) {
                 nlb_zk_process(nlb_events);
             } else {
                 process_route_request(evlist[i].data.fd);
@@ -25,6 +25,9 @@
 #define NLB_POLLIN   (1<<0)
 #define NLB_POLLOUT  (1<<1)
 
+/* 注册到主循环的fd事件处理函数，nlb_events为NLB_POLLIN/NLB_POLLOUT */
+typedef void (*network_handler)(int32_t fd, uint32_t nlb_events);
+
 /* 获取agent监听套接字 */
 int32_t get_listen_fd(void);
 
@@ -51,5 +54,17 @@ int32_t network_poll(void);
  */
 int32_t network_process(void);
 
+/**
+ * @brief  注册fd到主循环，可读时调用处理函数
+ * @info   用于健康检查等模块把自己的epoll fd挂到主循环上
+ * @return =0 成功 <0 失败
+ */
+int32_t network_add_fd(int32_t fd, network_handler handler);
+
+/**
+ * @brief  从主循环删除注册的fd
+ */
+void network_del_fd(int32_t fd);
+
 #endif
 
@@ -0,0 +1,93 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename plugin.c
+ * @info     agent业务插件加载
+ */
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "log.h"
+#include "plugin.h"
+
+static void *plugin_handle = NULL;      /* 插件动态库句柄 */
+
+/**
+ * @brief  加载业务插件，重复调用只加载一次
+ * @return =0 成功 <0 失败
+ */
+int32_t plugin_load(const char *path)
+{
+    uint32_t version;
+    nlb_plugin_abi_func abi_version;
+
+    if (plugin_handle) {
+        return 0;
+    }
+
+    if (NULL == path) {
+        NLOG_ERROR("No plugin configured");
+        return -1;
+    }
+
+    plugin_handle = dlopen(path, RTLD_NOW);
+    if (NULL == plugin_handle) {
+        NLOG_WARN("Load plugin (%s) failed, [%s]", path, dlerror());
+        return -2;
+    }
+
+    /* 检查插件ABI版本，没有导出版本的插件按版本1处理 */
+    abi_version = (nlb_plugin_abi_func)dlsym(plugin_handle, NLB_PLUGIN_ABI_SYMBOL);
+    version     = abi_version ? abi_version() : 1;
+    if (version != NLB_PLUGIN_ABI_VERSION) {
+        NLOG_ERROR("Plugin (%s) abi version [%u] mismatch, expect [%u]", path, version, NLB_PLUGIN_ABI_VERSION);
+        dlclose(plugin_handle);
+        plugin_handle = NULL;
+        return -3;
+    }
+
+    NLOG_INFO("Load plugin (%s) success, abi version [%u]", path, version);
+    return 0;
+}
+
+/**
+ * @brief  获取插件导出符号
+ * @return NULL 插件没有加载或者没有该符号
+ */
+void *plugin_symbol(const char *name)
+{
+    if (NULL == plugin_handle) {
+        return NULL;
+    }
+
+    return dlsym(plugin_handle, name);
+}
+
+/**
+ * @brief 卸载业务插件
+ */
+void plugin_close(void)
+{
+    if (plugin_handle) {
+        dlclose(plugin_handle);
+        plugin_handle = NULL;
+    }
+}
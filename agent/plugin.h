@@ -0,0 +1,83 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename plugin.h
+ * @info     agent业务插件
+ *           插件为业务提供的动态库(-p参数)，agent按需加载，通过导出符号调用业务实现；
+ *           插件导出的函数都在agent主循环中调用，不能阻塞，所有符号都是可选的
+ */
+
+#ifndef _PLUGIN_H_
+#define _PLUGIN_H_
+
+#include <stdint.h>
+
+/**
+ * @brief  插件ABI版本
+ * @info   插件可以导出nlb_plugin_abi_version返回编译时的NLB_PLUGIN_ABI_VERSION，
+ *         版本不一致时agent拒绝加载；没有导出时按版本1处理
+ */
+#define NLB_PLUGIN_ABI_VERSION      (1)
+typedef uint32_t (*nlb_plugin_abi_func)(void);
+#define NLB_PLUGIN_ABI_SYMBOL "nlb_plugin_abi_version"
+
+/* 应用负载，所有字段为本机服务的汇总值 */
+struct nlb_app_load {
+    uint32_t queue;             /* 排队等待处理的请求数 */
+    uint32_t inflight;          /* 处理中的请求数 */
+    uint32_t busy;              /* 忙碌的工作线程数 */
+    uint32_t workers;           /* 工作线程总数，0表示未知 */
+};
+
+/**
+ * @brief  获取应用负载
+ * @info   服务端agent负载上报时调用，和业务进程通过API写入的负载累加
+ * @return 0 成功 非0 没有负载数据
+ */
+typedef int32_t (*nlb_app_load_func)(struct nlb_app_load *load);
+#define NLB_APP_LOAD_SYMBOL "nlb_app_load"
+
+/**
+ * @brief  本地服务健康检查
+ * @info   服务端agent按本地健康检查间隔在独立的探测线程中调用，同一时刻只有一个调用；
+ *         超过本地健康检查超时没有返回按失败处理，返回前的后续探测都按失败处理
+ * @return 0 健康 非0 不健康
+ */
+typedef int32_t (*nlb_local_check_func)(void);
+#define NLB_LOCAL_CHECK_SYMBOL "nlb_local_check"
+
+/**
+ * @brief  加载业务插件，重复调用只加载一次
+ * @return =0 成功 <0 失败
+ */
+int32_t plugin_load(const char *path);
+
+/**
+ * @brief  获取插件导出符号
+ * @return NULL 插件没有加载或者没有该符号
+ */
+void *plugin_symbol(const char *name);
+
+/**
+ * @brief 卸载业务插件
+ */
+void plugin_close(void);
+
+#endif
@@ -83,5 +83,9 @@ BOOL check_need_heartbeat(int32_t policy)
     return FALSE;
 }
 
-
+/* 检查是否要按负载上报调整权重 */
+BOOL check_need_loadreport(int32_t policy)
+{
+    return (policy == NLB_POLICY_ODD);
+}
 
@@ -50,6 +50,9 @@ const char *policy2str(int32_t policy);
 /* 检查是否要做心跳上报 */
 BOOL check_need_heartbeat(int32_t policy);
 
+/* 检查是否要按负载上报调整权重 */
+BOOL check_need_loadreport(int32_t policy);
+
 
 #endif
 
@@ -0,0 +1,306 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename resync.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "nlbtime.h"
+#include "list.h"
+#include "agent.h"
+#include "config.h"
+#include "log.h"
+#include "zkplugin.h"
+#include "zkservice.h"
+#include "resync.h"
+
+#define NLB_RESYNC_WINDOW       (64)        /* 同时进行重新同步的业务数 */
+
+struct resync_item {
+    char     name[NLB_SERVICE_NAME_LEN];    /* 业务名 */
+    uint64_t priority;                      /* 优先级，越大越先同步 */
+};
+
+static struct resync_item *resync_items;    /* 待同步业务，按优先级排序 */
+static uint32_t resync_num;                 /* 待同步业务数 */
+static uint32_t resync_next;                /* 下一个要发送请求的业务 */
+static uint32_t resync_inflight;            /* 窗口内未完成的业务数 */
+static uint32_t resync_round;               /* 当前轮次，每轮开始时递增 */
+static uint32_t resync_stat[NLB_RESYNC_RESULT_MAX];
+static uint64_t resync_start_time;
+static BOOL     resync_active;
+
+static struct resync_item *resync_queued;   /* 指定优先同步的业务，按加入顺序 */
+static uint32_t resync_queued_num;
+static uint32_t resync_queued_cap;
+
+/* 按业务名排序 */
+static int32_t resync_item_name_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct resync_item *)a)->name, ((const struct resync_item *)b)->name);
+}
+
+/* 按优先级从高到低排序 */
+static int32_t resync_item_priority_cmp(const void *a, const void *b)
+{
+    uint64_t pa = ((const struct resync_item *)a)->priority;
+    uint64_t pb = ((const struct resync_item *)b)->priority;
+
+    if (pa == pb) {
+        return 0;
+    }
+
+    return (pa > pb) ? -1 : 1;
+}
+
+/**
+ * @brief  取出指定优先同步的业务，按加入顺序给出最高优先级
+ * @info   取出的业务按业务名排序，重复加入的业务只保留最早的一个
+ * @return 取出的业务数
+ */
+static uint32_t take_queued(struct resync_item *items)
+{
+    uint32_t i, num = 0;
+
+    for (i = 0; i < resync_queued_num; i++) {
+        memcpy(items[i].name, resync_queued[i].name, NLB_SERVICE_NAME_LEN);
+        items[i].priority = UINT64_MAX - i;
+    }
+
+    qsort(items, resync_queued_num, sizeof(struct resync_item), resync_item_name_cmp);
+
+    /* 同名业务相邻，保留优先级最高的，即最早加入的 */
+    for (i = 0; i < resync_queued_num; i++) {
+        if (num && !resync_item_name_cmp(&items[num - 1], &items[i])) {
+            if (items[i].priority > items[num - 1].priority) {
+                items[num - 1].priority = items[i].priority;
+            }
+            continue;
+        }
+        items[num++] = items[i];
+    }
+
+    resync_queued_num = 0;
+
+    return num;
+}
+
+/**
+ * @brief 开始新的一轮，之前轮次未完成的请求不再计入
+ */
+static void resync_begin(struct resync_item *items, uint32_t num)
+{
+    free(resync_items);
+    resync_items      = items;
+    resync_num        = num;
+    resync_next       = 0;
+    resync_inflight   = 0;
+    resync_active     = (num > 0);
+    resync_start_time = get_time_ms();
+    resync_round++;
+    memset(resync_stat, 0, sizeof(resync_stat));
+}
+
+/**
+ * @brief 启动一轮重新同步
+ * @info  指定优先同步的业务在前，本地没有的直接预取，其余业务按最近的请求量排序；
+ *        启动时请求量由本地业务清单恢复
+ */
+void resync_start(void)
+{
+    uint32_t queued, total = 0;
+    struct resync_item *items;
+    struct agent_local_rdata *rdata;
+    struct list_head *rdata_list = get_rdata_list();
+
+    if (get_worker_mode() == SERVER_MODE) {
+        return;
+    }
+
+    /* 上一轮未完成的请求带着旧轮次返回，不会扣减本轮的窗口 */
+    resync_begin(NULL, 0);
+
+    list_for_each_entry(rdata, rdata_list, list_node) {
+        total++;
+    }
+
+    items = (struct resync_item *)calloc(total + resync_queued_num + 1, sizeof(struct resync_item));
+    if (NULL == items) {
+        NLOG_ERROR("No memory");
+        return;
+    }
+
+    queued = take_queued(items);
+
+    total = queued;
+    list_for_each_entry(rdata, rdata_list, list_node) {
+        /* resync_item以业务名开头，可以直接用业务名查找 */
+        if (queued && bsearch(rdata->name, items, queued, sizeof(struct resync_item), resync_item_name_cmp)) {
+            continue;
+        }
+        memcpy(items[total].name, rdata->name, NLB_SERVICE_NAME_LEN);
+        items[total].priority = rdata->traffic;
+        total++;
+    }
+
+    if (total == 0) {
+        free(items);
+        return;
+    }
+
+    qsort(items, total, sizeof(struct resync_item), resync_item_priority_cmp);
+    resync_begin(items, total);
+
+    NLOG_INFO("resync start, services [%u], queued [%u]", total, queued);
+}
+
+/**
+ * @brief 指定业务优先重新同步
+ * @info  下一轮开始时排在最前面；没有进行中的轮次时，下次处理时只同步这些业务
+ */
+void resync_queue(const char *name)
+{
+    uint32_t cap;
+    struct resync_item *items;
+
+    if (resync_queued_num >= resync_queued_cap) {
+        cap   = resync_queued_cap ? resync_queued_cap * 2 : 64;
+        items = (struct resync_item *)realloc(resync_queued, sizeof(struct resync_item) * cap);
+        if (NULL == items) {
+            NLOG_ERROR("No memory");
+            return;
+        }
+
+        resync_queued     = items;
+        resync_queued_cap = cap;
+    }
+
+    memset(&resync_queued[resync_queued_num], 0, sizeof(struct resync_item));
+    strncpy(resync_queued[resync_queued_num].name, name, NLB_SERVICE_NAME_LEN - 1);
+    resync_queued_num++;
+}
+
+/**
+ * @brief 把指定优先同步的业务插到当前轮次剩余业务的前面，没有进行中的轮次时开始新的一轮
+ * @info  剩余业务中已经在指定业务里的不再保留，和resync_start一样用业务名二分查找
+ */
+static void merge_queued(void)
+{
+    uint32_t i, queued, total, remain = resync_num - resync_next;
+    struct resync_item *items;
+
+    items = (struct resync_item *)malloc(sizeof(struct resync_item) * (remain + resync_queued_num + 1));
+    if (NULL == items) {
+        NLOG_ERROR("No memory");
+        return;
+    }
+
+    queued = take_queued(items);
+    total  = queued;
+    for (i = resync_next; resync_active && i < resync_num; i++) {
+        if (bsearch(resync_items[i].name, items, queued, sizeof(struct resync_item), resync_item_name_cmp)) {
+            continue;
+        }
+        items[total++] = resync_items[i];
+    }
+
+    /* 指定业务恢复加入顺序，剩余业务本来就按优先级排序 */
+    qsort(items, queued, sizeof(struct resync_item), resync_item_priority_cmp);
+
+    if (!resync_active) {
+        resync_begin(items, queued);
+        NLOG_INFO("resync start, services [%u], queued [%u]", queued, queued);
+        return;
+    }
+
+    free(resync_items);
+    resync_items = items;
+    resync_num   = total;
+    resync_next  = 0;
+}
+
+/**
+ * @brief 一个业务重新同步完成
+ */
+void resync_complete(uint32_t round, int32_t result)
+{
+    if (round != resync_round) {
+        return;
+    }
+
+    if (resync_inflight) {
+        resync_inflight--;
+    }
+
+    if (result >= 0 && result < NLB_RESYNC_RESULT_MAX) {
+        resync_stat[result]++;
+    }
+}
+
+/**
+ * @brief 重新同步主循环处理函数
+ */
+void resync_run(void)
+{
+    uint32_t i, total = 0;
+    uint64_t now = get_time_ms();
+
+    if (resync_queued_num && (get_worker_mode() != SERVER_MODE)) {
+        merge_queued();
+    }
+
+    if (!resync_active || !zk_connected()) {
+        return;
+    }
+
+    /* 补满窗口 */
+    while (resync_inflight < NLB_RESYNC_WINDOW && resync_next < resync_num) {
+        if (resync_service(resync_items[resync_next++].name, resync_round) < 0) {
+            resync_stat[NLB_RESYNC_FAILED]++;
+            continue;
+        }
+        resync_inflight++;
+    }
+
+    if (resync_next < resync_num || resync_inflight) {
+        return;
+    }
+
+    /* 进行中插入的业务也计入本轮 */
+    for (i = 0; i < NLB_RESYNC_RESULT_MAX; i++) {
+        total += resync_stat[i];
+    }
+
+    NLOG_INFO("resync converged in [%llu] ms, services [%u], changed [%u], unchanged [%u], failed [%u]",
+              (unsigned long long)(now - resync_start_time), total,
+              resync_stat[NLB_RESYNC_CHANGED], resync_stat[NLB_RESYNC_UNCHANGED],
+              resync_stat[NLB_RESYNC_FAILED]);
+
+    free(resync_items);
+    resync_items  = NULL;
+    resync_num    = 0;
+    resync_next   = 0;
+    resync_active = FALSE;
+}
+
@@ -0,0 +1,68 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename resync.h
+ * @info     zookeeper业务配置重新同步
+ *           启动和会话重建后，按业务热度排序，在有限窗口内流水线地重新设置业务监视，
+ *           比较mtime后只拉取有变化的业务配置，收敛后输出耗时统计。
+ *           启动时业务热度由本地业务清单恢复，清单中过期或者加载失败的业务指定优先同步
+ */
+
+#ifndef _RESYNC_H_
+#define _RESYNC_H_
+
+#include <stdint.h>
+
+enum {
+    NLB_RESYNC_UNCHANGED = 0,   /* 配置未变化 */
+    NLB_RESYNC_CHANGED   = 1,   /* 配置变化，已重新拉取 */
+    NLB_RESYNC_FAILED    = 2,   /* 请求失败 */
+    NLB_RESYNC_RESULT_MAX,
+};
+
+/**
+ * @brief 启动一轮重新同步
+ * @info  客户端初始化和zookeeper重新初始化时调用，连接建立后开始发送请求
+ *        上一轮未完成的请求不再计入窗口和统计
+ */
+void resync_start(void);
+
+/**
+ * @brief 指定业务优先重新同步
+ * @info  在resync_start之前加入时排在该轮最前面，轮次进行中加入时插到剩余业务前面，
+ *        没有进行中的轮次时开始只包含这些业务的一轮；本地没有的业务直接拉取配置
+ */
+void resync_queue(const char *name);
+
+/**
+ * @brief 重新同步主循环处理函数，定时调用
+ * @info  合并指定优先同步的业务，补充窗口内的请求，检查是否收敛
+ */
+void resync_run(void);
+
+/**
+ * @brief 一个业务重新同步完成
+ * @param round  --> 发出请求时的轮次，不是当前轮次的完成直接忽略
+ * @param result --> NLB_RESYNC_UNCHANGED/NLB_RESYNC_CHANGED/NLB_RESYNC_FAILED
+ */
+void resync_complete(uint32_t round, int32_t result);
+
+#endif
+
@@ -39,6 +39,7 @@
 #include "nlbapi.h"
 #include "networking.h"
 #include "nlbrand.h"
+#include "utils.h"
 
 #define NLB_ROUTE_TASK_MAX      100  /* 单个业务最大路由请求数 */
 #define NLB_ROUTE_TASK_HASHLEN  17   /* hash查找 */
@@ -55,6 +56,8 @@ struct route_task
     int32_t   request_num;      /* 请求数       */
     char      service_name[NLB_SERVICE_NAME_LEN];
     struct sockaddr_in addr[NLB_ROUTE_TASK_MAX];
+    uint16_t  route_num[NLB_ROUTE_TASK_MAX];    /* 每个请求的路由个数，0为单个路由请求 */
+    uint16_t  route_flags[NLB_ROUTE_TASK_MAX];  /* 批量路由请求标记 */
 };
 
 /**
@@ -98,9 +101,11 @@ void delete_route_task(const char *name)
  * @brief  创建路由请求任务
  * @info   如果该业务已经存在路由请求，将该次请求的地址加入任务中；如果任务已满，返回指定错误码
  *         否则，创建一个新的任务
+ * @param  num:   路由个数，0为单个路由请求
+ *         flags: 批量路由请求标记
  * @return =0 成功 <0 失败 =1 该业务路由任务已满
  */
-int32_t create_route_task(const char *name, const struct sockaddr_in *addr)
+int32_t create_route_task(const char *name, const struct sockaddr_in *addr, uint16_t num, uint16_t flags)
 {
     int32_t  ret;
     uint32_t hash;
@@ -117,6 +122,8 @@ int32_t create_route_task(const char *name, const struct sockaddr_in *addr)
         }
 
         task->mtime = get_time_ms();
+        task->route_num[task->request_num]   = num;
+        task->route_flags[task->request_num] = flags;
         memcpy(&task->addr[task->request_num++], addr, sizeof(*addr));
         return 0;
     }
@@ -133,6 +140,8 @@ int32_t create_route_task(const char *name, const struct sockaddr_in *addr)
     task->ctime = get_time_ms();
     task->mtime = task->ctime;
     strncpy(task->service_name, name, NLB_SERVICE_NAME_LEN);
+    task->route_num[task->request_num]   = num;
+    task->route_flags[task->request_num] = flags;
     memcpy(&task->addr[task->request_num++], addr, sizeof(*addr));
 
     hash = gen_hash_key(name) % NLB_ROUTE_TASK_HASHLEN;
@@ -164,6 +173,10 @@ int32_t get_random_route(const char *name, struct routeid *id)
     }
 
     shm_servers = rdata->servs_data[rdata->route_meta->index];
+    if (!shm_servers->server_num) {
+        return -1;
+    }
+
     server = shm_servers->svrs + nlb_rand()%shm_servers->server_num;
 
     id->ip   = server->server_ip;
@@ -172,6 +185,71 @@ int32_t get_random_route(const char *name, struct routeid *id)
     return 0;
 }
 
+/**
+ * @brief  随机获取多个本地路由
+ * @info   distinct时从随机位置开始顺序选择，保证服务器不同
+ * @return =-1 没有路由 >0 路由个数
+ */
+int32_t get_random_routes(const char *name, uint16_t num, uint16_t flags, struct routeid *ids)
+{
+    uint32_t i, start;
+    struct agent_local_rdata *rdata = get_local_rdata(name);
+    struct shm_servers *shm_servers;
+    struct server_info *server;
+
+    if (NULL == rdata) {
+        NLOG_DEBUG("No this service (%s) local route", name);
+        return -1;
+    }
+
+    shm_servers = rdata->servs_data[rdata->route_meta->index];
+    if (!shm_servers->server_num) {
+        return -1;
+    }
+
+    if (flags & NLB_ROUTE_BATCH_DISTINCT) {
+        num = min(num, (uint16_t)min(shm_servers->server_num, (uint32_t)NLB_ROUTE_BATCH_MAX));
+    }
+
+    start = nlb_rand();
+    for (i = 0; i < num; i++) {
+        if (flags & NLB_ROUTE_BATCH_DISTINCT) {
+            server = shm_servers->svrs + (start + i) % shm_servers->server_num;
+        } else {
+            server = shm_servers->svrs + nlb_rand() % shm_servers->server_num;
+        }
+
+        ids[i].ip   = server->server_ip;
+        ids[i].port = server->port[0];
+        ids[i].type = (NLB_PORT_TYPE)server->port_type;
+    }
+
+    return num;
+}
+
+/**
+ * @brief  打包单个或批量路由回复
+ * @param  num: 路由个数，0为单个路由请求
+ * @return 回复包长度
+ */
+static int32_t make_route_response(const char *name, uint16_t num, uint16_t flags, char *buff, int32_t len)
+{
+    int32_t ret;
+    struct routeid ids[NLB_ROUTE_BATCH_MAX];
+
+    if (!num) {
+        ret = get_random_route(name, &ids[0]);
+        return serialize_route_response(ret < 0 ? 1 : 0, &ids[0], buff, len);
+    }
+
+    ret = get_random_routes(name, num, flags, ids);
+    if (ret < 0) {
+        return serialize_route_batch_response(1, NULL, 0, buff, len);
+    }
+
+    return serialize_route_batch_response(0, ids, ret, buff, len);
+}
+
 /**
  * @brief 处理路由请求
  * @info  路由请求都是从API发送过来
@@ -179,11 +257,11 @@ int32_t get_random_route(const char *name, struct routeid *id)
  */
 void process_route_request(int32_t listen_fd)
 {
-    int32_t ret;
-    int32_t len;
-    char    buff[1024];
-    char    service_name[NLB_SERVICE_NAME_LEN];
-    struct routeid id;
+    int32_t  ret;
+    int32_t  len;
+    uint16_t num, flags;
+    char     buff[1024];
+    char     service_name[NLB_SERVICE_NAME_LEN];
     struct sockaddr_in addr;
     socklen_t addr_len = sizeof(addr);
 
@@ -197,25 +275,24 @@ void process_route_request(int32_t listen_fd)
         }
 
         /* 解路由请求包 */
-        ret = deserialize_route_request(buff, len, service_name, sizeof(service_name));
+        ret = deserialize_route_batch_request(buff, len, service_name, sizeof(service_name), &num, &flags);
         if (ret < 0) {
             NLOG_ERROR("Invalid route request package");
             continue;
         }
 
-        NLOG_DEBUG("recevice service (%s) route request", service_name);
+        NLOG_DEBUG("recevice service (%s) route request, num [%u]", service_name, num);
 
         /* 试着从本地获取路由，如果有，直接回复路由信息 */
-        ret = get_random_route(service_name, &id);
-        if (!ret) {
-            ret = serialize_route_response(0, &id, buff, sizeof(buff));
+        if (get_local_rdata(service_name)) {
+            ret = make_route_response(service_name, num, flags, buff, sizeof(buff));
             sendto(listen_fd, buff, ret, 0, (struct sockaddr *)&addr, addr_len);
             NLOG_DEBUG("send service (%s) route response", service_name);
             continue;
         }
 
         /* 创建路由请求任务 */
-        ret = create_route_task(service_name, &addr);
+        ret = create_route_task(service_name, &addr, num, flags);
         if (ret < 0) {
             NLOG_ERROR("create route request task failed");
             ret = serialize_route_response(1, NULL, buff, sizeof(buff));
@@ -246,7 +323,6 @@ void process_route_task(const char *name)
     int32_t  ret;
     uint32_t loop;
     char     buff[64*1024];
-    struct routeid id;
     struct route_task *task;
     struct sockaddr_in *addr;
 
@@ -258,13 +334,7 @@ void process_route_task(const char *name)
     /* 循环所有路由请求 */
     for (loop = 0; loop < task->request_num; loop++) {
         addr = &task->addr[loop];
-        ret = get_random_route(name, &id);
-        if (ret < 0) {
-            ret = serialize_route_response(1, NULL, buff, sizeof(buff));
-            continue;
-        } else {
-            ret = serialize_route_response(0, &id, buff, sizeof(buff));
-        }
+        ret  = make_route_response(name, task->route_num[loop], task->route_flags[loop], buff, sizeof(buff));
 
         ret = sendto(get_listen_fd(), buff, ret, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
         if (ret == -1) {
@@ -0,0 +1,1266 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename shaping.c
+ * @info     路由数据调整算法: 动态权重、死机判定、多阶hash等
+ *           不依赖zookeeper和网络，可被agent和离线工具共同使用
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "hash.h"
+#include "log.h"
+#include "nlbtime.h"
+#include "utils.h"
+#include "atomic.h"
+#include "flightrec.h"
+#include "shaping.h"
+
+#define NLB_CONC_MIN_COST_DRIFT 32  /* 最小时延向当前时延漂移的速度，每周期漂移差值的1/32 */
+#define NLB_INFLIGHT_PERIOD     5000 /* 定时更新的统计周期，毫秒，和agent定时更新间隔一致 */
+
+/* 多阶hash模数，20000个节点，15阶 */
+static uint32_t mhash_mods[MAX_ROW_COUNT] = {4621, 3557, 2741, 2111, 1627, 1259, 971, 751, 577, 443, 347, 269, 211, 163, 352};
+
+/* 服务器权重上限回调，没有设置时不限制 */
+static weight_cap_handler weight_cap = NULL;
+static weight_cap_prepare_handler weight_cap_prepare = NULL;
+
+/**
+ * @brief 重新初始化多阶索引
+ */
+void calc_servers_hash(struct shm_servers *servers)
+{
+    uint32_t base, hash;
+    int32_t  i, j;
+    struct server_info *server;
+
+    servers->mhash_order = MAX_ROW_COUNT;
+    memcpy(servers->mhash_mods, mhash_mods, sizeof(mhash_mods));
+    memset(servers->mhash_idx, 0xff, sizeof(servers->mhash_idx));
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+        base   = 0;
+
+        for (j = 0; j < MAX_ROW_COUNT; j++) {
+            hash = server->server_ip%servers->mhash_mods[j];
+
+            if (servers->mhash_idx[base + hash] == 0xffffffff) {
+                servers->mhash_idx[base + hash] = i;
+                break;
+            }
+
+            base += servers->mhash_mods[j];
+        }
+    }
+}
+
+/**
+ * @brief 清空服务器统计数据
+ * @info  包括时延、成功数、失败数，清空后可以写入共享内存
+ */
+void clean_servers_stat(struct shm_servers *servers)
+{
+    uint32_t i;
+    uint32_t svr_num = servers->server_num;
+    struct server_info *server;
+
+
+    servers->cost_total    = 0;
+    servers->fail_total    = 0;
+    servers->success_total = 0;
+
+    for (i = 0; i < svr_num; i++) {
+        server = &servers->svrs[i];
+
+        server->failed  = 0;
+        server->success = 0;
+        server->cost    = 0;
+    }
+}
+
+/**
+ * @brief 交换两个server的信息
+ */
+void swap_server_info(struct server_info *server1, struct server_info *server2)
+{
+    struct server_info server_tmp;
+
+    /* 相同地址，直接返回 */
+    if (server1 == server2) {
+        return;
+    }
+
+    memcpy(&server_tmp, server1, sizeof(struct server_info));
+    memcpy(server1, server2, sizeof(struct server_info));
+    memcpy(server2, &server_tmp, sizeof(struct server_info));
+}
+
+/**
+ * @brief 计算服务器的权重信息
+ * @info  同时按下标升序记录预热中的存活服务器，API选择时按预热曲线扣除这些服务器的部分权重
+ */
+void calc_servers_weight(struct shm_servers *servers)
+{
+    uint32_t i;
+    uint32_t weight, base = 0;
+    uint32_t dead_retrys;
+    struct server_info *server;
+
+    servers->warm_num = 0;
+
+    /* 设置每个服务器的权重基数 */
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+        if (server->dead_time) {
+            break;
+        }
+
+        server->weight_base = base;
+        base += server->weight_dynamic;
+
+        if (server->warm_start && servers->slow_start_window && servers->warm_num < NLB_SLOW_START_LIST) {
+            servers->warm_idx[servers->warm_num++] = (uint16_t)i;
+        }
+    }
+
+    servers->dead_num         = servers->server_num - i;
+    servers->weight_total     = base;
+    servers->weight_dead_base = base;
+    servers->dead_retry_times = 0;
+
+    /* 计算死机服务器可以分配的权重，死机机器统一一个权重，随机选择一个 */
+    if (servers->dead_num != 0) {
+        weight      = (uint32_t)(servers->weight_total * servers->dead_retry_ratio + 1);
+        dead_retrys = (uint32_t)((servers->success_total + servers->fail_total)*servers->dead_retry_ratio);
+        servers->weight_total      += max(weight, (uint32_t)1);
+        servers->dead_retry_times   = max(dead_retrys, (uint32_t)1);
+    }
+}
+
+/* 预热开始时间，秒的低16位，0表示不在预热 */
+static uint16_t warm_stamp(void)
+{
+    uint16_t now = (uint16_t)get_time_s();
+
+    return now ? now : 1;
+}
+
+/**
+ * @brief 服务器开始预热
+ * @info  没有开启预热时不做处理
+ */
+void start_warmup(struct shm_servers *servers, struct server_info *server)
+{
+    if (servers->slow_start_window) {
+        server->warm_start = warm_stamp();
+    }
+}
+
+/**
+ * @brief 死机服务器恢复，清除死机标记并设置动态权重
+ * @info  开启预热时恢复静态权重，由API按预热曲线平滑增加实际权重；
+ *        否则按恢复比例设置权重，之后每个调整周期增加
+ */
+void resume_server(struct shm_servers *servers, struct server_info *server)
+{
+    uint16_t weight;
+
+    server->dead_time = 0;
+
+    if (servers->slow_start_window) {
+        server->weight_dynamic = server->weight_static;
+        start_warmup(servers, server);
+        return;
+    }
+
+    weight                 = (uint16_t)(server->weight_static * servers->resume_weight_ratio);
+    server->weight_dynamic = max(weight, (uint16_t)1);
+}
+
+/**
+ * @brief 撤销排空的服务器恢复权重
+ * @info  死机服务器不处理；开启预热时恢复静态权重并开始预热，否则至少恢复到恢复比例，
+ *        之后每个调整周期增加
+ */
+void undrain_server(struct shm_servers *servers, struct server_info *server)
+{
+    uint16_t weight;
+
+    if (server->dead_time) {
+        return;
+    }
+
+    if (servers->slow_start_window) {
+        if (server->weight_dynamic < server->weight_static) {
+            server->weight_dynamic = server->weight_static;
+            start_warmup(servers, server);
+        }
+        return;
+    }
+
+    weight                 = (uint16_t)(server->weight_static * servers->resume_weight_ratio);
+    weight                 = max(weight, (uint16_t)1);
+    server->weight_dynamic = max(server->weight_dynamic, weight);
+}
+
+/**
+ * @brief 设置服务器权重上限回调
+ * @param prepare 准备回调，可以为NULL
+ */
+void set_weight_cap_handler(weight_cap_handler handler, weight_cap_prepare_handler prepare)
+{
+    weight_cap         = handler;
+    weight_cap_prepare = prepare;
+}
+
+/* 按权重上限回调计算服务器的权重上限 */
+static uint16_t calc_weight_cap(struct shm_servers *servers, struct server_info *server)
+{
+    uint32_t cap = weight_cap(servers, server);
+
+    if (cap >= 1000) {
+        return server->weight_static;
+    }
+
+    return (uint16_t)(server->weight_static * cap / 1000);
+}
+
+/**
+ * @brief 按权重上限降低非死机服务器的动态权重
+ */
+void apply_weight_cap(struct shm_servers *servers)
+{
+    uint32_t i;
+    struct server_info *server;
+
+    if (NULL == weight_cap) {
+        return;
+    }
+
+    if (weight_cap_prepare) {
+        weight_cap_prepare(servers);
+    }
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+        if (server->dead_time) {
+            continue;
+        }
+
+        server->weight_dynamic = min(server->weight_dynamic, calc_weight_cap(servers, server));
+    }
+}
+
+/**
+ * @brief 检查是否有非死机服务器的动态权重超过权重上限
+ */
+BOOL check_servers_capped(struct shm_servers *servers)
+{
+    uint32_t i;
+    struct server_info *server;
+
+    if (NULL == weight_cap) {
+        return FALSE;
+    }
+
+    if (weight_cap_prepare) {
+        weight_cap_prepare(servers);
+    }
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+        if (!server->dead_time && server->weight_dynamic > calc_weight_cap(servers, server)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 计算预热曲线表
+ * @info  ramp[i] = floor + (1 - floor) * (i/N)^(1/aggression)，千分比
+ */
+void calc_slow_start_ramp(struct shm_servers *servers)
+{
+    uint32_t i;
+    double   floor_ratio = min(max((double)servers->slow_start_floor, 0.0), 1.0);
+    double   aggression  = max((double)servers->slow_start_aggression, 0.01);
+    double   factor;
+
+    for (i = 0; i <= NLB_SLOW_START_STEPS; i++) {
+        factor = floor_ratio + (1.0 - floor_ratio) * pow((double)i / NLB_SLOW_START_STEPS, 1.0 / aggression);
+        servers->slow_start_ramp[i] = (uint16_t)(factor * 1000 + 0.5);
+    }
+}
+
+/**
+ * @brief 结束已经完成预热的服务器
+ * @info  死机或者关闭预热的服务器同样结束预热，避免预热时间戳16位回绕后重新预热
+ */
+void reconcile_warmup(struct shm_servers *servers)
+{
+    uint32_t i;
+    uint16_t now = warm_stamp();
+    struct server_info *server;
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+        if (!server->warm_start) {
+            continue;
+        }
+
+        if (!servers->slow_start_window || server->dead_time
+            || (uint16_t)(now - server->warm_start) >= servers->slow_start_window) {
+            server->warm_start = 0;
+        }
+    }
+}
+
+/**
+ * @brief 按基准成功率调整每一个服务器的权重和死机状态
+ * @info  调整后，非死机服务器在数组前面，死机服务器在数组后面
+ */
+void _shaping_servers(struct shm_servers *servers, double success_ratio_base, BOOL weight_dec)
+{
+    int32_t  begin, end;
+    uint16_t weight;
+    uint32_t svr_num = servers->server_num;
+    uint64_t single_req_total;
+    double   single_success_ratio, ratio;
+
+    struct server_info *server;
+
+    /* 计算每一个服务器权重和死机状态 */
+    end   = (int32_t)svr_num - 1;
+    begin = 0;
+    while ((begin <= end) && (end >= 0)) {
+        server              = &servers->svrs[begin];
+        single_req_total    = server->failed + server->success;
+
+        /* 如果没有处理过请求，权重信息保持不变 */
+        if (!single_req_total) {
+            if (server->dead_time) {
+                server->weight_dynamic = 0;
+                swap_server_info(server, &servers->svrs[end]);
+                end--;
+            } else {
+                begin++;
+            }
+            continue;
+        }
+
+        single_success_ratio = ((double)server->success)/single_req_total;
+
+        /* 单机成功率大于基准成功率 */
+        if (single_success_ratio >= success_ratio_base) {
+            /* 死机机器，重新修改权重 */
+            if (server->dead_time) {
+                resume_server(servers, server);
+                begin++;
+                continue;
+            }
+
+            /* 如果大于基准成功率，增加权重 */
+            if (server->weight_static != server->weight_dynamic) {
+                weight = (uint16_t)(server->weight_static * servers->weight_incr_ratio);
+                weight = max(weight, (uint16_t)1);
+                server->weight_dynamic += weight;
+                server->weight_dynamic  = min(server->weight_static, server->weight_dynamic);
+            }
+
+            begin++;
+
+            continue;
+        }
+
+        /* 单机成功率为0 */
+        if (single_success_ratio <= 0.00001) {
+            if (server->dead_time == 0) {
+                server->dead_time = get_time_ms();
+            }
+
+            server->weight_dynamic  = 0;
+            swap_server_info(server, &servers->svrs[end]);
+            end--;
+            continue;
+        }
+
+        if (!weight_dec) {
+            begin++;
+            continue;
+        }
+
+        /* 单机成功率低于平均成功率,减小权重 */
+        ratio = single_success_ratio;
+        ratio = ratio * ratio;
+        server->weight_dynamic = (uint16_t)(server->weight_dynamic * ratio);
+
+        /* 降低权重后，权重为零 */
+        if (0 == server->weight_dynamic) {
+            if (0 == server->dead_time) {
+                server->dead_time = get_time_ms();
+            }
+
+            swap_server_info(server, &servers->svrs[end]);
+            end--;
+            continue;
+        }
+
+        begin++;
+    }
+}
+
+/**
+ * @brief 计算低权重机器数
+ */
+uint32_t calc_weight_low_num(struct shm_servers *servers)
+{
+    struct server_info *info;
+    float water_mark = servers->weight_low_watermark;
+    uint32_t idx, cnt = 0;
+
+    for (idx = 0; idx < servers->server_num; idx ++) {
+        info = servers->svrs + idx;
+        if (((float)info->weight_dynamic)/info->weight_static < water_mark) {
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief 对服务器信息做调整
+ * @info  包括调整动态权重，死机等信息
+ * @param ratio: 输出本次使用的基准成功率，可以为NULL
+ * @return 调整分支 NLB_SHAPING_XXX
+ */
+int32_t shaping_servers(struct shm_servers *servers, float *ratio)
+{
+    uint32_t svr_num = servers->server_num;
+    uint64_t req_total;
+    double   success_rate;
+    float    weight_low_real_ratio;
+    int32_t  branch;
+
+    /* 没有服务器，不用计算 */
+    if (!svr_num) {
+        return NLB_SHAPING_NONE;
+    }
+
+    weight_low_real_ratio = ((float)servers->weight_low_num)/svr_num;
+    if (weight_low_real_ratio <= servers->weight_low_ratio) {
+        success_rate = servers->success_ratio_base;
+        branch       = NLB_SHAPING_BASE_RATIO;
+        _shaping_servers(servers, servers->success_ratio_base, TRUE);
+    } else {
+        /* 计算平均成功率，用平均成功率计算权重 */
+        req_total = servers->fail_total + servers->success_total;
+        if (req_total == 0) {
+            success_rate = 100.0;
+        } else {
+            success_rate = ((double)servers->success_total)/req_total;
+        }
+
+        success_rate = min(success_rate, (double)servers->success_ratio_base);
+        branch       = NLB_SHAPING_AVG_RATIO;
+        _shaping_servers(servers, success_rate, FALSE);
+    }
+
+    servers->weight_low_num = calc_weight_low_num(servers);
+
+    if (ratio) {
+        *ratio = (float)success_rate;
+    }
+
+    return branch;
+}
+
+/**
+ * @brief 重置泄漏的并发计数
+ * @info  上个周期没有任何请求完成，但是还有进行中的请求，认为是调用方没有上报结果
+ *        (例如进程退出)泄漏的计数；并发计数占满上限时不会再有请求，下个周期就会被重置
+ */
+static void reset_leaked_inflight(struct server_info *server)
+{
+    uint16_t inflight = server->inflight;
+
+    if (inflight && !server->failed && !server->success) {
+        compare_and_swap_2(&server->inflight, inflight, 0);
+    }
+}
+
+/**
+ * @brief 定时更新时回收泄漏的并发计数
+ * @info  1. 周期内没有请求完成时，和reset_leaked_inflight一样全部回收
+ *        2. 按Little定律周期内的平均并发约为时延总和除以周期时长，进行中的请求数超过
+ *           平均并发加上最小并发上限时，超出部分认为是泄漏，每周期回收一半；
+ *           统计不满一个周期的数据会累积到下个周期，只会高估平均并发；
+ *           并发瞬时波动被误回收的计数在释放时不会减到0以下，空闲后自动恢复
+ */
+static void reclaim_leaked_inflight(struct server_info *server, uint16_t slack)
+{
+    uint16_t inflight = server->inflight;
+    uint64_t expect;
+
+    if (!inflight) {
+        return;
+    }
+
+    if (!server->failed && !server->success) {
+        compare_and_swap_2(&server->inflight, inflight, 0);
+        return;
+    }
+
+    expect = server->cost / NLB_INFLIGHT_PERIOD + max(slack, (uint16_t)1);
+    if (inflight > expect) {
+        compare_and_swap_2(&server->inflight, inflight, inflight - (inflight - expect + 1) / 2);
+    }
+}
+
+/**
+ * @brief 拷贝服务器信息数据
+ * @info  拷贝服务器数据的同时，计算统计数据
+ */
+void copy_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower)
+{
+    uint32_t i, j;
+    uint32_t svr_num = src_svrs->server_num;
+    struct server_info *dst_svr;
+    struct server_info *src_svr;
+
+    dst_svrs->cost_total    = 0;
+    dst_svrs->fail_total    = 0;
+    dst_svrs->success_total = 0;
+
+    if (src_svrs->version == NLB_SHM_VERSION1) {
+        dst_svrs->server_num            = svr_num;
+        dst_svrs->policy                = src_svrs->policy;
+        dst_svrs->weight_total          = src_svrs->weight_total;
+        dst_svrs->weight_static_total   = src_svrs->weight_static_total;
+        dst_svrs->shaping_request_min   = src_svrs->shaping_request_min;
+        dst_svrs->success_ratio_base    = src_svrs->success_ratio_base;
+        dst_svrs->success_ratio_min     = src_svrs->success_ratio_min;
+        dst_svrs->resume_weight_ratio   = src_svrs->resume_weight_ratio;
+        dst_svrs->dead_retry_ratio      = src_svrs->dead_retry_ratio;
+        dst_svrs->weight_low_watermark  = src_svrs->weight_low_watermark;
+        dst_svrs->weight_low_ratio      = src_svrs->weight_low_ratio;
+        dst_svrs->weight_incr_ratio     = src_svrs->weight_incr_ratio;
+        dst_svrs->eject_consecutive     = src_svrs->eject_consecutive;
+        dst_svrs->eject_burst           = src_svrs->eject_burst;
+        dst_svrs->eject_burst_window    = src_svrs->eject_burst_window;
+        dst_svrs->eject_base_time       = src_svrs->eject_base_time;
+        dst_svrs->eject_max_time        = src_svrs->eject_max_time;
+        dst_svrs->retry_budget_ratio    = src_svrs->retry_budget_ratio;
+        dst_svrs->retry_budget_min      = src_svrs->retry_budget_min;
+        dst_svrs->retry_budget_max      = src_svrs->retry_budget_max;
+        dst_svrs->conc_limit_min        = src_svrs->conc_limit_min;
+        dst_svrs->conc_limit_max        = src_svrs->conc_limit_max;
+        dst_svrs->conc_limit_init       = src_svrs->conc_limit_init;
+        dst_svrs->conc_reroll_times     = src_svrs->conc_reroll_times;
+        dst_svrs->conc_tolerance        = src_svrs->conc_tolerance;
+        dst_svrs->conc_smoothing        = src_svrs->conc_smoothing;
+        dst_svrs->slow_start_window     = src_svrs->slow_start_window;
+        dst_svrs->slow_start_floor      = src_svrs->slow_start_floor;
+        dst_svrs->slow_start_aggression = src_svrs->slow_start_aggression;
+        dst_svrs->drain_window          = src_svrs->drain_window;
+        dst_svrs->version               = NLB_SHM_VERSION1;
+        dst_svrs->weight_low_num        = src_svrs->weight_low_num;
+    } else {
+        dst_svrs->server_num            = svr_num;
+        dst_svrs->policy                = src_svrs->policy;
+        dst_svrs->weight_total          = src_svrs->weight_total;
+        dst_svrs->weight_static_total   = 0;
+        dst_svrs->shaping_request_min   = NLB_SHAPING_REQUEST_MIN;
+        dst_svrs->success_ratio_base    = NLB_SUCCESS_RATIO_BASE;
+        dst_svrs->success_ratio_min     = NLB_SUCCESS_RATIO_MIN;
+        dst_svrs->resume_weight_ratio   = NLB_RESUME_WEIGHT_RATIO;
+        dst_svrs->dead_retry_ratio      = NLB_DEAD_RETRY_RATIO;
+        dst_svrs->weight_low_watermark  = NLB_WEIGHT_LOW_WATERMARK;
+        dst_svrs->weight_low_ratio      = NLB_WEIGHT_LOW_RATIO;
+        dst_svrs->weight_incr_ratio     = NLB_WEIGHT_INCR_RATIO;
+        dst_svrs->eject_consecutive     = NLB_EJECT_CONSECUTIVE;
+        dst_svrs->eject_burst           = NLB_EJECT_BURST;
+        dst_svrs->eject_burst_window    = NLB_EJECT_BURST_WINDOW;
+        dst_svrs->eject_base_time       = NLB_EJECT_BASE_TIME;
+        dst_svrs->eject_max_time        = NLB_EJECT_MAX_TIME;
+        dst_svrs->retry_budget_ratio    = NLB_RETRY_BUDGET_RATIO;
+        dst_svrs->retry_budget_min      = NLB_RETRY_BUDGET_MIN;
+        dst_svrs->retry_budget_max      = NLB_RETRY_BUDGET_MAX;
+        dst_svrs->conc_limit_min        = NLB_CONC_LIMIT_MIN;
+        dst_svrs->conc_limit_max        = NLB_CONC_LIMIT_MAX;
+        dst_svrs->conc_limit_init       = NLB_CONC_LIMIT_INIT;
+        dst_svrs->conc_reroll_times     = NLB_CONC_REROLL_TIMES;
+        dst_svrs->conc_tolerance        = NLB_CONC_TOLERANCE;
+        dst_svrs->conc_smoothing        = NLB_CONC_SMOOTHING;
+        dst_svrs->slow_start_window     = NLB_SLOW_START_WINDOW;
+        dst_svrs->slow_start_floor      = NLB_SLOW_START_FLOOR;
+        dst_svrs->slow_start_aggression = NLB_SLOW_START_AGGRESSION;
+        dst_svrs->drain_window          = NLB_DRAIN_WINDOW;
+        dst_svrs->version               = NLB_SHM_VERSION1;
+        dst_svrs->weight_low_num        = src_svrs->weight_low_num;
+    }
+    calc_slow_start_ramp(dst_svrs);
+
+    for (i = 0; i < svr_num; i++) {
+        dst_svr = &dst_svrs->svrs[i];
+        src_svr = &src_svrs->svrs[i];
+
+        dst_svr->server_ip      = src_svr->server_ip;
+        dst_svr->weight_static  = src_svr->weight_static;
+        dst_svr->weight_dynamic = src_svr->weight_dynamic;
+        dst_svr->port_type      = src_svr->port_type;
+        dst_svr->port_num       = src_svr->port_num;
+
+        dst_svr->dead_time      = src_svr->dead_time;
+        dst_svr->fail_streak    = src_svr->fail_streak;
+        dst_svr->eject_level    = src_svr->eject_level;
+        dst_svr->eject_time     = src_svr->eject_time;
+        dst_svr->conc_limit     = src_svr->conc_limit;
+        dst_svr->min_cost       = src_svr->min_cost;
+        dst_svr->warm_start     = src_svr->warm_start;
+        reclaim_leaked_inflight(src_svr, src_svrs->conc_limit_min);
+        if ((dst_svr->dead_time != 0) || ((src_svr->failed + src_svr->success) >= lower)) {
+            dst_svr->failed     = return_and_set(&src_svr->failed, (uint32_t)0);
+            dst_svr->success    = return_and_set(&src_svr->success, (uint32_t)0);
+            dst_svr->cost       = return_and_set_8(&src_svr->cost, (uint64_t)0);
+        } else {
+            dst_svr->failed     = 0;
+            dst_svr->success    = 0;
+            dst_svr->cost       = 0;
+        }
+
+        for (j = 0; j < src_svr->port_num; j++) {
+            dst_svr->port[j]    = src_svr->port[j];
+        }
+
+        dst_svrs->cost_total   += dst_svr->cost;
+        dst_svrs->fail_total   += dst_svr->failed;
+        dst_svrs->success_total+= dst_svr->success;
+    }
+}
+
+
+/**
+ * @brief 拷贝指定的服务器信息数据
+ * @info  拷贝指定的服务器数据的同时，计算统计数据
+ */
+void copy_specified_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower)
+{
+    uint32_t i;
+    uint32_t svr_num = dst_svrs->server_num;
+    struct server_info *dst_svr;
+    struct server_info *src_svr;
+
+    dst_svrs->cost_total    = 0;
+    dst_svrs->fail_total    = 0;
+    dst_svrs->success_total = 0;
+    dst_svrs->weight_low_num= 0;
+    calc_slow_start_ramp(dst_svrs);
+
+    for (i = 0; i < svr_num; i++) {
+        dst_svr = &dst_svrs->svrs[i];
+        src_svr = get_server_info(dst_svr->server_ip, src_svrs);
+        if (NULL == src_svr) {
+            dst_svr->cost       = 0;
+            dst_svr->failed     = 0;
+            dst_svr->success    = 0;
+            dst_svr->dead_time  = 0;
+            dst_svr->fail_streak= 0;
+            dst_svr->eject_level= 0;
+            dst_svr->eject_time = 0;
+            dst_svr->conc_limit = 0;
+            dst_svr->min_cost   = 0;
+            dst_svr->weight_dynamic = dst_svr->weight_static;
+            start_warmup(dst_svrs, dst_svr);
+            continue;
+        }
+
+        dst_svr->dead_time      = src_svr->dead_time;
+        dst_svr->fail_streak    = src_svr->fail_streak;
+        dst_svr->eject_level    = src_svr->eject_level;
+        dst_svr->eject_time     = src_svr->eject_time;
+        dst_svr->conc_limit     = src_svr->conc_limit;
+        dst_svr->min_cost       = src_svr->min_cost;
+        dst_svr->warm_start     = src_svr->warm_start;
+        reset_leaked_inflight(src_svr);
+
+        if ((dst_svr->dead_time != 0) || ((src_svr->failed + src_svr->success) >= lower)) {
+            dst_svr->failed     = return_and_set(&src_svr->failed, (uint32_t)0);
+            dst_svr->success    = return_and_set(&src_svr->success, (uint32_t)0);
+            dst_svr->cost       = return_and_set_8(&src_svr->cost, (uint64_t)0);
+        } else {
+            dst_svr->failed     = 0;
+            dst_svr->success    = 0;
+            dst_svr->cost       = 0;
+        }
+        dst_svr->weight_dynamic = src_svr->weight_dynamic;
+
+        dst_svrs->cost_total   += dst_svr->cost;
+        dst_svrs->fail_total   += dst_svr->failed;
+        dst_svrs->success_total+= dst_svr->success;
+    }
+}
+
+
+
+/**
+ * @brief 通过IP获取服务器信息
+ */
+struct server_info *get_server_info(uint32_t ip, struct shm_servers *servers)
+{
+    uint32_t i;
+    uint32_t hash, idx, base = 0;
+    struct server_info *server;
+
+    /* 增量更新删除服务器后中间阶可能为空，每一阶都要按模数推进基址 */
+    for (i = 0; i < servers->mhash_order; i++) {
+        hash    = ip % servers->mhash_mods[i];
+        idx     = servers->mhash_idx[hash + base];
+        base   += servers->mhash_mods[i];
+        if (idx == 0xffffffff) {
+            continue;
+        }
+
+        if (idx >= NLB_SERVER_MAX) {
+            NLOG_ERROR("Invalid service local config");
+            return NULL;
+        }
+
+        server  = &servers->svrs[idx];
+        if (server->server_ip == ip) {
+            return server;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 合并统计数据
+ */
+static void merge_server_stat(struct shm_servers *dst_svrs, struct server_info *dst_svr, struct server_info *src_svr)
+{
+    fetch_and_add(&dst_svr->failed, src_svr->failed);
+    fetch_and_add(&dst_svr->success, src_svr->success);
+    fetch_and_add_8(&dst_svr->cost, src_svr->cost);
+
+    /* 进行中的请求完成时在新数据中释放并发，计数迁移到新数据 */
+    fetch_and_add_2(&dst_svr->inflight, src_svr->inflight);
+
+    /* 切换期间客户端摘除的服务器，摘除状态带到新数据中 */
+    if (src_svr->eject_time && !dst_svr->eject_time && !dst_svr->dead_time) {
+        dst_svr->eject_level = max(dst_svr->eject_level, src_svr->eject_level);
+        if (compare_and_swap(&dst_svr->eject_time, 0, src_svr->eject_time)) {
+            fetch_and_add(&dst_svrs->eject_num, 1);
+        }
+    }
+}
+
+void merge_servers_stat(struct shm_servers *dst_svrs, struct shm_servers *src_svrs)
+{
+    uint32_t i;
+    uint32_t svr_num = dst_svrs->server_num;
+    struct server_info *dst_svr;
+    struct server_info *src_svr;
+
+    for (i = 0; i < svr_num; i++) {
+        dst_svr = &dst_svrs->svrs[i];
+        src_svr = get_server_info(dst_svr->server_ip, src_svrs);
+
+        if (NULL == src_svr) {
+            continue;
+        }
+
+        merge_server_stat(dst_svrs, dst_svr, src_svr);
+    }
+}
+
+/**
+ * @brief 根据时延梯度计算服务器的并发上限
+ * @info  gradient = min_cost * tolerance / 平均时延，限制在[0.5, 1]，
+ *        新上限 = 上限 * gradient + sqrt(上限)，时延没有升高时按排队余量增长，
+ *        时延升高时收缩；最小时延取历史最小值并缓慢向当前时延漂移，适应后端真实变化
+ */
+void calc_servers_limit(struct shm_servers *servers)
+{
+    uint32_t i;
+    double   cost, gradient, limit, new_limit;
+    struct server_info *server;
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+
+        if (!servers->conc_limit_max || server->dead_time) {
+            server->conc_limit = 0;
+            continue;
+        }
+
+        limit = server->conc_limit ? server->conc_limit : servers->conc_limit_init;
+        if (!server->success) {
+            server->conc_limit = (uint16_t)limit;
+            continue;
+        }
+
+        cost = min(max((double)server->cost / server->success, 1.0), (double)UINT16_MAX);
+        if (!server->min_cost || cost < server->min_cost) {
+            server->min_cost = (uint16_t)cost;
+        } else {
+            server->min_cost += (uint16_t)((cost - server->min_cost) / NLB_CONC_MIN_COST_DRIFT);
+        }
+
+        gradient  = max(0.5, min(1.0, server->min_cost * servers->conc_tolerance / cost));
+        new_limit = limit * gradient + sqrt(limit);
+        limit     = limit * (1.0 - servers->conc_smoothing) + new_limit * servers->conc_smoothing;
+        limit     = max(limit, (double)servers->conc_limit_min);
+        limit     = min(limit, (double)servers->conc_limit_max);
+
+        server->conc_limit = (uint16_t)(limit + 0.5);
+    }
+}
+
+/**
+ * @brief 调整客户端摘除状态
+ * @info  已判死的服务器交给死机探测处理，清除摘除状态；
+ *        未摘除的服务器每个调整周期退避级别减一；
+ *        重新统计摘除中的服务器数，修正切换数据期间客户端增减计数的误差
+ */
+void reconcile_ejection(struct shm_servers *servers)
+{
+    uint32_t i;
+    uint32_t eject_num = 0;
+    struct server_info *server;
+
+    for (i = 0; i < servers->server_num; i++) {
+        server = &servers->svrs[i];
+
+        if (server->dead_time) {
+            server->eject_time  = 0;
+            server->fail_streak = 0;
+            continue;
+        }
+
+        if (server->eject_time) {
+            eject_num++;
+        } else if (server->eject_level) {
+            server->eject_level--;
+        }
+    }
+
+    servers->eject_num = eject_num;
+}
+
+/**
+ * @brief 检查服务器是否真死了
+ */
+BOOL check_server_real_dead(struct server_info *server, float success_ratio)
+{
+    uint32_t total = server->success + server->failed;
+
+    if (total == 0) {
+        return TRUE;
+    }
+
+    if ((server->success*1.0)/total < success_ratio) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 调整私有服务器数据并写入共享内存
+ * @info  servers为拷贝了统计数据的私有内存，调整后写入非当前下标的共享内存，
+ *        然后切换下标，并把切换期间产生的统计数据合并到新数据中
+ */
+void reshape_servers(struct shm_meta *meta, struct shm_servers **servs_data, struct shm_servers *servers)
+{
+    uint32_t idx, new_idx;
+    uint32_t data_len;
+    int32_t  branch;
+    float    ratio = 0.0;
+    struct shm_servers *cur_shm_servers;
+    struct shm_servers *next_shm_servers;
+
+    idx              = meta->index;
+    new_idx          = (idx+1)%2;
+    cur_shm_servers  = servs_data[idx];
+    next_shm_servers = servs_data[new_idx];
+    data_len         = sizeof(struct shm_servers) + sizeof(struct server_info) * servers->server_num;
+
+    /* 计算动态权重和死机信息，调整前后记录到调整记录器 */
+    flightrec_begin(servers);
+    branch = shaping_servers(servers, &ratio);
+    apply_weight_cap(servers);
+    reconcile_ejection(servers);
+    reconcile_warmup(servers);
+    calc_servers_limit(servers);
+    calc_slow_start_ramp(servers);
+
+    /* 清除统计数据 */
+    clean_servers_stat(servers);
+
+    /* 统一计算每一个服务器的权重基数，以及死机机器的权重 */
+    calc_servers_weight(servers);
+
+    /* 计算多阶hash */
+    calc_servers_hash(servers);
+    flightrec_commit(meta->name, servers, branch, ratio);
+
+    /* 拷贝新服务器数据到共享内存 */
+    memcpy(next_shm_servers, servers, data_len);
+
+    /* 设置新寻址服务器数据 */
+    mb();
+    meta->index = new_idx;
+
+    /* 合并统计数据到新服务器数据里面 */
+    merge_servers_stat(next_shm_servers, cur_shm_servers);
+}
+
+/**
+ * @brief 只按权重上限重新计算权重并写入共享内存
+ * @info  不做成功率调整，用于两次调整周期之间平滑降低排空服务器的权重；
+ *        servers为当前共享内存数据的私有拷贝，统计数据和并发计数清零，切换后从当前数据合并
+ */
+void reweight_servers(struct shm_meta *meta, struct shm_servers **servs_data, struct shm_servers *servers)
+{
+    uint32_t i;
+    uint32_t idx, new_idx;
+    uint32_t data_len;
+    struct shm_servers *cur_shm_servers;
+    struct shm_servers *next_shm_servers;
+
+    idx              = meta->index;
+    new_idx          = (idx+1)%2;
+    cur_shm_servers  = servs_data[idx];
+    next_shm_servers = servs_data[new_idx];
+    data_len         = sizeof(struct shm_servers) + sizeof(struct server_info) * servers->server_num;
+
+    clean_servers_stat(servers);
+    for (i = 0; i < servers->server_num; i++) {
+        servers->svrs[i].inflight = 0;
+    }
+
+    apply_weight_cap(servers);
+    calc_servers_weight(servers);
+    calc_servers_hash(servers);
+
+    memcpy(next_shm_servers, servers, data_len);
+
+    mb();
+    meta->index = new_idx;
+
+    merge_servers_stat(next_shm_servers, cur_shm_servers);
+}
+
+/* 增量更新时新数据每个位置对应的当前数据下标，新增服务器为0xffffffff */
+static uint32_t delta_slots[NLB_SERVER_MAX];
+
+/**
+ * @brief 检查两份配置的业务参数是否相同
+ */
+static BOOL servers_param_equal(const struct shm_servers *a, const struct shm_servers *b)
+{
+    return a->policy == b->policy
+        && a->version == b->version
+        && a->shaping_request_min == b->shaping_request_min
+        && a->success_ratio_base == b->success_ratio_base
+        && a->success_ratio_min == b->success_ratio_min
+        && a->resume_weight_ratio == b->resume_weight_ratio
+        && a->dead_retry_ratio == b->dead_retry_ratio
+        && a->weight_low_watermark == b->weight_low_watermark
+        && a->weight_low_ratio == b->weight_low_ratio
+        && a->weight_incr_ratio == b->weight_incr_ratio
+        && a->eject_consecutive == b->eject_consecutive
+        && a->eject_burst == b->eject_burst
+        && a->eject_burst_window == b->eject_burst_window
+        && a->eject_base_time == b->eject_base_time
+        && a->eject_max_time == b->eject_max_time
+        && a->retry_budget_ratio == b->retry_budget_ratio
+        && a->retry_budget_min == b->retry_budget_min
+        && a->retry_budget_max == b->retry_budget_max
+        && a->conc_limit_min == b->conc_limit_min
+        && a->conc_limit_max == b->conc_limit_max
+        && a->conc_limit_init == b->conc_limit_init
+        && a->conc_reroll_times == b->conc_reroll_times
+        && a->conc_tolerance == b->conc_tolerance
+        && a->conc_smoothing == b->conc_smoothing
+        && a->slow_start_window == b->slow_start_window
+        && a->slow_start_floor == b->slow_start_floor
+        && a->slow_start_aggression == b->slow_start_aggression
+        && a->drain_window == b->drain_window;
+}
+
+/**
+ * @brief 检查服务器的寻址配置(权重和端口)是否相同
+ */
+static BOOL server_addr_equal(const struct server_info *a, const struct server_info *b)
+{
+    return a->weight_static == b->weight_static
+        && a->port_type == b->port_type
+        && a->port_num == b->port_num
+        && !memcmp(a->port, b->port, a->port_num * sizeof(a->port[0]));
+}
+
+/**
+ * @brief 计算新配置和当前数据的服务器列表差异
+ * @info  新配置的每个服务器在当前数据中按IP查找一次，没有找到的为新增，
+ *        当前数据中没有被匹配的为删除；业务参数变化、IP重复或者变化过多时不做增量更新
+ * @return =0 可以增量更新 <0 需要全量更新
+ */
+int32_t calc_servers_delta(const struct shm_servers *new_svrs, struct shm_servers *cur_svrs,
+                           struct servers_delta *delta)
+{
+    static uint8_t matched[NLB_SERVER_MAX];
+    uint32_t i, idx, changes;
+    const struct server_info *new_svr;
+    struct server_info *cur_svr;
+
+    delta->add_num = 0;
+    delta->del_num = 0;
+    delta->mod_num = 0;
+
+    if (!new_svrs->server_num || !cur_svrs->server_num || cur_svrs->server_num > NLB_SERVER_MAX) {
+        return -1;
+    }
+
+    if (!servers_param_equal(new_svrs, cur_svrs)) {
+        return -2;
+    }
+
+    memset(matched, 0, cur_svrs->server_num);
+    for (i = 0; i < new_svrs->server_num; i++) {
+        new_svr = &new_svrs->svrs[i];
+        cur_svr = get_server_info(new_svr->server_ip, cur_svrs);
+        if (NULL == cur_svr) {
+            delta->add[delta->add_num++] = i;
+            continue;
+        }
+
+        /* 同一IP配置多次，槽位无法一一对应 */
+        idx = cur_svr - cur_svrs->svrs;
+        if (matched[idx]) {
+            return -3;
+        }
+
+        matched[idx] = 1;
+        if (!server_addr_equal(new_svr, cur_svr)) {
+            delta->mod[delta->mod_num++] = i;
+        }
+    }
+
+    if (new_svrs->server_num - delta->add_num < cur_svrs->server_num) {
+        for (i = 0; i < cur_svrs->server_num; i++) {
+            if (matched[i]) {
+                continue;
+            }
+
+            cur_svr = &cur_svrs->svrs[i];
+            if (get_server_info(cur_svr->server_ip, cur_svrs) != cur_svr) {
+                return -3;
+            }
+
+            delta->del[delta->del_num++] = cur_svr->server_ip;
+        }
+    }
+
+    changes = delta->add_num + delta->del_num + delta->mod_num;
+    if (changes * NLB_SERVERS_DELTA_RATIO > new_svrs->server_num) {
+        return -4;
+    }
+
+    return 0;
+}
+
+/* 查找服务器在多阶hash中的位置 */
+static uint32_t *find_server_hash(uint32_t ip, struct shm_servers *servers)
+{
+    uint32_t i, idx, base = 0;
+    uint32_t *slot;
+
+    for (i = 0; i < servers->mhash_order; i++) {
+        slot  = &servers->mhash_idx[base + ip % servers->mhash_mods[i]];
+        idx   = *slot;
+        base += servers->mhash_mods[i];
+        if (idx < NLB_SERVER_MAX && servers->svrs[idx].server_ip == ip) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/* 服务器加入多阶hash的第一个空位，和calc_servers_hash一致 */
+static int32_t insert_server_hash(struct shm_servers *servers, uint32_t idx)
+{
+    uint32_t i, base = 0;
+    uint32_t *slot;
+
+    for (i = 0; i < servers->mhash_order; i++) {
+        slot  = &servers->mhash_idx[base + servers->svrs[idx].server_ip % servers->mhash_mods[i]];
+        base += servers->mhash_mods[i];
+        if (*slot == 0xffffffff) {
+            *slot = idx;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* 服务器移动到新位置，同时更新hash和槽位对应关系 */
+static void move_server(struct shm_servers *servers, uint32_t from, uint32_t to)
+{
+    uint32_t *slot;
+
+    if (from == to) {
+        return;
+    }
+
+    slot = find_server_hash(servers->svrs[from].server_ip, servers);
+    memcpy(&servers->svrs[to], &servers->svrs[from], sizeof(struct server_info));
+    delta_slots[to] = delta_slots[from];
+    if (slot) {
+        *slot = to;
+    }
+}
+
+/**
+ * @brief 按服务器列表差异更新寻址数据
+ * @info  当前数据拷贝到非当前下标的共享内存，统计数据清零后只对变化的服务器做删除、
+ *        新增和修改，未变化的服务器保持原来的动态权重、死机和摘除状态，不做权重调整；
+ *        删除用末尾服务器填补，新增放在非死机服务器末尾，多阶hash按变化增量维护；
+ *        切换后按槽位对应关系合并统计数据，不需要按IP查找
+ * @return =0 成功 <0 新配置中有重复IP，没有切换，调用方需要全量更新
+ */
+int32_t patch_servers(struct shm_meta *meta, struct shm_servers **servs_data, const struct shm_servers *new_svrs,
+                      const struct servers_delta *delta)
+{
+    uint32_t i, idx, new_idx;
+    uint32_t num, alive;
+    uint32_t *slot;
+    BOOL     rehash = FALSE;
+    const struct server_info *new_svr;
+    struct server_info *server;
+    struct shm_servers *cur_shm_servers;
+    struct shm_servers *next_shm_servers;
+
+    idx              = meta->index;
+    new_idx          = (idx+1)%2;
+    cur_shm_servers  = servs_data[idx];
+    next_shm_servers = servs_data[new_idx];
+    num              = cur_shm_servers->server_num;
+    alive            = num - cur_shm_servers->dead_num;
+
+    memcpy(next_shm_servers, cur_shm_servers, sizeof(struct shm_servers) + sizeof(struct server_info) * num);
+    clean_servers_stat(next_shm_servers);
+    for (i = 0; i < num; i++) {
+        next_shm_servers->svrs[i].inflight = 0;
+        delta_slots[i] = i;
+    }
+
+    /* 删除: 非死机区域用最后一个非死机服务器填补，再用最后一个服务器填补死机区域的空位 */
+    for (i = 0; i < delta->del_num; i++) {
+        slot = find_server_hash(delta->del[i], next_shm_servers);
+        if (NULL == slot) {
+            continue;
+        }
+
+        idx   = *slot;
+        *slot = 0xffffffff;
+        if (idx < alive) {
+            alive--;
+            move_server(next_shm_servers, alive, idx);
+            idx = alive;
+        }
+
+        num--;
+        move_server(next_shm_servers, num, idx);
+    }
+    next_shm_servers->server_num = num;
+
+    /* 修改: 只更新寻址配置，动态权重不超过新的静态权重 */
+    for (i = 0; i < delta->mod_num; i++) {
+        new_svr = &new_svrs->svrs[delta->mod[i]];
+        slot    = find_server_hash(new_svr->server_ip, next_shm_servers);
+        if (NULL == slot) {
+            continue;
+        }
+
+        server                 = &next_shm_servers->svrs[*slot];
+        server->weight_static  = new_svr->weight_static;
+        server->weight_dynamic = min(server->weight_dynamic, server->weight_static);
+        server->port_type      = new_svr->port_type;
+        server->port_num       = new_svr->port_num;
+        memcpy(server->port, new_svr->port, sizeof(server->port));
+    }
+
+    /* 新增: 第一个死机服务器移到末尾，新服务器放在非死机服务器末尾 */
+    for (i = 0; i < delta->add_num; i++) {
+        new_svr = &new_svrs->svrs[delta->add[i]];
+        if (find_server_hash(new_svr->server_ip, next_shm_servers)) {
+            return -1;
+        }
+
+        move_server(next_shm_servers, alive, num);
+        server = &next_shm_servers->svrs[alive];
+        memset(server, 0, sizeof(*server));
+        server->server_ip      = new_svr->server_ip;
+        server->weight_static  = new_svr->weight_static;
+        server->weight_dynamic = new_svr->weight_static;
+        server->port_type      = new_svr->port_type;
+        server->port_num       = new_svr->port_num;
+        memcpy(server->port, new_svr->port, sizeof(server->port));
+        start_warmup(next_shm_servers, server);
+        delta_slots[alive] = 0xffffffff;
+
+        next_shm_servers->server_num = ++num;
+        if (insert_server_hash(next_shm_servers, alive++) < 0) {
+            rehash = TRUE;
+        }
+    }
+
+    next_shm_servers->weight_static_total = new_svrs->weight_static_total;
+    calc_servers_weight(next_shm_servers);
+    if (rehash) {
+        calc_servers_hash(next_shm_servers);
+    }
+
+    /* 设置新寻址服务器数据 */
+    mb();
+    meta->index = new_idx;
+
+    /* 未变化的服务器位置一一对应，直接合并切换期间的统计数据 */
+    for (i = 0; i < num; i++) {
+        if (delta_slots[i] != 0xffffffff) {
+            merge_server_stat(next_shm_servers, &next_shm_servers->svrs[i], &cur_shm_servers->svrs[delta_slots[i]]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+#ifndef _SHAPING_H_
+#define _SHAPING_H_
+
+#include <stdint.h>
+#include "commtype.h"
+#include "commstruct.h"
+
+/* 权重调整分支 */
+enum {
+    NLB_SHAPING_NONE       = 0,     /* 没有服务器，未调整 */
+    NLB_SHAPING_BASE_RATIO = 1,     /* 按基准成功率调整，可以降权 */
+    NLB_SHAPING_AVG_RATIO  = 2,     /* 低权重机器过多，按平均成功率调整，只加权 */
+};
+
+#define NLB_SERVERS_DELTA_RATIO 4   /* 变化的服务器超过1/4时全量更新 */
+
+/* 服务器列表差异 */
+struct servers_delta {
+    uint32_t add_num;                   /* 新增服务器数 */
+    uint32_t del_num;                   /* 删除服务器数 */
+    uint32_t mod_num;                   /* 权重或者端口变化的服务器数 */
+    uint32_t add[NLB_SERVER_MAX];       /* 新增服务器在新配置中的下标 */
+    uint32_t del[NLB_SERVER_MAX];       /* 删除服务器的IP */
+    uint32_t mod[NLB_SERVER_MAX];       /* 变化服务器在新配置中的下标 */
+};
+
+/**
+ * @brief  服务器权重上限回调，用于排空等外部状态限制动态权重
+ * @return 静态权重的千分比，>=1000表示不限制
+ */
+typedef uint32_t (*weight_cap_handler)(const struct shm_servers *servers, const struct server_info *server);
+
+/**
+ * @brief 服务器权重上限准备回调，计算一个业务的权重上限前调用，用于计算业务级的基准
+ */
+typedef void (*weight_cap_prepare_handler)(const struct shm_servers *servers);
+
+/**
+ * @brief 重新初始化多阶索引
+ */
+void calc_servers_hash(struct shm_servers *servers);
+
+/**
+ * @brief 清空服务器统计数据
+ * @info  包括时延、成功数、失败数，清空后可以写入共享内存
+ */
+void clean_servers_stat(struct shm_servers *servers);
+
+/**
+ * @brief 计算服务器的权重信息
+ */
+void calc_servers_weight(struct shm_servers *servers);
+
+/**
+ * @brief 对服务器信息做调整
+ * @info  包括调整动态权重，死机等信息
+ * @param ratio: 输出本次使用的基准成功率，可以为NULL
+ * @return 调整分支 NLB_SHAPING_XXX
+ */
+int32_t shaping_servers(struct shm_servers *servers, float *ratio);
+
+/**
+ * @brief 拷贝服务器信息数据
+ * @info  拷贝服务器数据的同时，计算统计数据
+ */
+void copy_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower);
+
+/**
+ * @brief 拷贝指定的服务器信息数据
+ * @info  拷贝指定的服务器数据的同时，计算统计数据
+ */
+void copy_specified_servers(struct shm_servers *dst_svrs, struct shm_servers *src_svrs, uint32_t lower);
+
+/**
+ * @brief 通过IP获取服务器信息
+ */
+struct server_info *get_server_info(uint32_t ip, struct shm_servers *servers);
+
+/**
+ * @brief 合并统计数据
+ */
+void merge_servers_stat(struct shm_servers *dst_svrs, struct shm_servers *src_svrs);
+
+/**
+ * @brief 检查服务器是否真死了
+ */
+BOOL check_server_real_dead(struct server_info *server, float success_ratio);
+
+/**
+ * @brief 服务器开始预热，没有开启预热时不做处理
+ */
+void start_warmup(struct shm_servers *servers, struct server_info *server);
+
+/**
+ * @brief 死机服务器恢复，清除死机标记并设置动态权重
+ * @info  开启预热时恢复静态权重，由API按预热曲线平滑增加实际权重
+ */
+void resume_server(struct shm_servers *servers, struct server_info *server);
+
+/**
+ * @brief 撤销排空的服务器恢复权重，死机服务器不处理
+ */
+void undrain_server(struct shm_servers *servers, struct server_info *server);
+
+/**
+ * @brief 计算预热曲线表
+ */
+void calc_slow_start_ramp(struct shm_servers *servers);
+
+/**
+ * @brief 结束已经完成预热的服务器
+ */
+void reconcile_warmup(struct shm_servers *servers);
+
+/**
+ * @brief 根据时延梯度计算服务器的并发上限
+ * @info  使用本周期的平均时延和最小时延，需要在清除统计数据之前调用
+ */
+void calc_servers_limit(struct shm_servers *servers);
+
+/**
+ * @brief 调整客户端摘除状态
+ * @info  已判死的服务器清除摘除状态，未摘除的服务器退避级别逐步衰减
+ */
+void reconcile_ejection(struct shm_servers *servers);
+
+/**
+ * @brief  计算新配置和当前数据的服务器列表差异
+ * @info   业务参数变化、IP重复或者变化过多时不做增量更新
+ * @return =0 可以增量更新 <0 需要全量更新
+ */
+int32_t calc_servers_delta(const struct shm_servers *new_svrs, struct shm_servers *cur_svrs,
+                           struct servers_delta *delta);
+
+/**
+ * @brief  按服务器列表差异更新寻址数据并切换
+ * @info   只处理变化的服务器，未变化的服务器保持槽位和状态，不做权重调整
+ * @return =0 成功 <0 失败，没有切换，调用方需要全量更新
+ */
+int32_t patch_servers(struct shm_meta *meta, struct shm_servers **servs_data, const struct shm_servers *new_svrs,
+                      const struct servers_delta *delta);
+
+/**
+ * @brief 调整私有服务器数据并写入共享内存
+ * @info  servers为拷贝了统计数据的私有内存，调整后写入非当前下标的共享内存，
+ *        然后切换下标，并把切换期间产生的统计数据合并到新数据中
+ */
+void reshape_servers(struct shm_meta *meta, struct shm_servers **servs_data, struct shm_servers *servers);
+
+/**
+ * @brief 设置服务器权重上限回调，调整权重时按上限降低非死机服务器的动态权重
+ * @param prepare 准备回调，可以为NULL
+ */
+void set_weight_cap_handler(weight_cap_handler handler, weight_cap_prepare_handler prepare);
+
+/**
+ * @brief 按权重上限降低非死机服务器的动态权重
+ */
+void apply_weight_cap(struct shm_servers *servers);
+
+/**
+ * @brief 检查是否有非死机服务器的动态权重超过权重上限
+ */
+BOOL check_servers_capped(struct shm_servers *servers);
+
+/**
+ * @brief 只按权重上限重新计算权重并写入共享内存，不做成功率调整
+ */
+void reweight_servers(struct shm_meta *meta, struct shm_servers **servs_data, struct shm_servers *servers);
+
+#endif
+
@@ -0,0 +1,315 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcchunk.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "commstruct.h"
+#include "list.h"
+#include "hash.h"
+#include "zookeeper.h"
+#include "log.h"
+#include "event.h"
+#include "zkplugin.h"
+#include "zkservice.h"
+#include "jsonparser.h"
+#include "routeprocess.h"
+#include "svcchunk.h"
+
+#define NLB_SVCCHUNK_HASH_LEN   (1024)      /* 分片业务hash桶数 */
+
+/* 已解析的分片 */
+struct svc_shard {
+    uint64_t version;               /* 分片版本 */
+    BOOL     loaded;                /* 是否已加载 */
+    uint32_t server_num;            /* 服务器数 */
+    uint32_t weight_static_total;   /* 静态权重总和 */
+    struct server_info *svrs;       /* 服务器列表 */
+};
+
+/* 分片业务 */
+struct svc_chunks {
+    struct list_head hash_node;
+    char     name[NLB_SERVICE_NAME_LEN];
+    uint64_t mtime;                 /* 正在加载的清单mtime */
+    uint32_t generation;            /* 清单代数，丢弃过期的分片回调 */
+    uint32_t pending;               /* 未完成的分片请求数 */
+    uint32_t fetched;               /* 本次拉取的分片数 */
+    BOOL     failed;                /* 本次是否有分片失败 */
+    uint32_t shard_num;             /* 清单中的分片数 */
+    uint64_t versions[NLB_SERVICE_SHARD_MAX];   /* 清单中的分片版本 */
+    struct shm_servers params;      /* 清单中的业务参数 */
+    struct svc_shard shards[NLB_SERVICE_SHARD_MAX];
+};
+
+/* 分片请求上下文 */
+struct shard_ctx {
+    struct svc_chunks *chunks;
+    uint32_t index;
+    uint32_t generation;
+};
+
+static struct list_head chunks_hash[NLB_SVCCHUNK_HASH_LEN];
+static BOOL chunks_inited = FALSE;
+
+/**
+ * @brief 查找分片业务，不存在时创建
+ */
+static struct svc_chunks *get_svc_chunks(const char *name)
+{
+    uint32_t i, hash;
+    struct svc_chunks *chunks;
+
+    if (!chunks_inited) {
+        for (i = 0; i < NLB_SVCCHUNK_HASH_LEN; i++) {
+            INIT_LIST_HEAD(&chunks_hash[i]);
+        }
+        chunks_inited = TRUE;
+    }
+
+    hash = gen_hash_key(name) % NLB_SVCCHUNK_HASH_LEN;
+    list_for_each_entry(chunks, &chunks_hash[hash], hash_node) {
+        if (!strcmp(chunks->name, name)) {
+            return chunks;
+        }
+    }
+
+    chunks = (struct svc_chunks *)calloc(1, sizeof(struct svc_chunks));
+    if (NULL == chunks) {
+        NLOG_ERROR("No memory");
+        return NULL;
+    }
+
+    strncpy(chunks->name, name, NLB_SERVICE_NAME_LEN - 1);
+    list_add(&chunks->hash_node, &chunks_hash[hash]);
+
+    return chunks;
+}
+
+/* 释放分片的服务器列表 */
+static void free_svc_shard(struct svc_shard *shard)
+{
+    free(shard->svrs);
+    memset(shard, 0, sizeof(*shard));
+}
+
+/**
+ * @brief  拼接所有分片，更新本地业务
+ * @return =0 成功 <0 失败
+ */
+static int32_t assemble_svc_chunks(struct svc_chunks *chunks)
+{
+    int32_t  ret;
+    uint32_t i, total = 0;
+    struct shm_servers *servers;
+    struct server_info *pos;
+
+    for (i = 0; i < chunks->shard_num; i++) {
+        total += chunks->shards[i].server_num;
+    }
+
+    if ((total == 0) || (total >= NLB_SERVER_MAX)) {
+        NLOG_ERROR("service (%s) shards have invalid server number [%u]", chunks->name, total);
+        return -1;
+    }
+
+    servers = (struct shm_servers *)malloc(sizeof(struct shm_servers) + sizeof(struct server_info) * total);
+    if (NULL == servers) {
+        NLOG_ERROR("No memory");
+        return -2;
+    }
+
+    memcpy(servers, &chunks->params, sizeof(struct shm_servers));
+    servers->server_num          = total;
+    servers->weight_static_total = 0;
+
+    pos = servers->svrs;
+    for (i = 0; i < chunks->shard_num; i++) {
+        memcpy(pos, chunks->shards[i].svrs, sizeof(struct server_info) * chunks->shards[i].server_num);
+        pos += chunks->shards[i].server_num;
+        servers->weight_static_total += chunks->shards[i].weight_static_total;
+    }
+
+    ret = update_rdata_by_zk_service_servers(chunks->name, servers, chunks->mtime);
+    free(servers);
+
+    return (ret < 0) ? -3 : 0;
+}
+
+/**
+ * @brief 所有分片请求完成
+ * @info  有分片失败时保留本地数据，产生业务事件稍后重新拉取
+ */
+static void finish_svc_chunks(struct svc_chunks *chunks)
+{
+    if (chunks->failed || (assemble_svc_chunks(chunks) < 0)) {
+        NLOG_ERROR("load service (%s) shards failed", chunks->name);
+        delete_route_task(chunks->name);
+        add_service_event(chunks->name);
+        return;
+    }
+
+    NLOG_INFO("receive service (%s) shards [%u], fetched [%u]", chunks->name, chunks->shard_num, chunks->fetched);
+    process_route_task(chunks->name);
+}
+
+/**
+ * @brief 分片节点get回调函数
+ */
+static void shard_aget_completion(int32_t rc, const char *value, int32_t value_len,
+                                  const struct Stat *stat, const void *data)
+{
+    int32_t ret;
+    struct shard_ctx  *ctx    = (struct shard_ctx *)data;
+    struct svc_chunks *chunks = ctx->chunks;
+    struct svc_shard   shard;
+
+    /* 清单已经变化，丢弃过期的结果 */
+    if (ctx->generation != chunks->generation) {
+        free(ctx);
+        return;
+    }
+
+    memset(&shard, 0, sizeof(shard));
+    if (rc != ZOK) {
+        NLOG_ERROR("get service (%s) shard [%u] failed, [%s]", chunks->name, ctx->index, zerror(rc));
+        chunks->failed = TRUE;
+    } else {
+        ret = json_parse_service_shard(value, value_len, &shard.svrs, &shard.server_num, &shard.weight_static_total);
+        if (ret < 0) {
+            NLOG_ERROR("parse service (%s) shard [%u] failed, ret [%d]", chunks->name, ctx->index, ret);
+            chunks->failed = TRUE;
+        } else {
+            free_svc_shard(&chunks->shards[ctx->index]);
+            shard.version = chunks->versions[ctx->index];
+            shard.loaded  = TRUE;
+            chunks->shards[ctx->index] = shard;
+        }
+    }
+
+    free(ctx);
+
+    if (--chunks->pending == 0) {
+        finish_svc_chunks(chunks);
+    }
+}
+
+/**
+ * @brief  拉取一个分片
+ * @return =0 成功 <0 失败
+ */
+static int32_t fetch_svc_shard(struct svc_chunks *chunks, uint32_t index)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+    size_t  len;
+    struct shard_ctx *ctx;
+
+    if (make_zk_service_path(chunks->name, path, sizeof(path)) < 0) {
+        return -1;
+    }
+
+    len = strlen(path);
+    snprintf(path + len, sizeof(path) - len, "/%u", index);
+
+    ctx = (struct shard_ctx *)malloc(sizeof(struct shard_ctx));
+    if (NULL == ctx) {
+        NLOG_ERROR("No memory");
+        return -2;
+    }
+
+    ctx->chunks     = chunks;
+    ctx->index      = index;
+    ctx->generation = chunks->generation;
+
+    ret = zoo_aget(get_zk_instance(), path, 0, shard_aget_completion, ctx);
+    if (ret != ZOK) {
+        NLOG_ERROR("get service shard (%s) failed, [%s]", path, zerror(ret));
+        free(ctx);
+        return -3;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  加载分片业务的清单
+ * @return =0 成功 <0 清单格式错误
+ */
+int32_t svcchunk_load(const char *name, const char *value, int32_t value_len, uint64_t mtime)
+{
+    int32_t  ret;
+    uint32_t i;
+    struct svc_chunks *chunks;
+
+    chunks = get_svc_chunks(name);
+    if (NULL == chunks) {
+        return -1;
+    }
+
+    /* 新清单使正在进行的分片请求过期 */
+    ret = json_parse_manifest(value, value_len, &chunks->params, chunks->versions, &chunks->shard_num);
+    if (ret < 0) {
+        NLOG_ERROR("Parse service (%s) manifest failed, ret [%d]", name, ret);
+        chunks->generation++;
+        chunks->pending = 0;
+        return -2;
+    }
+
+    chunks->generation++;
+    chunks->mtime   = mtime;
+    chunks->pending = 0;
+    chunks->fetched = 0;
+    chunks->failed  = FALSE;
+
+    for (i = chunks->shard_num; i < NLB_SERVICE_SHARD_MAX; i++) {
+        if (chunks->shards[i].loaded) {
+            free_svc_shard(&chunks->shards[i]);
+        }
+    }
+
+    /* 版本变化的分片并行拉取，计数在所有请求发出后才可能归零 */
+    chunks->pending = 1;
+    for (i = 0; i < chunks->shard_num; i++) {
+        if (chunks->shards[i].loaded && (chunks->shards[i].version == chunks->versions[i])) {
+            continue;
+        }
+
+        if (fetch_svc_shard(chunks, i) < 0) {
+            chunks->failed = TRUE;
+            continue;
+        }
+
+        chunks->pending++;
+        chunks->fetched++;
+    }
+
+    if (--chunks->pending == 0) {
+        finish_svc_chunks(chunks);
+    }
+
+    return 0;
+}
+
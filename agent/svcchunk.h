@@ -0,0 +1,42 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcchunk.h
+ * @info     分片业务配置
+ *           服务器很多的业务把配置拆成一个清单节点和N个分片节点，清单节点为业务节点本身，
+ *           内容为{"IPShards":[v0,v1,...], 业务参数...}，分片节点为业务节点的子节点0~N-1，
+ *           内容为{"IPInfo":[...]}。发布者先写分片，再更新清单中该分片的版本。
+ *           agent缓存已解析的分片，清单变化时只并行拉取版本变化的分片，拼接后更新本地业务
+ */
+
+#ifndef _SVCCHUNK_H_
+#define _SVCCHUNK_H_
+
+#include <stdint.h>
+
+/**
+ * @brief  加载分片业务的清单
+ * @info   版本没有变化的分片直接使用缓存，全部分片就绪后更新本地业务并处理路由请求任务
+ * @return =0 成功 <0 清单格式错误
+ */
+int32_t svcchunk_load(const char *name, const char *value, int32_t value_len, uint64_t mtime);
+
+#endif
+
@@ -0,0 +1,218 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcindex.c
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "log.h"
+#include "shaping.h"
+#include "svcindex.h"
+
+static struct svc_index_node **index_buckets;   /* hash桶 */
+static uint32_t index_mask;                     /* hash桶数-1 */
+static uint32_t index_count;                    /* 索引节点数 */
+
+/* IP的hash桶 */
+static inline uint32_t svcindex_bucket(uint32_t ip)
+{
+    return hash_ip(ip) & index_mask;
+}
+
+/* 节点加入hash冲突链头 */
+static void svcindex_link(struct svc_index_node *node)
+{
+    struct svc_index_node **head = &index_buckets[svcindex_bucket(node->ip)];
+
+    node->next  = *head;
+    node->pprev = head;
+    if (*head) {
+        (*head)->pprev = &node->next;
+    }
+    *head = node;
+}
+
+/* 节点从hash冲突链删除 */
+static void svcindex_unlink(struct svc_index_node *node)
+{
+    *node->pprev = node->next;
+    if (node->next) {
+        node->next->pprev = node->pprev;
+    }
+}
+
+/**
+ * @brief  扩容hash桶，装载率超过1时翻倍
+ * @return =0 成功 <0 内存不足
+ */
+static int32_t svcindex_grow(void)
+{
+    uint32_t i, size = index_buckets ? (index_mask + 1) * 2 : NLB_SVC_INDEX_MIN_SIZE;
+    struct svc_index_node **old = index_buckets;
+    struct svc_index_node *node, *next;
+    uint32_t old_size = index_buckets ? (index_mask + 1) : 0;
+
+    index_buckets = calloc(size, sizeof(*index_buckets));
+    if (NULL == index_buckets) {
+        index_buckets = old;
+        return -1;
+    }
+
+    index_mask = size - 1;
+    for (i = 0; i < old_size; i++) {
+        for (node = old[i]; node; node = next) {
+            next = node->next;
+            svcindex_link(node);
+        }
+    }
+
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief 删除业务的所有索引
+ */
+void svcindex_remove(struct agent_local_rdata *rdata)
+{
+    struct svc_index_node *node, *tmp;
+
+    list_for_each_entry_safe(node, tmp, &rdata->index_list, rdata_node) {
+        svcindex_unlink(node);
+        list_del(&node->rdata_node);
+        free(node);
+        index_count--;
+    }
+}
+
+/**
+ * @brief  业务增加一个服务器的索引
+ * @info   调用方保证该业务还没有这个IP的索引，不需要遍历共享该IP的所有业务
+ * @return =0 成功 <0 内存不足
+ */
+int32_t svcindex_add(struct agent_local_rdata *rdata, uint32_t ip)
+{
+    struct svc_index_node *node;
+
+    if ((index_count >= (index_buckets ? index_mask + 1 : 0)) && (svcindex_grow() < 0)) {
+        NLOG_ERROR("No memory");
+        return -1;
+    }
+
+    node = malloc(sizeof(*node));
+    if (NULL == node) {
+        NLOG_ERROR("No memory");
+        return -2;
+    }
+
+    node->ip    = ip;
+    node->rdata = rdata;
+    svcindex_link(node);
+    list_add_tail(&node->rdata_node, &rdata->index_list);
+    index_count++;
+
+    return 0;
+}
+
+/**
+ * @brief 删除业务的一个服务器的索引
+ */
+void svcindex_del(struct agent_local_rdata *rdata, uint32_t ip)
+{
+    struct svc_index_node *node;
+
+    for (node = svcindex_find(ip); node; node = svcindex_next(node)) {
+        if (node->rdata == rdata) {
+            svcindex_unlink(node);
+            list_del(&node->rdata_node);
+            free(node);
+            index_count--;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief  按业务当前的服务器列表重建该业务的索引
+ * @return =0 成功 <0 内存不足，索引不完整
+ */
+int32_t svcindex_update(struct agent_local_rdata *rdata, const struct shm_servers *servers)
+{
+    uint32_t i;
+    int32_t  ret;
+    struct server_info *first;
+
+    svcindex_remove(rdata);
+
+    for (i = 0; i < servers->server_num; i++) {
+        /* 同一IP多个端口只索引一次，多阶hash返回该IP的第一个服务器 */
+        first = get_server_info(servers->svrs[i].server_ip, (struct shm_servers *)servers);
+        if (first && first != &servers->svrs[i]) {
+            continue;
+        }
+
+        ret = svcindex_add(rdata, servers->svrs[i].server_ip);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  查找包含服务器的第一个业务
+ * @return NULL 没有业务包含该服务器
+ */
+struct svc_index_node *svcindex_find(uint32_t ip)
+{
+    struct svc_index_node *node;
+
+    if (NULL == index_buckets) {
+        return NULL;
+    }
+
+    for (node = index_buckets[svcindex_bucket(ip)]; node; node = node->next) {
+        if (node->ip == ip) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  查找包含同一服务器的下一个业务
+ * @return NULL 没有更多业务
+ */
+struct svc_index_node *svcindex_next(struct svc_index_node *node)
+{
+    uint32_t ip = node->ip;
+
+    for (node = node->next; node; node = node->next) {
+        if (node->ip == ip) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,79 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcindex.h
+ * @info     服务器IP到业务的反向索引
+ *           业务服务器列表变化时更新，节点事件只分发给包含该服务器的业务，
+ *           不需要遍历所有业务逐个查找
+ */
+
+#ifndef _SVCINDEX_H_
+#define _SVCINDEX_H_
+
+#include <stdint.h>
+#include "list.h"
+#include "agent.h"
+
+#define NLB_SVC_INDEX_MIN_SIZE  (1024)      /* 初始hash桶数，2的幂 */
+
+/* 索引节点，一个(IP, 业务)对 */
+struct svc_index_node {
+    uint32_t ip;                            /* 服务器IP，网络字节序 */
+    struct agent_local_rdata *rdata;        /* 包含该服务器的业务 */
+    struct svc_index_node *next;            /* hash冲突链 */
+    struct svc_index_node **pprev;          /* 冲突链上指向自己的指针 */
+    struct list_head rdata_node;            /* 业务的索引节点链表 */
+};
+
+/**
+ * @brief  按业务当前的服务器列表重建该业务的索引
+ * @return =0 成功 <0 内存不足，索引不完整
+ */
+int32_t svcindex_update(struct agent_local_rdata *rdata, const struct shm_servers *servers);
+
+/**
+ * @brief  业务增加一个服务器的索引，调用方保证该业务还没有这个IP的索引
+ * @return =0 成功 <0 内存不足
+ */
+int32_t svcindex_add(struct agent_local_rdata *rdata, uint32_t ip);
+
+/**
+ * @brief 删除业务的一个服务器的索引
+ */
+void svcindex_del(struct agent_local_rdata *rdata, uint32_t ip);
+
+/**
+ * @brief 删除业务的所有索引
+ */
+void svcindex_remove(struct agent_local_rdata *rdata);
+
+/**
+ * @brief  查找包含服务器的第一个业务
+ * @return NULL 没有业务包含该服务器
+ */
+struct svc_index_node *svcindex_find(uint32_t ip);
+
+/**
+ * @brief  查找包含同一服务器的下一个业务
+ * @return NULL 没有更多业务
+ */
+struct svc_index_node *svcindex_next(struct svc_index_node *node);
+
+#endif
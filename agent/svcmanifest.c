@@ -0,0 +1,219 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcmanifest.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "commstruct.h"
+#include "hash.h"
+#include "nlbtime.h"
+#include "list.h"
+#include "agent.h"
+#include "log.h"
+#include "svcmanifest.h"
+
+static BOOL     manifest_dirty;         /* 本地业务有变化，需要保存 */
+static uint64_t manifest_save_time;
+
+/* 按最近访问时间从近到远排序，访问时间相同时请求量大的在前 */
+static int32_t manifest_entry_cmp(const void *a, const void *b)
+{
+    const struct svc_manifest_entry *ea = (const struct svc_manifest_entry *)a;
+    const struct svc_manifest_entry *eb = (const struct svc_manifest_entry *)b;
+
+    if (ea->access_time != eb->access_time) {
+        return (ea->access_time > eb->access_time) ? -1 : 1;
+    }
+
+    if (ea->traffic != eb->traffic) {
+        return (ea->traffic > eb->traffic) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  读取本地业务清单，按最近访问时间从近到远排序
+ * @return >=0 业务数 <0 没有可用的清单
+ */
+int32_t svcmanifest_load(struct svc_manifest_entry **entries)
+{
+    FILE *fp;
+    uint32_t i, num;
+    struct stat st;
+    struct svc_manifest_head head;
+    struct svc_manifest_entry *items;
+
+    fp = fopen(NLB_MANIFEST_PATH, "r");
+    if (NULL == fp) {
+        return -1;
+    }
+
+    if (fstat(fileno(fp), &st) < 0 || fread(&head, sizeof(head), 1, fp) != 1
+        || head.magic != NLB_MANIFEST_MAGIC || head.version != NLB_MANIFEST_VERSION) {
+        fclose(fp);
+        return -2;
+    }
+
+    num = head.num;
+    if ((uint64_t)st.st_size != sizeof(head) + (uint64_t)num * sizeof(struct svc_manifest_entry)) {
+        fclose(fp);
+        return -3;
+    }
+
+    items = (struct svc_manifest_entry *)malloc(sizeof(struct svc_manifest_entry) * (num + 1));
+    if (NULL == items) {
+        fclose(fp);
+        return -4;
+    }
+
+    if (fread(items, sizeof(struct svc_manifest_entry), num, fp) != num
+        || gen_adler32(items, sizeof(struct svc_manifest_entry) * num) != head.checksum) {
+        fclose(fp);
+        free(items);
+        return -5;
+    }
+
+    fclose(fp);
+
+    for (i = 0; i < num; i++) {
+        items[i].name[NLB_SERVICE_NAME_LEN - 1] = '\0';
+    }
+
+    qsort(items, num, sizeof(struct svc_manifest_entry), manifest_entry_cmp);
+    *entries = items;
+
+    return (int32_t)num;
+}
+
+/**
+ * @brief 标记本地业务有变化，下次定时处理时保存清单
+ */
+void svcmanifest_touch(void)
+{
+    manifest_dirty = TRUE;
+}
+
+/**
+ * @brief  保存本地业务清单，写临时文件后rename
+ * @return =0 成功 <0 失败
+ */
+int32_t svcmanifest_save(void)
+{
+    FILE *fp;
+    uint32_t num = 0;
+    struct svc_manifest_head head;
+    struct svc_manifest_entry *items;
+    struct svc_manifest_entry *item;
+    struct agent_local_rdata *rdata;
+    struct list_head *rdata_list = get_rdata_list();
+
+    list_for_each_entry(rdata, rdata_list, list_node) {
+        num++;
+    }
+
+    items = (struct svc_manifest_entry *)calloc(num + 1, sizeof(struct svc_manifest_entry));
+    if (NULL == items) {
+        NLOG_ERROR("No memory");
+        return -1;
+    }
+
+    num = 0;
+    list_for_each_entry(rdata, rdata_list, list_node) {
+        item = &items[num++];
+        strncpy(item->name, rdata->name, NLB_SERVICE_NAME_LEN - 1);
+        item->mtime       = rdata->route_meta->mtime;
+        item->access_time = rdata->access_time;
+        item->traffic     = rdata->traffic;
+        item->server_num  = rdata->servs_data[rdata->route_meta->index]->server_num;
+    }
+
+    head.magic    = NLB_MANIFEST_MAGIC;
+    head.version  = NLB_MANIFEST_VERSION;
+    head.num      = num;
+    head.checksum = gen_adler32(items, sizeof(struct svc_manifest_entry) * num);
+
+    fp = fopen(NLB_MANIFEST_PATH".tmp", "w");
+    if (NULL == fp) {
+        NLOG_ERROR("open manifest file failed, [%m]");
+        free(items);
+        return -2;
+    }
+
+    if (fwrite(&head, sizeof(head), 1, fp) != 1
+        || fwrite(items, sizeof(struct svc_manifest_entry), num, fp) != num) {
+        NLOG_ERROR("write manifest file failed, [%m]");
+        fclose(fp);
+        free(items);
+        return -3;
+    }
+
+    free(items);
+    if (fclose(fp) != 0 || rename(NLB_MANIFEST_PATH".tmp", NLB_MANIFEST_PATH) < 0) {
+        NLOG_ERROR("save manifest file failed, [%m]");
+        return -4;
+    }
+
+    manifest_dirty = FALSE;
+
+    return 0;
+}
+
+/**
+ * @brief 是否有业务最近有请求
+ */
+static BOOL manifest_has_traffic(void)
+{
+    struct agent_local_rdata *rdata;
+
+    list_for_each_entry(rdata, get_rdata_list(), list_node) {
+        if (rdata->traffic) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 清单主循环处理函数，业务有变化或者有请求时定期保存
+ * @info  请求量和最近访问时间决定下次启动的加载和同步顺序，没有请求时保留上次的记录
+ */
+void svcmanifest_run(void)
+{
+    uint64_t now;
+
+    /* 保存失败时同样等待一个间隔再重试 */
+    now = get_time_ms();
+    if (manifest_save_time + NLB_MANIFEST_INTERVAL > now) {
+        return;
+    }
+
+    manifest_save_time = now;
+    if (manifest_dirty || manifest_has_traffic()) {
+        svcmanifest_save();
+    }
+}
@@ -0,0 +1,79 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcmanifest.h
+ * @info     本地业务清单
+ *           记录agent管理的所有本地业务(业务名、修改时间、服务器数、最近访问时间和请求量)，
+ *           定期写入文件。启动时按清单并行加载本地业务，目录扫描在就绪后后台进行，
+ *           最近访问的业务先加载，请求量作为重新同步的优先级(代替单独的热点业务列表)
+ */
+
+#ifndef _SVCMANIFEST_H_
+#define _SVCMANIFEST_H_
+
+#include <stdint.h>
+#include "commdef.h"
+
+#define NLB_MANIFEST_MAGIC      (0x4e4c424d)    /* "NLBM" */
+#define NLB_MANIFEST_VERSION    (1)
+#define NLB_MANIFEST_INTERVAL   (300000)        /* 清单保存间隔(ms) */
+
+/* 清单文件头 */
+struct svc_manifest_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num;                       /* 业务数 */
+    uint32_t checksum;                  /* 所有业务记录的adler32 */
+};
+
+/* 清单中的一个业务 */
+struct svc_manifest_entry {
+    char     name[NLB_SERVICE_NAME_LEN];    /* 业务名 */
+    uint64_t mtime;                         /* 配置修改时间 */
+    uint64_t access_time;                   /* 最近有请求的时间(s) */
+    uint64_t traffic;                       /* 最近每周期的请求量，平滑值 */
+    uint32_t server_num;                    /* 服务器数 */
+    uint32_t reserved;
+};
+
+/**
+ * @brief  读取本地业务清单，按最近访问时间从近到远排序
+ * @info   文件不存在、长度或者校验和错误时返回失败，调用方需要释放entries
+ * @return >=0 业务数 <0 没有可用的清单
+ */
+int32_t svcmanifest_load(struct svc_manifest_entry **entries);
+
+/**
+ * @brief 标记本地业务有变化，下次定时处理时保存清单
+ */
+void svcmanifest_touch(void);
+
+/**
+ * @brief  保存本地业务清单，写临时文件后rename
+ * @return =0 成功 <0 失败
+ */
+int32_t svcmanifest_save(void);
+
+/**
+ * @brief 清单主循环处理函数，业务有变化或者有请求时定期保存
+ */
+void svcmanifest_run(void);
+
+#endif
@@ -17,6 +17,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -25,201 +26,361 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <stdio.h>
-#include <string.h>
-#include <time.h>
 #include <net/if.h>
-#include <sys/ioctl.h>
 #include <linux/sockios.h>
 #include <unistd.h>
 
+#include "commdef.h"
 #include "commtype.h"
 #include "log.h"
+#include "nlbtime.h"
 #include "sysinfo.h"
+#include "utils.h"
+
+#define DEAULT_ETH_SPEED        1000                /* 获取不到网卡速率时的默认值，Mb/s */
+#define ETH_SPEED_REFRESH       60000               /* 网卡速率刷新间隔，毫秒 */
+#define MAX_ETH_NUM             8
+#define SMALL_BUFF_SIZE         512                 /* 只读取首行或者小文件的缓冲区 */
+#define PROC_BUFF_SIZE          16384               /* /proc/meminfo, /proc/net/dev缓冲区 */
+#define PROC_CPU_STAT           "/proc/stat"
+#define PROC_MEM_STAT           "/proc/meminfo"
+#define PROC_NET_DEV            "/proc/net/dev"
+#define PROC_SELF_CGROUP        "/proc/self/cgroup"
+#define PROC_CPU_PRESSURE       "/proc/pressure/cpu"
+#define PROC_MEM_PRESSURE       "/proc/pressure/memory"
+#define CGROUP_ROOT             "/sys/fs/cgroup"
+#define CGROUP_UNIFIED_ROOT     "/sys/fs/cgroup/unified"
+
+/* 保持打开的统计文件 */
+enum {
+    SYS_FD_CPU_STAT = 0,        /* /proc/stat */
+    SYS_FD_MEM_STAT,            /* /proc/meminfo */
+    SYS_FD_NET_DEV,             /* /proc/net/dev */
+    SYS_FD_CPU_PSI,             /* cgroup或系统cpu.pressure */
+    SYS_FD_MEM_PSI,             /* cgroup或系统memory.pressure */
+    SYS_FD_CG_CPU_STAT,         /* cgroup cpu.stat */
+    SYS_FD_CG_CPU_MAX,          /* cgroup cpu.max */
+    SYS_FD_CG_MEM_CURRENT,      /* cgroup memory.current */
+    SYS_FD_CG_MEM_MAX,          /* cgroup memory.max */
+    SYS_FD_NUM,
+};
 
-#define MAX_LINE_SIZE     256
-#define DEAULT_ETH_SPEED  1000
-#define MAX_ETH_NUM       8
-#define PROC_CPU_STAT     "/proc/stat"
-#define PROC_MEM_STAT     "/proc/meminfo"
-#define PROC_NET_DEV      "/proc/net/dev"
-#define CALC_ETH_SPEED(s) (((s) * 1024 * 1024) / 8)
+/* 累计计数快照，两次采样取差值 */
+typedef struct _tag_sys_counter
+{
+    uint64_t    cpu_total;      /* CPU总时间，jiffies */
+    uint64_t    cpu_idle;       /* CPU空闲时间，包括IO等待 */
+    uint64_t    rcv_bytes;      /* 网卡接收字节数 */
+    uint64_t    snd_bytes;      /* 网卡发送字节数 */
+    uint64_t    cg_usage;       /* cgroup CPU使用时间，微秒 */
+    uint64_t    cg_periods;     /* cgroup CPU配额周期数 */
+    uint64_t    cg_throttled;   /* cgroup CPU被限流的周期数 */
+} sys_counter_t;
 
-typedef unsigned long long   llu64_t;
+/* 全局的系统资源信息 */
+struct sysinfo
+{
+    int32_t         fds[SYS_FD_NUM];    /* 统计文件，-1表示不可用 */
+    int32_t         sock;               /* 网卡ioctl socket */
+    uint32_t        ip;                 /* 本机IP */
+    char            eth_name[IFNAMSIZ]; /* 本机IP所在网卡，空表示没有找到 */
+    uint32_t        eth_speed;          /* 网卡速率，Mb/s */
+    uint64_t        speed_time;         /* 上次获取网卡速率的时间 */
+
+    uint64_t        sample_time;        /* 上次采样时间，毫秒，0表示还没有采样 */
+    sys_counter_t   last;               /* 上次采样的累计计数 */
+    BOOL            smoothed;           /* 已经有平滑值 */
+
+    double          cpu;                /* 平滑后的主机CPU使用率，千分比 */
+    double          cg_cpu;             /* 平滑后的cgroup CPU配额使用率，千分比 */
+    double          net_snd;            /* 平滑后的网卡发送使用率，千分比 */
+    double          net_rcv;            /* 平滑后的网卡接收使用率，千分比 */
+    double          throttle;           /* 平滑后的cgroup CPU限流比例，千分比 */
+
+    uint64_t        mem_total;          /* 内存总量 KB */
+    uint64_t        mem_free;           /* 内存可用 KB */
+    uint32_t        cpu_psi;            /* CPU压力，千分比，本身是10秒平均值 */
+    uint32_t        mem_psi;            /* 内存压力，千分比 */
+};
+
+static struct sysinfo sys_stat = {
+    .fds  = {-1, -1, -1, -1, -1, -1, -1, -1, -1},
+    .sock = -1,
+};
+
+static char proc_buff[PROC_BUFF_SIZE];
 
-/* CPU 实时快照结构定义 */
-typedef struct _tag_cpu_stat
+/**
+ * @brief  从文件头读取整个文件内容，文件保持打开
+ * @return >=0 读取长度 <0 失败
+ */
+static int32_t read_stat_file(int32_t fd, char *buff, int32_t size)
 {
-    uint64_t    total;          /* 总的计数值 */
-    uint64_t    user;           /* 累计的 用户态 */
-    uint64_t    nice;           /* 累计的 nice为负 */
-    uint64_t    system;         /* 系统态运行时间 */
-    uint64_t    idle;           /* IO等待以外的其他等待时间 */
-    uint64_t    iowait;         /* IO等待时间 */
-    uint64_t    irq;            /* 硬中断 */
-    uint64_t    softirq;        /* 软中断 */
-} cpu_stat_t;
-
-/* 内存数据结构定义 */
-typedef struct _tag_mem_stat
+    ssize_t len;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    len = pread(fd, buff, size - 1, 0);
+    if (len < 0) {
+        return -2;
+    }
+
+    buff[len] = '\0';
+    return (int32_t)len;
+}
+
+/* 跳过空白字符 */
+static const char *skip_space(const char *pos)
 {
-    uint64_t    mem_total;      /* 总的内存 KB  */
-    uint64_t    mem_free;       /* 可用物理内存 */
-    uint64_t    buffers;        /* buffer内存   */
-    uint64_t    cached;         /* 文件cache等  */
-    uint64_t    mapped;         /* 已映射内存   */
-    uint64_t    inactive_file;  /* 不活跃的文件cache */
-} mem_stat_t;
-
-typedef struct _tag_eth_info
+    while (*pos == ' ' || *pos == '\t') {
+        pos++;
+    }
+
+    return pos;
+}
+
+/* 解析一个无符号整数，pos移到数字之后 */
+static uint64_t parse_u64(const char **pos)
 {
-    uint32_t    ip;
-    char        eth_name[32];
-} eth_info_t;
+    uint64_t    value = 0;
+    const char *cur   = skip_space(*pos);
+
+    while (*cur >= '0' && *cur <= '9') {
+        value = value * 10 + (uint64_t)(*cur - '0');
+        cur++;
+    }
 
-/* 网卡数据结构定义 */
-typedef struct _tag_network_stat
+    *pos = cur;
+    return value;
+}
+
+/**
+ * @brief  查找行首的关键字，返回关键字之后的位置
+ * @return NULL 没有找到
+ */
+static const char *find_line_key(const char *buff, const char *key)
 {
-    uint64_t    rcv_bytes;
-    uint64_t    snd_bytes;
-    uint32_t    speed;
-    eth_info_t  eth_info;
-} network_stat_t, *network_stat_p;
-
-/* 进程cpu数据定义 */
-typedef struct _tag_proc_cpu
+    size_t      len = strlen(key);
+    const char *pos = buff;
+
+    while (pos && *pos) {
+        if (!strncmp(pos, key, len)) {
+            return pos + len;
+        }
+
+        pos = strchr(pos, '\n');
+        if (pos) {
+            pos++;
+        }
+    }
+
+    return NULL;
+}
+
+/* 查找行首关键字之后的整数，没有找到时返回0 */
+static uint64_t parse_key_u64(const char *buff, const char *key)
 {
-    uint64_t    utime;          /* 用户态时间 */
-    uint64_t    stime;          /* 系统态时间 */
-    uint64_t    cutime;         /* 子线程用户态时间 */
-    uint64_t    cstime;         /* 子线程系统态时间 */
-    uint64_t    proc_total;     /* 进程汇总时间 */
-    uint64_t    sys_total;      /* 系统切片时间 */
-} proc_cpu_t;
+    const char *pos = find_line_key(buff, key);
 
-/* 全局的系统资源信息 */
-struct sysinfo
+    return pos ? parse_u64(&pos) : 0;
+}
+
+/**
+ * @brief 解析PSI文件 "some avg10=2.96 ..." 的avg10，转换为千分比
+ */
+static uint32_t parse_psi_some(const char *buff)
 {
-    uint64_t        cpu_idle;        /* cpu 空闲时间 */
-    uint64_t        cpu_total;       /* cpu 总数 */
-    uint64_t        mem_total;       /* 内存总数 KB  */
-    uint64_t        mem_free;        /* 内存可用 KB  */
-    cpu_stat_t      records[2];      /* cpu统计值, 2次取差值 */
-    network_stat_t  network;         /* 网络数据链表 */
-};
+    uint32_t    value;
+    const char *pos = find_line_key(buff, "some avg10=");
 
-/* 进程资源信息 */
-struct procinfo
+    if (NULL == pos) {
+        return 0;
+    }
+
+    value = (uint32_t)parse_u64(&pos) * 10;
+    if (*pos == '.' && pos[1] >= '0' && pos[1] <= '9') {
+        value += (uint32_t)(pos[1] - '0');
+    }
+
+    return value;
+}
+
+/**
+ * @brief 读取CPU总时间和空闲时间
+ * @info  只需要首行 "cpu  user nice system idle iowait irq softirq steal ..."
+ */
+static void extract_cpu_stat(sys_counter_t *counter)
 {
-    uint32_t    pid;              /* 进程pid */
-    uint64_t    mem_used;         /* 物理内存kb */
-    uint32_t    cpu_used;         /* 比例相对单CPU比例 */
-    proc_cpu_t  records[2];       /* 快照信息 */
-};
+    uint32_t    i;
+    uint64_t    value[8];
+    const char *pos = proc_buff;
+
+    if (read_stat_file(sys_stat.fds[SYS_FD_CPU_STAT], proc_buff, SMALL_BUFF_SIZE) <= 0
+        || strncmp(pos, "cpu ", 4)) {
+        return;
+    }
+
+    pos += 4;
+    counter->cpu_total = 0;
+    for (i = 0; i < 8; i++) {
+        value[i] = parse_u64(&pos);
+        counter->cpu_total += value[i];
+    }
+
+    counter->cpu_idle = value[3] + value[4];
+}
 
-static eth_info_t eth[MAX_ETH_NUM];
-static struct sysinfo sys_stat;
+/**
+ * @brief 读取内存信息，优先使用MemAvailable
+ */
+static void extract_mem_info(void)
+{
+    uint64_t available;
+
+    if (read_stat_file(sys_stat.fds[SYS_FD_MEM_STAT], proc_buff, PROC_BUFF_SIZE) <= 0) {
+        return;
+    }
+
+    sys_stat.mem_total = parse_key_u64(proc_buff, "MemTotal:");
+    available          = parse_key_u64(proc_buff, "MemAvailable:");
+    if (!available) {
+        available = parse_key_u64(proc_buff, "MemFree:") + parse_key_u64(proc_buff, "Buffers:")
+                    + parse_key_u64(proc_buff, "Cached:") - parse_key_u64(proc_buff, "Mapped:");
+    }
+    sys_stat.mem_free = available;
+}
 
 /**
- * @brief 提取CPU统计信息
+ * @brief 读取本机IP所在网卡的收发字节数
+ * @info  行格式 "  eth0: rcv_bytes packets errs drop fifo frame compressed multicast snd_bytes ..."
  */
-static void extract_cpu_stat(cpu_stat_t *stat)
+static void extract_network_stat(sys_counter_t *counter)
 {
-    char name[64];
-    char line[512];
-    FILE* fp = fopen(PROC_CPU_STAT, "r");
-    if (!fp) {
-        NLOG_ERROR("open /proc/stat failed, [%m]");
+    uint32_t    i;
+    size_t      len = strlen(sys_stat.eth_name);
+    const char *pos = proc_buff;
+
+    if (!len || read_stat_file(sys_stat.fds[SYS_FD_NET_DEV], proc_buff, PROC_BUFF_SIZE) <= 0) {
         return;
     }
-    memset(stat, 0, sizeof(*stat));
-
-    while (fgets(line, sizeof(line)-1, fp)) {
-        /* cpu  155328925 640355 14677305 9174748668 331430975 0 457328 7242581 */
-        if (sscanf(line, "%s%llu%llu%llu%llu%llu%llu%llu", name,
-                   (llu64_t*)&stat->user, (llu64_t*)&stat->nice,
-                   (llu64_t*)&stat->system, (llu64_t*)&stat->idle,
-                   (llu64_t*)&stat->iowait, (llu64_t*)&stat->irq,
-                   (llu64_t*)&stat->softirq) != 8)
-        {
-            continue;
+
+    while (pos && *pos) {
+        pos = skip_space(pos);
+        if (!strncmp(pos, sys_stat.eth_name, len) && pos[len] == ':') {
+            pos += len + 1;
+            counter->rcv_bytes = parse_u64(&pos);
+            for (i = 0; i < 7; i++) {
+                parse_u64(&pos);
+            }
+            counter->snd_bytes = parse_u64(&pos);
+            return;
         }
 
-        /* 只获取CPU总统计数据 */
-        if (!strncmp(name, "cpu", 4)) {
-            stat->total = stat->user + stat->nice + stat->system + stat->idle
-                          + stat->iowait + stat->irq + stat->softirq;
-            break;
+        pos = strchr(pos, '\n');
+        if (pos) {
+            pos++;
         }
     }
+}
 
-    fclose(fp);
+/**
+ * @brief 读取cgroup CPU使用时间和限流周期数
+ */
+static void extract_cgroup_cpu(sys_counter_t *counter)
+{
+    if (read_stat_file(sys_stat.fds[SYS_FD_CG_CPU_STAT], proc_buff, SMALL_BUFF_SIZE) <= 0) {
+        return;
+    }
 
-    return;
+    counter->cg_usage     = parse_key_u64(proc_buff, "usage_usec");
+    counter->cg_periods   = parse_key_u64(proc_buff, "nr_periods");
+    counter->cg_throttled = parse_key_u64(proc_buff, "nr_throttled");
 }
 
 /**
- * @brief 提取内存统计信息
+ * @brief  读取cgroup CPU配额，"max 100000" 表示不限制
+ * @return 配额相当的CPU核数，千分比，0表示不限制
  */
-static int32_t extract_mem_info(mem_stat_t *stat)
+static uint64_t extract_cgroup_quota(void)
 {
-    char name[MAX_LINE_SIZE];
-    char line[MAX_LINE_SIZE];
-    int32_t finish_num = 0;
-    llu64_t value;
-    FILE* fp = fopen(PROC_MEM_STAT, "r");
-    if (!fp) {
-        NLOG_ERROR("open /proc/meminfo failed, [%m]");
-        return -1;
+    uint64_t    quota, period;
+    const char *pos = proc_buff;
+
+    if (read_stat_file(sys_stat.fds[SYS_FD_CG_CPU_MAX], proc_buff, SMALL_BUFF_SIZE) <= 0
+        || *pos < '0' || *pos > '9') {
+        return 0;
     }
 
-    while (fgets(line, sizeof(line)-1, fp)) {
-        if (sscanf(line, "%s%llu", name, &value) != 2) {
-            continue;
-        }
+    quota  = parse_u64(&pos);
+    period = parse_u64(&pos);
+    if (!period) {
+        return 0;
+    }
 
-        if (!strcmp(name, "MemTotal:")) {
-            finish_num++;
-            stat->mem_total = (uint64_t)value;
-        } else if (!strcmp(name, "MemFree:")) {
-            finish_num++;
-            stat->mem_free = (uint64_t)value;
-        } else if (!strcmp(name, "Buffers:")) {
-            finish_num++;
-            stat->buffers = (uint64_t)value;
-        } else if (!strcmp(name, "Cached:")) {
-            finish_num++;
-            stat->cached = (uint64_t)value;
-        } /* else if (! strcmp(name, "Inactive:")) {
-            finish_num++;
-            stat->inactive_file = (uint64_t)value;
-        }*/  else if (!strcmp(name, "Mapped:")) {
-            finish_num++;
-            stat->mapped = (uint64_t)value;
-        }
+    return quota * 1000 / period;
+}
+
+/**
+ * @brief 读取cgroup内存限制和使用量，限制小于主机内存时按cgroup计算
+ */
+static void extract_cgroup_mem(void)
+{
+    uint64_t    limit, current;
+    const char *pos = proc_buff;
+
+    if (read_stat_file(sys_stat.fds[SYS_FD_CG_MEM_MAX], proc_buff, SMALL_BUFF_SIZE) <= 0
+        || *pos < '0' || *pos > '9') {
+        return;
     }
 
-    fclose(fp);
+    limit = parse_u64(&pos) / 1024;
+    if (!limit || (sys_stat.mem_total && limit >= sys_stat.mem_total)) {
+        return;
+    }
 
-    /* 确认所有字段都提取到了 */
-    if (finish_num != 5) {
-        NLOG_ERROR("extract /proc/meminfo failed!");
-        return -2;
+    pos = proc_buff;
+    if (read_stat_file(sys_stat.fds[SYS_FD_CG_MEM_CURRENT], proc_buff, SMALL_BUFF_SIZE) <= 0) {
+        return;
     }
 
-    return 0;
+    current = parse_u64(&pos) / 1024;
+    sys_stat.mem_total = limit;
+    sys_stat.mem_free  = (current < limit) ? (limit - current) : 0;
+}
+
+/**
+ * @brief 读取CPU和内存压力
+ */
+static void extract_pressure(void)
+{
+    sys_stat.cpu_psi = 0;
+    if (read_stat_file(sys_stat.fds[SYS_FD_CPU_PSI], proc_buff, SMALL_BUFF_SIZE) > 0) {
+        sys_stat.cpu_psi = parse_psi_some(proc_buff);
+    }
+
+    sys_stat.mem_psi = 0;
+    if (read_stat_file(sys_stat.fds[SYS_FD_MEM_PSI], proc_buff, SMALL_BUFF_SIZE) > 0) {
+        sys_stat.mem_psi = parse_psi_some(proc_buff);
+    }
 }
 
 /**
- * @brief 获取内存空闲大小
+ * @brief 获取网卡IP，使用保持打开的ioctl socket
  */
-static void calc_mem_free(struct sysinfo *info)
+static int32_t get_eth_ip(const char *name, uint32_t *ip)
 {
-    mem_stat_t stat;
+    struct ifreq ifr;
 
-    extract_mem_info(&stat);
-    info->mem_total = stat.mem_total;
-    info->mem_free  = stat.mem_free + stat.buffers + stat.cached - stat.mapped;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+    if (ioctl(sys_stat.sock, SIOCGIFADDR, &ifr) < 0) {
+        return -1;
+    }
+
+    memcpy(ip, &((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr, sizeof(*ip));
+    return 0;
 }
 
 /*  struct for ethtool driver   */
@@ -239,231 +400,294 @@ struct ethtool_cmd
     unsigned int    reserved[4];
 };
 
-static int get_eth_ip(char *name, uint32_t *ip)
+/**
+ * @brief 刷新网卡速率，虚拟网卡等获取不到速率时使用默认值
+ */
+static void refresh_eth_speed(uint64_t now)
 {
-    int ret;
-    int fd;
     struct ifreq ifr;
     struct ethtool_cmd ecmd;
 
-    /*  this entire function is almost copied from ethtool source code */
-    memset(&ifr, 0, sizeof(ifr));
-    strcpy(ifr.ifr_name, name);  //eth0
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return -1;
+    if (sys_stat.speed_time && now < sys_stat.speed_time + ETH_SPEED_REFRESH) {
+        return;
     }
-    /*  Pass the "get info" command to eth tool driver  */
-    ecmd.cmd = 0x00000001;
-    ifr.ifr_data = (caddr_t)&ecmd;
-    ret = ioctl(fd, SIOCGIFADDR, &ifr);
-    close(fd);
+    sys_stat.speed_time = now;
+    sys_stat.eth_speed  = DEAULT_ETH_SPEED;
 
-    memcpy(ip, &((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr, sizeof(*ip));
+    if (!sys_stat.eth_name[0] || sys_stat.sock < 0) {
+        return;
+    }
 
-    return ret;
+    memset(&ifr, 0, sizeof(ifr));
+    memset(&ecmd, 0, sizeof(ecmd));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", sys_stat.eth_name);
+    ecmd.cmd     = 0x00000001;  /* ETHTOOL_GSET */
+    ifr.ifr_data = (caddr_t)&ecmd;
+    if (ioctl(sys_stat.sock, SIOCETHTOOL, &ifr) == 0 && ecmd.speed && ecmd.speed != 0xFFFF) {
+        sys_stat.eth_speed = ecmd.speed;
+    }
 }
 
-static int get_eth_speed(char *name, uint32_t *speed)
+/**
+ * @brief 查找本机IP所在的网卡
+ */
+static void find_local_eth(uint32_t ip)
 {
-    int ret;
-    int fd;
-    struct ifreq ifr;
-    struct ethtool_cmd ecmd;
+    uint32_t    num = 0;
+    uint32_t    eth_ip;
+    size_t      len;
+    char        name[IFNAMSIZ];
+    const char *pos, *colon;
 
-    /*  this entire function is almost copied from ethtool source code */
-    memset(&ifr, 0, sizeof(ifr));
-    strcpy(ifr.ifr_name, name);  //eth0
-
-    /* Open control socket. */
-    fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        return -1;
+    if (read_stat_file(sys_stat.fds[SYS_FD_NET_DEV], proc_buff, PROC_BUFF_SIZE) <= 0) {
+        return;
     }
-    /*  Pass the "get info" command to eth tool driver  */
-    ecmd.cmd = 0x00000001;
-    ifr.ifr_data = (caddr_t)&ecmd;
-    ret = ioctl(fd, SIOCETHTOOL, &ifr);
-    *speed = ecmd.speed;
 
-    close(fd);
+    /* 跳过两行表头 */
+    pos = strchr(proc_buff, '\n');
+    pos = pos ? strchr(pos + 1, '\n') : NULL;
+    while (pos && *(++pos) && num < MAX_ETH_NUM) {
+        pos   = skip_space(pos);
+        colon = strchr(pos, ':');
+        if (NULL == colon) {
+            break;
+        }
 
-    return ret;
-}
+        len = min((size_t)(colon - pos), sizeof(name) - 1);
+        memcpy(name, pos, len);
+        name[len] = '\0';
+        num++;
 
-static void parse_netstat_line(char* line, network_stat_p stat)
-{
-    // alloc a new network_stat_t struct, and populate the rcv_bytes, snd_bytes, and eth_name parts of it
-    uint64_t dummy, rcv_bytes, snd_bytes;
-    sscanf(line, "%lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-            &rcv_bytes, &dummy, &dummy, &dummy, &dummy, &dummy, &dummy, &dummy,
-            &snd_bytes, &dummy, &dummy, &dummy, &dummy, &dummy, &dummy, &dummy);
-
-    stat->rcv_bytes = rcv_bytes;
-    stat->snd_bytes = snd_bytes;
-    stat->speed = 1000; // default: 1000Mb/s
+        if (get_eth_ip(name, &eth_ip) == 0 && eth_ip == ip) {
+            snprintf(sys_stat.eth_name, sizeof(sys_stat.eth_name), "%s", name);
+            return;
+        }
+
+        pos = strchr(colon, '\n');
+    }
+
+    NLOG_ERROR("can't get ethernet adapter info for ip %s", inet_ntoa(*(struct in_addr *)(void*)(&ip)));
 }
 
 /**
- * @brief 提取netowrk adapter统计信息
+ * @brief  获取本进程所在的cgroup v2目录
+ * @return 0 成功 <0 不是cgroup v2或者在根cgroup中
  */
-static int extract_network_stat(network_stat_p stat)
+static int32_t get_cgroup_dir(char *dir, int32_t len)
 {
-    char* colon;
-    char line[MAX_LINE_SIZE];
-    char eth_name[32];
-    uint32_t speed;
-    size_t   len;
-    int      ret;
-
-    FILE* fp = fopen(PROC_NET_DEV, "r");
-    if (!fp) {
-        NLOG_ERROR("open %s failed, [%m]", PROC_NET_DEV);
+    int32_t     fd;
+    int32_t     ret;
+    const char *root;
+    char       *pos, *end;
+
+    if (access(CGROUP_ROOT"/cgroup.controllers", F_OK) == 0) {
+        root = CGROUP_ROOT;
+    } else if (access(CGROUP_UNIFIED_ROOT"/cgroup.controllers", F_OK) == 0) {
+        root = CGROUP_UNIFIED_ROOT;
+    } else {
         return -1;
     }
 
-    ret = -2;
-    while (fgets(line, MAX_LINE_SIZE, fp) != NULL) {
-        if ((colon = strchr(line, ':')) != NULL) {
-            len = colon-line;
-            if (32 < len) {
-                len = 32;
-            }
-            strncpy(eth_name, line, len);
-            if (0 ==strncmp(eth_name, stat->eth_info.eth_name, len)) {
-                parse_netstat_line(colon + 1, stat);
-                if (get_eth_speed(eth_name, &speed) == 0) {
-                    stat->speed = speed;
-                }
-
-                break;
-            }
-        }
+    fd = open(PROC_SELF_CGROUP, O_RDONLY);
+    if (fd < 0) {
+        return -2;
     }
 
-    fclose(fp);
+    ret = read_stat_file(fd, proc_buff, PROC_BUFF_SIZE);
+    close(fd);
+    if (ret <= 0) {
+        return -3;
+    }
+
+    /* cgroup v2的行格式为 "0::/path" */
+    pos = (char *)find_line_key(proc_buff, "0::");
+    if (NULL == pos) {
+        return -4;
+    }
+
+    end = strchr(pos, '\n');
+    if (end) {
+        *end = '\0';
+    }
+
+    if (!strcmp(pos, "/")) {
+        return -5;
+    }
+
+    ret = snprintf(dir, len, "%s%s", root, pos);
+    if (ret >= len) {
+        return -6;
+    }
+
+    return 0;
+}
 
-    return ret;
+/* 打开cgroup目录下的统计文件 */
+static int32_t open_cgroup_file(const char *dir, const char *name)
+{
+    char path[NLB_PATH_MAX_LEN];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, O_RDONLY);
 }
 
 /**
- * @brief 初始化网卡绑定的ip
+ * @brief 打开统计文件，cgroup文件不存在时对应统计不可用
+ * @info  压力统计优先使用cgroup的，没有时使用系统的
  */
-static void extract_eth_info(void)
+static void open_stat_files(void)
 {
-    char* colon;
-    char line[MAX_LINE_SIZE];
-    uint32_t idx;
-    uint32_t ip;
-    int      ret;
-
-    FILE* fp = fopen(PROC_NET_DEV, "r");
-    if (!fp) {
-        NLOG_ERROR("open %s failed, [%m]", PROC_NET_DEV);
-        return;
+    char dir[NLB_PATH_MAX_LEN];
+
+    sys_stat.fds[SYS_FD_CPU_STAT] = open(PROC_CPU_STAT, O_RDONLY);
+    sys_stat.fds[SYS_FD_MEM_STAT] = open(PROC_MEM_STAT, O_RDONLY);
+    sys_stat.fds[SYS_FD_NET_DEV]  = open(PROC_NET_DEV, O_RDONLY);
+    if (sys_stat.fds[SYS_FD_CPU_STAT] < 0 || sys_stat.fds[SYS_FD_MEM_STAT] < 0
+        || sys_stat.fds[SYS_FD_NET_DEV] < 0) {
+        NLOG_ERROR("open /proc stat files failed, [%m]");
     }
 
-    idx = 0;
-    while (fgets(line, MAX_LINE_SIZE, fp) != NULL) {
-        if ((colon = strchr(line, ':')) != NULL) {
-            if (idx >= MAX_ETH_NUM) {
-                NLOG_ERROR("ethernet adapters number is not less than %u", idx);
-                break;
-            }
-
-            strncpy(eth[idx].eth_name, line, colon-line);
-            ret = get_eth_ip(eth[idx].eth_name, &ip);
-            if (0 == ret) {
-                eth[idx].ip = ip;
-            }
-            idx ++;
-        }
+    if (get_cgroup_dir(dir, sizeof(dir)) == 0) {
+        sys_stat.fds[SYS_FD_CPU_PSI]        = open_cgroup_file(dir, "cpu.pressure");
+        sys_stat.fds[SYS_FD_MEM_PSI]        = open_cgroup_file(dir, "memory.pressure");
+        sys_stat.fds[SYS_FD_CG_CPU_STAT]    = open_cgroup_file(dir, "cpu.stat");
+        sys_stat.fds[SYS_FD_CG_CPU_MAX]     = open_cgroup_file(dir, "cpu.max");
+        sys_stat.fds[SYS_FD_CG_MEM_CURRENT] = open_cgroup_file(dir, "memory.current");
+        sys_stat.fds[SYS_FD_CG_MEM_MAX]     = open_cgroup_file(dir, "memory.max");
+        NLOG_INFO("sysinfo cgroup v2 dir (%s)", dir);
     }
 
-    fclose(fp);
+    if (sys_stat.fds[SYS_FD_CPU_PSI] < 0) {
+        sys_stat.fds[SYS_FD_CPU_PSI] = open(PROC_CPU_PRESSURE, O_RDONLY);
+    }
 
-    return;
+    if (sys_stat.fds[SYS_FD_MEM_PSI] < 0) {
+        sys_stat.fds[SYS_FD_MEM_PSI] = open(PROC_MEM_PRESSURE, O_RDONLY);
+    }
 }
 
 /**
  * @brief 初始化系统信息
+ * @info  打开并保持/proc和cgroup v2统计文件，查找本机IP所在的网卡
  */
-void init_sysinfo(void)
+void init_sysinfo(uint32_t ip)
 {
-    /* 获取CPU占用快照 */
-    extract_cpu_stat(&sys_stat.records[0]);
-    extract_cpu_stat(&sys_stat.records[1]);
-    sys_stat.cpu_idle  = sys_stat.records[0].total;
+    sys_stat.ip   = ip;
+    sys_stat.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sys_stat.sock < 0) {
+        NLOG_ERROR("create sysinfo ioctl socket failed, [%m]");
+    }
 
-    /* 获取内存信息 */
-    calc_mem_free(&sys_stat);
+    open_stat_files();
+    find_local_eth(ip);
 
-    // 获取网卡绑定的ip地址
-    memset(eth, 0, sizeof(eth));
-    extract_eth_info();
+    /* 首次采样只记录累计计数 */
+    sysinfo_run();
+}
+
+/* 指数平滑 */
+static void smooth_value(double *smoothed, double value)
+{
+    if (!sys_stat.smoothed) {
+        *smoothed = value;
+        return;
+    }
+
+    *smoothed += (value - *smoothed) * NLB_SYSINFO_SMOOTHING;
 }
 
 /**
- * @brief 更新系统信息
+ * @brief 系统信息采样，主循环中调用
+ * @info  每NLB_SYSINFO_INTERVAL采样一次，按实际采样间隔计算差值并做指数平滑
  */
-static void update_sysinfo(uint32_t ip)
+void sysinfo_run(void)
 {
-    /* 获取CPU占用快照 */
-    cpu_stat_t *last_stat = &sys_stat.records[0];
-    cpu_stat_t *cur_stat  = &sys_stat.records[1];
-
-    memcpy(last_stat, cur_stat, sizeof(cpu_stat_t));
-    extract_cpu_stat(cur_stat);
-    sys_stat.cpu_idle   = cur_stat->idle - last_stat->idle;
-    sys_stat.cpu_total  = cur_stat->total - last_stat->total;
-
-    /* 获取内存信息 */
-    calc_mem_free(&sys_stat);
-
-    // 获取网卡信息
-    int ret = -1;
-    network_stat_t network_stat;
-    for (int32_t idx = 0; idx < MAX_ETH_NUM; idx++) {
-        if (eth[idx].ip == ip) {
-            memcpy(&(network_stat.eth_info), eth + idx, sizeof(network_stat.eth_info));
-            ret = extract_network_stat(&network_stat);
-            if (ret == 0) {
-                memcpy(&(sys_stat.network), &network_stat, sizeof(sys_stat.network));
-            }
-            break;
-        }
+    uint64_t now = get_time_ms();
+    uint64_t elapsed, quota;
+    double   cpu = 0.0, cg_cpu = 0.0, throttle = 0.0;
+    double   bits;
+    sys_counter_t cur;
+    sys_counter_t *last = &sys_stat.last;
+
+    if (sys_stat.sample_time && now < sys_stat.sample_time + NLB_SYSINFO_INTERVAL) {
+        return;
     }
 
-    if (ret != 0) {
-        NLOG_ERROR("can't get ethernet adapter info for ip %s", inet_ntoa(*(struct in_addr *)(void*)(&ip)));
+    cur = *last;
+    extract_cpu_stat(&cur);
+    extract_network_stat(&cur);
+    extract_cgroup_cpu(&cur);
+    refresh_eth_speed(now);
+
+    extract_mem_info();
+    extract_cgroup_mem();
+    extract_pressure();
+
+    if (!sys_stat.sample_time) {
+        sys_stat.sample_time = now;
+        sys_stat.last        = cur;
+        return;
+    }
+
+    elapsed = max(now - sys_stat.sample_time, (uint64_t)1);
+
+    /* 主机CPU使用率 */
+    if (cur.cpu_total > last->cpu_total) {
+        cpu = 1000.0 - (double)(cur.cpu_idle - last->cpu_idle) * 1000 / (cur.cpu_total - last->cpu_total);
     }
+
+    /* cgroup CPU配额使用率和限流比例 */
+    quota = extract_cgroup_quota();
+    if (quota && cur.cg_usage >= last->cg_usage) {
+        cg_cpu = (double)(cur.cg_usage - last->cg_usage) * 1000 * 1000 / (elapsed * quota);
+    }
+
+    if (cur.cg_periods > last->cg_periods) {
+        throttle = (double)(cur.cg_throttled - last->cg_throttled) * 1000 / (cur.cg_periods - last->cg_periods);
+    }
+
+    smooth_value(&sys_stat.cpu, max(cpu, 0.0));
+    smooth_value(&sys_stat.cg_cpu, min(cg_cpu, 1000.0));
+    smooth_value(&sys_stat.throttle, throttle);
+
+    /* 网卡使用率 = 每毫秒比特数 / (速率Mb/s * 1000)，计数器重置时按0处理 */
+    bits = (cur.snd_bytes >= last->snd_bytes) ? (double)(cur.snd_bytes - last->snd_bytes) * 8 : 0.0;
+    smooth_value(&sys_stat.net_snd, min(bits / elapsed / sys_stat.eth_speed, 1000.0));
+    bits = (cur.rcv_bytes >= last->rcv_bytes) ? (double)(cur.rcv_bytes - last->rcv_bytes) * 8 : 0.0;
+    smooth_value(&sys_stat.net_rcv, min(bits / elapsed / sys_stat.eth_speed, 1000.0));
+
+    sys_stat.smoothed    = TRUE;
+    sys_stat.sample_time = now;
+    sys_stat.last        = cur;
 }
 
 /**
  * @brief 获取系统信息
- * @info  CPU占用百分比，MEM总量，MEM空闲
+ * @info  返回平滑后的采样值，CPU和网卡使用率需要至少两次采样
  */
-void get_sysinfo(uint32_t ip, sys_load_info_p sys_load)
+void get_sysinfo(sys_load_info_p sys_load)
 {
-    memset(&(sys_stat.network), 0, sizeof(sys_stat.network));
-    /* 更新当前系统信息 */
-    update_sysinfo(ip);
+    memset(sys_load, 0, sizeof(*sys_load));
+
+    if (!sys_stat.sample_time) {
+        sysinfo_run();
+    }
 
-    /* CPU百分比 */
-    sys_load->cpu_percent = 100 - (uint32_t)((100.0*sys_stat.cpu_idle)/sys_stat.cpu_total);
+    /* CPU百分比，有cgroup配额时取配额使用率 */
+    sys_load->cpu_percent  = (uint32_t)((max(sys_stat.cpu, sys_stat.cg_cpu) + 5) / 10);
+    sys_load->cpu_psi      = sys_stat.cpu_psi;
+    sys_load->mem_psi      = sys_stat.mem_psi;
+    sys_load->cpu_throttle = (uint32_t)(sys_stat.throttle + 0.5);
 
     /* 内存使用情况 */
     sys_load->mem_total = sys_stat.mem_total;
-    sys_load->mem_free = sys_stat.mem_free;
-
-    // 网卡使用情况
-    if (sys_stat.network.eth_info.ip == ip) {
-        sys_load->net_total = sys_stat.network.speed;
-        if (sys_load->net_total != 0) {
-            sys_load->net_snd_ratio = (uint64_t)(((float)(sys_stat.network.snd_bytes) / sys_load->net_total) * 1000.f);
-            sys_load->net_rcv_ratio = (uint64_t)(((float)(sys_stat.network.rcv_bytes) / sys_load->net_total) * 1000.f);
-        }
+    sys_load->mem_free  = sys_stat.mem_free;
+
+    /* 网卡使用情况 */
+    if (sys_stat.eth_name[0]) {
+        sys_load->net_total     = sys_stat.eth_speed;
+        sys_load->net_snd_ratio = (uint64_t)(sys_stat.net_snd + 0.5);
+        sys_load->net_rcv_ratio = (uint64_t)(sys_stat.net_rcv + 0.5);
     }
 }
+
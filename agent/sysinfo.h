@@ -16,32 +16,44 @@
  * and limitations under the License.
  */
 
-
 #ifndef _SYSINFO_H_
 #define _SYSINFO_H_
 
 #include <stdint.h>
 
+#define NLB_SYSINFO_INTERVAL    (1000)      /* 采样间隔，毫秒 */
+#define NLB_SYSINFO_SMOOTHING   (0.2)       /* 采样值的指数平滑系数 */
+
 /**
  * @brief 初始化系统信息
+ * @info  打开并保持/proc和cgroup v2统计文件，查找本机IP所在的网卡
+ */
+void init_sysinfo(uint32_t ip);
+
+/**
+ * @brief 系统信息采样，主循环中调用
+ * @info  每NLB_SYSINFO_INTERVAL采样一次，按实际采样间隔计算差值并做指数平滑
  */
-void init_sysinfo(void);
+void sysinfo_run(void);
 
 typedef struct {
-    uint32_t cpu_percent;
-    uint64_t mem_total;
+    uint32_t cpu_percent;   /* CPU使用率，有cgroup CPU配额时取主机和配额使用率的较大值 */
+    uint64_t mem_total;     /* 内存总量KB，有cgroup内存限制时取较小值 */
     uint64_t mem_free;
     uint64_t net_total;     /* 网卡总带宽 Mb/s */
     uint64_t net_snd_ratio; /* 网卡发送使用比率, 千分比 */
     uint64_t net_rcv_ratio; /* 网卡接收使用比率, 千分比 */
+    uint32_t cpu_psi;       /* CPU压力，some avg10，千分比 */
+    uint32_t mem_psi;       /* 内存压力，some avg10，千分比 */
+    uint32_t cpu_throttle;  /* cgroup CPU被限流的周期比例，千分比 */
 } sys_load_info_t, *sys_load_info_p;
 
 
 /**
  * @brief 获取系统信息
- * @info  CPU占用百分比，MEM总量，MEM空闲
+ * @info  返回平滑后的采样值，CPU和网卡使用率需要至少两次采样
  */
-void get_sysinfo(uint32_t ip, sys_load_info_p sys_load);
+void get_sysinfo(sys_load_info_p sys_load);
 
 #endif
 
@@ -33,13 +33,38 @@
 #include "zkplugin.h"
 #include "zkheartbeat.h"
 #include "policy.h"
+#include "drain.h"
+#include "zkloadreport.h"
+#include "loadaware.h"
+#include "ipset.h"
 
 #define NLB_NODE_WATCHER_MAX        1000000              /* 多阶hash节点数，100万 */
 
 static BOOL heartbeat_created = FALSE;
+static BOOL heartbeat_deleted = FALSE;                   /* 心跳节点已经确认删除 */
+static int64_t heartbeat_session;                        /* 创建心跳节点的会话 */
+static uint32_t heartbeat_writes;                        /* 心跳节点的累计写次数 */
 static uint32_t node_watcher_mod_cnt = MAX_ROW_COUNT;    /* 多阶hash阶数 */
 static uint32_t node_watcher_mods[MAX_ROW_COUNT];        /* 多阶hash模数 */
 static uint32_t node_watcher_mhash[NLB_NODE_WATCHER_MAX];/* 多阶hash数组 */
+static uint32_t drain_watcher_mhash[NLB_NODE_WATCHER_MAX];/* 排空节点监视的多阶hash数组 */
+static uint32_t load_watcher_mhash[NLB_NODE_WATCHER_MAX]; /* 负载上报节点监视的多阶hash数组 */
+
+/* 子节点监视，心跳分片或者排空节点 */
+struct child_watch {
+    uint32_t prefix;            /* 心跳分片IP前缀，网络字节序 */
+    BOOL     used;              /* 已经使用 */
+    BOOL     watching;          /* 已经发出获取子节点请求或者设置了watch */
+    BOOL     loaded;            /* 已经获取过子节点列表 */
+    struct ipset children;      /* 子节点对应的服务器 */
+};
+
+static struct child_watch hb_shards[NLB_HEARTBEAT_SHARD_MAX];  /* 心跳分片，按前缀开放寻址 */
+static struct child_watch drain_children;                       /* /serverdrain的子节点 */
+static struct ipset hb_watched;                                 /* 关注的服务器 */
+static struct ipset hb_alive;                                   /* 已经通知存活的服务器 */
+static struct ipset hb_dead;                                    /* 已经通知死机的服务器 */
+static struct ipset hb_listing;                                 /* 解析子节点列表的临时集合 */
 
 /**
  * @brief 获取zookeeper节点路径
@@ -56,10 +81,25 @@ static int32_t make_zk_heartbeat_path(uint32_t ip, char *buff, int32_t len)
     return 0;
 }
 
+/**
+ * @brief 获取排空节点路径
+ */
+static int32_t make_zk_drain_path(uint32_t ip, char *buff, int32_t len)
+{
+    int32_t slen;
+
+    slen = snprintf(buff, len, "/serverdrain/%s", inet_ntoa(*(struct in_addr *)&ip));
+    if (slen >= len) {
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * @brief 检查一个节点是否在监视中
  */
-static BOOL is_node_watching(uint32_t ip)
+static BOOL is_node_watching(uint32_t *mhash, uint32_t ip)
 {
     uint32_t i;
     uint32_t hash, idx, base = 0;
@@ -67,7 +107,7 @@ static BOOL is_node_watching(uint32_t ip)
     for (i = 0; i < node_watcher_mod_cnt; i++) {
         hash = ip%node_watcher_mods[i];
         idx  = hash + base;
-        if (node_watcher_mhash[idx] == ip) {
+        if (mhash[idx] == ip) {
             return TRUE;
         }
         base += node_watcher_mods[i];
@@ -79,7 +119,7 @@ static BOOL is_node_watching(uint32_t ip)
 /**
  * @brief 清除一个节点的监视状态
  */
-static void clean_node_watching(uint32_t ip)
+static void clean_node_watching(uint32_t *mhash, uint32_t ip)
 {
     uint32_t i;
     uint32_t hash, idx, base = 0;
@@ -87,8 +127,8 @@ static void clean_node_watching(uint32_t ip)
     for (i = 0; i < node_watcher_mod_cnt; i++) {
         hash = ip%node_watcher_mods[i];
         idx  = hash + base;
-        if (node_watcher_mhash[idx] == ip) {
-            node_watcher_mhash[idx] = 0;
+        if (mhash[idx] == ip) {
+            mhash[idx] = 0;
             return;
         }
 
@@ -100,7 +140,7 @@ static void clean_node_watching(uint32_t ip)
  * @brief 设置一个节点已经在监视中
  * @info  在多阶hash中写入IP地址
  */
-static void set_node_watching(uint32_t ip)
+static void set_node_watching(uint32_t *mhash, uint32_t ip)
 {
     uint32_t i;
     uint32_t hash, idx, base = 0;
@@ -109,26 +149,47 @@ static void set_node_watching(uint32_t ip)
         hash = ip%node_watcher_mods[i];
         idx  = hash + base;
 
-        if (node_watcher_mhash[idx] == 0) {
-            node_watcher_mhash[idx] = ip;
+        if (mhash[idx] == 0) {
+            mhash[idx] = ip;
             return;
         }
         base += node_watcher_mods[i];
     }
 
-    NLOG_ERROR("node_watcher_mhash is full, [%s].", inet_ntoa(*(struct in_addr *)&ip));
+    NLOG_ERROR("node watcher mhash is full, [%s].", inet_ntoa(*(struct in_addr *)&ip));
 }
 
-/* 检查是否创建心跳节点 */
+/* 获取当前会话ID */
+static int64_t get_zk_session(void)
+{
+    const clientid_t *id = zoo_client_id(get_zk_instance());
+
+    return id ? id->client_id : 0;
+}
+
+/* 检查是否创建心跳节点，会话变化后临时节点已经不存在 */
 BOOL check_heartbeat_created(void)
 {
-    return heartbeat_created;
+    return heartbeat_created && zk_connected() && (heartbeat_session == get_zk_session());
+}
+
+/* 检查心跳节点是否已经确认删除 */
+BOOL check_heartbeat_deleted(void)
+{
+    return heartbeat_deleted;
 }
 
 /* 设置心跳节点已经创建 */
 void set_heartbeat_created(void)
 {
     heartbeat_created = TRUE;
+    heartbeat_session = get_zk_session();
+}
+
+/* 获取心跳节点的累计写次数 */
+uint32_t get_heartbeat_writes(void)
+{
+    return heartbeat_writes;
 }
 
 /* 初始化节点监视数据 */
@@ -153,9 +214,91 @@ static void heartbeat_create_complete(int32_t rc, const char *name, const void *
     NLOG_ERROR("create heartbeat node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
 }
 
+/**
+ * @brief 获取心跳分片路径
+ */
+static int32_t make_zk_heartbeat_shard_path(uint32_t prefix, char *buff, int32_t len)
+{
+    int32_t  slen;
+    uint8_t *p = (uint8_t *)&prefix;
+
+    slen = snprintf(buff, len, NLB_HEARTBEAT_SHARD_PATH"/%u.%u.%u", p[0], p[1], p[2]);
+    if (slen >= len) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 获取分片心跳节点路径
+ */
+static int32_t make_zk_heartbeat_shard_node(uint32_t ip, char *buff, int32_t len)
+{
+    int32_t slen;
+
+    if (make_zk_heartbeat_shard_path(ip & htonl(NLB_HEARTBEAT_SHARD_MASK), buff, len) < 0) {
+        return -1;
+    }
+
+    slen = strlen(buff);
+    slen += snprintf(buff + slen, len - slen, "/%s", inet_ntoa(*(struct in_addr *)&ip));
+    if (slen >= len) {
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 创建分片心跳节点回调函数
+ * @info  失败时下次检查重新创建
+ */
+static void heartbeat_shard_create_complete(int32_t rc, const char *name, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+
+    if ((rc == ZNODEEXISTS) || (rc == ZOK)) {
+        NLOG_INFO("create heartbeat shard node success, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    heartbeat_created = FALSE;
+    NLOG_ERROR("create heartbeat shard node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 创建分片心跳临时节点，分片方式监视的客户端使用
+ * @info  和/serverheartbeat/ip节点同时存在，兼容其它监视方式的客户端
+ */
+static int32_t create_heartbeat_shard_node(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    /* 创建父节点，请求按顺序处理，子节点创建时父节点已经存在 */
+    make_zk_heartbeat_shard_path(ip & htonl(NLB_HEARTBEAT_SHARD_MASK), path, sizeof(path));
+    if ((zk_simple_create(NLB_HEARTBEAT_SHARD_PATH) < 0) || (zk_simple_create(path) < 0)) {
+        NLOG_ERROR("create %s node failed", path);
+        return -1;
+    }
+
+    make_zk_heartbeat_shard_node(ip, path, sizeof(path));
+    ret = zoo_acreate(get_zk_instance(), path, NULL, 0, &ZOO_OPEN_ACL_UNSAFE, ZOO_EPHEMERAL,
+                      heartbeat_shard_create_complete, (void *)(long)ip);
+    if (ret != ZOK) {
+        NLOG_ERROR("create %s node failed, [%s]", path, zerror(ret));
+        return -2;
+    }
+
+    heartbeat_writes += 3;
+    return 0;
+}
+
 /**
  * @brief 创建服务器临时节点，用于检测节点死活
  * @info  服务提供方agent创建，[server | mix]
+ *        分片监视方式同时创建分片心跳节点
  */
 int32_t create_heartbeat_node(uint32_t ip)
 {
@@ -168,6 +311,8 @@ int32_t create_heartbeat_node(uint32_t ip)
         return 0;
     }
 
+    heartbeat_deleted = FALSE;
+
     /* 创建父节点 */
     ret = zk_simple_create("/serverheartbeat");
     if (ret < 0) {
@@ -185,6 +330,211 @@ int32_t create_heartbeat_node(uint32_t ip)
         return -2;
     }
 
+    heartbeat_writes++;
+
+    if (get_heartbeat_watch() == NLB_HB_WATCH_SHARD) {
+        return create_heartbeat_shard_node(ip);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 检查心跳节点回调函数
+ * @info  节点不存在或者属于其它会话时，下次检查重新创建
+ */
+static void heartbeat_verify_complete(int32_t rc, const struct Stat *stat, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+
+    if ((rc == ZOK) && (stat->ephemeralOwner == get_zk_session())) {
+        return;
+    }
+
+    if ((rc == ZOK) || (rc == ZNONODE)) {
+        heartbeat_created = FALSE;
+        NLOG_ERROR("heartbeat node lost, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+        return;
+    }
+
+    NLOG_ERROR("check heartbeat node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 检查已经创建的心跳节点是否还存在
+ * @info  exists是读请求，由连接的zookeeper服务器直接处理，不需要重复创建节点
+ */
+int32_t verify_heartbeat_node(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (!check_heartbeat_created()) {
+        return 0;
+    }
+
+    make_zk_heartbeat_path(ip, path, sizeof(path));
+    ret = zoo_aexists(get_zk_instance(), path, 0, heartbeat_verify_complete, (void *)(long)ip);
+    if (ret != ZOK) {
+        NLOG_ERROR("check %s node failed, [%s] [%s]", path,
+                   inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 删除心跳节点回调函数
+ */
+static void heartbeat_delete_complete(int32_t rc, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+    if ((rc == ZNONODE) || (rc == ZOK)) {
+        heartbeat_deleted = TRUE;
+        NLOG_INFO("delete heartbeat node success, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    NLOG_ERROR("delete heartbeat node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 删除分片心跳节点回调函数
+ */
+static void heartbeat_shard_delete_complete(int32_t rc, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+    if ((rc == ZNONODE) || (rc == ZOK)) {
+        return;
+    }
+
+    NLOG_ERROR("delete heartbeat shard node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 删除服务器心跳节点，客户端立即收到节点死机事件
+ * @info  本地服务健康检查失败时调用，[server | mix]；
+ *        删除成功后设置确认删除标记，没有连接或者删除失败时由定时检查重试
+ */
+int32_t delete_heartbeat_node(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    heartbeat_created = FALSE;
+
+    if (!zk_connected()) {
+        NLOG_DEBUG("zookeeper is not connected");
+        return 0;
+    }
+
+    make_zk_heartbeat_path(ip, path, sizeof(path));
+    ret = zoo_adelete(get_zk_instance(), path, -1, heartbeat_delete_complete, (void *)(long)ip);
+    if (ret != ZOK) {
+        NLOG_ERROR("delete %s node failed, [%s] [%s]", path,
+                   inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+        return -1;
+    }
+
+    heartbeat_writes++;
+
+    /* 删除分片心跳节点 */
+    if (get_heartbeat_watch() == NLB_HB_WATCH_SHARD) {
+        make_zk_heartbeat_shard_node(ip, path, sizeof(path));
+        ret = zoo_adelete(get_zk_instance(), path, -1, heartbeat_shard_delete_complete, (void *)(long)ip);
+        if (ret != ZOK) {
+            NLOG_ERROR("delete %s node failed, [%s]", path, zerror(ret));
+            return -2;
+        }
+
+        heartbeat_writes++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 创建排空节点回调函数
+ */
+static void drain_create_complete(int32_t rc, const char *name, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+    if ((rc == ZNODEEXISTS) || (rc == ZOK)) {
+        NLOG_INFO("create drain node success, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    NLOG_ERROR("create drain node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 创建服务器排空临时节点，通知客户端停止向本机分配请求
+ * @info  服务提供方agent创建，[server | mix]，agent退出后节点随会话删除
+ */
+int32_t create_drain_node(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (!zk_connected()) {
+        NLOG_DEBUG("zookeeper is not connected");
+        return 0;
+    }
+
+    ret = zk_simple_create("/serverdrain");
+    if (ret < 0) {
+        NLOG_ERROR("create /serverdrain node failed, [%d]", ret);
+        return -1;
+    }
+
+    make_zk_drain_path(ip, path, sizeof(path));
+    ret = zoo_acreate(get_zk_instance(), path, NULL, 0, &ZOO_OPEN_ACL_UNSAFE, ZOO_EPHEMERAL,
+                      drain_create_complete, (void *)(long)ip);
+    if (ret != ZOK) {
+        NLOG_ERROR("create %s node failed, [%s] [%s]", path,
+                   inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 删除排空节点回调函数
+ */
+static void drain_delete_complete(int32_t rc, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+    if ((rc == ZNONODE) || (rc == ZOK)) {
+        NLOG_INFO("delete drain node success, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    NLOG_ERROR("delete drain node failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
+}
+
+/**
+ * @brief 删除服务器排空节点，客户端恢复向本机分配请求
+ */
+int32_t delete_drain_node(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (!zk_connected()) {
+        NLOG_DEBUG("zookeeper is not connected");
+        return 0;
+    }
+
+    make_zk_drain_path(ip, path, sizeof(path));
+    ret = zoo_adelete(get_zk_instance(), path, -1, drain_delete_complete, (void *)(long)ip);
+    if (ret != ZOK) {
+        NLOG_ERROR("delete %s node failed, [%s] [%s]", path,
+                   inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -198,19 +548,19 @@ static void heartbeat_exist_complete(int32_t rc, const struct Stat *stat, const
     if (rc == ZNONODE) {
         NLOG_INFO("Server (%s) no heartbeat", inet_ntoa(*(struct in_addr *)&ip));
         add_node_event((uint32_t)(long)data, NLB_EVENT_TYPE_NODE_DEAD);
-        set_node_watching(ip);
+        set_node_watching(node_watcher_mhash, ip);
         return;
     }
 
     if (rc == ZOK) {
         NLOG_DEBUG("Server (%s) alive", inet_ntoa(*(struct in_addr *)&ip));
         add_node_event((uint32_t)(long)data, NLB_EVENT_TYPE_NODE_RESUME);
-        set_node_watching(ip);
+        set_node_watching(node_watcher_mhash, ip);
         return;
     }
 
     NLOG_ERROR("heartbeat_complete failed, [%s]", zerror(rc));
-    clean_node_watching(ip);
+    clean_node_watching(node_watcher_mhash, ip);
 }
 
 /**
@@ -240,7 +590,7 @@ static void heartbeat_exist_watcher(zhandle_t *zzh, int32_t type, int32_t state,
         }
     }
 
-    clean_node_watching(ip);
+    clean_node_watching(node_watcher_mhash, ip);
 }
 
 /**
@@ -251,7 +601,7 @@ int32_t set_node_watcher(uint32_t ip)
     int32_t ret;
     char    path[NLB_PATH_MAX_LEN];
 
-    if (!is_node_watching(ip) && zk_connected()) {
+    if (!is_node_watching(node_watcher_mhash, ip) && zk_connected()) {
         make_zk_heartbeat_path(ip, path, sizeof(path));
         ret = zoo_awexists(get_zk_instance(), path, heartbeat_exist_watcher, (void *)(long)ip,
                            heartbeat_exist_complete, (void *)(long)ip);
@@ -265,13 +615,424 @@ int32_t set_node_watcher(uint32_t ip)
     return 0;
 }
 
+/**
+ * @brief /serverdrain/ip节点exists回调函数
+ */
+static void drain_exist_complete(int32_t rc, const struct Stat *stat, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+
+    if (rc == ZNONODE) {
+        drain_end(ip);
+        set_node_watching(drain_watcher_mhash, ip);
+        return;
+    }
+
+    if (rc == ZOK) {
+        drain_begin(ip);
+        set_node_watching(drain_watcher_mhash, ip);
+        return;
+    }
+
+    NLOG_ERROR("drain_exist_complete failed, [%s]", zerror(rc));
+    clean_node_watching(drain_watcher_mhash, ip);
+}
+
+/**
+ * @brief /serverdrain/ip节点exists watcher函数
+ */
+static void drain_exist_watcher(zhandle_t *zzh, int32_t type, int32_t state, const char *path, void* context)
+{
+    uint32_t ip = (uint32_t)(long)context;
+
+    NLOG_DEBUG("drain watcher %s state %s ip %s",
+              zk_type_2_str(type), zk_stat_2_str(state),
+              inet_ntoa(*(struct in_addr *)&ip));
+
+    if (state == ZOO_CONNECTED_STATE) {
+        if (type == ZOO_SESSION_EVENT) {
+            return;
+        }
+
+        if (type == ZOO_CREATED_EVENT) {
+            drain_begin(ip);
+        }
+
+        if (type == ZOO_DELETED_EVENT) {
+            drain_end(ip);
+        }
+    }
+
+    clean_node_watching(drain_watcher_mhash, ip);
+}
+
+/**
+ * @brief 设置节点排空监视事件
+ */
+int32_t set_drain_watcher(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (!is_node_watching(drain_watcher_mhash, ip) && zk_connected()) {
+        make_zk_drain_path(ip, path, sizeof(path));
+        ret = zoo_awexists(get_zk_instance(), path, drain_exist_watcher, (void *)(long)ip,
+                           drain_exist_complete, (void *)(long)ip);
+        if (ret != ZOK) {
+            NLOG_ERROR("set drain watcher failed, [%s] [%s].",
+                       inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int32_t set_loadreport_watcher(uint32_t ip);
+
+/**
+ * @brief /loadreport/ip节点get回调函数
+ * @info  节点不存在时get不会设置watch，清除监视状态，下个更新周期重新获取
+ */
+static void loadreport_get_complete(int32_t rc, const char *value, int32_t value_len,
+                                    const struct Stat *stat, const void *data)
+{
+    uint32_t ip = (uint32_t)(long)data;
+
+    if (rc == ZOK) {
+        loadaware_parse(ip, value, value_len);
+        set_node_watching(load_watcher_mhash, ip);
+        return;
+    }
+
+    if (rc == ZNONODE) {
+        NLOG_DEBUG("Server (%s) no load report", inet_ntoa(*(struct in_addr *)&ip));
+        loadaware_remove(ip);
+    } else {
+        NLOG_ERROR("loadreport_get_complete failed, [%s]", zerror(rc));
+    }
+
+    clean_node_watching(load_watcher_mhash, ip);
+}
+
+/**
+ * @brief /loadreport/ip节点get watcher函数
+ * @info  数据变化后立即重新获取并设置watch
+ */
+static void loadreport_get_watcher(zhandle_t *zzh, int32_t type, int32_t state, const char *path, void* context)
+{
+    uint32_t ip = (uint32_t)(long)context;
+
+    NLOG_DEBUG("loadreport watcher %s state %s ip %s",
+              zk_type_2_str(type), zk_stat_2_str(state),
+              inet_ntoa(*(struct in_addr *)&ip));
+
+    if (state == ZOO_CONNECTED_STATE) {
+        if (type == ZOO_SESSION_EVENT) {
+            return;
+        }
+
+        if (type == ZOO_DELETED_EVENT) {
+            loadaware_remove(ip);
+        }
+
+        if (type == ZOO_CHANGED_EVENT) {
+            clean_node_watching(load_watcher_mhash, ip);
+            set_loadreport_watcher(ip);
+            return;
+        }
+    }
+
+    clean_node_watching(load_watcher_mhash, ip);
+}
+
+/**
+ * @brief 设置节点负载上报监视事件
+ */
+static int32_t set_loadreport_watcher(uint32_t ip)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (!is_node_watching(load_watcher_mhash, ip) && zk_connected()) {
+        make_zk_loadreport_path(ip, path, sizeof(path));
+        ret = zoo_awget(get_zk_instance(), path, loadreport_get_watcher, (void *)(long)ip,
+                        loadreport_get_complete, (void *)(long)ip);
+        if (ret != ZOK) {
+            NLOG_ERROR("set loadreport watcher failed, [%s] [%s].",
+                       inet_ntoa(*(struct in_addr *)&ip), zerror(ret));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 获取服务器所在的心跳分片前缀
+ */
+static uint32_t get_heartbeat_prefix(uint32_t ip)
+{
+    if (get_heartbeat_watch() == NLB_HB_WATCH_SHARD) {
+        return ip & htonl(NLB_HEARTBEAT_SHARD_MASK);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  查找心跳分片，开放寻址线性探测
+ * @return NULL 分片数超过上限
+ */
+static struct child_watch *find_heartbeat_shard(uint32_t prefix)
+{
+    uint32_t i;
+    uint32_t idx = hash_ip(prefix) & (NLB_HEARTBEAT_SHARD_MAX - 1);
+
+    for (i = 0; i < NLB_HEARTBEAT_SHARD_MAX; i++) {
+        struct child_watch *shard = &hb_shards[idx];
+        if (!shard->used) {
+            shard->used   = TRUE;
+            shard->prefix = prefix;
+            return shard;
+        }
+
+        if (shard->prefix == prefix) {
+            return shard;
+        }
+
+        idx = (idx + 1) & (NLB_HEARTBEAT_SHARD_MAX - 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 获取子节点监视的路径
+ */
+static void make_child_watch_path(const struct child_watch *watch, char *buff, int32_t len)
+{
+    if (watch == &drain_children) {
+        snprintf(buff, len, "/serverdrain");
+    } else if (get_heartbeat_watch() == NLB_HB_WATCH_SHARD) {
+        make_zk_heartbeat_shard_path(watch->prefix, buff, len);
+    } else {
+        snprintf(buff, len, "/serverheartbeat");
+    }
+}
+
+/**
+ * @brief 更新服务器心跳状态，状态变化时添加节点事件
+ * @return TRUE 状态变化
+ */
+static BOOL update_heartbeat_state(uint32_t ip, BOOL alive)
+{
+    if (alive && !ipset_has(&hb_alive, ip)) {
+        ipset_add(&hb_alive, ip);
+        ipset_del(&hb_dead, ip);
+        add_node_event(ip, NLB_EVENT_TYPE_NODE_RESUME);
+        return TRUE;
+    }
+
+    if (!alive && !ipset_has(&hb_dead, ip)) {
+        ipset_add(&hb_dead, ip);
+        ipset_del(&hb_alive, ip);
+        add_node_event(ip, NLB_EVENT_TYPE_NODE_DEAD);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 子节点列表变化后，对比关注的服务器，批量产生事件
+ * @info  心跳分片产生死机/恢复事件，排空节点开始或结束排空
+ */
+static void apply_child_watch(struct child_watch *watch)
+{
+    uint32_t i, ip;
+    uint32_t alive = 0, dead = 0;
+    BOOL     exist;
+
+    ipset_for_each(&hb_watched, i, ip) {
+        exist = ipset_has(&watch->children, ip);
+        if (watch == &drain_children) {
+            if (exist) {
+                drain_begin(ip);
+            } else {
+                drain_end(ip);
+            }
+            continue;
+        }
+
+        if ((get_heartbeat_prefix(ip) != watch->prefix) || !update_heartbeat_state(ip, exist)) {
+            continue;
+        }
+
+        if (exist) {
+            alive++;
+        } else {
+            dead++;
+        }
+    }
+
+    if (watch != &drain_children) {
+        NLOG_INFO("heartbeat children [%u], resume [%u] dead [%u]", watch->children.count, alive, dead);
+    }
+}
+
+static int32_t set_child_watcher(struct child_watch *watch);
+
+/**
+ * @brief 子节点watcher函数
+ * @info  子节点变化或者节点创建后立即重新获取并设置watch
+ */
+static void child_watcher(zhandle_t *zzh, int32_t type, int32_t state, const char *path, void* context)
+{
+    struct child_watch *watch = (struct child_watch *)context;
+
+    NLOG_DEBUG("child watcher %s state %s path %s", zk_type_2_str(type), zk_stat_2_str(state), path);
+
+    if ((state == ZOO_CONNECTED_STATE) && (type == ZOO_SESSION_EVENT)) {
+        return;
+    }
+
+    watch->watching = FALSE;
+    if (state == ZOO_CONNECTED_STATE) {
+        set_child_watcher(watch);
+    }
+}
+
+/**
+ * @brief 父节点exists回调函数
+ * @info  父节点不存在时exists设置watch，等待创建
+ */
+static void child_exists_complete(int32_t rc, const struct Stat *stat, const void *data)
+{
+    struct child_watch *watch = (struct child_watch *)data;
+
+    if (rc == ZNONODE) {
+        return;
+    }
+
+    watch->watching = FALSE;
+    if (rc == ZOK) {
+        set_child_watcher(watch);
+        return;
+    }
+
+    NLOG_ERROR("child_exists_complete failed, [%s]", zerror(rc));
+}
+
+/**
+ * @brief 获取子节点回调函数
+ * @info  子节点名解析为IP，和上次的列表交换后对比关注的服务器；父节点不存在时按空列表处理
+ */
+static void child_get_complete(int32_t rc, const struct String_vector *strings, const void *data)
+{
+    int32_t  i, ret;
+    uint32_t ip;
+    char     path[NLB_PATH_MAX_LEN];
+    struct child_watch *watch = (struct child_watch *)data;
+
+    if (rc == ZNONODE) {
+        ipset_clear(&watch->children);
+        watch->loaded = TRUE;
+        apply_child_watch(watch);
+
+        make_child_watch_path(watch, path, sizeof(path));
+        ret = zoo_awexists(get_zk_instance(), path, child_watcher, watch, child_exists_complete, watch);
+        if (ret != ZOK) {
+            NLOG_ERROR("set %s exists watcher failed, [%s]", path, zerror(ret));
+            watch->watching = FALSE;
+        }
+        return;
+    }
+
+    if (rc != ZOK) {
+        NLOG_ERROR("child_get_complete failed, [%s]", zerror(rc));
+        watch->watching = FALSE;
+        return;
+    }
+
+    ipset_clear(&hb_listing);
+    for (i = 0; i < strings->count; i++) {
+        if ((inet_pton(AF_INET, strings->data[i], &ip) != 1) || (ipset_add(&hb_listing, ip) < 0)) {
+            NLOG_ERROR("invalid heartbeat child (%s)", strings->data[i]);
+        }
+    }
+
+    ipset_swap(&watch->children, &hb_listing);
+    watch->loaded = TRUE;
+    apply_child_watch(watch);
+}
+
+/**
+ * @brief 获取子节点并设置watch
+ */
+static int32_t set_child_watcher(struct child_watch *watch)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (watch->watching || !zk_connected()) {
+        return 0;
+    }
+
+    make_child_watch_path(watch, path, sizeof(path));
+    ret = zoo_awget_children(get_zk_instance(), path, child_watcher, watch, child_get_complete, watch);
+    if (ret != ZOK) {
+        NLOG_ERROR("set %s children watcher failed, [%s]", path, zerror(ret));
+        return -1;
+    }
+
+    watch->watching = TRUE;
+    return 0;
+}
+
+/**
+ * @brief 子节点方式监视服务器心跳和排空
+ * @info  新关注的服务器所在分片已经获取过时直接产生事件
+ */
+static void set_node_children_watcher(uint32_t ip)
+{
+    struct child_watch *shard;
+
+    shard = find_heartbeat_shard(get_heartbeat_prefix(ip));
+    if (NULL == shard) {
+        NLOG_ERROR("too many heartbeat shards, [%s]", inet_ntoa(*(struct in_addr *)&ip));
+        return;
+    }
+
+    if (!ipset_has(&hb_watched, ip)) {
+        if (ipset_add(&hb_watched, ip) < 0) {
+            NLOG_ERROR("no memory for heartbeat watching");
+            return;
+        }
+
+        if (shard->loaded) {
+            update_heartbeat_state(ip, ipset_has(&shard->children, ip));
+        }
+
+        if (drain_children.loaded && ipset_has(&drain_children.children, ip)) {
+            drain_begin(ip);
+        }
+    }
+
+    set_child_watcher(shard);
+    set_child_watcher(&drain_children);
+}
+
 /**
  * @brief 设置单个业务所有节点的watch信息
+ * @info  心跳策略关注心跳和排空节点，异构策略关注负载上报节点
+ *        心跳按配置的方式监视，子节点方式同时监视/serverdrain的子节点
  */
 void set_service_nodes_wather(struct agent_local_rdata *rdata)
 {
     uint32_t i, index;
     uint32_t ip;
+    BOOL     heartbeat, loadreport;
     struct shm_servers *servers;
     struct server_info *server;
     struct shm_meta *meta = rdata->route_meta;
@@ -279,8 +1040,10 @@ void set_service_nodes_wather(struct agent_local_rdata *rdata)
     index   = meta->index;
     servers = rdata->servs_data[index];
 
-    /* 检查策略是否需要关注服务器心跳 */
-    if (!check_need_heartbeat(servers->policy)) {
+    /* 检查策略是否需要关注服务器心跳或负载 */
+    heartbeat  = check_need_heartbeat(servers->policy);
+    loadreport = check_need_loadreport(servers->policy);
+    if (!heartbeat && !loadreport) {
         return;
     }
 
@@ -288,7 +1051,16 @@ void set_service_nodes_wather(struct agent_local_rdata *rdata)
     for (i = 0; i < servers->server_num; i++) {
         server  = &servers->svrs[i];
         ip      = server->server_ip;
-        set_node_watcher(ip);
+        if (heartbeat && (get_heartbeat_watch() != NLB_HB_WATCH_NODE)) {
+            set_node_children_watcher(ip);
+        } else if (heartbeat) {
+            set_node_watcher(ip);
+            set_drain_watcher(ip);
+        }
+
+        if (loadreport) {
+            set_loadreport_watcher(ip);
+        }
     }
 }
 
@@ -297,5 +1069,18 @@ void set_service_nodes_wather(struct agent_local_rdata *rdata)
  */
 void clean_nodes_watching(void)
 {
-    memset(node_watcher_mhash, 0, sizeof(node_watcher_mhash));
+    uint32_t i;
+
+    /* 子节点方式保留上次的列表，重新获取后只对变化的服务器产生事件 */
+    if (get_heartbeat_watch() != NLB_HB_WATCH_NODE) {
+        for (i = 0; i < NLB_HEARTBEAT_SHARD_MAX; i++) {
+            hb_shards[i].watching = FALSE;
+        }
+        drain_children.watching = FALSE;
+    } else {
+        memset(node_watcher_mhash, 0, sizeof(node_watcher_mhash));
+        memset(drain_watcher_mhash, 0, sizeof(drain_watcher_mhash));
+    }
+
+    memset(load_watcher_mhash, 0, sizeof(load_watcher_mhash));
 }
@@ -23,9 +23,26 @@
 #include <stdint.h>
 #include "agent.h"
 
-/* 检查是否创建心跳节点 */
+/* 客户端监视服务器心跳的方式 */
+enum {
+    NLB_HB_WATCH_NODE     = 0,      /* 每台服务器一个exists watch */
+    NLB_HB_WATCH_CHILDREN = 1,      /* 监视/serverheartbeat的子节点 */
+    NLB_HB_WATCH_SHARD    = 2,      /* 按IP前缀分片，监视/heartbeatshard/a.b.c的子节点 */
+};
+
+#define NLB_HEARTBEAT_SHARD_PATH    "/heartbeatshard"   /* 分片心跳节点根路径 */
+#define NLB_HEARTBEAT_SHARD_MASK    (0xFFFFFF00)        /* 分片IP前缀，/24 */
+#define NLB_HEARTBEAT_SHARD_MAX     (4096)              /* 客户端最多监视的分片数，2的幂 */
+
+/* 检查是否创建心跳节点，会话变化后临时节点已经不存在 */
 BOOL check_heartbeat_created(void);
 
+/* 检查心跳节点是否已经确认删除 */
+BOOL check_heartbeat_deleted(void);
+
+/* 获取心跳节点的累计写次数 */
+uint32_t get_heartbeat_writes(void);
+
 /* 初始化节点监视数据 */
 void heartbeat_data_init(void);
 
@@ -35,8 +52,32 @@ void heartbeat_data_init(void);
  */
 int32_t create_heartbeat_node(uint32_t ip);
 
+/**
+ * @brief 检查已经创建的心跳节点是否还存在
+ * @info  exists是读请求，由连接的zookeeper服务器直接处理，不需要重复创建节点
+ */
+int32_t verify_heartbeat_node(uint32_t ip);
+
+/**
+ * @brief 删除服务器心跳节点，客户端立即收到节点死机事件
+ * @info  本地服务健康检查失败时调用，[server | mix]
+ */
+int32_t delete_heartbeat_node(uint32_t ip);
+
+/**
+ * @brief 创建服务器排空临时节点，通知客户端停止向本机分配请求
+ * @info  服务提供方agent创建，[server | mix]
+ */
+int32_t create_drain_node(uint32_t ip);
+
+/**
+ * @brief 删除服务器排空节点，客户端恢复向本机分配请求
+ */
+int32_t delete_drain_node(uint32_t ip);
+
 /**
  * @brief 设置单个业务所有节点的watch信息
+ * @info  心跳按配置的方式监视，子节点方式同时监视/serverdrain的子节点
  */
 void set_service_nodes_wather(struct agent_local_rdata *rdata);
 
@@ -0,0 +1,313 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename zkjournal.c
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "zookeeper.h"
+#include "log.h"
+#include "config.h"
+#include "agent.h"
+#include "event.h"
+#include "zkplugin.h"
+#include "resync.h"
+#include "zkjournal.h"
+
+/* 变更日志状态 */
+enum {
+    NLB_JOURNAL_PENDING  = 0,   /* 还没有读取成功 */
+    NLB_JOURNAL_ACTIVE   = 1,   /* 分片已读取，由日志代替业务watch */
+    NLB_JOURNAL_FALLBACK = 2,   /* 分片不存在，回退到业务exists watch */
+};
+
+struct journal_shard {
+    uint32_t index;             /* 分片号 */
+    BOOL     watching;          /* 是否设置了子节点watch */
+    BOOL     loaded;            /* 是否读取过 */
+    int64_t  last_seq;          /* 已处理的最大序号 */
+};
+
+static struct journal_shard journal_shards[NLB_CHANGE_JOURNAL_SHARDS];
+static int32_t journal_state = NLB_JOURNAL_PENDING;
+static BOOL    journal_inited = FALSE;
+
+static int32_t set_journal_watcher(struct journal_shard *shard);
+
+/* 初始化分片，序号从-1开始，首次读取时处理所有条目 */
+static void journal_init(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < NLB_CHANGE_JOURNAL_SHARDS; i++) {
+        journal_shards[i].index    = i;
+        journal_shards[i].watching = FALSE;
+        journal_shards[i].loaded   = FALSE;
+        journal_shards[i].last_seq = -1;
+    }
+
+    journal_inited = TRUE;
+}
+
+/**
+ * @brief  解析日志条目"<业务名>@<mtime>-<序号>"
+ * @return =0 成功 <0 格式错误
+ */
+static int32_t parse_journal_entry(const char *entry, char *name, uint64_t *mtime, int64_t *seq)
+{
+    const char *at, *dash;
+    char *end;
+    size_t len;
+
+    at   = strrchr(entry, '@');
+    dash = strrchr(entry, '-');
+    if ((NULL == at) || (NULL == dash) || (dash < at)) {
+        return -1;
+    }
+
+    len = (size_t)(at - entry);
+    if ((len == 0) || (len >= NLB_SERVICE_NAME_LEN)) {
+        return -2;
+    }
+
+    *mtime = strtoull(at + 1, &end, 10);
+    if (end != dash) {
+        return -3;
+    }
+
+    *seq = strtoll(dash + 1, &end, 10);
+    if ((*end != '\0') || (*seq < 0)) {
+        return -4;
+    }
+
+    memcpy(name, entry, len);
+    name[len] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief  解析分片序号下限节点"@floor-<序号>"
+ * @return =0 成功 <0 不是下限节点
+ */
+static int32_t parse_journal_floor(const char *entry, int64_t *floor)
+{
+    char *end;
+    size_t len = strlen(NLB_CHANGE_JOURNAL_FLOOR);
+
+    if (strncmp(entry, NLB_CHANGE_JOURNAL_FLOOR, len)) {
+        return -1;
+    }
+
+    *floor = strtoll(entry + len, &end, 10);
+    if ((end == entry + len) || (*end != '\0') || (*floor < 0)) {
+        return -2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 分片不存在，回退到每个业务的exists watch
+ * @info  重新同步一次，设置所有业务的watch
+ */
+static void journal_fallback(const char *path)
+{
+    if (journal_state == NLB_JOURNAL_FALLBACK) {
+        return;
+    }
+
+    NLOG_WARN("change journal (%s) not found, fall back to service watching", path);
+    journal_state = NLB_JOURNAL_FALLBACK;
+    resync_start();
+}
+
+/**
+ * @brief 分片子节点watcher函数
+ */
+static void journal_watcher(zhandle_t *zzh, int32_t type, int32_t state, const char *path, void *context)
+{
+    struct journal_shard *shard = (struct journal_shard *)context;
+
+    NLOG_DEBUG("journal watcher %s state %s path %s", zk_type_2_str(type), zk_stat_2_str(state), path);
+
+    if ((state == ZOO_CONNECTED_STATE) && (type == ZOO_SESSION_EVENT)) {
+        return;
+    }
+
+    shard->watching = FALSE;
+    if (state == ZOO_CONNECTED_STATE) {
+        set_journal_watcher(shard);
+    }
+}
+
+/**
+ * @brief 获取分片子节点回调函数
+ * @info  只处理序号比上次大的条目，本地有该业务且mtime更新时产生拉取配置事件；
+ *        序号下限超过已处理的序号时，未处理的条目已被发布者删除，重新同步所有业务
+ */
+static void journal_get_complete(int32_t rc, const struct String_vector *strings, const void *data)
+{
+    int32_t  i, changed = 0;
+    int64_t  seq, max_seq, floor = -1, value;
+    uint64_t mtime;
+    char     name[NLB_SERVICE_NAME_LEN];
+    char     path[NLB_PATH_MAX_LEN];
+    struct agent_local_rdata *rdata;
+    struct journal_shard *shard = (struct journal_shard *)data;
+
+    if (rc == ZNONODE) {
+        shard->watching = FALSE;
+        snprintf(path, sizeof(path), NLB_CHANGE_JOURNAL_PATH"/%u", shard->index);
+        journal_fallback(path);
+        return;
+    }
+
+    if (rc != ZOK) {
+        NLOG_ERROR("journal_get_complete failed, [%s]", zerror(rc));
+        shard->watching = FALSE;
+        return;
+    }
+
+    max_seq = shard->last_seq;
+    for (i = 0; i < strings->count; i++) {
+        /* 更新下限期间可能同时存在新旧两个下限节点，取最大的 */
+        if (parse_journal_floor(strings->data[i], &value) == 0) {
+            if (value > floor) {
+                floor = value;
+            }
+            continue;
+        }
+
+        if (parse_journal_entry(strings->data[i], name, &mtime, &seq) < 0) {
+            NLOG_ERROR("invalid journal entry (%s)", strings->data[i]);
+            continue;
+        }
+
+        if (seq <= shard->last_seq) {
+            continue;
+        }
+
+        if (seq > max_seq) {
+            max_seq = seq;
+        }
+
+        rdata = get_local_rdata(name);
+        if ((NULL == rdata) || (rdata->route_meta->mtime >= mtime)) {
+            continue;
+        }
+
+        add_service_event(name);
+        changed++;
+    }
+
+    /* 首次读取时启动流程已经同步过所有业务，不需要处理被删除的条目 */
+    if (shard->loaded && (floor > shard->last_seq)) {
+        NLOG_WARN("journal shard [%u] pruned past last seq [%lld], floor [%lld], resync all services",
+                  shard->index, (long long)shard->last_seq, (long long)floor);
+        resync_start();
+    }
+
+    if (floor > max_seq) {
+        max_seq = floor;
+    }
+
+    shard->last_seq = max_seq;
+    shard->loaded   = TRUE;
+    if (journal_state == NLB_JOURNAL_PENDING) {
+        journal_state = NLB_JOURNAL_ACTIVE;
+    }
+
+    NLOG_DEBUG("journal shard [%u] entries [%d], changed [%d], last seq [%lld], floor [%lld]",
+               shard->index, strings->count, changed, (long long)max_seq, (long long)floor);
+}
+
+/**
+ * @brief 获取分片子节点并设置watch
+ */
+static int32_t set_journal_watcher(struct journal_shard *shard)
+{
+    int32_t ret;
+    char    path[NLB_PATH_MAX_LEN];
+
+    if (shard->watching || !zk_connected() || (journal_state == NLB_JOURNAL_FALLBACK)) {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), NLB_CHANGE_JOURNAL_PATH"/%u", shard->index);
+    ret = zoo_awget_children(get_zk_instance(), path, journal_watcher, shard, journal_get_complete, shard);
+    if (ret != ZOK) {
+        NLOG_ERROR("set %s children watcher failed, [%s]", path, zerror(ret));
+        return -1;
+    }
+
+    shard->watching = TRUE;
+    return 0;
+}
+
+/**
+ * @brief 是否由变更日志代替每个业务的exists watch
+ */
+BOOL service_journal_active(void)
+{
+    return (get_service_watch() == NLB_SVC_WATCH_JOURNAL) && (journal_state != NLB_JOURNAL_FALLBACK);
+}
+
+/**
+ * @brief 变更日志主循环处理函数
+ */
+void service_journal_run(void)
+{
+    uint32_t i;
+
+    if (!service_journal_active()) {
+        return;
+    }
+
+    if (!journal_inited) {
+        journal_init();
+    }
+
+    for (i = 0; i < NLB_CHANGE_JOURNAL_SHARDS; i++) {
+        set_journal_watcher(&journal_shards[i]);
+    }
+}
+
+/**
+ * @brief zookeeper重新初始化时清除watch标记
+ * @info  会话重建期间追加的条目序号更大，重新读取后处理；回退状态也重新检查
+ */
+void clean_service_journal(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < NLB_CHANGE_JOURNAL_SHARDS; i++) {
+        journal_shards[i].watching = FALSE;
+    }
+
+    if (journal_state == NLB_JOURNAL_FALLBACK) {
+        journal_state = NLB_JOURNAL_PENDING;
+    }
+}
+
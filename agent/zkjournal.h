@@ -0,0 +1,71 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename zkjournal.h
+ * @info     业务配置变更日志
+ *           发布者修改/nameservice/<a>/<b>后，在/nameservice_changes/<分片>下追加一个顺序节点，
+ *           节点名为"<业务名>@<mtime>-<序号>"，分片为change_journal_shard(业务名)。
+ *           agent只监视固定个数的分片子节点，按序号读取新条目，只拉取本地有的且mtime更新的业务，
+ *           watch个数和重新设置watch的请求与业务数无关。
+ *           发布者用nlbjournal工具追加条目，并按条目数上限和保留时间删除旧条目，
+ *           删除时在同一个multi请求中把分片下的"@floor-<序号>"节点更新为删除的最大序号。
+ *           agent读到的下限大于已处理的序号时，说明有未处理的条目已被删除，重新同步所有业务
+ */
+
+#ifndef _ZKJOURNAL_H_
+#define _ZKJOURNAL_H_
+
+#include <stdint.h>
+#include "commtype.h"
+#include "hash.h"
+
+/* 客户端监视业务配置的方式 */
+enum {
+    NLB_SVC_WATCH_EXISTS  = 0,      /* 每个业务一个exists watch */
+    NLB_SVC_WATCH_JOURNAL = 1,      /* 监视变更日志分片，分片不存在时回退到exists watch */
+};
+
+#define NLB_CHANGE_JOURNAL_PATH     "/nameservice_changes"  /* 变更日志根路径 */
+#define NLB_CHANGE_JOURNAL_SHARDS   (16)                    /* 分片数，分片节点名为0~15 */
+#define NLB_CHANGE_JOURNAL_FLOOR    "@floor-"               /* 分片序号下限节点名前缀 */
+
+/* 业务所在的变更日志分片 */
+static inline uint32_t change_journal_shard(const char *name) {
+    return gen_hash_key(name) % NLB_CHANGE_JOURNAL_SHARDS;
+}
+
+/**
+ * @brief 是否由变更日志代替每个业务的exists watch
+ * @info  日志方式且没有回退时返回TRUE
+ */
+BOOL service_journal_active(void);
+
+/**
+ * @brief 变更日志主循环处理函数，设置所有分片的子节点watch
+ */
+void service_journal_run(void);
+
+/**
+ * @brief zookeeper重新初始化时清除watch标记，保留已读取的序号
+ */
+void clean_service_journal(void);
+
+#endif
+
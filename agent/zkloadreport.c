@@ -33,7 +33,12 @@
 #include "zkplugin.h"
 #include "zkloadreport.h"
 #include "sysinfo.h"
+#include "appload.h"
+#include "loadaware.h"
+#include "loadproto.h"
+#include "zkheartbeat.h"
 #include "nlbtime.h"
+#include "utils.h"
 
 static BOOL loadreport_created = FALSE;
 
@@ -52,7 +57,7 @@ void set_loadreport_created(void)
 /**
  * @brief 获取zookeeper节点路径
  */
-static int32_t make_zk_loadreport_path(uint32_t ip, char *buff, int32_t len)
+int32_t make_zk_loadreport_path(uint32_t ip, char *buff, int32_t len)
 {
     int32_t slen;
 
@@ -117,18 +122,39 @@ int32_t create_loadreport_node(uint32_t ip)
     return 0;
 }
 
+/* 负载上报统计 */
+struct load_report_stat {
+    uint32_t changed;           /* 负载变化触发的上报次数 */
+    uint32_t keepalive;         /* 超过最长上报间隔触发的上报次数 */
+    uint32_t suppressed;        /* 负载没有明显变化，没有上报的次数 */
+    uint32_t failed;            /* 上报失败次数 */
+    uint32_t heartbeat;         /* 统计开始时心跳节点的累计写次数 */
+    uint64_t start_time;        /* 统计开始时间，毫秒 */
+};
+
+static struct load_report last_report;          /* 上次发出的负载上报 */
+static uint64_t last_report_time;               /* 上次发出上报的时间，0表示需要立即上报 */
+static uint64_t last_check_time;                /* 上次检查负载变化的时间 */
+static BOOL     report_pending = FALSE;         /* 上报请求还没有完成 */
+static struct load_report_stat report_stat;
+
 /**
  * @brief 负载上报完成回调函数
+ * @info  失败时下次检查立即重新上报
  */
 static void loadreport_set_completion(int32_t rc, const struct Stat *stat, const void *data)
 {
     uint32_t ip = (uint32_t)(long)data;
 
+    report_pending = FALSE;
+
     if (rc != ZOK) {
         if (rc == ZNONODE) {
             create_loadreport_node(ip);
         }
 
+        last_report_time = 0;
+        report_stat.failed++;
         NLOG_ERROR("load report failed, [%s] [%s]", inet_ntoa(*(struct in_addr *)&ip), zerror(rc));
         return;
     }
@@ -136,35 +162,177 @@ static void loadreport_set_completion(int32_t rc, const struct Stat *stat, const
     NLOG_DEBUG("load report success, [%s]", inet_ntoa(*(struct in_addr *)&ip));
 }
 
+/* 两个千分比的差值 */
+static uint32_t load_diff(uint32_t a, uint32_t b)
+{
+    return (a > b) ? (a - b) : (b - a);
+}
+
+/* 应用使用率，千分比，和客户端的计算方式一致 */
+static uint32_t report_app_used(const struct load_report *report)
+{
+    uint64_t used;
+
+    if (!(report->flags & NLB_LOAD_REPORT_APP) || !report->app_workers) {
+        return 0;
+    }
+
+    used = ((uint64_t)report->app_busy + report->app_queue) * 1000 / report->app_workers;
+    return (uint32_t)min(used, (uint64_t)1000);
+}
+
+/**
+ * @brief 检查负载相对上次上报是否有明显变化
+ * @info  只比较客户端计算权重使用的CPU、网卡和应用负载，压力和限流数据随上报发布，变化不触发上报；
+ *        应用排队增长到饱和时不管阈值立即上报，客户端需要尽快降低权重
+ */
+static BOOL load_report_changed(const struct load_report *old, const struct load_report *cur)
+{
+    uint32_t delta = get_load_delta() * 10;
+
+    if ((old->flags ^ cur->flags) & NLB_LOAD_REPORT_APP) {
+        return TRUE;
+    }
+
+    if ((load_diff(old->cpu * 10, cur->cpu * 10) >= delta)
+        || (load_diff(old->net_snd_ratio, cur->net_snd_ratio) >= delta)
+        || (load_diff(old->net_rcv_ratio, cur->net_rcv_ratio) >= delta)
+        || (load_diff(report_app_used(old), report_app_used(cur)) >= delta)) {
+        return TRUE;
+    }
+
+    if ((cur->flags & NLB_LOAD_REPORT_APP) && (cur->app_queue > old->app_queue)
+        && (cur->app_queue >= max(cur->app_workers, (uint32_t)NLB_LOAD_QUEUE_MIN))) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 收集当前的负载
+ */
+static void collect_load_report(struct load_report *report, uint64_t now)
+{
+    sys_load_info_t load;
+    struct nlb_app_load app;
+
+    get_sysinfo(&load);
+
+    memset(report, 0, sizeof(*report));
+    report->timestamp     = now;
+    report->keepalive     = get_load_keepalive() * 1000;
+    report->cpu           = load.cpu_percent;
+    report->cpu_psi       = load.cpu_psi;
+    report->mem_psi       = load.mem_psi;
+    report->cpu_throttle  = load.cpu_throttle;
+    report->mem_total     = (uint32_t)(load.mem_total / 1024);
+    report->mem_free      = (uint32_t)(load.mem_free / 1024);
+    report->net_total     = (uint32_t)load.net_total;
+    report->net_snd_ratio = (uint32_t)load.net_snd_ratio;
+    report->net_rcv_ratio = (uint32_t)load.net_rcv_ratio;
+
+    /* 有业务进程或插件提供应用负载时一起上报 */
+    if (appload_collect(&app) == 0) {
+        report->flags       |= NLB_LOAD_REPORT_APP;
+        report->app_queue    = app.queue;
+        report->app_inflight = app.inflight;
+        report->app_busy     = app.busy;
+        report->app_workers  = app.workers;
+    }
+}
+
 /**
- * @brief 负载上报主处理函数
+ * @brief 定时输出上报统计，包括心跳节点的写次数
+ */
+static void load_report_stat_run(uint64_t now)
+{
+    uint32_t writes, heartbeat;
+    uint64_t elapsed;
+
+    if (!report_stat.start_time) {
+        report_stat.start_time = now;
+        report_stat.heartbeat  = get_heartbeat_writes();
+        return;
+    }
+
+    if (now < report_stat.start_time + NLB_LOAD_REPORT_STAT) {
+        return;
+    }
+
+    elapsed   = now - report_stat.start_time;
+    heartbeat = get_heartbeat_writes() - report_stat.heartbeat;
+    writes    = report_stat.changed + report_stat.keepalive + heartbeat;
+    NLOG_INFO("Zookeeper write stat: load report [%u] (changed %u, keepalive %u, failed %u), suppressed [%u], "
+              "heartbeat [%u], rate [%.2f/min]", report_stat.changed + report_stat.keepalive,
+              report_stat.changed, report_stat.keepalive, report_stat.failed, report_stat.suppressed,
+              heartbeat, (double)writes * 60000 / elapsed);
+
+    memset(&report_stat, 0, sizeof(report_stat));
+    report_stat.start_time = now;
+    report_stat.heartbeat  = get_heartbeat_writes();
+}
+
+/**
+ * @brief 负载上报主处理函数，主循环中调用
+ * @info  每NLB_LOAD_REPORT_CHECK检查一次，负载变化超过阈值或者超过最长上报间隔时才写zookeeper，
+ *        定时输出写zookeeper的次数和频率
  */
 void load_report(uint32_t ip)
 {
     int32_t  ret;
     int32_t  data_len;
-    char     buff[1024];
+    uint64_t now = get_time_ms();
+    BOOL     keepalive;
+    char     buff[NLB_LOAD_REPORT_LEN];
     char     path[NLB_PATH_MAX_LEN];
-    sys_load_info_t load;
+    struct load_report report;
+
+    load_report_stat_run(now);
+
+    if (now < last_check_time + NLB_LOAD_REPORT_CHECK) {
+        return;
+    }
+    last_check_time = now;
 
     if (!zk_connected()) {
         NLOG_DEBUG("zookeeper is not connected");
         return;
     }
 
-    make_zk_loadreport_path(ip, path, sizeof(path));
+    /* 上次上报还没有完成，超过最长上报间隔没有回调时不再等待 */
+    if (report_pending && (now < last_report_time + get_load_keepalive() * 1000)) {
+        return;
+    }
 
-    /* 获取系统信息 */
-    get_sysinfo(ip, &load);
+    collect_load_report(&report, now);
+
+    keepalive = (now >= last_report_time + report.keepalive);
+    if (!keepalive && !load_report_changed(&last_report, &report)) {
+        report_stat.suppressed++;
+        return;
+    }
 
-    /* 组装json字符串 */
-    data_len = snprintf(buff, sizeof(buff), "{\"timestamp\": %lu, \"cpu\": %u, \"mem_total\": %lu, \"mem_free\": %lu,"
-                        "\"net_total\": %lu, \"net_snd_ratio\": %lu, \"net_rcv_ratio\": %lu}",
-                        get_time_ms(), load.cpu_percent, load.mem_total, load.mem_free,
-                        load.net_total, load.net_snd_ratio, load.net_rcv_ratio);
+    data_len = serialize_load_report(&report, buff, sizeof(buff));
+    if (data_len < 0) {
+        NLOG_ERROR("serialize load report failed, [%d]", data_len);
+        return;
+    }
 
+    make_zk_loadreport_path(ip, path, sizeof(path));
     ret = zoo_aset(get_zk_instance(), path, buff, data_len, -1, loadreport_set_completion, (void *)(long)ip);
     if (ret != ZOK) {
         NLOG_ERROR("set load report data failed, [%s]", zerror(ret));
+        return;
+    }
+
+    if (keepalive) {
+        report_stat.keepalive++;
+    } else {
+        report_stat.changed++;
     }
+
+    report_pending   = TRUE;
+    last_report      = report;
+    last_report_time = now;
 }
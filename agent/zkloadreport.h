@@ -22,6 +22,16 @@
 
 #include <stdint.h>
 
+#define NLB_LR_DEFAULT_DELTA        (5)         /* 默认负载变化阈值，百分点 */
+#define NLB_LR_DEFAULT_KEEPALIVE    (60)        /* 默认负载没有变化时的最长上报间隔，秒 */
+#define NLB_LOAD_REPORT_CHECK       (1000)      /* 检查负载变化的间隔，毫秒 */
+#define NLB_LOAD_REPORT_STAT        (60000)     /* 输出上报统计的间隔，毫秒 */
+
+/**
+ * @brief 获取负载上报节点路径
+ */
+int32_t make_zk_loadreport_path(uint32_t ip, char *buff, int32_t len);
+
 /**
  * @brief 创建服务器负载上报临时节点
  * @info  服务提供方agent创建，[server | mix]
@@ -30,7 +40,9 @@
 int32_t create_loadreport_node(uint32_t ip);
 
 /**
- * @brief 负载上报主处理函数
+ * @brief 负载上报主处理函数，主循环中调用
+ * @info  每NLB_LOAD_REPORT_CHECK检查一次，负载变化超过阈值或者超过最长上报间隔时才写zookeeper，
+ *        定时输出写zookeeper的次数和频率
  */
 void load_report(uint32_t ip);
 
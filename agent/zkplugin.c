@@ -33,6 +33,8 @@
 #include "nlbtime.h"
 #include "agent.h"
 #include "zkheartbeat.h"
+#include "resync.h"
+#include "zkjournal.h"
 
 static zhandle_t *zh;
 static clientid_t myid;
@@ -330,6 +332,7 @@ int32_t nlb_zk_reinit(void)
 
     clean_nodes_watching();
     clean_services_watching();
+    clean_service_journal();
 
     ret = nlb_zk_init(get_zk_host(), get_zk_timeout());
     if (ret < 0) {
@@ -337,6 +340,9 @@ int32_t nlb_zk_reinit(void)
         return -1;
     }
 
+    /* 会话重建后所有业务监视都已失效，重新同步 */
+    resync_start();
+
     return 0;
 }
 
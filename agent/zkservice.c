@@ -31,11 +31,20 @@
 #include "event.h"
 #include "routeprocess.h"
 #include "jsonparser.h"
+#include "resync.h"
+#include "zkjournal.h"
+#include "svcchunk.h"
+
+/* 拉取业务配置的请求上下文，业务名在开头，回调中可以直接作为业务名使用 */
+struct service_req_ctx {
+    char     name[NLB_SERVICE_NAME_LEN];    /* 业务名 */
+    uint32_t round;                         /* 重新同步的轮次，普通请求为0 */
+};
 
 /**
  * @brief 获取zookeeper节点路径
  */
-static int32_t make_zk_service_path(const char *name, char *buff, int32_t len)
+int32_t make_zk_service_path(const char *name, char *buff, int32_t len)
 {
     int32_t slen;
     char *pos;
@@ -167,7 +176,8 @@ void set_service_watcher(struct agent_local_rdata *rdata)
     int32_t ret;
     char path[NLB_PATH_MAX_LEN];
 
-    if (!zk_connected() || is_service_watching(rdata->name)) {
+    /* 变更日志方式不需要每个业务的watch */
+    if (!zk_connected() || is_service_watching(rdata->name) || service_journal_active()) {
         return;
     }
 
@@ -182,27 +192,18 @@ void set_service_watcher(struct agent_local_rdata *rdata)
 }
 
 /**
- * @brief  处理从zookeeper新加载的配置
+ * @brief  用解析好的服务器列表更新或者创建本地业务
  * @return =0 成功 <0 失败
  */
-int32_t update_rdata_by_zk_service_json_data(const char *name, const char *value, int32_t value_len, uint64_t mtime)
+int32_t update_rdata_by_zk_service_servers(const char *name, struct shm_servers *servers, uint64_t mtime)
 {
     int32_t ret;
-    struct shm_servers *servers = NULL;
     struct agent_local_rdata *rdata;
 
-    /* 解析json协议 */
-    ret = json_parse_service(value, value_len, &servers);
-    if (ret < 0) {
-        NLOG_ERROR("Parse nameservice (%s) json config failed, ret [%d].", name, ret);
-        return -1;
-    }
-
     /* 如果本地有该业务路由数据，只需要更新 */
     rdata = get_local_rdata(name);
     if (rdata != NULL) {
         update_rdata_by_zk_service_nodes(rdata, servers, mtime);
-        free(servers);
         return 0;
     }
 
@@ -210,13 +211,38 @@ int32_t update_rdata_by_zk_service_json_data(const char *name, const char *value
     ret = add_rdata(name, servers, mtime);
     if (ret < 0) {
         NLOG_ERROR("add new service failed, ret [%d]", ret);
-        free(servers);
-        return -2;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  处理从zookeeper新加载的配置
+ * @info   没有IPInfo时按分片业务清单处理，分片异步拉取
+ * @return =0 成功 >0 分片拉取中 <0 失败
+ */
+int32_t update_rdata_by_zk_service_json_data(const char *name, const char *value, int32_t value_len, uint64_t mtime)
+{
+    int32_t ret;
+    struct shm_servers *servers = NULL;
+
+    /* 解析json协议 */
+    ret = json_parse_service(value, value_len, &servers);
+    if (ret == NLB_JSON_NO_IPINFO) {
+        ret = svcchunk_load(name, value, value_len, mtime);
+        return (ret < 0) ? -1 : 1;
     }
 
+    if (ret < 0) {
+        NLOG_ERROR("Parse nameservice (%s) json config failed, ret [%d].", name, ret);
+        return -1;
+    }
+
+    ret = update_rdata_by_zk_service_servers(name, servers, mtime);
     free(servers);
 
-    return 0;
+    return (ret < 0) ? -2 : 0;
 }
 
 /**
@@ -266,6 +292,12 @@ static void nameservice_aget_completion(int32_t rc, const char *value, int32_t v
         goto ERR_RET;
     }
 
+    /* 分片业务在所有分片拉取完成后处理路由请求任务 */
+    if (ret > 0) {
+        free((void *)ctx);
+        return;
+    }
+
     /* 业务配置加载成功，需要处理路由请求任务 */
     process_route_task((char *)ctx);
     free((void *)ctx);
@@ -278,15 +310,14 @@ ERR_RET:
 }
 
 /**
- * @brief  获取业务配置信息
- * @info   只有新业务请求和NLB_EVENT_TYPE_GET_SERVICE_NODES事件会调用该函数
+ * @brief  发起获取业务配置请求
  * @return =0 成功 <0 失败
  */
-int32_t get_service_nodes(const char *name)
+static int32_t aget_service_nodes(const char *name, data_completion_t completion, uint32_t round)
 {
     int32_t ret, result;
     char  path[NLB_PATH_MAX_LEN];
-    char *ctx = NULL;
+    struct service_req_ctx *ctx = NULL;
 
     if (!zk_connected()) {
         result = -1;
@@ -296,16 +327,18 @@ int32_t get_service_nodes(const char *name)
 
     NLOG_DEBUG("load service [%s] config", name);
 
-    ctx = strdup(name);
+    ctx = (struct service_req_ctx *)calloc(1, sizeof(struct service_req_ctx));
     if (NULL == ctx) {
         NLOG_ERROR("No memory");
         result = -1;
         goto ERR_EXIT;
     }
+    strncpy(ctx->name, name, NLB_SERVICE_NAME_LEN - 1);
+    ctx->round = round;
 
     /* 调用zookeeper接口获取数据 */
     make_zk_service_path(name, path, NLB_PATH_MAX_LEN);
-    ret = zoo_aget(get_zk_instance(), path, 0, nameservice_aget_completion, ctx);
+    ret = zoo_aget(get_zk_instance(), path, 0, completion, ctx);
     if (ret != ZOK) {
         NLOG_ERROR("get service (%s) from zookeeper failed, [%s]", name, zerror(ret));
         result = -2;
@@ -324,3 +357,136 @@ ERR_EXIT:
 
     return result;
 }
+
+/**
+ * @brief  获取业务配置信息
+ * @info   只有新业务请求和NLB_EVENT_TYPE_GET_SERVICE_NODES事件会调用该函数
+ * @return =0 成功 <0 失败
+ */
+int32_t get_service_nodes(const char *name)
+{
+    return aget_service_nodes(name, nameservice_aget_completion, 0);
+}
+
+/**
+ * @brief 重新同步拉取业务配置回调函数
+ * @info  先通知重新同步引擎释放窗口，再按普通拉取流程处理配置
+ */
+static void nameservice_resync_aget_completion(int32_t rc, const char *value, int32_t value_len,
+                                               const struct Stat *stat, const void *ctx)
+{
+    uint32_t round = ((const struct service_req_ctx *)ctx)->round;
+
+    if (rc == ZOK) {
+        resync_complete(round, NLB_RESYNC_CHANGED);
+    } else if (rc == ZNONODE) {
+        resync_complete(round, NLB_RESYNC_UNCHANGED);
+    } else {
+        resync_complete(round, NLB_RESYNC_FAILED);
+    }
+
+    nameservice_aget_completion(rc, value, value_len, stat, ctx);
+}
+
+/**
+ * @brief 重新同步业务exists回调函数
+ * @info  重新设置监视的同时比较mtime，只有配置变化的业务才拉取数据
+ *        请求期间业务可能已被删除，按业务名重新查找
+ */
+static void nameservice_resync_exists_completion(int32_t rc, const struct Stat *stat, const void *data)
+{
+    struct service_req_ctx *ctx = (struct service_req_ctx *)data;
+    struct agent_local_rdata *rdata;
+    char *name = ctx->name;
+    uint32_t round = ctx->round;
+    int32_t result;
+
+    rdata = get_local_rdata(name);
+    if (NULL == rdata) {
+        result = NLB_RESYNC_UNCHANGED;
+        goto EXIT;
+    }
+
+    if (rc == ZNONODE) {
+        set_service_watching(name);
+        result = NLB_RESYNC_UNCHANGED;
+        goto EXIT;
+    }
+
+    if (rc != ZOK) {
+        clean_service_watching(name);
+        NLOG_ERROR("resync service (%s) exists failed, [%s]", name, zerror(rc));
+        result = NLB_RESYNC_FAILED;
+        goto EXIT;
+    }
+
+    set_service_watching(name);
+
+    if (rdata->route_meta->mtime == (uint64_t)stat->mtime) {
+        result = NLB_RESYNC_UNCHANGED;
+        goto EXIT;
+    }
+
+    /* 配置变化，拉取数据期间继续占用同步窗口 */
+    if (aget_service_nodes(name, nameservice_resync_aget_completion, round) < 0) {
+        result = NLB_RESYNC_FAILED;
+        goto EXIT;
+    }
+
+    free(ctx);
+    return;
+
+EXIT:
+    resync_complete(round, result);
+    free(ctx);
+}
+
+/**
+ * @brief  重新同步一个业务
+ * @info   本地有该业务时设置监视并比较mtime，本地没有时(热点列表预取)直接拉取配置
+ *         请求完成后会调用且只调用一次resync_complete，并带回本轮的轮次
+ * @return =0 请求已发出 <0 失败
+ */
+int32_t resync_service(const char *name, uint32_t round)
+{
+    int32_t ret;
+    char path[NLB_PATH_MAX_LEN];
+    struct agent_local_rdata *rdata;
+    struct service_req_ctx *ctx;
+
+    if (!zk_connected()) {
+        return -1;
+    }
+
+    rdata = get_local_rdata(name);
+    if (NULL == rdata) {
+        ret = aget_service_nodes(name, nameservice_resync_aget_completion, round);
+        return (ret < 0) ? -2 : 0;
+    }
+
+    ctx = (struct service_req_ctx *)calloc(1, sizeof(struct service_req_ctx));
+    if (NULL == ctx) {
+        NLOG_ERROR("No memory");
+        return -4;
+    }
+    memcpy(ctx->name, rdata->name, NLB_SERVICE_NAME_LEN);
+    ctx->round = round;
+
+    /* 变更日志方式只比较mtime，不设置watch */
+    make_zk_service_path(name, path, sizeof(path));
+    if (service_journal_active()) {
+        ret = zoo_aexists(get_zk_instance(), path, 0, nameservice_resync_exists_completion, ctx);
+    } else {
+        ret = zoo_awexists(get_zk_instance(), path, nameservice_exists_watcher, rdata,
+                           nameservice_resync_exists_completion, ctx);
+    }
+    if (ret != ZOK) {
+        clean_service_watching(name);
+        NLOG_ERROR("zoo_awexists (%s) failed, [%s]", path, zerror(ret));
+        free(ctx);
+        return -3;
+    }
+
+    return 0;
+}
+
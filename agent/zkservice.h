@@ -23,6 +23,11 @@
 #include <stdint.h>
 #include "agent.h"
 
+/**
+ * @brief 获取业务的zookeeper节点路径
+ */
+int32_t make_zk_service_path(const char *name, char *buff, int32_t len);
+
 /**
  * @brief  获取业务配置信息
  * @info   只有新业务请求和NLB_EVENT_TYPE_GET_SERVICE_NODES事件会调用该函数
@@ -30,11 +35,25 @@
  */
 int32_t get_service_nodes(const char *name);
 
+/**
+ * @brief  用解析好的服务器列表更新或者创建本地业务
+ * @return =0 成功 <0 失败
+ */
+int32_t update_rdata_by_zk_service_servers(const char *name, struct shm_servers *servers, uint64_t mtime);
+
 /**
  * @brief 设置业务监视事件
  * @info  必须保证在本地有该业务
  */
 void set_service_watcher(struct agent_local_rdata *rdata);
 
+/**
+ * @brief  重新同步一个业务
+ * @info   请求完成后会调用且只调用一次resync_complete，并带回本轮的轮次
+ * @param  round --> 重新同步的轮次
+ * @return =0 请求已发出 <0 失败
+ */
+int32_t resync_service(const char *name, uint32_t round);
+
 #endif
 
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <signal.h>
 #include "hash.h"
 #include "commtype.h"
 #include "commdef.h"
@@ -48,21 +49,24 @@
 #include "atomic.h"
 #include "version.h"
 #include "nlbrand.h"
+#include "nlbtime.h"
+#include "routedata.h"
 
 #define NLB_ROUTE_DATA_HASHLEN 107
-
-/* 一个后台服务的路由相关数据 */
-struct api_routedata
-{
-    struct slist_head node;                  /* 链表节点   */
-    char name[NLB_SERVICE_NAME_LEN];         /* 业务名     */
-    struct shm_meta *route_meta;             /* 元数据信息 */
-    struct shm_servers *servers_data[2];     /* 服务器信息 */
-};
+#define NLB_ROUTE_DISTINCT_TRIES 4  /* 批量获取不同路由时，每个路由的随机重试次数 */
+#define NLB_EJECT_REROLL_TIMES   2  /* 选中被摘除服务器时，按权重重新选择的次数 */
+#define NLB_EJECT_LEVEL_MAX      16 /* 摘除退避级别上限 */
+#define NLB_APP_LOAD_RETRY_TIME  1000 /* 没有应用负载共享内存时重新加载的间隔，毫秒 */
 
 /* API所有业务路由数据，使用hash建索引，快速查找 */
 static struct slist_head route_data_hash[NLB_ROUTE_DATA_HASHLEN];
 
+/* 应用负载共享内存和本进程的负载槽 */
+static struct shm_app_load  *app_load;
+static struct app_load_slot *app_load_slot;
+static uint32_t app_load_pid;           /* 申请负载槽的进程号，fork后重新申请 */
+static uint64_t app_load_attach_time;   /* 上次加载共享内存的时间 */
+
 
 /**
  * @brief 更新服务器和统计数据
@@ -157,100 +161,902 @@ uint16_t get_one_port(struct server_info *server)
     return (server->port[idx]);
 }
 
-/* 获取端口类型 */
-NLB_PORT_TYPE get_port_type(struct server_info *server)
-{
-    return (NLB_PORT_TYPE)server->port_type;
+/* 获取端口类型 */
+NLB_PORT_TYPE get_port_type(struct server_info *server)
+{
+    return (NLB_PORT_TYPE)server->port_type;
+}
+
+float calc_success_ratio(struct shm_servers *shm_servers, struct server_info *server)
+{
+    uint32_t req_total;
+
+    req_total = server->failed + server->success;
+
+    if (req_total < shm_servers->shaping_request_min) {
+        return 100.0;
+    }
+
+    return ((float)server->success) / (req_total == 0 ? 1e-6f : (float)(req_total));
+}
+
+/* 摘除时间戳，最低位为0，并且不为0 */
+static inline uint32_t eject_stamp(uint32_t now)
+{
+    now &= ~(uint32_t)1;
+    return now ? now : 2;
+}
+
+/**
+ * @brief 计算摘除后的探测等待时间，按退避级别指数增长
+ */
+static uint32_t calc_eject_wait(struct shm_servers *servers, uint8_t level)
+{
+    uint64_t wait = servers->eject_base_time;
+
+    if (level > 1) {
+        wait <<= min(level - 1, NLB_EJECT_LEVEL_MAX);
+    }
+
+    return (uint32_t)min(wait, (uint64_t)servers->eject_max_time);
+}
+
+/**
+ * @brief 检查服务器是否被客户端摘除
+ * @info  摘除后等待退避时间，抢到探测权的一个请求放行，探测期间eject_time最低位为1；
+ *        探测请求没有上报结果时，等待时间到了再放行下一个探测
+ * @return TRUE 摘除中，不能选择 FALSE 可以选择
+ */
+static BOOL check_server_ejected(struct shm_servers *servers, struct server_info *server)
+{
+    uint32_t eject_time = server->eject_time;
+    uint32_t now;
+
+    if (!eject_time) {
+        return FALSE;
+    }
+
+    now = (uint32_t)get_time_ms();
+    if (now - eject_time < calc_eject_wait(servers, server->eject_level)) {
+        return TRUE;
+    }
+
+    return !compare_and_swap(&server->eject_time, eject_time, now | 1);
+}
+
+/* 计数加value，到255后不再增长 */
+static void saturate_add_1(uint8_t *ptr, uint8_t value)
+{
+    uint8_t old;
+
+    do {
+        old = *ptr;
+        if (old == 255) {
+            return;
+        }
+    } while (!compare_and_swap_1(ptr, old, (uint8_t)min((uint32_t)old + value, 255U)));
+}
+
+/**
+ * @brief 占用一个摘除名额
+ * @info  同时摘除的服务器不超过存活服务器的NLB_EJECT_MAX_PERCENT，至少可以摘除一台，
+ *        避免下游故障时所有客户端把整个业务都摘除
+ * @return TRUE 成功 FALSE 名额已满
+ */
+static BOOL acquire_eject_slot(struct shm_servers *servers)
+{
+    uint32_t num;
+    uint32_t alive = servers->server_num - servers->dead_num;
+    uint32_t limit = max(alive * NLB_EJECT_MAX_PERCENT / 100, 1U);
+
+    do {
+        num = servers->eject_num;
+        if (num >= limit) {
+            return FALSE;
+        }
+    } while (!compare_and_swap(&servers->eject_num, num, num + 1));
+
+    return TRUE;
+}
+
+/* 释放一个摘除名额 */
+static void release_eject_slot(struct shm_servers *servers)
+{
+    uint32_t num;
+
+    do {
+        num = servers->eject_num;
+        if (!num) {
+            return;
+        }
+    } while (!compare_and_swap(&servers->eject_num, num, num - 1));
+}
+
+/* 退避级别加一 */
+static void incr_eject_level(struct server_info *server)
+{
+    if (server->eject_level < NLB_EJECT_LEVEL_MAX) {
+        fetch_and_add_1(&server->eject_level, 1);
+    }
+}
+
+/**
+ * @brief 失败时更新连续失败和错误突发计数，达到阈值立即摘除
+ * @info  探测请求失败，重新摘除并加大退避
+ */
+static void eject_on_failure(struct shm_servers *servers, struct server_info *server, int32_t failed)
+{
+    uint32_t now, window, eject_time;
+    uint8_t  cnt = (uint8_t)min(failed, 255);
+
+    if (!servers->eject_consecutive && !servers->eject_burst) {
+        return;
+    }
+
+    saturate_add_1(&server->fail_streak, cnt);
+
+    now        = (uint32_t)get_time_ms();
+    eject_time = server->eject_time;
+
+    if (eject_time & 1) {
+        if (compare_and_swap(&server->eject_time, eject_time, eject_stamp(now))) {
+            incr_eject_level(server);
+        }
+        return;
+    }
+
+    if (eject_time) {
+        return;
+    }
+
+    if (servers->eject_burst) {
+        window = (now / max(servers->eject_burst_window, (uint16_t)1)) & 0xff;
+        if (server->burst_window != window) {
+            server->burst_window = (uint8_t)window;
+            server->burst_failed = 0;
+        }
+
+        saturate_add_1(&server->burst_failed, cnt);
+    }
+
+    if ((servers->eject_consecutive && server->fail_streak >= servers->eject_consecutive)
+        || (servers->eject_burst && server->burst_failed >= servers->eject_burst)) {
+        if (!acquire_eject_slot(servers)) {
+            return;
+        }
+
+        if (compare_and_swap(&server->eject_time, 0, eject_stamp(now))) {
+            incr_eject_level(server);
+        } else {
+            release_eject_slot(servers);
+        }
+    }
+}
+
+/**
+ * @brief 成功时清除连续失败计数，探测成功则恢复服务器
+ */
+static void eject_on_success(struct shm_servers *servers, struct server_info *server)
+{
+    uint32_t eject_time = server->eject_time;
+
+    if (server->fail_streak) {
+        server->fail_streak = 0;
+    }
+
+    if ((eject_time & 1) && compare_and_swap(&server->eject_time, eject_time, 0)) {
+        release_eject_slot(servers);
+    }
+}
+
+/**
+ * @brief 通过二分查找法在存活服务器中查找权重落点所在的服务器
+ */
+static struct server_info *find_server_by_weight(struct shm_servers *servers_data, uint32_t weight_rand)
+{
+    uint32_t high, mid, low = 0;
+    struct server_info *servers = servers_data->svrs;
+    struct server_info *server  = servers;
+
+    high = servers_data->server_num - servers_data->dead_num - 1;
+    while (low <= high) {
+        mid    = (low + high)/2;
+        server = servers + mid;
+        if (low == high) {
+            break;
+        }
+
+        if (weight_rand < server->weight_base) {
+            high = mid - 1;
+            continue;
+        }
+
+        if (weight_rand >= (server->weight_dynamic + server->weight_base)) {
+            low = mid + 1;
+            continue;
+        }
+
+        break;
+    }
+
+    return server;
+}
+
+/* 检查IP是否在排除列表中 */
+static BOOL ip_excluded(const uint32_t *excludes, int32_t num, uint32_t ip)
+{
+    int32_t i;
+
+    for (i = 0; i < num; i++) {
+        if (excludes[i] == ip) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief 选中的服务器被客户端摘除，重新选择
+ * @info  先按权重重新选择几次，再从随机位置顺序查找未摘除的存活服务器，
+ *        都被摘除时仍然返回原服务器，避免无路由可用
+ */
+static struct server_info *reroll_ejected(struct shm_servers *servers_data, struct server_info *server,
+                                          const uint32_t *excludes, int32_t num)
+{
+    uint32_t i, start;
+    uint32_t alive_num = servers_data->server_num - servers_data->dead_num;
+    struct server_info *other;
+
+    if (!alive_num || !servers_data->weight_dead_base) {
+        return server;
+    }
+
+    for (i = 0; i < NLB_EJECT_REROLL_TIMES; i++) {
+        other = find_server_by_weight(servers_data, nlb_rand() % servers_data->weight_dead_base);
+        if (!ip_excluded(excludes, num, other->server_ip) && !check_server_ejected(servers_data, other)) {
+            return other;
+        }
+    }
+
+    start = nlb_rand() % alive_num;
+    for (i = 0; i < alive_num; i++) {
+        other = servers_data->svrs + (start + i) % alive_num;
+        if (!other->eject_time && !ip_excluded(excludes, num, other->server_ip)) {
+            return other;
+        }
+    }
+
+    return server;
+}
+
+/* 被跳过的权重区间 */
+struct weight_range {
+    uint32_t begin;
+    uint32_t len;
+};
+
+/**
+ * @brief 计算预热中的服务器当前的权重比例，千分比
+ * @info  预热开始时间为秒的低16位，毫秒级插值预热曲线表，权重在选择时平滑增长
+ */
+static uint32_t calc_warm_factor(struct shm_servers *servers_data, struct server_info *server)
+{
+    uint16_t start  = server->warm_start;
+    uint32_t window = servers_data->slow_start_window;
+    uint32_t idx, frac;
+    uint64_t now, elapsed, pos;
+    const uint16_t *ramp = servers_data->slow_start_ramp;
+
+    if (!start || !window) {
+        return 1000;
+    }
+
+    now     = get_time_ms();
+    elapsed = (((now / 1000) - start) & 0xffff) * 1000 + now % 1000;
+    if (elapsed >= (uint64_t)window * 1000) {
+        return 1000;
+    }
+
+    /* 曲线表位置，单位为千分之一段 */
+    pos  = elapsed * NLB_SLOW_START_STEPS / window;
+    idx  = (uint32_t)(pos / 1000);
+    frac = (uint32_t)(pos % 1000);
+
+    return (uint32_t)(ramp[idx] + ((int32_t)ramp[idx + 1] - (int32_t)ramp[idx]) * (int32_t)frac / 1000);
+}
+
+/**
+ * @brief 收集预热中的服务器需要跳过的权重区间
+ * @info  按预热曲线只保留服务器权重区间的前一部分，剩余部分在选择时跳过，
+ *        等效于在选择时按曲线降低该服务器的权重，不会因为预热服务器权重占比高而失效；
+ *        agent按下标升序记录预热服务器，区间已经按起始权重排序，排除的服务器整个区间另外跳过
+ * @return 区间个数
+ */
+static int32_t collect_warm_ranges(struct shm_servers *servers_data, const uint32_t *excludes, int32_t num,
+                                   struct weight_range *ranges, uint32_t *weight_cut)
+{
+    uint32_t i, idx, keep;
+    uint32_t alive_num = servers_data->server_num - servers_data->dead_num;
+    uint32_t warm_num  = min((uint32_t)servers_data->warm_num, (uint32_t)NLB_SLOW_START_LIST);
+    int32_t  cnt = 0;
+    struct server_info *server;
+
+    *weight_cut = 0;
+    if (!servers_data->slow_start_window) {
+        return 0;
+    }
+
+    for (i = 0; i < warm_num; i++) {
+        idx = servers_data->warm_idx[i];
+        if (idx >= alive_num) {
+            continue;
+        }
+
+        server = servers_data->svrs + idx;
+        if (!server->weight_dynamic || ip_excluded(excludes, num, server->server_ip)) {
+            continue;
+        }
+
+        keep = server->weight_dynamic * calc_warm_factor(servers_data, server) / 1000;
+        if (keep >= server->weight_dynamic) {
+            continue;
+        }
+
+        ranges[cnt].begin = server->weight_base + keep;
+        ranges[cnt].len   = server->weight_dynamic - keep;
+        *weight_cut      += ranges[cnt].len;
+        cnt++;
+    }
+
+    return cnt;
+}
+
+/* 在去掉跳过区间的权重中随机，依次跳过落点之前的区间映射回原始权重 */
+static uint32_t rand_weight_skip(uint32_t weight, const struct weight_range *ranges, int32_t cnt)
+{
+    int32_t  i;
+    uint32_t weight_rand = nlb_rand() % weight;
+
+    for (i = 0; i < cnt && weight_rand >= ranges[i].begin; i++) {
+        weight_rand += ranges[i].len;
+    }
+
+    return weight_rand;
+}
+
+/**
+ * @brief 占用服务器的一个并发
+ * @info  没有并发上限的服务器不计数
+ * @return TRUE 成功 FALSE 并发已满
+ */
+static BOOL acquire_inflight(struct server_info *server)
+{
+    uint16_t inflight;
+    uint16_t limit = server->conc_limit;
+
+    if (!limit) {
+        return TRUE;
+    }
+
+    do {
+        inflight = server->inflight;
+        if (inflight >= limit) {
+            return FALSE;
+        }
+    } while (!compare_and_swap_2(&server->inflight, inflight, inflight + 1));
+
+    return TRUE;
+}
+
+/**
+ * @brief 释放服务器的一个并发，不会减到0以下
+ */
+static void release_inflight(struct server_info *server)
+{
+    uint16_t inflight;
+
+    do {
+        inflight = server->inflight;
+        if (!inflight) {
+            return;
+        }
+    } while (!compare_and_swap_2(&server->inflight, inflight, inflight - 1));
+}
+
+/**
+ * @brief 选中的服务器并发已满，按权重重新选择
+ * @info  跳过排除和客户端摘除的服务器，重新选择次数用完返回NULL
+ */
+static struct server_info *reroll_overloaded(struct shm_servers *servers_data, const uint32_t *excludes, int32_t num)
+{
+    uint32_t i;
+    struct server_info *server;
+
+    if (!servers_data->weight_dead_base || servers_data->dead_num >= servers_data->server_num) {
+        return NULL;
+    }
+
+    for (i = 0; i < servers_data->conc_reroll_times; i++) {
+        server = find_server_by_weight(servers_data, nlb_rand() % servers_data->weight_dead_base);
+        if (server->eject_time || ip_excluded(excludes, num, server->server_ip)) {
+            continue;
+        }
+
+        if (acquire_inflight(server)) {
+            return server;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 在指定服务器数据中通过二分查找法查找路由服务器
+ * @info  选中的服务器占用一个并发，并发已满时重新选择
+ * @return <0 失败 =0 成功
+ */
+static int32_t search_route_in_servers(struct shm_servers *servers_data, struct routeid *route)
+{
+    int32_t  cnt;
+    uint32_t weight_rand, weight_total, weight_cut;
+    uint32_t server_num, dead_num, dead_base;
+
+    struct server_info *servers      = servers_data->svrs;
+    struct server_info *server;
+    struct weight_range ranges[NLB_SLOW_START_LIST];
+
+    server_num   = servers_data->server_num;
+    dead_num     = servers_data->dead_num;
+    dead_base    = servers_data->weight_dead_base;
+    weight_total = servers_data->weight_total;
+
+    /* 没有服务器信息 */
+    if (!server_num) {
+        return NLB_ERR_NO_ROUTE;
+    }
+
+    /* 服务器全死机,原则上不会出现总权重为0的情况 */
+    if (dead_num == server_num || !dead_base || !weight_total) {
+        server = servers + nlb_rand() % server_num;
+        goto FOUND_ROUTE;
+    }
+
+    /* 如果权重落入死机区域，随机选择一个 */
+    weight_rand = nlb_rand() % weight_total;
+    if (weight_rand >= dead_base && check_dead_useable(servers_data)) {
+        server = servers + server_num - dead_num + nlb_rand()%dead_num;
+        goto FOUND_ROUTE;
+    }
+
+    /* 二分查找，预热中的服务器按预热曲线跳过部分权重，都在预热起点时按原始权重 */
+    cnt = collect_warm_ranges(servers_data, NULL, 0, ranges, &weight_cut);
+    if (weight_cut >= dead_base) {
+        cnt        = 0;
+        weight_cut = 0;
+    }
+
+    weight_rand = rand_weight_skip(dead_base - weight_cut, ranges, cnt);
+    server      = find_server_by_weight(servers_data, weight_rand);
+
+    /* 客户端摘除的服务器，重新选择 */
+    if (check_server_ejected(servers_data, server)) {
+        server = reroll_ejected(servers_data, server, NULL, 0);
+    }
+
+FOUND_ROUTE:
+
+    /* 如果当前机器成功率太低，重新再随机选择一个 */
+    if (calc_success_ratio(servers_data, server) < servers_data->success_ratio_min) {
+        server = servers + nlb_rand() % server_num;
+    }
+
+    /* 并发已满，重新选择，都满了返回过载 */
+    if (!acquire_inflight(server)) {
+        server = reroll_overloaded(servers_data, NULL, 0);
+        if (NULL == server) {
+            return NLB_ERR_OVERLOAD;
+        }
+    }
+
+    route->ip    = server->server_ip;
+    route->port  = get_one_port(server);
+    route->type  = get_port_type(server);
+
+    return 0;
+}
+
+/**
+ * @brief 通过二分查找法查找路由服务器
+ * @info  1. 服务器都死机，会随机找一个服务器
+ *        2. 死机服务器如果有dead_retrys,会尝试dead_retrys次
+ * @return <0 失败 =0 成功
+ */
+int32_t search_route(struct api_routedata *route_data, struct routeid *route)
+{
+    uint32_t index = route_data->route_meta->index;
+
+    return search_route_in_servers(route_data->servers_data[index], route);
+}
+
+/**
+ * @brief 从指定下标范围的随机位置开始，顺序查找第一个不在排除列表中的服务器
+ */
+static struct server_info *pick_server_excluded(struct shm_servers *servers_data, uint32_t begin, uint32_t count,
+                                                const uint32_t *excludes, int32_t num)
+{
+    uint32_t i, start;
+    struct server_info *server;
+
+    if (!count) {
+        return NULL;
+    }
+
+    start = nlb_rand() % count;
+    for (i = 0; i < count; i++) {
+        server = servers_data->svrs + begin + (start + i) % count;
+        if (!ip_excluded(excludes, num, server->server_ip)) {
+            return server;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 排除指定服务器后查找路由
+ * @info  1. 排除的存活服务器在weight_base布局中对应不相交的权重区间，排序后从剩余权重中随机，
+ *           再依次跳过落点之前的排除区间映射回原始权重，最后二分查找，复杂度O(k log k + log n)，
+ *           不会因为排除的服务器权重占比高而反复重试
+ *        2. 死机探测和低成功率重选同样跳过排除的服务器
+ *        3. 所有服务器都被排除时返回失败
+ * @return <0 失败 =0 成功
+ */
+int32_t search_route_exclude(struct api_routedata *route_data, const uint32_t *excludes, int32_t num,
+                             struct routeid *route)
+{
+    int32_t  i, j, cnt = 0, warm_cnt;
+    uint32_t alive_num, weight_rand, weight_excluded = 0, weight_cut;
+    uint32_t server_num, dead_num, dead_base, weight_total;
+    uint32_t index = route_data->route_meta->index;
+    struct shm_servers *servers_data = route_data->servers_data[index];
+    struct server_info *servers      = servers_data->svrs;
+    struct server_info *server, *other;
+    struct weight_range ranges[NLB_ROUTE_BATCH_MAX + NLB_SLOW_START_LIST], tmp;
+    struct weight_range warm_ranges[NLB_SLOW_START_LIST];
+
+    server_num   = servers_data->server_num;
+    dead_num     = servers_data->dead_num;
+    dead_base    = servers_data->weight_dead_base;
+    weight_total = servers_data->weight_total;
+    alive_num    = server_num - dead_num;
+
+    if (!server_num) {
+        return NLB_ERR_NO_ROUTE;
+    }
+
+    /* 收集排除的存活服务器的权重区间，按起始权重插入排序并去重 */
+    for (i = 0; i < num && cnt < NLB_ROUTE_BATCH_MAX; i++) {
+        server = get_server_by_ip(servers_data, excludes[i]);
+        if (NULL == server || (uint32_t)(server - servers) >= alive_num || !server->weight_dynamic) {
+            continue;
+        }
+
+        tmp.begin = server->weight_base;
+        tmp.len   = server->weight_dynamic;
+        for (j = cnt - 1; j >= 0 && ranges[j].begin > tmp.begin; j--) {
+            ranges[j + 1] = ranges[j];
+        }
+
+        if (j >= 0 && ranges[j].begin == tmp.begin) {
+            memmove(&ranges[j + 1], &ranges[j + 2], sizeof(tmp) * (cnt - j - 1));
+            continue;
+        }
+
+        ranges[j + 1] = tmp;
+        weight_excluded += tmp.len;
+        cnt++;
+    }
+
+    /* 服务器全死机或者存活权重全部被排除，随机选择一个未排除的服务器 */
+    if (dead_num == server_num || !dead_base || !weight_total || weight_excluded >= dead_base) {
+        server = pick_server_excluded(servers_data, 0, server_num, excludes, num);
+        if (NULL == server) {
+            return NLB_ERR_NO_ROUTE;
+        }
+        goto FOUND_ROUTE;
+    }
+
+    /* 如果权重落入死机区域，随机选择一个未排除的死机服务器 */
+    weight_rand = nlb_rand() % (weight_total - weight_excluded);
+    if (weight_rand >= dead_base - weight_excluded && check_dead_useable(servers_data)) {
+        server = pick_server_excluded(servers_data, alive_num, dead_num, excludes, num);
+        if (server) {
+            goto FOUND_ROUTE;
+        }
+    }
+
+    /* 预热中的未排除服务器按预热曲线跳过部分权重，合并到排除区间中 */
+    warm_cnt = collect_warm_ranges(servers_data, excludes, num, warm_ranges, &weight_cut);
+    if (weight_excluded + weight_cut < dead_base) {
+        for (i = 0; i < warm_cnt; i++) {
+            for (j = cnt - 1; j >= 0 && ranges[j].begin > warm_ranges[i].begin; j--) {
+                ranges[j + 1] = ranges[j];
+            }
+
+            ranges[j + 1] = warm_ranges[i];
+            cnt++;
+        }
+        weight_excluded += weight_cut;
+    }
+
+    /* 在剩余权重中随机，跳过排除区间映射回原始权重 */
+    weight_rand = rand_weight_skip(dead_base - weight_excluded, ranges, cnt);
+    server      = find_server_by_weight(servers_data, weight_rand);
+
+    /* 客户端摘除的服务器，重新选择 */
+    if (check_server_ejected(servers_data, server)) {
+        server = reroll_ejected(servers_data, server, excludes, num);
+    }
+
+FOUND_ROUTE:
+
+    /* 如果当前机器成功率太低，重新再随机选择一个未排除的服务器 */
+    if (calc_success_ratio(servers_data, server) < servers_data->success_ratio_min) {
+        other = pick_server_excluded(servers_data, 0, server_num, excludes, num);
+        server = other ? other : server;
+    }
+
+    /* 并发已满，重新选择，都满了返回过载 */
+    if (!acquire_inflight(server)) {
+        server = reroll_overloaded(servers_data, excludes, num);
+        if (NULL == server) {
+            return NLB_ERR_OVERLOAD;
+        }
+    }
+
+    route->ip    = server->server_ip;
+    route->port  = get_one_port(server);
+    route->type  = get_port_type(server);
+
+    return 0;
+}
+
+/* 检查路由是否已经选中 */
+static BOOL route_picked(const struct routeid *routes, int32_t num, uint32_t ip)
+{
+    int32_t i;
+
+    for (i = 0; i < num; i++) {
+        if (routes[i].ip == ip) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* 批量查找失败时释放已经占用的并发 */
+static void release_routes_inflight(struct shm_servers *servers_data, const struct routeid *routes, int32_t num)
+{
+    int32_t i;
+    struct server_info *server;
+
+    for (i = 0; i < num; i++) {
+        server = get_server_by_ip(servers_data, routes[i].ip);
+        if (server) {
+            release_inflight(server);
+        }
+    }
+}
+
+/**
+ * @brief 在同一份服务器数据快照中查找多个路由
+ * @info  1. 只读取一次数据下标，所有路由来自同一份数据
+ *        2. distinct非零时返回不同的服务器，按权重随机选择，重试次数用完后按顺序补齐，
+ *           存活服务器在数组前面，补齐时优先选择存活服务器，跳过客户端摘除的服务器
+ *        3. 两种方式都和单个查找一样占用并发，并发已满的服务器不会返回：
+ *           非distinct任一路由没有可用服务器时释放已占用的并发，返回过载；
+ *           distinct跳过并发已满的服务器，没有其它服务器可选时才返回少于请求个数的路由，
+ *           一个都没有时返回过载
+ * @return <0 失败 >0 路由个数，distinct时可能小于请求个数
+ */
+int32_t search_routes(struct api_routedata *route_data, int32_t num, int32_t distinct, struct routeid *routes)
+{
+    int32_t  ret, cnt = 0, tries;
+    uint32_t i;
+    uint32_t index = route_data->route_meta->index;
+    struct shm_servers *servers_data = route_data->servers_data[index];
+    struct server_info *server;
+
+    if (!servers_data->server_num) {
+        return NLB_ERR_NO_ROUTE;
+    }
+
+    if (!distinct) {
+        for (cnt = 0; cnt < num; cnt++) {
+            ret = search_route_in_servers(servers_data, &routes[cnt]);
+            if (ret < 0) {
+                release_routes_inflight(servers_data, routes, cnt);
+                return ret;
+            }
+        }
+        return cnt;
+    }
+
+    num = min(num, (int32_t)servers_data->server_num);
+    for (tries = num * NLB_ROUTE_DISTINCT_TRIES; cnt < num && tries > 0; tries--) {
+        ret = search_route_in_servers(servers_data, &routes[cnt]);
+        if (ret == NLB_ERR_OVERLOAD) {
+            continue;
+        }
+
+        if (ret < 0) {
+            release_routes_inflight(servers_data, routes, cnt);
+            return ret;
+        }
+
+        /* 重复选中的服务器释放刚占用的并发 */
+        if (route_picked(routes, cnt, routes[cnt].ip)) {
+            release_routes_inflight(servers_data, &routes[cnt], 1);
+            continue;
+        }
+
+        cnt++;
+    }
+
+    for (i = 0; cnt < num && i < servers_data->server_num; i++) {
+        server = servers_data->svrs + i;
+        if (route_picked(routes, cnt, server->server_ip) || check_server_ejected(servers_data, server)
+            || !acquire_inflight(server)) {
+            continue;
+        }
+
+        routes[cnt].ip   = server->server_ip;
+        routes[cnt].port = get_one_port(server);
+        routes[cnt].type = get_port_type(server);
+        cnt++;
+    }
+
+    if (!cnt) {
+        return NLB_ERR_OVERLOAD;
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief 更新服务器数据中指定服务器的统计信息
+ * @return <0 失败 =0 成功
+ */
+static int32_t update_server_stat(struct shm_servers *svrs, uint32_t ip, int32_t failed, int32_t cost)
+{
+    struct server_info *server;
+
+    server  = get_server_by_ip(svrs, ip);
+    if (NULL == server) {
+        return NLB_ERR_NO_SERVER;
+    }
+
+    release_inflight(server);
+
+    if (failed) {
+        fetch_and_add(&server->failed, (uint32_t)failed);
+        //fetch_and_add(&svrs->failed, (uint64_t)failed);
+        eject_on_failure(svrs, server, failed);
+    } else {
+        //fetch_and_add(&svrs->success, (uint32_t)1);
+        //fetch_and_add(&svrs->cost, (uint64_t)cost);
+        fetch_and_add(&server->success, (uint32_t)1);
+        fetch_and_add_8(&server->cost, (uint64_t)cost);
+        eject_on_success(svrs, server);
+    }
+
+    return 0;
 }
 
-float calc_success_ratio(struct shm_servers *shm_servers, struct server_info *server)
+/**
+ * @brief 成功调用按比例补充重试令牌
+ * @info  令牌桶满了只读不写，避免高并发成功调用时写共享缓存行
+ */
+static void deposit_retry_tokens(struct shm_meta *meta, struct shm_servers *svrs, uint32_t success)
 {
-    uint32_t req_total;
+    uint32_t capacity;
 
-    req_total = server->failed + server->success;
+    if (!success || svrs->retry_budget_ratio <= 0) {
+        return;
+    }
 
-    if (req_total < shm_servers->shaping_request_min) {
-        return 100.0;
+    capacity = min(svrs->retry_budget_max, (uint32_t)(UINT32_MAX / NLB_RETRY_TOKEN_UNIT / 2));
+    if (meta->retry_tokens >= capacity * NLB_RETRY_TOKEN_UNIT) {
+        return;
     }
 
-    return ((float)server->success) / (req_total == 0 ? 1e-6f : (float)(req_total));
+    fetch_and_add((uint32_t *)&meta->retry_tokens,
+                  (uint32_t)(svrs->retry_budget_ratio * NLB_RETRY_TOKEN_UNIT * success));
 }
 
 /**
- * @brief 通过二分查找法查找路由服务器
- * @info  1. 服务器都死机，会随机找一个服务器
- *        2. 死机服务器如果有dead_retrys,会尝试dead_retrys次
+ * @brief 更新指定路由数据的统计信息
  * @return <0 失败 =0 成功
  */
-int32_t search_route(struct api_routedata *route_data, struct routeid *route)
+int32_t update_route_stat(struct api_routedata *route_data, uint32_t ip, int32_t failed, int32_t cost)
 {
-    uint32_t high, mid, low = 0;
-    uint32_t weight_rand, weight_total;
-    uint32_t server_num, dead_num, dead_base;
-    uint32_t index = route_data->route_meta->index;
+    int32_t  ret;
+    uint32_t idx = route_data->route_meta->index;
+    struct shm_servers *svrs = route_data->servers_data[idx];
 
-    struct shm_servers *servers_data = route_data->servers_data[index];
-    struct server_info *servers      = servers_data->svrs;
-    struct server_info *server;
+    ret = update_server_stat(svrs, ip, failed, cost);
+    if (!ret && !failed) {
+        deposit_retry_tokens(route_data->route_meta, svrs, 1);
+    }
 
-    server_num   = servers_data->server_num;
-    dead_num     = servers_data->dead_num;
-    dead_base    = servers_data->weight_dead_base;
-    weight_total = servers_data->weight_total;
+    return ret;
+}
 
-    /* 没有服务器信息 */
-    if (!server_num) {
-        return NLB_ERR_NO_ROUTE;
+/**
+ * @brief 批量更新指定路由数据的统计信息
+ * @info  只读取一次数据下标，没有找到的服务器跳过，其它结果继续更新
+ * @return <0 有服务器没有找到 =0 成功
+ */
+int32_t update_routes_stat(struct api_routedata *route_data, const struct routeresult *results, int32_t num)
+{
+    int32_t  i, ret, result = 0;
+    uint32_t success = 0;
+    uint32_t idx = route_data->route_meta->index;
+    struct shm_servers *svrs = route_data->servers_data[idx];
+
+    for (i = 0; i < num; i++) {
+        ret = update_server_stat(svrs, results[i].ip, results[i].failed, results[i].cost);
+        if (ret < 0) {
+            result = ret;
+        } else if (!results[i].failed) {
+            success++;
+        }
     }
 
-    /* 服务器全死机,原则上不会出现总权重为0的情况 */
-    if (dead_num == server_num || !dead_base || !weight_total) {
-        server = servers + nlb_rand() % server_num;
-        goto FOUND_ROUTE;
-    }
+    deposit_retry_tokens(route_data->route_meta, svrs, success);
 
-    /* 如果权重落入死机区域，随机选择一个 */
-    weight_rand = nlb_rand() % weight_total;
-    if (weight_rand >= dead_base && check_dead_useable(servers_data)) {
-        server = servers + server_num - dead_num + nlb_rand()%dead_num;
-        goto FOUND_ROUTE;
-    }
+    return result;
+}
 
-    /* 二分查找 */
-    weight_rand = nlb_rand() % dead_base;
-    high = server_num - dead_num - 1;
-    while (low <= high) {
-        mid    = (low + high)/2;
-        server = servers + mid;
-        if (low == high) {
-            goto FOUND_ROUTE;
-        }
+/**
+ * @brief 从指定路由数据的重试令牌桶申请一次重试
+ * @info  先取令牌，令牌不足时使用每秒保底重试次数，保底计数按秒重置
+ * @return NLB_ERR_RETRY_BUDGET 预算已用完 =0 允许重试
+ */
+int32_t acquire_route_retry(struct api_routedata *route_data)
+{
+    uint32_t tokens, second, now;
+    struct shm_meta    *meta = route_data->route_meta;
+    struct shm_servers *svrs = route_data->servers_data[meta->index];
 
-        if (weight_rand < server->weight_base) {
-            high = mid - 1;
-            continue;
-        }
+    if (svrs->retry_budget_ratio <= 0) {
+        return 0;
+    }
 
-        if (weight_rand >= (server->weight_dynamic + server->weight_base)) {
-            low = mid + 1;
-            continue;
+    for (tokens = meta->retry_tokens; tokens >= NLB_RETRY_TOKEN_UNIT; tokens = meta->retry_tokens) {
+        if (compare_and_swap((uint32_t *)&meta->retry_tokens, tokens, tokens - NLB_RETRY_TOKEN_UNIT)) {
+            return 0;
         }
-
-        goto FOUND_ROUTE;
     }
 
-FOUND_ROUTE:
+    if (!svrs->retry_budget_min) {
+        return NLB_ERR_RETRY_BUDGET;
+    }
 
-    /* 如果当前机器成功率太低，重新再随机选择一个 */
-    if (calc_success_ratio(servers_data, server) < servers_data->success_ratio_min) {
-        server = servers + nlb_rand() % server_num;
+    now    = (uint32_t)(get_time_ms() / 1000);
+    second = meta->retry_second;
+    if (second != now && compare_and_swap((uint32_t *)&meta->retry_second, second, now)) {
+        return_and_set((uint32_t *)&meta->retry_floor, 1);
+        return 0;
     }
 
-    route->ip    = server->server_ip;
-    route->port  = get_one_port(server);
-    route->type  = get_port_type(server);
+    if (fetch_and_add((uint32_t *)&meta->retry_floor, 1) < svrs->retry_budget_min) {
+        return 0;
+    }
 
-    return 0;
+    return NLB_ERR_RETRY_BUDGET;
 }
 
 /**
@@ -375,6 +1181,70 @@ EXIT_LABEL:
     return result;
 }
 
+/**
+ * @brief  通过业务名到Agent批量获取路由
+ * @return <0 失败  >0 路由个数
+ */
+int32_t get_routes_from_agent(const char *name, int32_t num, int32_t distinct, struct routeid *routes)
+{
+    int32_t ret, len, result = 0;
+    int32_t fd;
+    char    buff[1024];
+    struct  sockaddr_in server_addr;
+
+    if (NULL == name || NULL == routes) {
+        return NLB_ERR_INVALID_PARA;
+    }
+
+    /* 创建UDP socket，并设置非阻塞 */
+    fd = create_udp_socket();
+    if (fd < 0) {
+        return NLB_ERR_CREATE_SOCKET_FAIL;
+    }
+
+    /* 组包并发送批量路由请求 */
+    make_inet_addr("127.0.0.1", (uint16_t)NLB_AGENT_LISTEN_PORT, &server_addr);
+    len = serialize_route_batch_request(name, (uint16_t)num, distinct ? NLB_ROUTE_BATCH_DISTINCT : 0,
+                                        buff, sizeof(buff));
+    if (len < 0) {
+        result = NLB_ERR_INVALID_PARA;
+        goto EXIT_LABEL;
+    }
+
+    ret = udp_send(fd, &server_addr, buff, len);
+    if (ret < 0) {
+        result = NLB_ERR_SEND_FAIL;
+        goto EXIT_LABEL;
+    }
+
+    /* 阻塞接收路由请求应答: 1秒超时 */
+    len = udp_recv(fd, buff, sizeof(buff), 1000);
+    if (len <= 0) {
+        result = NLB_ERR_RECV_FAIL;
+        goto EXIT_LABEL;
+    }
+
+    ret = deserialize_route_batch_response(buff, len, &result, routes, &num);
+    if (ret < 0) {
+        result = NLB_ERR_INVALID_RSP;
+        goto EXIT_LABEL;
+    }
+
+    /* agent回复错误码 */
+    if (result || !num) {
+        result = NLB_ERR_AGENT_ERR;
+        goto EXIT_LABEL;
+    }
+
+    close(fd);
+    return num;
+
+EXIT_LABEL:
+
+    close(fd);
+    return result;
+}
+
 /**
  * @brief 检查业务名是否有效
  * @info  必须两级业务名，"Login.ptlogin"
@@ -431,10 +1301,7 @@ int32_t getroutebyname(const char *name, struct routeid *route)
  */
 int32_t updateroute(const char *name, uint32_t ip, int32_t failed, int32_t cost)
 {
-    uint32_t idx;
     struct api_routedata *route_data;
-    struct shm_servers *svrs;
-    struct server_info *server;
 
     if (!check_service_name(name)) {
         return NLB_ERR_INVALID_PARA;
@@ -445,23 +1312,214 @@ int32_t updateroute(const char *name, uint32_t ip, int32_t failed, int32_t cost)
         return NLB_ERR_NO_ROUTEDATA;
     }
 
-    idx     = route_data->route_meta->index;
-    svrs    = route_data->servers_data[idx];
-    server  = get_server_by_ip(svrs, ip);
-    if (NULL == server) {
-        return NLB_ERR_NO_SERVER;
+    return update_route_stat(route_data, ip, failed, cost);
+}
+
+/**
+ * @brief 通过业务名批量获取路由信息
+ * @info  所有路由来自同一份路由数据，适用于分片扇出、对冲请求、重试等场景
+ * @para  name:    输入参数，业务名字符串  "Login.ptlogin"
+ *        num:     输入参数，路由个数，不超过NLB_ROUTE_BATCH_MAX
+ *        distinct:输入参数，非零表示返回不同的服务器
+ *        routes:  输出参数，路由信息数组，至少num个
+ * @return  >0: 返回的路由个数，distinct时服务器数不足会小于num  others: 失败
+ */
+int32_t getroutesbyname(const char *name, int32_t num, int32_t distinct, struct routeid *routes)
+{
+    struct api_routedata *route_data;
+
+    if (!check_service_name(name) || NULL == routes || num <= 0 || num > NLB_ROUTE_BATCH_MAX) {
+        return NLB_ERR_INVALID_PARA;
     }
 
-    if (failed) {
-        fetch_and_add(&server->failed, (uint32_t)failed);
-        //fetch_and_add(&svrs->failed, (uint64_t)failed);
-    } else {
-        //fetch_and_add(&svrs->success, (uint32_t)1);
-        //fetch_and_add(&svrs->cost, (uint64_t)cost);
-        fetch_and_add(&server->success, (uint32_t)1);
-        fetch_and_add_8(&server->cost, (uint64_t)cost);
+    route_data = get_route_data(name);
+    if (NULL == route_data) {
+        route_data = load_route_data(name);
+    }
+
+    if (NULL == route_data) {
+        return get_routes_from_agent(name, num, distinct, routes);
+    }
+
+    return search_routes(route_data, num, distinct, routes);
+}
+
+/**
+ * @brief 批量更新路由统计数据
+ * @info  没有找到的服务器跳过，其它结果继续更新
+ * @para  name:    输入参数，业务名字符串  "Login.ptlogin"
+ *        results: 输入参数，调用结果数组
+ *        num:     输入参数，结果个数
+ * @return  0: 成功  others: 失败
+ */
+int32_t updateroutes(const char *name, const struct routeresult *results, int32_t num)
+{
+    struct api_routedata *route_data;
+
+    if (!check_service_name(name) || NULL == results || num < 0) {
+        return NLB_ERR_INVALID_PARA;
+    }
+
+    route_data = get_route_data(name);
+    if (NULL == route_data) {
+        return NLB_ERR_NO_ROUTEDATA;
+    }
+
+    return update_routes_stat(route_data, results, num);
+}
+
+/**
+ * @brief 申请一次重试
+ * @info  没有本地路由数据时不做限制
+ * @para  name:  输入参数，业务名字符串  "Login.ptlogin"
+ * @return  0: 允许重试  NLB_ERR_RETRY_BUDGET: 预算已用完  others: 失败
+ */
+int32_t nlb_acquire_retry(const char *name)
+{
+    struct api_routedata *route_data;
+
+    if (!check_service_name(name)) {
+        return NLB_ERR_INVALID_PARA;
     }
 
+    route_data = get_route_data(name);
+    if (NULL == route_data) {
+        route_data = load_route_data(name);
+    }
+
+    if (NULL == route_data) {
+        return 0;
+    }
+
+    return acquire_route_retry(route_data);
+}
+
+/**
+ * @brief 通过业务名获取路由信息，排除指定的服务器
+ * @info  用于失败重试，避免重新选中刚刚失败的服务器
+ * @para  name:     输入参数，业务名字符串  "Login.ptlogin"
+ *        excludes: 输入参数，排除的IPV4地址数组，网络字节序
+ *        num:      输入参数，排除的地址个数，不超过NLB_ROUTE_BATCH_MAX
+ *        route:    输出参数，路由信息(ip地址，端口，端口类型)
+ * @return  0: 成功  others: 失败
+ */
+int32_t getroutebyname_ex(const char *name, const uint32_t *excludes, int32_t num, struct routeid *route)
+{
+    int32_t  i, ret;
+    struct api_routedata *route_data;
+    struct routeid routes[NLB_ROUTE_BATCH_MAX];
+
+    if (!check_service_name(name) || NULL == route || num < 0 || num > NLB_ROUTE_BATCH_MAX
+        || (num && NULL == excludes)) {
+        return NLB_ERR_INVALID_PARA;
+    }
+
+    route_data = get_route_data(name);
+    if (NULL == route_data) {
+        route_data = load_route_data(name);
+    }
+
+    if (NULL != route_data) {
+        return search_route_exclude(route_data, excludes, num, route);
+    }
+
+    /* 没有本地路由数据，从agent获取多个不同的路由，选择第一个未排除的 */
+    ret = get_routes_from_agent(name, min(num + 1, NLB_ROUTE_BATCH_MAX), 1, routes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < ret; i++) {
+        if (!ip_excluded(excludes, num, routes[i].ip)) {
+            *route = routes[i];
+            return 0;
+        }
+    }
+
+    return NLB_ERR_NO_ROUTE;
+}
+
+/* 检查进程是否已经退出 */
+static BOOL check_process_exit(uint32_t pid)
+{
+    return (kill((pid_t)pid, 0) == -1) && (errno == ESRCH);
+}
+
+/**
+ * @brief 申请本进程的应用负载槽
+ * @info  从进程号对应的槽开始查找，使用空闲槽或者已经退出进程的槽
+ */
+static struct app_load_slot *alloc_app_load_slot(uint32_t pid)
+{
+    uint32_t i, owner;
+    struct app_load_slot *slot;
+
+    for (i = 0; i < NLB_APP_LOAD_SLOTS; i++) {
+        slot  = &app_load->slots[(pid + i) % NLB_APP_LOAD_SLOTS];
+        owner = slot->pid;
+        if (owner == pid) {
+            return slot;
+        }
+
+        if (owner && !check_process_exit(owner)) {
+            continue;
+        }
+
+        if (compare_and_swap((uint32_t *)&slot->pid, owner, pid)) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 上报本进程的应用负载
+ * @para  queue:    输入参数，排队等待处理的请求数
+ *        inflight: 输入参数，处理中的请求数
+ *        busy:     输入参数，忙碌的工作线程数
+ *        workers:  输入参数，工作线程总数，0表示不按线程占用计算使用率
+ * @return  0: 成功  NLB_ERR_NO_AGENT: 本机没有服务端agent  NLB_ERR_NO_LOAD_SLOT: 槽已用完
+ */
+int32_t nlb_report_load(uint32_t queue, uint32_t inflight, uint32_t busy, uint32_t workers)
+{
+    uint32_t mmaplen;
+    uint32_t pid;
+    uint64_t now = get_time_ms();
+    struct app_load_slot *slot;
+
+    /* 没有agent时限制重新加载的频率 */
+    if (NULL == app_load) {
+        if (app_load_attach_time && now < app_load_attach_time + NLB_APP_LOAD_RETRY_TIME) {
+            return NLB_ERR_NO_AGENT;
+        }
+
+        app_load_attach_time = now;
+        app_load = (struct shm_app_load *)attach_app_load(&mmaplen);
+        if (NULL == app_load) {
+            return NLB_ERR_NO_AGENT;
+        }
+    }
+
+    /* 首次上报、fork后的子进程或者槽被agent回收时重新申请 */
+    pid  = (uint32_t)getpid();
+    slot = app_load_slot;
+    if ((NULL == slot) || (app_load_pid != pid) || (slot->pid != pid)) {
+        slot = alloc_app_load_slot(pid);
+        if (NULL == slot) {
+            return NLB_ERR_NO_LOAD_SLOT;
+        }
+
+        app_load_slot = slot;
+        app_load_pid  = pid;
+    }
+
+    slot->queue       = queue;
+    slot->inflight    = inflight;
+    slot->busy        = busy;
+    slot->workers     = workers;
+    slot->update_time = now;
+
     return 0;
 }
 
@@ -40,6 +40,16 @@ struct routeid
     NLB_PORT_TYPE type; // 端口类型
 };
 
+/* 单条路由调用结果，批量更新统计数据使用 */
+struct routeresult
+{
+    uint32_t ip;        // IPV4地址 : 网络字节序
+    int32_t  failed;    // >=1:失败次数 0->成功
+    int32_t  cost;      // 时延
+};
+
+#define NLB_ROUTE_BATCH_MAX     64  // 单次批量获取路由的最大个数
+
 /* API错误码 */
 enum {
     NLB_ERR_INVALID_PARA    = -1,  // 参数无效
@@ -56,16 +66,33 @@ enum {
     NLB_ERR_RECV_FAIL          = -12, // 接收路由请求失败
     NLB_ERR_INVALID_RSP        = -13, // 路由请求回复报文无效
     NLB_ERR_AGENT_ERR          = -14, // Agent回复路由请求失败
+    NLB_ERR_RETRY_BUDGET       = -15, // 重试预算已用完，不允许重试
+    NLB_ERR_OVERLOAD           = -16, // 选中的服务器并发都已达到上限，建议丢弃请求
+    NLB_ERR_NO_LOAD_SLOT       = -17, // 应用负载槽已用完
 };
 
 /**
  * @brief 通过业务名获取路由信息
+ * @info  业务开启并发限制时，选中的服务器计入进行中请求，必须调用updateroute上报结果；
+ *        进程退出等原因没有上报的计数由agent每个统计周期(5秒)回收：周期内没有请求完成时全部回收，
+ *        否则超过平均并发(时延总和/周期时长)加上最小并发上限的部分每周期回收一半
  * @para  name:  输入参数，业务名字符串  "Login.ptlogin"
  * @      route: 输出参数，路由信息(ip地址，端口，端口类型)
- * @return  0: 成功  others: 失败
+ * @return  0: 成功  NLB_ERR_OVERLOAD: 服务器并发已满  others: 失败
  */
 int32_t getroutebyname(const char *name, struct routeid *route);
 
+/**
+ * @brief 通过业务名获取路由信息，排除指定的服务器
+ * @info  用于失败重试，避免重新选中刚刚失败的服务器；从剩余存活权重中直接抽样，不会反复重试
+ * @para  name:     输入参数，业务名字符串  "Login.ptlogin"
+ *        excludes: 输入参数，排除的IPV4地址数组，网络字节序
+ *        num:      输入参数，排除的地址个数，不超过NLB_ROUTE_BATCH_MAX
+ *        route:    输出参数，路由信息(ip地址，端口，端口类型)
+ * @return  0: 成功  others: 失败
+ */
+int32_t getroutebyname_ex(const char *name, const uint32_t *excludes, int32_t num, struct routeid *route);
+
 /**
  * @brief 更新路由统计数据
  * @info  每次收发结束后，需要将成功与否、时延数据更新到统计数据
@@ -76,6 +103,56 @@ int32_t getroutebyname(const char *name, struct routeid *route);
  */
 int32_t updateroute(const char *name, uint32_t ip, int32_t failed, int32_t cost);
 
+/**
+ * @brief 通过业务名批量获取路由信息
+ * @info  所有路由来自同一份路由数据，适用于分片扇出、对冲请求、重试等场景；
+ *        每个路由和getroutebyname一样占用服务器的一个并发，需要通过updateroute(s)上报结果释放，
+ *        并发已满的服务器不会返回
+ * @para  name:    输入参数，业务名字符串  "Login.ptlogin"
+ *        num:     输入参数，路由个数，不超过NLB_ROUTE_BATCH_MAX
+ *        distinct:输入参数，非零表示返回不同的服务器
+ *        routes:  输出参数，路由信息数组，至少num个
+ * @return  >0: 返回的路由个数，distinct时服务器数不足或者并发已满会小于num
+ *          NLB_ERR_OVERLOAD: 非distinct时有路由没有可用并发，distinct时所有服务器并发都已满
+ *          others: 失败
+ */
+int32_t getroutesbyname(const char *name, int32_t num, int32_t distinct, struct routeid *routes);
+
+/**
+ * @brief 批量更新路由统计数据
+ * @info  没有找到的服务器跳过，其它结果继续更新
+ * @para  name:    输入参数，业务名字符串  "Login.ptlogin"
+ *        results: 输入参数，调用结果数组
+ *        num:     输入参数，结果个数
+ * @return  0: 成功  others: 失败
+ */
+int32_t updateroutes(const char *name, const struct routeresult *results, int32_t num);
+
+/**
+ * @brief 申请一次重试
+ * @info  同一业务的重试令牌桶由本机所有进程共享，每次成功的updateroute按比例补充令牌，
+ *        令牌不足时每秒仍允许少量保底重试，避免故障期间重试放大压垮剩余服务器；
+ *        没有本地路由数据时不做限制
+ * @para  name:  输入参数，业务名字符串  "Login.ptlogin"
+ * @return  0: 允许重试  NLB_ERR_RETRY_BUDGET: 预算已用完，不要重试  others: 失败
+ */
+int32_t nlb_acquire_retry(const char *name);
+
+/**
+ * @brief 上报本进程的应用负载
+ * @info  写入本机服务端agent创建的应用负载共享内存，每个进程占用一个槽，只有几次内存写入，
+ *        可以在请求入队、出队时调用；agent汇总本机所有进程的负载随负载上报发布，
+ *        负载感知策略的客户端按负载降低本机权重，排队数持续增长时尽快把请求转移到其它服务器；
+ *        多线程同时调用时各字段分别生效，以最后一次写入为准；
+ *        共享内存文件权限为0660，非root业务进程需要属于agent --app-load-group指定的组
+ * @para  queue:    输入参数，排队等待处理的请求数
+ *        inflight: 输入参数，处理中的请求数
+ *        busy:     输入参数，忙碌的工作线程数
+ *        workers:  输入参数，工作线程总数，0表示不按线程占用计算使用率
+ * @return  0: 成功  NLB_ERR_NO_AGENT: 本机没有服务端agent  NLB_ERR_NO_LOAD_SLOT: 槽已用完
+ */
+int32_t nlb_report_load(uint32_t queue, uint32_t inflight, uint32_t busy, uint32_t workers);
+
 #ifdef __cplusplus
 }
 #endif
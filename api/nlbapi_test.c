@@ -33,9 +33,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "commstruct.h"
+#include "hash.h"
+#include "comm.h"
 #include "nlbapi.h"
 
 #define SERVER_NUM 100
+#define HASH_TEST_NUM 3000
 
 void init_dummy_servers_data(void)
 {
@@ -136,13 +139,87 @@ void init_dummy_meta_data(void)
     close(fd);
 }
 
+/**
+ * @brief 增量删除服务器后查找测试
+ * @info  删除服务器只把它的hash槽位置空，中间阶留下空位，
+ *        hash经过空位、放在更深一阶的服务器必须仍然可以找到
+ */
+int test_hash_delete(void)
+{
+    int i, j, missing = 0, behind = 0, survivors = 0;
+    unsigned int hash, base;
+    unsigned int slots[HASH_TEST_NUM];
+    int len = sizeof(struct shm_servers) + sizeof(struct server_info)*HASH_TEST_NUM;
+    struct shm_servers *servers = calloc(1, len);
+
+    /* 同agent的calc_servers_hash放置服务器，IP间隔取第一阶模数的约数，制造大量冲突 */
+    calc_hash_mods(NLB_SERVER_HASH_LEN, &servers->mhash_order, servers->mhash_mods);
+    memset(servers->mhash_idx, 0xff, sizeof(servers->mhash_idx));
+    servers->server_num = HASH_TEST_NUM;
+    for (i = 0; i < HASH_TEST_NUM; i++) {
+        servers->svrs[i].server_ip = 1 + (i % 1000) * servers->mhash_mods[0] + i / 1000;
+        slots[i] = 0xffffffff;
+        for (j = 0, base = 0; j < (int)servers->mhash_order; j++) {
+            hash = servers->svrs[i].server_ip % servers->mhash_mods[j];
+            if (servers->mhash_idx[base + hash] == 0xffffffff) {
+                servers->mhash_idx[base + hash] = i;
+                slots[i] = base + hash;
+                break;
+            }
+            base += servers->mhash_mods[j];
+        }
+    }
+
+    /* 同agent的patch_servers删除每三个服务器中的一个，只置空槽位 */
+    for (i = 0; i < HASH_TEST_NUM; i += 3) {
+        if (slots[i] != 0xffffffff) {
+            servers->mhash_idx[slots[i]] = 0xffffffff;
+        }
+    }
+
+    for (i = 0; i < HASH_TEST_NUM; i++) {
+        struct server_info *server = get_server_by_ip(servers, servers->svrs[i].server_ip);
+
+        if (i % 3 == 0) {
+            if (server != NULL) {
+                missing++;
+            }
+            continue;
+        }
+
+        survivors++;
+        if (server != &servers->svrs[i]) {
+            missing++;
+        }
+
+        /* 第一阶槽位已被删除的服务器 */
+        hash = servers->svrs[i].server_ip % servers->mhash_mods[0];
+        if (servers->mhash_idx[hash] == 0xffffffff) {
+            behind++;
+        }
+    }
+
+    printf("hash delete test: survivors %d, behind holes %d, wrong lookups %d\n", survivors, behind, missing);
+    free(servers);
+
+    return (missing || !behind) ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
     int i;
     int ret;
     int cnt;
+    int j, k, num = 0;
     int server_stat[SERVER_NUM+1] = {0};
     struct routeid id;
+    struct routeid ids[NLB_ROUTE_BATCH_MAX];
+    struct routeresult results[NLB_ROUTE_BATCH_MAX];
+
+    /* 第一个参数为hash时只运行增量删除查找测试 */
+    if (argc > 1 && !strcmp(argv[1], "hash")) {
+        return test_hash_delete();
+    }
 
     if (argc == 1)
     {
@@ -154,7 +231,38 @@ int main(int argc, char **argv)
         cnt = atoi(argv[1]);
     }
 
-    for (i = 0; i < cnt; i++) {
+    /* 第二个参数为批量路由个数，使用批量接口获取不同的服务器 */
+    if (argc > 2) {
+        num = atoi(argv[2]);
+    }
+
+    for (i = 0; num > 0 && i < cnt; i++) {
+        ret = getroutesbyname("login.ptlogin", num, 1, ids);
+        if (ret != num) {
+            printf("get routes failed, %d.\n", ret);
+            continue;
+        }
+
+        for (j = 0; j < ret; j++) {
+            for (k = 0; k < j; k++) {
+                if (ids[k].ip == ids[j].ip) {
+                    printf("get routes duplicated, ip:%u.\n", ids[j].ip);
+                }
+            }
+
+            results[j].ip     = ids[j].ip;
+            results[j].failed = 0;
+            results[j].cost   = 1;
+            server_stat[ids[j].ip]++;
+        }
+
+        ret = updateroutes("login.ptlogin", results, num);
+        if (ret) {
+            printf("update routes failed, %d.\n", ret);
+        }
+    }
+
+    for (i = 0; num <= 0 && i < cnt; i++) {
         ret = getroutebyname("login.ptlogin", &id);
 
         if (id.ip > 100000 || id.ip == 0 || (id.port != 1111 && id.port != 1112)) {
@@ -0,0 +1,83 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename routedata.h
+ * @info     API内部路由数据结构，寻址和统计接口
+ *           供API和离线工具(模拟器等)共用，业务请使用nlbapi.h
+ */
+
+#ifndef _ROUTEDATA_H_
+#define _ROUTEDATA_H_
+
+#include <stdint.h>
+#include "commstruct.h"
+#include "slist.h"
+#include "nlbapi.h"
+
+/* 一个后台服务的路由相关数据 */
+struct api_routedata
+{
+    struct slist_head node;                  /* 链表节点   */
+    char name[NLB_SERVICE_NAME_LEN];         /* 业务名     */
+    struct shm_meta *route_meta;             /* 元数据信息 */
+    struct shm_servers *servers_data[2];     /* 服务器信息 */
+};
+
+/**
+ * @brief 通过二分查找法查找路由服务器
+ * @info  1. 服务器都死机，会随机找一个服务器
+ *        2. 死机服务器如果有dead_retrys,会尝试dead_retrys次
+ * @return <0 失败 =0 成功
+ */
+int32_t search_route(struct api_routedata *route_data, struct routeid *route);
+
+/**
+ * @brief 排除指定服务器后查找路由
+ * @return <0 失败 =0 成功
+ */
+int32_t search_route_exclude(struct api_routedata *route_data, const uint32_t *excludes, int32_t num,
+                             struct routeid *route);
+
+/**
+ * @brief 在同一份服务器数据快照中查找多个路由
+ * @return <0 失败 >0 路由个数，distinct时可能小于请求个数
+ */
+int32_t search_routes(struct api_routedata *route_data, int32_t num, int32_t distinct, struct routeid *routes);
+
+/**
+ * @brief 更新指定路由数据的统计信息
+ * @return <0 失败 =0 成功
+ */
+int32_t update_route_stat(struct api_routedata *route_data, uint32_t ip, int32_t failed, int32_t cost);
+
+/**
+ * @brief 批量更新指定路由数据的统计信息
+ * @return <0 有服务器没有找到 =0 成功
+ */
+int32_t update_routes_stat(struct api_routedata *route_data, const struct routeresult *results, int32_t num);
+
+/**
+ * @brief 从指定路由数据的重试令牌桶申请一次重试
+ * @return NLB_ERR_RETRY_BUDGET 预算已用完 =0 允许重试
+ */
+int32_t acquire_route_retry(struct api_routedata *route_data);
+
+#endif
+
@@ -35,6 +35,24 @@ static inline uint32_t fetch_and_add(uint32_t *ptr, uint32_t value)
     return *ptr;
 }
 
+static inline uint8_t fetch_and_add_1(uint8_t *ptr, uint8_t value)
+{
+    if (value) {
+        return __sync_fetch_and_add(ptr, value);
+    }
+
+    return *ptr;
+}
+
+static inline uint16_t fetch_and_add_2(uint16_t *ptr, uint16_t value)
+{
+    if (value) {
+        return __sync_fetch_and_add(ptr, value);
+    }
+
+    return *ptr;
+}
+
 static inline uint64_t fetch_and_add_8(uint64_t *ptr, uint64_t value)
 {
     if (value) {
@@ -59,6 +77,16 @@ static inline int32_t compare_and_swap(uint32_t *ptr, uint32_t o, uint32_t n)
     return __sync_bool_compare_and_swap(ptr, o, n);
 }
 
+static inline int32_t compare_and_swap_1(uint8_t *ptr, uint8_t o, uint8_t n)
+{
+    return __sync_bool_compare_and_swap(ptr, o, n);
+}
+
+static inline int32_t compare_and_swap_2(uint16_t *ptr, uint16_t o, uint16_t n)
+{
+    return __sync_bool_compare_and_swap(ptr, o, n);
+}
+
 static inline int32_t compare_and_swap_8(uint64_t *ptr, uint64_t o, uint64_t n)
 {
     return __sync_bool_compare_and_swap(ptr, o, n);
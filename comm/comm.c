@@ -52,10 +52,15 @@ struct server_info *get_server_by_ip(struct shm_servers *servers, uint32_t ip)
     uint32_t hash, idx, base = 0;
     struct server_info *server;
 
-    /* 通过多阶hash快速查找 */
+    /* 通过多阶hash快速查找，增量更新删除服务器后中间阶可能为空，继续查找下一阶 */
     for (i = 0; i < servers->mhash_order; i++) {
-        hash = ip % servers->mhash_mods[i];
-        idx  = servers->mhash_idx[base + hash];
+        hash  = ip % servers->mhash_mods[i];
+        idx   = servers->mhash_idx[base + hash];
+        base += servers->mhash_mods[i];
+
+        if (idx == 0xffffffff) {
+            continue;
+        }
 
         if (idx >= NLB_SERVER_MAX) {
             return NULL;
@@ -65,8 +70,6 @@ struct server_info *get_server_by_ip(struct shm_servers *servers, uint32_t ip)
         if (server->server_ip == ip) {
             return server;
         }
-
-        base += servers->mhash_mods[i];
     }
 
     return NULL;
@@ -23,6 +23,8 @@
 #define NLB_PATH_MAX_LEN        256
 #define NLB_AGENT_LISTEN_PORT   2841
 #define NLB_NAME_BASE_PATH      "/var/nlb/naming"
+#define NLB_APP_LOAD_PATH       NLB_NAME_BASE_PATH"/.app_load"     /* 应用负载共享内存文件 */
+#define NLB_MANIFEST_PATH       NLB_NAME_BASE_PATH"/.manifest"     /* 本地业务清单文件 */
 
 #endif
 
@@ -41,6 +41,31 @@
 #define NLB_WEIGHT_LOW_WATERMARK    (0.50)  /* 机器权重低于该值，会被标记为低权重机器 */
 #define NLB_WEIGHT_LOW_RATIO        (0.50)  /* 低权重机器总数低于该值，不降低权重，只给大于平均成功率的机器加权重 */
 #define NLB_WEIGHT_INCR_RATIO       (0.05)  /* 每次增加权重的比例 */
+#define NLB_EJECT_CONSECUTIVE       (0)     /* 连续失败次数达到该值，客户端立即摘除，默认关闭 */
+#define NLB_EJECT_BURST             (0)     /* 错误突发窗口内失败数达到该值，客户端立即摘除，默认关闭 */
+#define NLB_EJECT_BURST_WINDOW      (1000)  /* 错误突发统计窗口，毫秒 */
+#define NLB_EJECT_BASE_TIME         (1000)  /* 摘除后首次探测等待时间，毫秒 */
+#define NLB_EJECT_MAX_TIME          (30000) /* 摘除后探测等待最大时间，毫秒 */
+#define NLB_EJECT_MAX_PERCENT       (50)    /* 客户端同时摘除的服务器不超过存活服务器的该比例，至少可以摘除一台 */
+#define NLB_RETRY_BUDGET_RATIO      (0.1)   /* 每次成功调用补充的重试令牌数 */
+#define NLB_RETRY_BUDGET_MIN        (10)    /* 令牌不足时每秒最少允许的重试次数 */
+#define NLB_RETRY_BUDGET_MAX        (1000)  /* 重试令牌桶容量 */
+#define NLB_RETRY_TOKEN_UNIT        (1000)  /* 一个重试令牌的定点数值 */
+#define NLB_CONC_LIMIT_MAX          (0)     /* 并发上限的最大值，0表示不限制并发 */
+#define NLB_CONC_LIMIT_MIN          (4)     /* 并发上限的最小值 */
+#define NLB_CONC_LIMIT_INIT         (20)    /* 初始并发上限 */
+#define NLB_CONC_TOLERANCE          (1.5)   /* 时延相对最小时延的容忍倍数，超过后收缩并发上限 */
+#define NLB_CONC_SMOOTHING          (0.2)   /* 并发上限调整的平滑系数 */
+#define NLB_CONC_REROLL_TIMES       (2)     /* 选中服务器并发已满时，重新选择的次数 */
+#define NLB_SLOW_START_WINDOW       (0)     /* 新增和恢复服务器的预热时间，秒，0表示不预热 */
+#define NLB_SLOW_START_FLOOR        (0.1)   /* 预热开始时的权重比例 */
+#define NLB_SLOW_START_AGGRESSION   (1.0)   /* 预热曲线系数，1为线性，越大前期增长越快 */
+#define NLB_SLOW_START_STEPS        (32)    /* 预热曲线表的分段数 */
+#define NLB_SLOW_START_LIST         (64)    /* 记录预热中服务器下标的个数，超出的服务器不按曲线预热 */
+#define NLB_DRAIN_WINDOW            (10)    /* 服务器排空时权重降到0的时间，秒 */
+#define NLB_APP_LOAD_SLOTS          (256)   /* 应用负载槽数，每个上报负载的业务进程占用一个 */
+#define NLB_APP_LOAD_STALE_TIME     (5000)  /* 应用负载过期时间，毫秒 */
+#define NLB_APP_LOAD_MAGIC          (0x4e4c4241)    /* 应用负载共享内存魔数 "NLBA" */
 
 #define NLB_SHM_VERSION1            (1)     /* 共享内存版本号 */
 
@@ -55,7 +80,10 @@ struct shm_meta
     volatile uint64_t squence;      /* 配置号   */
     volatile uint64_t mtime;        /* 修改时间 */
     volatile uint32_t index;        /* 文件下标 */
-    volatile uint32_t reserved[9];  /* 保留     */
+    volatile uint32_t retry_tokens; /* 重试令牌，单位1/NLB_RETRY_TOKEN_UNIT */
+    volatile uint32_t retry_second; /* 保底重试计数所在的秒 */
+    volatile uint32_t retry_floor;  /* 本秒已使用的保底重试次数 */
+    volatile uint32_t reserved[6];  /* 保留     */
     char name[NLB_SERVICE_NAME_LEN];/* 业务名   */
 };
 
@@ -77,7 +105,18 @@ struct server_info
     uint64_t cost;                 /* 时延总和   */
     uint64_t dead_time;            /* 死机时间   */
 
-    uint64_t reserved[2];          /* 保留 */
+    /*******  客户端摘除信息  *******/
+    uint8_t  fail_streak;          /* 连续失败次数 */
+    uint8_t  eject_level;          /* 摘除退避级别 */
+    uint8_t  burst_window;         /* 错误突发窗口编号 */
+    uint8_t  burst_failed;         /* 错误突发窗口内失败数 */
+    uint32_t eject_time;           /* 摘除时间，毫秒低32位，0表示未摘除，最低位为1表示探测中 */
+
+    /*******  并发限制信息  *******/
+    uint16_t inflight;             /* 进行中的请求数 */
+    uint16_t conc_limit;           /* 并发上限，0表示不限制 */
+    uint16_t min_cost;             /* 最小平均时延，毫秒 */
+    uint16_t warm_start;           /* 预热开始时间，秒低16位，0表示不在预热 */
 };
 
 /* 服务器信息数据 */
@@ -109,11 +148,64 @@ struct shm_servers
     float    weight_low_ratio;      // 低权重机器总数低于该值，不降低权重，只给大于平均成功率的机器加权重
     float    weight_incr_ratio;     // 每次增加权重的比例
 
-    uint32_t reserved[88];                     /* 保留字段     */
+    uint16_t eject_consecutive;     // 连续失败次数达到该值，客户端立即摘除，0表示关闭
+    uint16_t eject_burst;           // 错误突发窗口内失败数达到该值，客户端立即摘除，0表示关闭
+    uint16_t eject_burst_window;    // 错误突发统计窗口，毫秒
+    uint16_t eject_base_time;       // 摘除后首次探测等待时间，毫秒，之后指数退避
+    uint32_t eject_max_time;        // 摘除后探测等待最大时间，毫秒
+    uint32_t eject_num;             // 客户端摘除中的服务器数，客户端摘除和恢复时增减，agent每个调整周期重新统计
+
+    float    retry_budget_ratio;    // 每次成功调用补充的重试令牌数，0表示不限制重试
+    uint32_t retry_budget_min;      // 令牌不足时每秒最少允许的重试次数
+    uint32_t retry_budget_max;      // 重试令牌桶容量
+
+    uint16_t conc_limit_min;        // 并发上限的最小值
+    uint16_t conc_limit_max;        // 并发上限的最大值，0表示不限制并发
+    uint16_t conc_limit_init;       // 初始并发上限
+    uint16_t conc_reroll_times;     // 选中服务器并发已满时，重新选择的次数
+    float    conc_tolerance;        // 时延相对最小时延的容忍倍数
+    float    conc_smoothing;        // 并发上限调整的平滑系数
+
+    uint16_t slow_start_window;     // 新增和恢复服务器的预热时间，秒，0表示不预热
+    uint16_t slow_start_pad;        // 对齐
+    float    slow_start_floor;      // 预热开始时的权重比例
+    float    slow_start_aggression; // 预热曲线系数，1为线性，越大前期增长越快
+    uint16_t slow_start_ramp[NLB_SLOW_START_STEPS + 1]; // 预热曲线表，千分比，agent计算
+    uint16_t slow_start_pad2;       // 对齐
+
+    uint16_t warm_num;              // warm_idx中的服务器数
+    uint16_t warm_pad;              // 对齐
+    uint16_t warm_idx[NLB_SLOW_START_LIST]; // 预热中的存活服务器下标，升序，agent计算权重基数时记录
+
+    uint16_t drain_window;          // 服务器排空时权重降到0的时间，秒，0表示立即降到0
+    uint16_t drain_pad;             // 对齐
+
+    uint32_t reserved[23];                     /* 保留字段     */
 ///
     struct server_info svrs[0];                /* 所有服务器信息 */
 };
 
+/* 应用负载槽，业务进程通过API写入，服务端agent汇总后随负载上报发布 */
+struct app_load_slot
+{
+    volatile uint32_t pid;          /* 所属进程号，0表示空闲 */
+    volatile uint32_t queue;        /* 排队等待处理的请求数 */
+    volatile uint32_t inflight;     /* 处理中的请求数 */
+    volatile uint32_t busy;         /* 忙碌的工作线程数 */
+    volatile uint32_t workers;      /* 工作线程总数 */
+    volatile uint32_t reserved;     /* 保留 */
+    volatile uint64_t update_time;  /* 更新时间，毫秒 */
+};
+
+/* 应用负载共享内存，服务端agent创建 */
+struct shm_app_load
+{
+    volatile uint32_t magic;        /* NLB_APP_LOAD_MAGIC */
+    volatile uint32_t version;      /* 共享内存版本号 */
+    volatile uint32_t reserved[6];  /* 保留 */
+    struct app_load_slot slots[NLB_APP_LOAD_SLOTS];
+};
+
 #pragma pack(pop)
 
 #endif
@@ -39,6 +39,30 @@ uint32_t gen_hash_key(const char *str)
     return hash;
 }
 
+/**
+ * @brief adler32校验和，和zlib一致
+ */
+uint32_t gen_adler32(const void *data, uint32_t len)
+{
+    const uint8_t *pos = (const uint8_t *)data;
+    uint32_t a = 1, b = 0;
+    uint32_t n;
+
+    while (len > 0) {
+        /* 5552字节内不会溢出 */
+        n    = (len > 5552) ? 5552 : len;
+        len -= n;
+        while (n--) {
+            a += *pos++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
 /**
  * @brief 判断是否质数
  */ 
@@ -29,6 +29,24 @@
 
 uint32_t gen_hash_key(const char *str);
 
+/**
+ * @brief adler32校验和，和zlib一致
+ */
+uint32_t gen_adler32(const void *data, uint32_t len);
+
+/**
+ * @brief IP地址hash，网络字节序IP的低位字节变化很少，需要混合所有位
+ */
+static inline uint32_t hash_ip(uint32_t ip)
+{
+    ip ^= ip >> 16;
+    ip *= 0x85EBCA6BU;
+    ip ^= ip >> 13;
+    ip *= 0xC2B2AE35U;
+    ip ^= ip >> 16;
+    return ip;
+}
+
 /**
  * @brief 计算多阶hash每一阶的模数
  */
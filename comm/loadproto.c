@@ -0,0 +1,114 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename loadproto.c
+ */
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "loadproto.h"
+
+/**
+ * @brief  打包负载上报数据
+ * @info   格式  "magic version|flags timestamp_hi timestamp_lo keepalive cpu ... app_workers"
+ * @return >0 编码长度 <0 失败
+ */
+int32_t serialize_load_report(const struct load_report *report, char *buff, int32_t len)
+{
+    uint32_t *pos = (uint32_t *)buff;
+
+    if (NULL == buff || len < NLB_LOAD_REPORT_LEN) {
+        return -1;
+    }
+
+    *pos++ = htonl(NLB_LOAD_REPORT_MAGIC);
+    *pos++ = htonl((NLB_LOAD_REPORT_VERSION << 16) | (report->flags & 0xFFFF));
+    *pos++ = htonl((uint32_t)(report->timestamp >> 32));
+    *pos++ = htonl((uint32_t)report->timestamp);
+    *pos++ = htonl(report->keepalive);
+    *pos++ = htonl(report->cpu);
+    *pos++ = htonl(report->cpu_psi);
+    *pos++ = htonl(report->mem_psi);
+    *pos++ = htonl(report->cpu_throttle);
+    *pos++ = htonl(report->mem_total);
+    *pos++ = htonl(report->mem_free);
+    *pos++ = htonl(report->net_total);
+    *pos++ = htonl(report->net_snd_ratio);
+    *pos++ = htonl(report->net_rcv_ratio);
+    *pos++ = htonl(report->app_queue);
+    *pos++ = htonl(report->app_inflight);
+    *pos++ = htonl(report->app_busy);
+    *pos++ = htonl(report->app_workers);
+
+    return NLB_LOAD_REPORT_LEN;
+}
+
+/**
+ * @brief  解负载上报数据
+ * @info   更高版本的数据只解析版本1的字段
+ * @return =0 成功 -1 不是二进制格式 <-1 数据错误
+ */
+int32_t deserialize_load_report(const char *buff, int32_t blen, struct load_report *report)
+{
+    uint32_t words[NLB_LOAD_REPORT_LEN / 4];
+    uint32_t i;
+
+    if (NULL == buff || blen < 4) {
+        return -1;
+    }
+
+    /* zookeeper返回的数据不保证4字节对齐 */
+    memcpy(words, buff, 4);
+    if (ntohl(words[0]) != NLB_LOAD_REPORT_MAGIC) {
+        return -1;
+    }
+
+    if (blen < NLB_LOAD_REPORT_LEN) {
+        return -2;
+    }
+
+    memcpy(words, buff, sizeof(words));
+    for (i = 0; i < NLB_LOAD_REPORT_LEN / 4; i++) {
+        words[i] = ntohl(words[i]);
+    }
+
+    if ((words[1] >> 16) < NLB_LOAD_REPORT_VERSION) {
+        return -3;
+    }
+
+    report->flags         = words[1] & 0xFFFF;
+    report->timestamp     = ((uint64_t)words[2] << 32) | words[3];
+    report->keepalive     = words[4];
+    report->cpu           = words[5];
+    report->cpu_psi       = words[6];
+    report->mem_psi       = words[7];
+    report->cpu_throttle  = words[8];
+    report->mem_total     = words[9];
+    report->mem_free      = words[10];
+    report->net_total     = words[11];
+    report->net_snd_ratio = words[12];
+    report->net_rcv_ratio = words[13];
+    report->app_queue     = words[14];
+    report->app_inflight  = words[15];
+    report->app_busy      = words[16];
+    report->app_workers   = words[17];
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename loadproto.h
+ * @info     服务器负载上报数据编码
+ *           /loadreport/ip节点数据为固定长度的二进制格式，全部字段4字节网络字节序，
+ *           解码时兼容旧版本agent上报的json格式由调用方处理
+ */
+
+#ifndef _LOADPROTO_H_
+#define _LOADPROTO_H_
+
+#include <stdint.h>
+
+#define NLB_LOAD_REPORT_MAGIC       (0x4e4c5250)    /* "NLRP" */
+#define NLB_LOAD_REPORT_VERSION     (1)
+#define NLB_LOAD_REPORT_LEN         (72)            /* 版本1的编码长度 */
+#define NLB_LOAD_REPORT_APP         (0x0001)        /* 标记: 包含应用负载 */
+
+/* 负载上报数据 */
+struct load_report {
+    uint64_t timestamp;         /* 上报时间，毫秒 */
+    uint32_t flags;             /* NLB_LOAD_REPORT_APP */
+    uint32_t keepalive;         /* 负载没有变化时的最长上报间隔，毫秒 */
+    uint32_t cpu;               /* CPU使用率，百分比 */
+    uint32_t cpu_psi;           /* CPU压力，千分比 */
+    uint32_t mem_psi;           /* 内存压力，千分比 */
+    uint32_t cpu_throttle;      /* cgroup CPU限流比例，千分比 */
+    uint32_t mem_total;         /* 内存总量，MB */
+    uint32_t mem_free;          /* 可用内存，MB */
+    uint32_t net_total;         /* 网卡带宽，Mb/s */
+    uint32_t net_snd_ratio;     /* 网卡发送使用率，千分比 */
+    uint32_t net_rcv_ratio;     /* 网卡接收使用率，千分比 */
+    uint32_t app_queue;         /* 应用排队请求数 */
+    uint32_t app_inflight;      /* 应用处理中请求数 */
+    uint32_t app_busy;          /* 应用忙碌工作线程数 */
+    uint32_t app_workers;       /* 应用工作线程数 */
+};
+
+/**
+ * @brief  打包负载上报数据
+ * @info   格式  "magic version|flags timestamp_hi timestamp_lo keepalive cpu ... app_workers"
+ * @return >0 编码长度 <0 失败
+ */
+int32_t serialize_load_report(const struct load_report *report, char *buff, int32_t len);
+
+/**
+ * @brief  解负载上报数据
+ * @info   更高版本的数据只解析版本1的字段
+ * @return =0 成功 -1 不是二进制格式 <-1 数据错误
+ */
+int32_t deserialize_load_report(const char *buff, int32_t blen, struct load_report *report);
+
+#endif
@@ -31,6 +31,7 @@
 #include "commtype.h"
 #include "commstruct.h"
 #include "utils.h"
+#include "atomic.h"
 #include "nlbfile.h"
 
 /**
@@ -463,6 +464,69 @@ ERR_RET:
     return NULL;
 }
 
+/**
+ * @brief 只读映射文件，检查文件长度
+ */
+static void *attach_file(const char *path, uint32_t size, uint32_t *mmaplen)
+{
+    int32_t  fd;
+    void *   addr;
+    struct stat buf;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (fstat(fd, &buf) == -1 || buf.st_size != size) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    *mmaplen = size;
+    return addr;
+}
+
+/**
+ * @brief 只读加载元数据到内存
+ * @info  不加meta锁，不修改数据，用于监控等旁路工具
+ * @param name:   服务名
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_meta_data(const char *name, uint32_t *mmaplen)
+{
+    char path[NLB_PATH_MAX_LEN];
+
+    if (get_naming_meta_path(name, path, sizeof(path)) < 0) {
+        return NULL;
+    }
+
+    return attach_file(path, get_meta_file_size(), mmaplen);
+}
+
+/**
+ * @brief 只读加载路由服务器数据到内存
+ * @param name:   服务名
+ *        index:  数据索引
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_server_data(const char *name, uint32_t index, uint32_t *mmaplen)
+{
+    char path[NLB_PATH_MAX_LEN];
+
+    if (get_naming_server_path(name, index, path, sizeof(path)) < 0) {
+        return NULL;
+    }
+
+    return attach_file(path, get_server_file_size(), mmaplen);
+}
+
 /**
  * @brief 写服务器数据到文件
  * @param name:   服务名
@@ -592,6 +656,130 @@ BOOL check_and_mkdir(const char *path)
     return TRUE;
 }
 
+/**
+ * @brief 返回应用负载共享内存文件长度，按页框对齐
+ */
+uint32_t get_app_load_file_size(void)
+{
+    uint32_t page_size = sysconf(_SC_PAGE_SIZE);
+    uint32_t load_len  = sizeof(struct shm_app_load);
+
+    return (load_len + page_size - 1)/page_size*page_size;
+}
+
+/**
+ * @brief 初始化并加载应用负载共享内存，服务端agent调用
+ * @info  agent重启时保留业务进程已经写入的数据；
+ *        文件权限为0660，只有agent和业务进程所在的组可以写入，避免本机任意用户改写负载引流
+ * @param gid:    业务进程所在的组，(gid_t)-1表示不修改文件属组
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *init_and_load_app_load(gid_t gid, uint32_t *mmaplen)
+{
+    int32_t  fd = -1;
+    int32_t  ret;
+    uint32_t size;
+    void *   addr;
+    struct shm_app_load *app_load;
+
+    fd = open(NLB_APP_LOAD_PATH, O_RDWR | O_CREAT, 0660);
+    if (fd == -1) {
+        goto ERR_RET;
+    }
+
+    if (gid != (gid_t)-1) {
+        ret = fchown(fd, (uid_t)-1, gid);
+        if (ret == -1) {
+            goto ERR_RET;
+        }
+    }
+
+    /* 不受umask影响，同组的非root业务进程也可以写入，旧版本创建的文件同样收回其他用户的权限 */
+    ret = fchmod(fd, 0660);
+    if (ret == -1) {
+        goto ERR_RET;
+    }
+
+    size = get_app_load_file_size();
+    ret  = ftruncate(fd, size);
+    if (ret == -1) {
+        goto ERR_RET;
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        goto ERR_RET;
+    }
+
+    /* 新文件或者版本不一致，清空后最后写入魔数 */
+    app_load = (struct shm_app_load *)addr;
+    if (app_load->magic != NLB_APP_LOAD_MAGIC || app_load->version != NLB_SHM_VERSION1) {
+        memset(addr, 0, size);
+        app_load->version = NLB_SHM_VERSION1;
+        mb();
+        app_load->magic   = NLB_APP_LOAD_MAGIC;
+    }
+
+    close(fd);
+    *mmaplen = size;
+    return addr;
+
+ERR_RET:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 加载已经存在的应用负载共享内存，业务进程调用
+ * @param mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_app_load(uint32_t *mmaplen)
+{
+    int32_t  fd = -1;
+    int32_t  ret;
+    void *   addr;
+    struct stat buf;
+
+    fd = open(NLB_APP_LOAD_PATH, O_RDWR);
+    if (fd == -1) {
+        goto ERR_RET;
+    }
+
+    ret = fstat(fd, &buf);
+    if (ret == -1) {
+        goto ERR_RET;
+    }
+
+    if (buf.st_size != get_app_load_file_size()) {
+        goto ERR_RET;
+    }
+
+    addr = mmap(NULL, buf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        goto ERR_RET;
+    }
+
+    close(fd);
+
+    if (((struct shm_app_load *)addr)->magic != NLB_APP_LOAD_MAGIC) {
+        munmap(addr, buf.st_size);
+        return NULL;
+    }
+
+    *mmaplen = buf.st_size;
+    return addr;
+
+ERR_RET:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return NULL;
+}
+
 /**
  * @brief 递归创建目录
  */
@@ -110,6 +110,23 @@ void *init_and_load_meta_file(const char *name, uint32_t *mmaplen);
 void *load_server_data(const char *name, uint32_t index, uint32_t *mmaplen);
 
 
+/**
+ * @brief 只读加载元数据到内存，不加锁，用于监控等旁路工具
+ * @param name:   服务名
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_meta_data(const char *name, uint32_t *mmaplen);
+
+
+/**
+ * @brief 只读加载路由服务器数据到内存
+ * @param name:   服务名
+ *        index:  数据索引
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_server_data(const char *name, uint32_t index, uint32_t *mmaplen);
+
+
 /**
  * @brief 写服务器数据到文件
  * @param name:   服务名
@@ -127,6 +144,24 @@ int32_t write_server_data(const char *name, uint32_t index, const struct shm_ser
  */
 void *init_and_load_server_data(const char *name, uint32_t index, uint32_t *mmaplen);
 
+/**
+ * @brief 返回应用负载共享内存文件长度，按页框对齐
+ */
+uint32_t get_app_load_file_size(void);
+
+/**
+ * @brief 初始化并加载应用负载共享内存，服务端agent调用
+ * @param gid:    业务进程所在的组，(gid_t)-1表示不修改文件属组
+ *        mmaplen:mmap数据长度，unmap需要
+ */
+void *init_and_load_app_load(gid_t gid, uint32_t *mmaplen);
+
+/**
+ * @brief 加载已经存在的应用负载共享内存，业务进程调用
+ * @param mmaplen:mmap数据长度，unmap需要
+ */
+void *attach_app_load(uint32_t *mmaplen);
+
 /**
  * @brief 递归创建目录
  */
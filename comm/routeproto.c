@@ -25,6 +25,7 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include "nlbapi.h"
+#include "routeproto.h"
 
 /**
  * @brief 打包路由请求包
@@ -132,5 +133,149 @@ int32_t deserialize_route_response(const char *buff, int32_t blen, int32_t *resu
     return 0;
 }
 
+/**
+ * @brief 打包批量路由请求包
+ * @info  格式  "len num flags name"
+ *        len不包含自己的长度，最高位为批量标记，num和flags各2字节
+ */
+int32_t serialize_route_batch_request(const char *service_name, uint16_t num, uint16_t flags,
+                                      char *buff, int32_t len)
+{
+    int32_t rlen;
+
+    if (NULL == buff || len <= 8) {
+        return -1;
+    }
+
+    rlen = snprintf(buff+8, len-8, "%s", service_name);
+    if (rlen >= len-8) {
+        return -2;
+    }
+
+    *(uint16_t *)(buff + 4) = htons(num);
+    *(uint16_t *)(buff + 6) = htons(flags);
+    *(uint32_t *)buff       = htonl(NLB_ROUTE_BATCH_FLAG | (uint32_t)(rlen + 4));
+
+    return rlen+8;
+}
+
+/**
+ * @brief 解单个或批量路由请求包
+ * @info  单个请求num返回0，flags返回0
+ */
+int32_t deserialize_route_batch_request(const char *buff, int32_t blen, char *service_name, int32_t slen,
+                                        uint16_t *num, uint16_t *flags)
+{
+    uint32_t rlen;
+
+    if (blen <= 4) {
+        return -1;
+    }
 
+    rlen = ntohl(*(uint32_t *)buff);
+    if (!(rlen & NLB_ROUTE_BATCH_FLAG)) {
+        *num   = 0;
+        *flags = 0;
+        return deserialize_route_request(buff, blen, service_name, slen);
+    }
+
+    rlen &= ~NLB_ROUTE_BATCH_FLAG;
+    if (rlen < 4 || rlen - 4 >= (uint32_t)slen || rlen + 4 > (uint32_t)blen) {
+        return -2;
+    }
+
+    *num   = ntohs(*(uint16_t *)(buff + 4));
+    *flags = ntohs(*(uint16_t *)(buff + 6));
+    if (*num == 0 || *num > NLB_ROUTE_BATCH_MAX) {
+        return -3;
+    }
+
+    memcpy(service_name, buff+8, rlen-4);
+    service_name[rlen-4] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief 打包批量路由回复包
+ * @info  格式  "len result num [ip port type]..."
+ *        len不包含自己的长度
+ *        result非零，后面的num和路由就没有
+ */
+int32_t serialize_route_batch_response(int32_t result, const struct routeid *ids, int32_t num,
+                                       char *buff, int32_t len)
+{
+    int32_t i;
+    char   *pos;
+
+    if (NULL == buff || len < 8) {
+        return -1;
+    }
+
+    *(uint32_t *)(buff + 4) = htonl((uint32_t)result);
+
+    if (result) {
+        *(uint32_t *)buff = htonl(4);
+        return 8;
+    }
+
+    if (num < 0 || len < 12 + num * 8) {
+        return -2;
+    }
+
+    *(uint32_t *)(buff + 8) = htonl((uint32_t)num);
+    for (i = 0, pos = buff + 12; i < num; i++, pos += 8) {
+        *(uint32_t *)pos       = htonl(ids[i].ip);
+        *(uint16_t *)(pos + 4) = htons(ids[i].port);
+        *(uint16_t *)(pos + 6) = htons((uint16_t)ids[i].type);
+    }
+    *(uint32_t *)buff = htonl((uint32_t)(8 + num * 8));
+
+    return 12 + num * 8;
+}
+
+/**
+ * @brief 解批量路由回复包
+ * @param num: 输入ids数组长度，输出路由个数
+ */
+int32_t deserialize_route_batch_response(const char *buff, int32_t blen, int32_t *result,
+                                         struct routeid *ids, int32_t *num)
+{
+    int32_t i, rlen, cnt;
+    const char *pos;
+
+    if (blen < 8) {
+        return -1;
+    }
+
+    rlen    = (int32_t)ntohl(*(uint32_t *)buff);
+    *result = (int32_t)ntohl(*(uint32_t *)(buff + 4));
+
+    if (*result) {
+        if (rlen != 4) {
+            return -2;
+        }
+
+        *num = 0;
+        return 0;
+    }
+
+    if (blen < 12) {
+        return -3;
+    }
+
+    cnt = (int32_t)ntohl(*(uint32_t *)(buff + 8));
+    if (cnt < 0 || cnt > *num || rlen != 8 + cnt * 8 || blen < 12 + cnt * 8) {
+        return -4;
+    }
+
+    for (i = 0, pos = buff + 12; i < cnt; i++, pos += 8) {
+        ids[i].ip   = ntohl(*(uint32_t *)pos);
+        ids[i].port = ntohs(*(uint16_t *)(pos + 4));
+        ids[i].type = (NLB_PORT_TYPE)ntohs(*(uint16_t *)(pos + 6));
+    }
+    *num = cnt;
+
+    return 0;
+}
 
@@ -27,6 +27,9 @@
 #include <stdint.h>
 #include "nlbapi.h"
 
+#define NLB_ROUTE_BATCH_FLAG        (0x80000000)    /* 批量路由请求标记，在长度字段最高位 */
+#define NLB_ROUTE_BATCH_DISTINCT    (0x0001)        /* 批量路由请求: 返回不同的服务器 */
+
 /**
  * @brief 打包路由请求包
  * @info  格式  "len name"
@@ -58,6 +61,37 @@ int32_t serialize_route_response(int32_t result, const struct routeid *id, char
  */
 int32_t deserialize_route_response(const char *buff, int32_t blen, int32_t *result, struct routeid *id);
 
+/**
+ * @brief 打包批量路由请求包
+ * @info  格式  "len num flags name"
+ *        len不包含自己的长度，最高位为批量标记，num和flags各2字节
+ */
+int32_t serialize_route_batch_request(const char *service_name, uint16_t num, uint16_t flags,
+                                      char *buff, int32_t len);
+
+/**
+ * @brief 解单个或批量路由请求包
+ * @info  单个请求num返回0，flags返回0
+ */
+int32_t deserialize_route_batch_request(const char *buff, int32_t blen, char *service_name, int32_t slen,
+                                        uint16_t *num, uint16_t *flags);
+
+/**
+ * @brief 打包批量路由回复包
+ * @info  格式  "len result num [ip port type]..."
+ *        len不包含自己的长度
+ *        result非零，后面的num和路由就没有
+ */
+int32_t serialize_route_batch_response(int32_t result, const struct routeid *ids, int32_t num,
+                                       char *buff, int32_t len);
+
+/**
+ * @brief 解批量路由回复包
+ * @param num: 输入ids数组长度，输出路由个数
+ */
+int32_t deserialize_route_batch_response(const char *buff, int32_t blen, int32_t *result,
+                                         struct routeid *ids, int32_t *num);
+
 #endif
 
 
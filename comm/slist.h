@@ -48,7 +48,7 @@ struct slist_head
 /**
  * @brief 添加一个节点到链表头
  */
-void slist_add(struct slist_head *head, struct slist_head *node)
+static inline void slist_add(struct slist_head *head, struct slist_head *node)
 {
     struct slist_head *next;
 
@@ -0,0 +1,257 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcproto.c
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "hash.h"
+#include "svcproto.h"
+
+/* 服务器记录和server_info开头的布局一致 */
+_Static_assert(offsetof(struct server_info, failed) == NLB_SERVICE_PROTO_REC_LEN, "server record layout");
+_Static_assert(offsetof(struct server_info, port) == 16, "server record layout");
+
+/* 头部固定字段 */
+struct service_proto_head {
+    uint32_t magic;
+    uint32_t version;           /* 高16位版本，低16位标记 */
+    uint32_t head_len;          /* 头部长度 */
+    uint32_t rec_len;           /* 服务器记录长度 */
+    uint32_t server_num;        /* 服务器数 */
+    uint32_t checksum;          /* checksum之后所有数据的adler32 */
+};
+
+#define NLB_SERVICE_PROTO_SUM_OFFSET    (sizeof(struct service_proto_head))
+
+/* 浮点数按位模式打包 */
+static inline uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return htonl(bits);
+}
+
+static inline float bits_float(uint32_t bits)
+{
+    float value;
+    bits = ntohl(bits);
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief  打包业务配置
+ * @return >0 编码长度 <0 失败
+ */
+int32_t serialize_service(const struct service_proto_param *param, const struct server_info *svrs,
+                          uint32_t server_num, char *buff, int32_t len)
+{
+    uint32_t i, k;
+    uint32_t words[(NLB_SERVICE_PROTO_HEAD_LEN - NLB_SERVICE_PROTO_POLICY) / 4];
+    uint32_t *pos = words;
+    struct server_info rec;
+    char *rpos;
+
+    if (NULL == buff || server_num >= NLB_SERVER_MAX || len < service_proto_len(server_num)) {
+        return -1;
+    }
+
+    *pos++ = htonl(NLB_SERVICE_PROTO_MAGIC);
+    *pos++ = htonl(NLB_SERVICE_PROTO_VERSION << 16);
+    *pos++ = htonl(NLB_SERVICE_PROTO_HEAD_LEN);
+    *pos++ = htonl(NLB_SERVICE_PROTO_REC_LEN);
+    *pos++ = htonl(server_num);
+    *pos++ = 0;
+    memcpy(buff, words, NLB_SERVICE_PROTO_SUM_OFFSET);
+    memcpy(buff + NLB_SERVICE_PROTO_SUM_OFFSET, param->policy, NLB_SERVICE_PROTO_POLICY);
+
+    pos    = words;
+    *pos++ = htonl((uint32_t)param->shaping_request_min);
+    *pos++ = float_bits(param->success_ratio_base);
+    *pos++ = float_bits(param->success_ratio_min);
+    *pos++ = float_bits(param->resume_weight_ratio);
+    *pos++ = float_bits(param->dead_retry_ratio);
+    *pos++ = float_bits(param->weight_low_watermark);
+    *pos++ = float_bits(param->weight_low_ratio);
+    *pos++ = float_bits(param->weight_incr_ratio);
+    *pos++ = float_bits(param->retry_budget_ratio);
+    *pos++ = float_bits(param->conc_tolerance);
+    *pos++ = float_bits(param->conc_smoothing);
+    *pos++ = float_bits(param->slow_start_floor);
+    *pos++ = float_bits(param->slow_start_aggression);
+    *pos++ = htonl(param->retry_budget_min);
+    *pos++ = htonl(param->retry_budget_max);
+    *pos++ = htonl(param->conc_limit_min);
+    *pos++ = htonl(param->conc_limit_max);
+    *pos++ = htonl(param->conc_limit_init);
+    *pos++ = htonl(param->conc_reroll_times);
+    *pos++ = htonl(param->slow_start_window);
+    *pos++ = htonl(param->drain_window);
+    *pos++ = htonl(param->eject_consecutive);
+    *pos++ = htonl(param->eject_burst);
+    *pos++ = htonl(param->eject_burst_window);
+    *pos++ = htonl(param->eject_base_time);
+    *pos++ = htonl(param->eject_max_time);
+    memcpy(buff + NLB_SERVICE_PROTO_SUM_OFFSET + NLB_SERVICE_PROTO_POLICY, words,
+           NLB_SERVICE_PROTO_HEAD_LEN - NLB_SERVICE_PROTO_SUM_OFFSET - NLB_SERVICE_PROTO_POLICY);
+
+    /* 服务器记录，IP本身是网络字节序 */
+    rpos = buff + NLB_SERVICE_PROTO_HEAD_LEN;
+    for (i = 0; i < server_num; i++) {
+        memset(&rec, 0, NLB_SERVICE_PROTO_REC_LEN);
+        rec.server_ip     = svrs[i].server_ip;
+        rec.weight_static = htons(svrs[i].weight_static);
+        rec.port_type     = htons(svrs[i].port_type);
+        rec.port_num      = htons(svrs[i].port_num);
+        for (k = 0; k < NLB_PORT_MAX; k++) {
+            rec.port[k] = htons(svrs[i].port[k]);
+        }
+        memcpy(rpos, &rec, NLB_SERVICE_PROTO_REC_LEN);
+        rpos += NLB_SERVICE_PROTO_REC_LEN;
+    }
+
+    words[0] = htonl(gen_adler32((const uint8_t *)buff + NLB_SERVICE_PROTO_SUM_OFFSET,
+                                     service_proto_len(server_num) - NLB_SERVICE_PROTO_SUM_OFFSET));
+    memcpy(buff + offsetof(struct service_proto_head, checksum), words, 4);
+
+    return service_proto_len(server_num);
+}
+
+/**
+ * @brief  解业务配置头部，校验长度和校验和
+ * @return =0 成功 -1 不是二进制格式 <-1 数据错误
+ */
+int32_t deserialize_service_head(const char *buff, int32_t blen, struct service_proto_param *param,
+                                 uint32_t *server_num)
+{
+    uint32_t words[(NLB_SERVICE_PROTO_HEAD_LEN - NLB_SERVICE_PROTO_POLICY) / 4];
+    uint32_t *pos;
+    uint32_t head_len, rec_len, num;
+    struct service_proto_head head;
+
+    if (NULL == buff || blen < 4) {
+        return -1;
+    }
+
+    /* zookeeper返回的数据不保证4字节对齐 */
+    memcpy(&head, buff, 4);
+    if (ntohl(head.magic) != NLB_SERVICE_PROTO_MAGIC) {
+        return -1;
+    }
+
+    if (blen < NLB_SERVICE_PROTO_HEAD_LEN) {
+        return -2;
+    }
+
+    memcpy(&head, buff, sizeof(head));
+    head_len = ntohl(head.head_len);
+    rec_len  = ntohl(head.rec_len);
+    num      = ntohl(head.server_num);
+    if ((ntohl(head.version) >> 16) < NLB_SERVICE_PROTO_VERSION
+        || head_len < NLB_SERVICE_PROTO_HEAD_LEN || rec_len < NLB_SERVICE_PROTO_REC_LEN) {
+        return -3;
+    }
+
+    /* 长度按64位计算，防止溢出 */
+    if (num >= NLB_SERVER_MAX || (uint64_t)head_len + (uint64_t)rec_len * num != (uint64_t)blen) {
+        return -4;
+    }
+
+    if (ntohl(head.checksum) != gen_adler32((const uint8_t *)buff + NLB_SERVICE_PROTO_SUM_OFFSET,
+                                                (size_t)blen - NLB_SERVICE_PROTO_SUM_OFFSET)) {
+        return -5;
+    }
+
+    memcpy(param->policy, buff + NLB_SERVICE_PROTO_SUM_OFFSET, NLB_SERVICE_PROTO_POLICY);
+    param->policy[NLB_SERVICE_PROTO_POLICY - 1] = '\0';
+
+    memcpy(words, buff + NLB_SERVICE_PROTO_SUM_OFFSET + NLB_SERVICE_PROTO_POLICY,
+           NLB_SERVICE_PROTO_HEAD_LEN - NLB_SERVICE_PROTO_SUM_OFFSET - NLB_SERVICE_PROTO_POLICY);
+    pos = words;
+    param->shaping_request_min   = (int32_t)ntohl(*pos++);
+    param->success_ratio_base    = bits_float(*pos++);
+    param->success_ratio_min     = bits_float(*pos++);
+    param->resume_weight_ratio   = bits_float(*pos++);
+    param->dead_retry_ratio      = bits_float(*pos++);
+    param->weight_low_watermark  = bits_float(*pos++);
+    param->weight_low_ratio      = bits_float(*pos++);
+    param->weight_incr_ratio     = bits_float(*pos++);
+    param->retry_budget_ratio    = bits_float(*pos++);
+    param->conc_tolerance        = bits_float(*pos++);
+    param->conc_smoothing        = bits_float(*pos++);
+    param->slow_start_floor      = bits_float(*pos++);
+    param->slow_start_aggression = bits_float(*pos++);
+    param->retry_budget_min      = ntohl(*pos++);
+    param->retry_budget_max      = ntohl(*pos++);
+    param->conc_limit_min        = ntohl(*pos++);
+    param->conc_limit_max        = ntohl(*pos++);
+    param->conc_limit_init       = ntohl(*pos++);
+    param->conc_reroll_times     = ntohl(*pos++);
+    param->slow_start_window     = ntohl(*pos++);
+    param->drain_window          = ntohl(*pos++);
+    param->eject_consecutive     = ntohl(*pos++);
+    param->eject_burst           = ntohl(*pos++);
+    param->eject_burst_window    = ntohl(*pos++);
+    param->eject_base_time       = ntohl(*pos++);
+    param->eject_max_time        = ntohl(*pos++);
+
+    *server_num = num;
+
+    return 0;
+}
+
+/**
+ * @brief 解服务器记录
+ * @info  记录直接拷贝到server_info，再原地转换字节序
+ */
+void deserialize_service_servers(const char *buff, struct server_info *svrs, uint32_t server_num)
+{
+    uint32_t i, k;
+    uint32_t head_len, rec_len;
+    const char *rpos;
+    struct server_info *server;
+    struct service_proto_head head;
+
+    /* 更高版本的头部和记录可能更长，按头部中的长度跳过 */
+    memcpy(&head, buff, sizeof(head));
+    head_len = ntohl(head.head_len);
+    rec_len  = ntohl(head.rec_len);
+    rpos     = buff + head_len;
+
+    for (i = 0; i < server_num; i++) {
+        server = &svrs[i];
+        memcpy(server, rpos, NLB_SERVICE_PROTO_REC_LEN);
+        memset((char *)server + NLB_SERVICE_PROTO_REC_LEN, 0, sizeof(struct server_info) - NLB_SERVICE_PROTO_REC_LEN);
+        rpos += rec_len;
+
+        server->weight_base    = 0;
+        server->weight_dynamic = 0;
+        server->weight_static  = ntohs(server->weight_static);
+        server->port_type      = ntohs(server->port_type);
+        server->port_num       = ntohs(server->port_num);
+        for (k = 0; k < NLB_PORT_MAX; k++) {
+            server->port[k] = ntohs(server->port[k]);
+        }
+    }
+}
+
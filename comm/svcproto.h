@@ -0,0 +1,101 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename svcproto.h
+ * @info     业务配置二进制编码
+ *           /nameservice/<a>/<b>节点可以保存二进制格式的配置，agent按魔数自动识别，json格式继续有效。
+ *           格式为固定长度的头部(魔数、版本、长度、校验和、业务参数)加上固定长度的服务器记录，
+ *           全部字段网络字节序，浮点数为IEEE754单精度的位模式。
+ *           服务器记录和struct server_info开头的寻址信息布局一致，解码时直接拷贝后转换字节序
+ */
+
+#ifndef _SVCPROTO_H_
+#define _SVCPROTO_H_
+
+#include <stdint.h>
+#include "commstruct.h"
+
+#define NLB_SERVICE_PROTO_MAGIC     (0x4e4c4253)    /* "NLBS" */
+#define NLB_SERVICE_PROTO_VERSION   (1)
+#define NLB_SERVICE_PROTO_HEAD_LEN  (144)           /* 版本1的头部长度 */
+#define NLB_SERVICE_PROTO_REC_LEN   (32)            /* 版本1的服务器记录长度 */
+#define NLB_SERVICE_PROTO_POLICY    (16)            /* 策略名最大长度 */
+
+/* 业务参数，和json配置中的可选参数一一对应 */
+struct service_proto_param {
+    char     policy[NLB_SERVICE_PROTO_POLICY];     /* 策略名，不足补0 */
+    int32_t  shaping_request_min;
+    float    success_ratio_base;
+    float    success_ratio_min;
+    float    resume_weight_ratio;
+    float    dead_retry_ratio;
+    float    weight_low_watermark;
+    float    weight_low_ratio;
+    float    weight_incr_ratio;
+    float    retry_budget_ratio;
+    float    conc_tolerance;
+    float    conc_smoothing;
+    float    slow_start_floor;
+    float    slow_start_aggression;
+    uint32_t retry_budget_min;
+    uint32_t retry_budget_max;
+    uint32_t conc_limit_min;
+    uint32_t conc_limit_max;
+    uint32_t conc_limit_init;
+    uint32_t conc_reroll_times;
+    uint32_t slow_start_window;
+    uint32_t drain_window;
+    uint32_t eject_consecutive;
+    uint32_t eject_burst;
+    uint32_t eject_burst_window;
+    uint32_t eject_base_time;
+    uint32_t eject_max_time;
+};
+
+/* 编码长度 */
+static inline int32_t service_proto_len(uint32_t server_num) {
+    return NLB_SERVICE_PROTO_HEAD_LEN + NLB_SERVICE_PROTO_REC_LEN * (int32_t)server_num;
+}
+
+/**
+ * @brief  打包业务配置
+ * @info   格式  "magic version|flags head_len rec_len server_num checksum param... record..."
+ *         校验和为checksum字段之后所有数据的adler32
+ * @return >0 编码长度 <0 失败
+ */
+int32_t serialize_service(const struct service_proto_param *param, const struct server_info *svrs,
+                          uint32_t server_num, char *buff, int32_t len);
+
+/**
+ * @brief  解业务配置头部，校验长度和校验和
+ * @info   更高版本的头部和记录只解析版本1的字段
+ * @return =0 成功 -1 不是二进制格式 <-1 数据错误
+ */
+int32_t deserialize_service_head(const char *buff, int32_t blen, struct service_proto_param *param,
+                                 uint32_t *server_num);
+
+/**
+ * @brief 解服务器记录，调用前必须用deserialize_service_head校验过
+ * @info  svrs至少有server_num个，只写寻址信息，其它字段清零
+ */
+void deserialize_service_servers(const char *buff, struct server_info *svrs, uint32_t server_num);
+
+#endif
+
@@ -0,0 +1,253 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbbench.c
+ * @info     agent节点事件分发基准测试
+ *           模拟机架故障: 一批服务器先死机再恢复，分别用逐个业务查找(scan)和
+ *           IP反向索引(index)把节点事件分发到业务，对比耗时和待处理事件数
+ *           index直接调用agent的add_node_event，scan按引入反向索引前的实现逐业务查找
+ */
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "list.h"
+#include "shaping.h"
+#include "agent.h"
+#include "event.h"
+#include "svcindex.h"
+
+#define BENCH_RACK_SIZE     50          /* 每个机架的服务器数 */
+#define BENCH_IP_BASE       0x0a000000  /* 服务器IP从10.0.0.1开始分配 */
+
+static struct list_head bench_rdata_list;
+static struct agent_local_rdata *bench_rdatas;
+static uint32_t bench_services = 2000;  /* 业务数 */
+static uint32_t bench_servers  = 200;   /* 每个业务的服务器数 */
+static uint32_t bench_racks    = 400;   /* 机架总数 */
+static uint32_t bench_failed   = 8;     /* 故障机架数 */
+static uint32_t bench_seed     = 7;     /* 随机数种子 */
+
+/* event.c查找业务事件时使用，基准测试只分发节点事件 */
+struct list_head *get_rdata_list(void)
+{
+    return &bench_rdata_list;
+}
+
+struct agent_local_rdata *get_local_rdata(const char *name)
+{
+    return NULL;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief 引入反向索引前的节点事件分发
+ * @info  遍历所有业务查找服务器，再遍历业务的事件链表查找重复事件
+ */
+static void scan_add_node_event(uint32_t ip, int32_t type)
+{
+    struct agent_local_rdata *rdata;
+    struct shm_servers *servers;
+    struct event *event;
+    void *ctx = (void *)(long)ip;
+    BOOL merged;
+
+    list_for_each_entry(rdata, &bench_rdata_list, list_node) {
+        servers = rdata->servs_data[rdata->route_meta->index];
+        if (NULL == get_server_info(ip, servers)) {
+            continue;
+        }
+
+        merged = FALSE;
+        list_for_each_entry(event, &rdata->event_list, list_node) {
+            if (event->ctx == ctx) {
+                event->type = type;
+                merged = TRUE;
+                break;
+            }
+        }
+
+        if (merged) {
+            continue;
+        }
+
+        event = calloc(1, sizeof(struct event));
+        if (NULL == event) {
+            printf("No memory\n");
+            exit(1);
+        }
+
+        event->type = type;
+        event->ctx  = ctx;
+        memcpy(event->name, rdata->name, NLB_SERVICE_NAME_LEN);
+        list_add_tail(&event->list_node, &rdata->event_list);
+        INIT_LIST_HEAD(&event->hash_node);
+    }
+}
+
+/**
+ * @brief 清空所有业务的待处理事件
+ * @return 清空的事件数
+ */
+static uint64_t drain_events(void)
+{
+    struct agent_local_rdata *rdata;
+    struct event *event, *tmp;
+    uint64_t num = 0;
+
+    list_for_each_entry(rdata, &bench_rdata_list, list_node) {
+        list_for_each_entry_safe(event, tmp, &rdata->event_list, list_node) {
+            delete_event(event, FALSE);
+            num++;
+        }
+    }
+
+    return num;
+}
+
+/**
+ * @brief 生成业务，每个业务的服务器随机分布在所有机架上
+ */
+static void setup_services(void)
+{
+    struct agent_local_rdata *rdata;
+    struct shm_servers *servers;
+    uint32_t i, j, rack, size;
+
+    INIT_LIST_HEAD(&bench_rdata_list);
+    srand(bench_seed);
+
+    bench_rdatas = calloc(bench_services, sizeof(struct agent_local_rdata));
+    if (NULL == bench_rdatas) {
+        printf("No memory\n");
+        exit(1);
+    }
+
+    size = sizeof(struct shm_servers) + bench_servers * sizeof(struct server_info);
+    for (i = 0; i < bench_services; i++) {
+        rdata   = &bench_rdatas[i];
+        servers = calloc(1, size);
+        rdata->route_meta = calloc(1, sizeof(struct shm_meta));
+        if (NULL == servers || NULL == rdata->route_meta) {
+            printf("No memory\n");
+            exit(1);
+        }
+
+        servers->server_num = bench_servers;
+        for (j = 0; j < bench_servers; j++) {
+            rack = (uint32_t)rand() % bench_racks;
+            servers->svrs[j].server_ip = htonl(BENCH_IP_BASE + rack * BENCH_RACK_SIZE
+                                               + (uint32_t)rand() % BENCH_RACK_SIZE + 1);
+        }
+        calc_servers_hash(servers);
+
+        snprintf(rdata->name, sizeof(rdata->name), "bench.%u", i);
+        rdata->servs_data[0] = servers;
+        rdata->servs_data[1] = servers;
+        INIT_LIST_HEAD(&rdata->event_list);
+        INIT_LIST_HEAD(&rdata->index_list);
+        for (j = 0; j < NLB_EVENT_HASH_LEN; j++) {
+            INIT_LIST_HEAD(&rdata->event_hash[j]);
+        }
+        list_add_tail(&rdata->list_node, &bench_rdata_list);
+
+        if (svcindex_update(rdata, servers) < 0) {
+            printf("svcindex_update failed\n");
+            exit(1);
+        }
+    }
+}
+
+/**
+ * @brief 故障机架的服务器先死机再恢复
+ */
+static void run_rack_failure(const char *mode, void (*add)(uint32_t, int32_t))
+{
+    uint32_t i, num = bench_failed * BENCH_RACK_SIZE;
+    uint64_t events;
+    double start, cost;
+
+    start = now_ms();
+    for (i = 0; i < num; i++) {
+        add(htonl(BENCH_IP_BASE + i + 1), NLB_EVENT_TYPE_NODE_DEAD);
+    }
+    for (i = 0; i < num; i++) {
+        add(htonl(BENCH_IP_BASE + i + 1), NLB_EVENT_TYPE_NODE_RESUME);
+    }
+    cost   = now_ms() - start;
+    events = drain_events();
+
+    printf("%-6s %u IPs dead+resume across %u services: %9.1f ms, pending events %lu\n",
+           mode, num, bench_services, cost, events);
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a node event dispatch benchmark for nlb agent.\n");
+    printf(" Usage:  %s [OPTION]\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -s services     Number of services, default 2000\n");
+    printf("        -n servers      Servers per service, default 200\n");
+    printf("        -r racks        Number of racks of %d servers, default 400\n", BENCH_RACK_SIZE);
+    printf("        -f racks        Number of failed racks, default 8\n");
+    printf("        -S seed         Random seed, default 7\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t c;
+
+    while ((c = getopt(argc, argv, "hs:n:r:f:S:")) != -1) {
+        switch (c) {
+            case 's': bench_services = (uint32_t)atoi(optarg); break;
+            case 'n': bench_servers = (uint32_t)atoi(optarg); break;
+            case 'r': bench_racks = (uint32_t)atoi(optarg); break;
+            case 'f': bench_failed = (uint32_t)atoi(optarg); break;
+            case 'S': bench_seed = (uint32_t)atoi(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (!bench_services || !bench_servers || !bench_racks
+        || bench_failed > bench_racks || bench_servers > NLB_SERVER_MAX) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    setup_services();
+    run_rack_failure("scan", scan_add_node_event);
+    run_rack_failure("index", add_node_event);
+
+    return 0;
+}
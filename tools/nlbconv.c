@@ -0,0 +1,221 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbconv.c
+ * @info     业务配置格式转换工具
+ *           json配置转换为agent可直接识别的二进制配置，-d将二进制配置还原为json，
+ *           转换前后都按agent的规则校验配置
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "svcproto.h"
+#include "policy.h"
+#include "jsonparser.h"
+
+/**
+ * @brief  读取整个文件
+ * @return NULL 失败
+ */
+static char *read_file(const char *path, int32_t *len)
+{
+    int32_t fd;
+    char   *buff;
+    struct stat st;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("Open file (%s) failed, [%m]\n", path);
+        return NULL;
+    }
+
+    buff = (char *)malloc(st.st_size + 1);
+    if (NULL == buff || read(fd, buff, st.st_size) != st.st_size) {
+        printf("Read file (%s) failed\n", path);
+        free(buff);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    buff[st.st_size] = '\0';
+    *len = (int32_t)st.st_size;
+
+    return buff;
+}
+
+/**
+ * @brief 解析结果转换为二进制业务参数
+ */
+static void fill_proto_param(const struct shm_servers *svrs, struct service_proto_param *param)
+{
+    memset(param, 0, sizeof(*param));
+    strncpy(param->policy, policy2str(svrs->policy), sizeof(param->policy) - 1);
+    param->shaping_request_min   = svrs->shaping_request_min;
+    param->success_ratio_base    = svrs->success_ratio_base;
+    param->success_ratio_min     = svrs->success_ratio_min;
+    param->resume_weight_ratio   = svrs->resume_weight_ratio;
+    param->dead_retry_ratio      = svrs->dead_retry_ratio;
+    param->weight_low_watermark  = svrs->weight_low_watermark;
+    param->weight_low_ratio      = svrs->weight_low_ratio;
+    param->weight_incr_ratio     = svrs->weight_incr_ratio;
+    param->retry_budget_ratio    = svrs->retry_budget_ratio;
+    param->conc_tolerance        = svrs->conc_tolerance;
+    param->conc_smoothing        = svrs->conc_smoothing;
+    param->slow_start_floor      = svrs->slow_start_floor;
+    param->slow_start_aggression = svrs->slow_start_aggression;
+    param->retry_budget_min      = svrs->retry_budget_min;
+    param->retry_budget_max      = svrs->retry_budget_max;
+    param->conc_limit_min        = svrs->conc_limit_min;
+    param->conc_limit_max        = svrs->conc_limit_max;
+    param->conc_limit_init       = svrs->conc_limit_init;
+    param->conc_reroll_times     = svrs->conc_reroll_times;
+    param->slow_start_window     = svrs->slow_start_window;
+    param->drain_window          = svrs->drain_window;
+    param->eject_consecutive     = svrs->eject_consecutive;
+    param->eject_burst           = svrs->eject_burst;
+    param->eject_burst_window    = svrs->eject_burst_window;
+    param->eject_base_time       = svrs->eject_base_time;
+    param->eject_max_time        = svrs->eject_max_time;
+}
+
+/**
+ * @brief 按json配置格式输出解析结果，浮点参数和json配置一样用字符串表示
+ */
+static void print_json(FILE *fp, const struct shm_servers *svrs)
+{
+    uint32_t i, j;
+    const struct server_info *svr;
+    static const char *port_types[] = {"", "udp", "tcp", "all"};
+
+    fprintf(fp, "{\"Policy\":\"%s\",\"shaping_request_min\":%d,", policy2str(svrs->policy), svrs->shaping_request_min);
+    fprintf(fp, "\"success_ratio_base\":\"%.9g\",\"success_ratio_min\":\"%.9g\",", svrs->success_ratio_base, svrs->success_ratio_min);
+    fprintf(fp, "\"resume_weight_ratio\":\"%.9g\",\"dead_retry_ratio\":\"%.9g\",", svrs->resume_weight_ratio, svrs->dead_retry_ratio);
+    fprintf(fp, "\"weight_low_watermark\":\"%.9g\",\"weight_low_ratio\":\"%.9g\",", svrs->weight_low_watermark, svrs->weight_low_ratio);
+    fprintf(fp, "\"weight_incr_ratio\":\"%.9g\",", svrs->weight_incr_ratio);
+    fprintf(fp, "\"retry_budget_ratio\":\"%.9g\",\"retry_budget_min\":%u,\"retry_budget_max\":%u,",
+            svrs->retry_budget_ratio, svrs->retry_budget_min, svrs->retry_budget_max);
+    fprintf(fp, "\"conc_limit_max\":%u,\"conc_limit_min\":%u,\"conc_limit_init\":%u,\"conc_reroll_times\":%u,",
+            svrs->conc_limit_max, svrs->conc_limit_min, svrs->conc_limit_init, svrs->conc_reroll_times);
+    fprintf(fp, "\"conc_tolerance\":\"%.9g\",\"conc_smoothing\":\"%.9g\",", svrs->conc_tolerance, svrs->conc_smoothing);
+    fprintf(fp, "\"slow_start_window\":%u,\"slow_start_floor\":\"%.9g\",\"slow_start_aggression\":\"%.9g\",",
+            svrs->slow_start_window, svrs->slow_start_floor, svrs->slow_start_aggression);
+    fprintf(fp, "\"drain_window\":%u,\"eject_consecutive\":%u,\"eject_burst\":%u,\"eject_burst_window\":%u,",
+            svrs->drain_window, svrs->eject_consecutive, svrs->eject_burst, svrs->eject_burst_window);
+    fprintf(fp, "\"eject_base_time\":%u,\"eject_max_time\":%u,\"IPInfo\":[", svrs->eject_base_time, svrs->eject_max_time);
+
+    for (i = 0; i < svrs->server_num; i++) {
+        svr = &svrs->svrs[i];
+        fprintf(fp, "%s{\"IP\":\"%s\",\"w\":%u,\"t\":\"%s\",\"ports\":[", i ? "," : "",
+                inet_ntoa(*(struct in_addr *)&svr->server_ip), svr->weight_static, port_types[svr->port_type & 3]);
+        for (j = 0; j < svr->port_num; j++) {
+            fprintf(fp, "%s%u", j ? "," : "", svr->port[j]);
+        }
+        fprintf(fp, "]}");
+    }
+
+    fprintf(fp, "]}\n");
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a converter between json and binary nlb service configs.\n");
+    printf(" Usage:  %s [OPTION] input [output]\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -d              Decode a binary config to json\n");
+    printf(" The output is written to stdout if no output file is given.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t c, ret, ilen, olen;
+    BOOL    decode = FALSE;
+    char   *ibuff, *obuff;
+    FILE   *fp = stdout;
+    struct shm_servers *svrs = NULL;
+    struct service_proto_param param;
+
+    while ((c = getopt(argc, argv, "hd")) != -1) {
+        switch (c) {
+            case 'd': decode = TRUE; break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    ibuff = read_file(argv[optind], &ilen);
+    if (NULL == ibuff) {
+        exit(1);
+    }
+
+    /* agent按魔数识别格式，两种格式都用同一个入口校验 */
+    ret = json_parse_service(ibuff, ilen, &svrs);
+    if (ret) {
+        printf("Parse config (%s) failed, ret [%d]\n", argv[optind], ret);
+        exit(1);
+    }
+
+    if (optind + 1 < argc) {
+        fp = fopen(argv[optind + 1], "w");
+        if (NULL == fp) {
+            printf("Open output file (%s) failed, [%m]\n", argv[optind + 1]);
+            exit(1);
+        }
+    }
+
+    if (decode) {
+        print_json(fp, svrs);
+    } else {
+        olen  = service_proto_len(svrs->server_num);
+        obuff = (char *)malloc(olen);
+        fill_proto_param(svrs, &param);
+        if (NULL == obuff || serialize_service(&param, svrs->svrs, svrs->server_num, obuff, olen) != olen
+            || fwrite(obuff, 1, olen, fp) != (size_t)olen) {
+            printf("Write binary config failed\n");
+            exit(1);
+        }
+
+        fprintf(stderr, "servers: %u, json: %d bytes, binary: %d bytes\n", svrs->server_num, ilen, olen);
+        free(obuff);
+    }
+
+    if (fp != stdout) {
+        fclose(fp);
+    }
+
+    free(svrs);
+    free(ibuff);
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbfr.c
+ * @info     权重调整记录解析工具
+ *           读取agent写入的调整记录环形文件，按时间顺序输出每次调整的分支、
+ *           每台服务器的统计数据、权重变化和死机状态变化
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "shaping.h"
+#include "flightrec.h"
+
+static const char *filter_name;
+static uint32_t    filter_ip;
+static BOOL        changed_only;
+
+static const char *branch_str(uint8_t branch)
+{
+    switch (branch) {
+        case NLB_SHAPING_BASE_RATIO: return "base";
+        case NLB_SHAPING_AVG_RATIO:  return "average";
+        default:                     return "none";
+    }
+}
+
+/**
+ * @brief 输出一条调整记录
+ */
+static void print_record(const struct flightrec_record *record)
+{
+    uint32_t i, total;
+    char     name[NLB_SERVICE_NAME_LEN + 1];
+    char     ip[INET_ADDRSTRLEN];
+    char     tstr[64];
+    time_t   sec = (time_t)(record->time / 1000);
+    struct tm tm;
+    const struct flightrec_server *svrs;
+    const struct flightrec_server *svr;
+
+    snprintf(name, sizeof(name), "%.*s", (int)record->name_len, (const char *)(record + 1));
+    if (filter_name && strcmp(name, filter_name)) {
+        return;
+    }
+
+    localtime_r(&sec, &tm);
+    strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+
+    svrs = (const struct flightrec_server *)((const char *)record
+                                             + ((sizeof(*record) + record->name_len + 7) & ~7UL));
+
+    printf("%s.%03lu %s branch: %s ratio: %.4f servers: %u low: %u%s\n", tstr, record->time % 1000, name,
+           branch_str(record->branch), record->success_ratio, record->server_num, record->weight_low_num,
+           record->truncated ? " (truncated)" : "");
+
+    for (i = 0; i < record->server_num; i++) {
+        svr = &svrs[i];
+        if (filter_ip && svr->ip != filter_ip) {
+            continue;
+        }
+
+        if (changed_only && svr->weight_old == svr->weight_new && svr->dead_old == svr->dead_new) {
+            continue;
+        }
+
+        total = svr->success + svr->failed;
+        inet_ntop(AF_INET, &svr->ip, ip, sizeof(ip));
+        printf("    %-15s success: %-8u failed: %-8u ratio: %6.2f%% cost: %8.2fms weight: %5u -> %-5u/%5u %s -> %s\n",
+               ip, svr->success, svr->failed, total ? 100.0 * svr->success / total : 100.0,
+               total ? (double)svr->cost / total : 0.0, svr->weight_old, svr->weight_new, svr->weight_static,
+               svr->dead_old ? "DEAD" : "ALIVE", svr->dead_new ? "DEAD" : "ALIVE");
+    }
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a decoder of the nlb shaping flight recorder.\n");
+    printf(" Usage:  %s [OPTION]\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -f file         Flight recorder file, default %s\n", NLB_FLIGHTREC_PATH);
+    printf("        -s service      Only show records of this service\n");
+    printf("        -i ip           Only show this server\n");
+    printf("        -c              Only show servers whose weight or dead state changed\n");
+    printf("        -n count        Only show the last count records\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t  c, fd;
+    uint64_t head, tail, size, pos, off;
+    uint64_t *offsets = NULL;
+    uint64_t num = 0, cap = 0, i, last = 0;
+    const char *path = NLB_FLIGHTREC_PATH;
+    char    *data;
+    void    *addr;
+    struct stat buf;
+    struct in_addr in;
+    struct flightrec_header *header;
+    struct flightrec_record *record;
+
+    while ((c = getopt(argc, argv, "hf:s:i:cn:")) != -1) {
+        switch (c) {
+            case 'f': path = optarg; break;
+            case 's': filter_name = optarg; break;
+            case 'i':
+                if (!inet_aton(optarg, &in)) {
+                    printf("Invalid ip: %s\n", optarg);
+                    exit(1);
+                }
+                filter_ip = in.s_addr;
+                break;
+            case 'c': changed_only = TRUE; break;
+            case 'n': last = (uint64_t)atoll(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &buf) < 0 || buf.st_size < NLB_FLIGHTREC_DATA_OFFSET) {
+        printf("Open flight recorder file (%s) failed\n", path);
+        exit(1);
+    }
+
+    addr = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("Mmap flight recorder file (%s) failed, [%m]\n", path);
+        exit(1);
+    }
+
+    header = (struct flightrec_header *)addr;
+    size   = header->data_size;
+    if (header->magic != NLB_FLIGHTREC_MAGIC || header->version != NLB_FLIGHTREC_VERSION
+        || (uint64_t)buf.st_size != NLB_FLIGHTREC_DATA_OFFSET + size) {
+        printf("Invalid flight recorder file (%s)\n", path);
+        exit(1);
+    }
+
+    /* 拷贝数据区后再检查head，被agent覆盖的记录跳过 */
+    tail = header->tail;
+    head = header->head;
+    data = malloc(size);
+    if (NULL == data) {
+        printf("No memory\n");
+        exit(1);
+    }
+    memcpy(data, (char *)addr + NLB_FLIGHTREC_DATA_OFFSET, size);
+    head = header->head > head ? header->head : head;
+
+    for (off = head; off < tail; off += record->length) {
+        pos    = off % size;
+        record = (struct flightrec_record *)(data + pos);
+        if (record->length < sizeof(uint64_t) || pos + record->length > size) {
+            printf("Corrupted record at offset %lu\n", off);
+            break;
+        }
+
+        if (record->type != NLB_FLIGHTREC_TYPE_RECORD) {
+            continue;
+        }
+
+        if (num == cap) {
+            cap = cap ? cap * 2 : 1024;
+            offsets = realloc(offsets, cap * sizeof(uint64_t));
+            if (NULL == offsets) {
+                printf("No memory\n");
+                exit(1);
+            }
+        }
+        offsets[num++] = pos;
+    }
+
+    for (i = (last && last < num) ? num - last : 0; i < num; i++) {
+        print_record((struct flightrec_record *)(data + offsets[i]));
+    }
+
+    free(offsets);
+    free(data);
+    munmap(addr, buf.st_size);
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbjournal.c
+ * @info     业务配置变更日志维护工具，发布者使用
+ *           append: 发布者修改业务配置后，读取业务节点的mtime，在业务所在分片追加顺序节点
+ *           prune:  按每个分片的条目数上限和保留时间删除旧条目，同一个multi请求中
+ *                   把分片的"@floor-<序号>"节点更新为删除的最大序号，agent据此发现漏掉的条目
+ */
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "commstruct.h"
+#include "zookeeper.h"
+#include "zkjournal.h"
+
+#define JOURNAL_BATCH_MAX       (500)       /* 每个multi请求最多删除的条目数 */
+#define JOURNAL_FLOOR_MAX       (4)         /* 每个multi请求最多删除的旧下限节点数 */
+#define JOURNAL_CONNECT_WAIT    (100)       /* 等待连接的检查次数，每次100ms */
+
+/* 分片中的一个条目 */
+struct journal_entry {
+    char     node[NLB_SERVICE_NAME_LEN + 64];   /* 节点名 */
+    uint64_t mtime;                             /* 业务配置mtime，毫秒 */
+    int64_t  seq;                               /* 顺序节点序号 */
+};
+
+static const char *zk_host;
+static int32_t  zk_timeout = 10000;
+static uint32_t keep_max   = 10000;         /* 每个分片保留的最大条目数 */
+static uint64_t retention  = 86400;         /* 条目保留时间，秒 */
+
+/* 按序号从小到大排序 */
+static int32_t journal_entry_cmp(const void *a, const void *b)
+{
+    int64_t sa = ((const struct journal_entry *)a)->seq;
+    int64_t sb = ((const struct journal_entry *)b)->seq;
+
+    if (sa == sb) {
+        return 0;
+    }
+
+    return (sa < sb) ? -1 : 1;
+}
+
+/**
+ * @brief  解析日志条目"<业务名>@<mtime>-<序号>"，规则同agent
+ * @return =0 成功 <0 格式错误
+ */
+static int32_t parse_entry(const char *node, uint64_t *mtime, int64_t *seq)
+{
+    const char *at, *dash;
+    char *end;
+
+    at   = strrchr(node, '@');
+    dash = strrchr(node, '-');
+    if ((NULL == at) || (NULL == dash) || (dash < at) || (at == node)) {
+        return -1;
+    }
+
+    *mtime = strtoull(at + 1, &end, 10);
+    if (end != dash) {
+        return -2;
+    }
+
+    *seq = strtoll(dash + 1, &end, 10);
+    if ((*end != '\0') || (*seq < 0)) {
+        return -3;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  连接zookeeper，等待会话建立
+ * @return NULL 失败
+ */
+static zhandle_t *journal_connect(void)
+{
+    int32_t i;
+    zhandle_t *zh;
+
+    zoo_set_debug_level(ZOO_LOG_LEVEL_ERROR);
+    zh = zookeeper_init(zk_host, NULL, zk_timeout, NULL, NULL, 0);
+    if (NULL == zh) {
+        printf("Connect zookeeper (%s) failed, [%m]\n", zk_host);
+        return NULL;
+    }
+
+    for (i = 0; i < JOURNAL_CONNECT_WAIT; i++) {
+        if (zoo_state(zh) == ZOO_CONNECTED_STATE) {
+            return zh;
+        }
+        usleep(100000);
+    }
+
+    printf("Connect zookeeper (%s) timeout\n", zk_host);
+    zookeeper_close(zh);
+    return NULL;
+}
+
+/**
+ * @brief  业务配置变化后追加变更日志条目
+ * @return =0 成功 <0 失败
+ */
+static int32_t journal_append(zhandle_t *zh, const char *name)
+{
+    int32_t ret;
+    char *pos;
+    char path[NLB_PATH_MAX_LEN];
+    char node[NLB_PATH_MAX_LEN * 2];
+    struct Stat stat;
+
+    /* 业务名a.b对应节点/nameservice/a/b */
+    if (snprintf(path, sizeof(path), "/nameservice/%s", name) >= (int32_t)sizeof(path)
+        || NULL == (pos = strchr(path, '.'))) {
+        printf("Invalid service name (%s)\n", name);
+        return -1;
+    }
+    *pos = '/';
+
+    ret = zoo_exists(zh, path, 0, &stat);
+    if (ret != ZOK) {
+        printf("Get service (%s) stat failed, [%s]\n", path, zerror(ret));
+        return -2;
+    }
+
+    snprintf(node, sizeof(node), NLB_CHANGE_JOURNAL_PATH"/%u/%s@%lld-",
+             change_journal_shard(name), name, (long long)stat.mtime);
+    ret = zoo_create(zh, node, NULL, -1, &ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE, NULL, 0);
+    if (ret != ZOK) {
+        printf("Create journal entry (%s) failed, [%s]\n", node, zerror(ret));
+        return -3;
+    }
+
+    printf("%s: shard %u mtime %lld\n", name, change_journal_shard(name), (long long)stat.mtime);
+    return 0;
+}
+
+/**
+ * @brief  删除一个分片的旧条目
+ * @info   从最旧的条目开始，删除超过条目数上限或超过保留时间的条目，保留的条目序号连续递增；
+ *         每批删除和下限节点更新在同一个multi请求中完成，agent不会看到没有下限的删除
+ * @return >=0 删除的条目数 <0 失败
+ */
+static int32_t journal_prune_shard(zhandle_t *zh, uint32_t index, uint64_t cutoff)
+{
+    int32_t  ret, i, num = 0, floor_num = 0, start, end, ops_num, pruned = 0;
+    int64_t  seq, value, floor = -1;
+    uint64_t mtime;
+    size_t   len = strlen(NLB_CHANGE_JOURNAL_FLOOR);
+    char     path[NLB_PATH_MAX_LEN];
+    char     floor_path[NLB_PATH_MAX_LEN * 2];
+    char     old_floors[JOURNAL_FLOOR_MAX][NLB_PATH_MAX_LEN * 2];
+    char   (*del_paths)[NLB_PATH_MAX_LEN * 2] = NULL;
+    struct journal_entry *entries = NULL;
+    struct String_vector children;
+    zoo_op_t *ops = NULL;
+    zoo_op_result_t *results = NULL;
+
+    snprintf(path, sizeof(path), NLB_CHANGE_JOURNAL_PATH"/%u", index);
+    ret = zoo_get_children(zh, path, 0, &children);
+    if (ret != ZOK) {
+        printf("Get journal shard (%s) failed, [%s]\n", path, zerror(ret));
+        return -1;
+    }
+
+    entries   = calloc(children.count + 1, sizeof(struct journal_entry));
+    del_paths = calloc(JOURNAL_BATCH_MAX, sizeof(*del_paths));
+    ops       = calloc(JOURNAL_BATCH_MAX + JOURNAL_FLOOR_MAX + 1, sizeof(zoo_op_t));
+    results   = calloc(JOURNAL_BATCH_MAX + JOURNAL_FLOOR_MAX + 1, sizeof(zoo_op_result_t));
+    if (!entries || !del_paths || !ops || !results) {
+        printf("No memory\n");
+        ret = -2;
+        goto EXIT;
+    }
+
+    for (i = 0; i < children.count; i++) {
+        const char *node = children.data[i];
+
+        if (!strncmp(node, NLB_CHANGE_JOURNAL_FLOOR, len)) {
+            value = strtoll(node + len, NULL, 10);
+            if (value > floor) {
+                floor = value;
+            }
+            if (floor_num < JOURNAL_FLOOR_MAX) {
+                snprintf(old_floors[floor_num++], sizeof(old_floors[0]), "%s/%s", path, node);
+            }
+            continue;
+        }
+
+        if (parse_entry(node, &mtime, &seq) < 0 || strlen(node) >= sizeof(entries[num].node)) {
+            printf("Skip invalid journal entry (%s/%s)\n", path, node);
+            continue;
+        }
+
+        memcpy(entries[num].node, node, strlen(node) + 1);
+        entries[num].mtime = mtime;
+        entries[num].seq   = seq;
+        num++;
+    }
+
+    qsort(entries, num, sizeof(struct journal_entry), journal_entry_cmp);
+
+    /* 删除的条目是最旧的连续一段，遇到第一个需要保留的条目停止 */
+    for (end = 0; end < num; end++) {
+        if (((uint32_t)(num - end) <= keep_max) && (entries[end].mtime >= cutoff)) {
+            break;
+        }
+    }
+
+    for (start = 0; start < end; start += JOURNAL_BATCH_MAX) {
+        int32_t batch = (end - start > JOURNAL_BATCH_MAX) ? JOURNAL_BATCH_MAX : (end - start);
+
+        ops_num = 0;
+        snprintf(floor_path, sizeof(floor_path), "%s/"NLB_CHANGE_JOURNAL_FLOOR"%lld",
+                 path, (long long)entries[start + batch - 1].seq);
+        zoo_create_op_init(&ops[ops_num++], floor_path, NULL, -1, &ZOO_OPEN_ACL_UNSAFE, 0, NULL, 0);
+        for (i = 0; i < floor_num; i++) {
+            zoo_delete_op_init(&ops[ops_num++], old_floors[i], -1);
+        }
+        for (i = 0; i < batch; i++) {
+            snprintf(del_paths[i], sizeof(del_paths[i]), "%s/%s", path, entries[start + i].node);
+            zoo_delete_op_init(&ops[ops_num++], del_paths[i], -1);
+        }
+
+        ret = zoo_multi(zh, ops_num, ops, results);
+        if (ret != ZOK) {
+            printf("Prune journal shard (%s) failed, [%s]\n", path, zerror(ret));
+            ret = -3;
+            goto EXIT;
+        }
+
+        floor_num = 1;
+        memcpy(old_floors[0], floor_path, sizeof(floor_path));
+        pruned += batch;
+    }
+
+    printf("shard %u: entries %d, pruned %d\n", index, num, pruned);
+    ret = pruned;
+
+EXIT:
+    deallocate_String_vector(&children);
+    free(entries);
+    free(del_paths);
+    free(ops);
+    free(results);
+    return ret;
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a service change journal tool for nlb publishers.\n");
+    printf(" Usage:  %s [OPTION] append <service>...\n", name);
+    printf("         %s [OPTION] prune\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -z host         Zookeeper host list, required\n");
+    printf("        -t ms           Zookeeper session timeout, default 10000\n");
+    printf("        -n entries      Max entries kept per shard when pruning, default 10000\n");
+    printf("        -r seconds      Entries older than this are pruned, default 86400\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t  c, i, ret = 0;
+    uint64_t cutoff;
+    zhandle_t *zh;
+    struct timeval tv;
+
+    while ((c = getopt(argc, argv, "hz:t:n:r:")) != -1) {
+        switch (c) {
+            case 'z': zk_host = optarg; break;
+            case 't': zk_timeout = atoi(optarg); break;
+            case 'n': keep_max = (uint32_t)atoi(optarg); break;
+            case 'r': retention = (uint64_t)atoll(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (!zk_host || optind >= argc
+        || (strcmp(argv[optind], "append") && strcmp(argv[optind], "prune"))
+        || (!strcmp(argv[optind], "append") && optind + 1 >= argc)) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    zh = journal_connect();
+    if (NULL == zh) {
+        exit(1);
+    }
+
+    if (!strcmp(argv[optind], "append")) {
+        for (i = optind + 1; i < argc; i++) {
+            if (journal_append(zh, argv[i]) < 0) {
+                ret = 1;
+            }
+        }
+    } else {
+        gettimeofday(&tv, NULL);
+        cutoff = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        cutoff = (cutoff > retention * 1000) ? (cutoff - retention * 1000) : 0;
+        for (i = 0; i < NLB_CHANGE_JOURNAL_SHARDS; i++) {
+            if (journal_prune_shard(zh, (uint32_t)i, cutoff) < 0) {
+                ret = 1;
+            }
+        }
+    }
+
+    zookeeper_close(zh);
+    return ret;
+}
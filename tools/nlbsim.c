@@ -0,0 +1,1400 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbsim.c
+ * @info     负载均衡策略离线模拟器
+ *           在虚拟时间中运行真实的API寻址(search_route)和agent调整(reshape_servers)代码，
+ *           后端由模型描述(时延分布、容量、降级、抖动、慢启动)，或者回放记录的路由调用轨迹，
+ *           对比不同策略参数下的尾时延、错误率、摘除时间和恢复时间；
+ *           开启失败重试时，通过重试预算(acquire_route_retry)控制重试，输出重试放大倍数
+ *
+ *           虚拟时间通过链接参数 -Wl,--wrap=gettimeofday -Wl,--wrap=time 替换系统时间
+ */
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "commtype.h"
+#include "commstruct.h"
+#include "comm.h"
+#include "utils.h"
+#include "nlbapi.h"
+#include "routedata.h"
+#include "shaping.h"
+#include "drain.h"
+#include "loadaware.h"
+
+#define SIM_BACKEND_MAX     1000        /* 最大后端数 */
+#define SIM_FAULT_MAX       256         /* 最大故障事件数 */
+#define SIM_POLICY_MAX      16          /* 最大对比策略数 */
+#define SIM_LOAD_SLOTS      10          /* 负载统计窗口槽数，每槽100ms */
+#define SIM_EJECT_RATIO     0.1         /* 权重低于静态权重该比例认为已摘除 */
+#define SIM_RECOVER_RATIO   0.9         /* 权重恢复到静态权重该比例认为已恢复 */
+#define SIM_TRACE_WINDOW    1000        /* 回放时取样窗口，毫秒 */
+#define SIM_LOAD_REPORT     20000       /* 负载上报周期，同agent，毫秒 */
+
+enum {
+    SIM_FAULT_BROWNOUT = 1,             /* 降级: 错误率和时延升高 */
+    SIM_FAULT_DOWN     = 2,             /* 宕机: 请求全部超时 */
+    SIM_FAULT_FLAP     = 3,             /* 抖动: 周期性宕机 */
+    SIM_FAULT_RESTART  = 4,             /* 重启: 宕机后容量从冷启动逐渐恢复 */
+    SIM_FAULT_DRAIN    = 5,             /* 排空下线: 先通知排空，一段时间后宕机，结束后恢复 */
+};
+
+/* 回放轨迹中的单次调用结果 */
+struct sim_sample {
+    uint64_t t;                         /* 时间戳，毫秒 */
+    int32_t  failed;                    /* 失败次数 */
+    int32_t  cost;                      /* 时延 */
+};
+
+/* 后端模型 */
+struct sim_backend {
+    uint32_t ip;                        /* IP地址，网络字节序 */
+    uint16_t weight;                    /* 静态权重 */
+    double   lat_mean;                  /* 平均时延，毫秒 */
+    double   lat_sigma;                 /* 对数正态分布sigma */
+    double   capacity;                  /* 容量qps，0表示不限 */
+    double   err_ratio;                 /* 基础错误率 */
+
+    uint32_t load_slots[SIM_LOAD_SLOTS];/* 最近1秒每100ms的请求数 */
+    uint64_t load_slot_time;            /* 当前槽的起始时间，毫秒 */
+
+    struct sim_sample *samples;         /* 回放模式: 该后端的调用记录，按时间排序 */
+    uint32_t sample_num;
+    uint32_t sample_size;
+};
+
+/* 故障事件 */
+struct sim_fault {
+    int32_t  type;
+    int32_t  backend;                   /* 后端下标 */
+    uint64_t start;                     /* 开始时间，毫秒 */
+    uint64_t end;                       /* 结束时间，毫秒 */
+    uint64_t period;                    /* 抖动周期，毫秒 */
+    uint64_t warm;                      /* 重启后预热时间，毫秒 */
+    uint64_t kill;                      /* 排空开始到宕机的时间，毫秒 */
+    double   err;                       /* 降级错误率 */
+    double   lat_mul;                   /* 降级时延倍数 */
+
+    int64_t  eject_time;                /* 运行结果: 摘除耗时，-1表示未摘除 */
+    int64_t  recover_time;              /* 运行结果: 恢复耗时，-1表示未恢复 */
+    BOOL     draining;                  /* 运行状态: 客户端已经开始排空 */
+};
+
+/* 策略参数 */
+struct sim_policy {
+    char     name[64];
+    struct shm_servers param;           /* 只使用业务参数字段 */
+};
+
+/* 待完成请求，按完成时间组成小顶堆 */
+struct sim_pending {
+    uint64_t t;                         /* 完成时间，微秒 */
+    uint64_t start;                     /* 首次请求时间，微秒 */
+    uint32_t ip;
+    int32_t  failed;
+    int32_t  cost;
+    int32_t  attempt;                   /* 第几次重试，0表示首次请求 */
+};
+
+/* 单个策略的运行结果 */
+struct sim_result {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t attempts;                  /* 发往后端的请求数，包括重试 */
+    uint64_t denied;                    /* 重试预算不足放弃的重试数 */
+    uint32_t *lats;                     /* 所有请求时延 */
+    uint64_t lat_num;
+    uint64_t lat_size;
+};
+
+/* 模拟器全局配置和状态 */
+struct sim_config {
+    uint64_t duration;                  /* 模拟时长，毫秒 */
+    uint64_t interval;                  /* agent调整周期，毫秒 */
+    uint32_t timeout;                   /* 超时时延，毫秒 */
+    int32_t  retries;                   /* 失败最大重试次数 */
+    double   qps;                       /* 请求速率 */
+    uint64_t seed;                      /* 随机种子 */
+    BOOL     replay;                    /* 是否回放模式 */
+
+    uint64_t *arrivals;                 /* 回放模式: 请求到达时间，毫秒 */
+    uint64_t arrival_num;
+    uint64_t arrival_size;
+
+    struct sim_backend backends[SIM_BACKEND_MAX];
+    int32_t  backend_num;
+    struct sim_fault faults[SIM_FAULT_MAX];
+    int32_t  fault_num;
+    struct sim_policy policies[SIM_POLICY_MAX];
+    int32_t  policy_num;
+};
+
+static struct sim_config sim;
+static uint64_t sim_now_us;             /* 虚拟时间，微秒 */
+static struct sim_fault *sim_run_faults;/* 当前运行策略的故障事件 */
+static uint64_t rng_state;              /* 模型随机数状态 */
+
+static struct sim_pending *pendings;
+static uint64_t pending_num;
+static uint64_t pending_size;
+
+/**
+ * @brief 虚拟时间，替换gettimeofday
+ */
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+    tv->tv_sec  = sim_now_us / 1000000;
+    tv->tv_usec = sim_now_us % 1000000;
+    return 0;
+}
+
+/**
+ * @brief 虚拟时间，替换time
+ */
+time_t __wrap_time(time_t *t)
+{
+    time_t now = (time_t)(sim_now_us / 1000000);
+    if (t) {
+        *t = now;
+    }
+    return now;
+}
+
+/* 模型随机数: xorshift64* */
+static uint64_t sim_rand(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/* [0, 1)均匀分布 */
+static double sim_uniform(void)
+{
+    return (sim_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* 标准正态分布 */
+static double sim_normal(void)
+{
+    double u1 = sim_uniform();
+    double u2 = sim_uniform();
+
+    if (u1 < 1e-300) {
+        u1 = 1e-300;
+    }
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/* 指定均值和sigma的对数正态分布 */
+static double sim_lognormal(double mean, double sigma)
+{
+    double mu = log(mean) - sigma * sigma / 2.0;
+    return exp(mu + sigma * sim_normal());
+}
+
+/**
+ * @brief 通过IP查找后端下标
+ */
+static int32_t find_backend(uint32_t ip)
+{
+    int32_t i;
+
+    for (i = 0; i < sim.backend_num; i++) {
+        if (sim.backends[i].ip == ip) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 添加后端，已存在则返回已有下标
+ */
+static int32_t add_backend(uint32_t ip)
+{
+    int32_t idx = find_backend(ip);
+    struct sim_backend *backend;
+
+    if (idx >= 0) {
+        return idx;
+    }
+
+    if (sim.backend_num >= SIM_BACKEND_MAX) {
+        fprintf(stderr, "too many backends, max %d\n", SIM_BACKEND_MAX);
+        exit(1);
+    }
+
+    idx     = sim.backend_num++;
+    backend = &sim.backends[idx];
+    memset(backend, 0, sizeof(*backend));
+    backend->ip        = ip;
+    backend->weight    = 1000;
+    backend->lat_mean  = 10.0;
+    backend->lat_sigma = 0.3;
+
+    return idx;
+}
+
+/**
+ * @brief 解析 key=value 形式的参数
+ * @return 0 成功 <0 没有该参数
+ */
+static int32_t get_kv(char **argv, int32_t argc, const char *key, double *value)
+{
+    int32_t i;
+    size_t  klen = strlen(key);
+
+    for (i = 0; i < argc; i++) {
+        if (!strncmp(argv[i], key, klen) && argv[i][klen] == '=') {
+            *value = atof(argv[i] + klen + 1);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 加载场景文件
+ * @info  每行一条配置，#开头为注释，时间单位为秒:
+ *        server   <ip> weight=1000 lat=10 sigma=0.3 cap=500 err=0.001
+ *        brownout <ip> start=60 end=120 err=0.3 lat=3
+ *        down     <ip> start=60 end=90
+ *        flap     <ip> start=30 end=150 period=10
+ *        restart  <ip> start=100 down=5 warm=60
+ *        drain    <ip> start=60 kill=15 end=90
+ */
+static void load_scenario(const char *path)
+{
+    FILE   *fp;
+    char    line[1024];
+    char   *argv[32];
+    int32_t argc, lineno = 0, idx;
+    double  v;
+    struct in_addr addr;
+    struct sim_backend *backend;
+    struct sim_fault *fault;
+
+    fp = fopen(path, "r");
+    if (NULL == fp) {
+        fprintf(stderr, "open scenario (%s) failed, [%m]\n", path);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        argc = 0;
+        for (argv[argc] = strtok(line, " \t\r\n"); argv[argc] && argc < 31; argv[argc] = strtok(NULL, " \t\r\n")) {
+            argc++;
+        }
+
+        if (argc == 0 || argv[0][0] == '#') {
+            continue;
+        }
+
+        if (argc < 2 || !inet_aton(argv[1], &addr)) {
+            fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+            exit(1);
+        }
+
+        idx = add_backend(addr.s_addr);
+        backend = &sim.backends[idx];
+
+        if (!strcmp(argv[0], "server")) {
+            if (!get_kv(argv, argc, "weight", &v)) backend->weight = (uint16_t)v;
+            if (!get_kv(argv, argc, "lat", &v))    backend->lat_mean = v;
+            if (!get_kv(argv, argc, "sigma", &v))  backend->lat_sigma = v;
+            if (!get_kv(argv, argc, "cap", &v))    backend->capacity = v;
+            if (!get_kv(argv, argc, "err", &v))    backend->err_ratio = v;
+
+            if (backend->weight > NLB_WEIGHT_MAX || backend->weight < NLB_WEIGHT_MIN
+                || backend->lat_mean <= 0) {
+                fprintf(stderr, "%s:%d: invalid server\n", path, lineno);
+                exit(1);
+            }
+            continue;
+        }
+
+        if (sim.fault_num >= SIM_FAULT_MAX) {
+            fprintf(stderr, "too many faults, max %d\n", SIM_FAULT_MAX);
+            exit(1);
+        }
+
+        fault = &sim.faults[sim.fault_num];
+        memset(fault, 0, sizeof(*fault));
+        fault->backend = idx;
+        fault->lat_mul = 1.0;
+        if (!get_kv(argv, argc, "start", &v))  fault->start  = (uint64_t)(v * 1000);
+        if (!get_kv(argv, argc, "end", &v))    fault->end    = (uint64_t)(v * 1000);
+        if (!get_kv(argv, argc, "period", &v)) fault->period = (uint64_t)(v * 1000);
+        if (!get_kv(argv, argc, "warm", &v))   fault->warm   = (uint64_t)(v * 1000);
+        if (!get_kv(argv, argc, "kill", &v))   fault->kill   = (uint64_t)(v * 1000);
+        if (!get_kv(argv, argc, "err", &v))    fault->err    = v;
+        if (!get_kv(argv, argc, "lat", &v))    fault->lat_mul = v;
+
+        if (!strcmp(argv[0], "brownout")) {
+            fault->type = SIM_FAULT_BROWNOUT;
+        } else if (!strcmp(argv[0], "down")) {
+            fault->type = SIM_FAULT_DOWN;
+        } else if (!strcmp(argv[0], "flap")) {
+            fault->type = SIM_FAULT_FLAP;
+            if (!fault->period) {
+                fault->period = 10000;
+            }
+        } else if (!strcmp(argv[0], "restart")) {
+            fault->type = SIM_FAULT_RESTART;
+            if (!get_kv(argv, argc, "down", &v)) {
+                fault->end = fault->start + (uint64_t)(v * 1000);
+            }
+        } else if (!strcmp(argv[0], "drain")) {
+            fault->type = SIM_FAULT_DRAIN;
+        } else {
+            fprintf(stderr, "%s:%d: unknown directive (%s)\n", path, lineno, argv[0]);
+            exit(1);
+        }
+
+        if (fault->end <= fault->start) {
+            fprintf(stderr, "%s:%d: fault end must be after start\n", path, lineno);
+            exit(1);
+        }
+
+        sim.fault_num++;
+    }
+
+    fclose(fp);
+}
+
+/**
+ * @brief 内置默认场景
+ * @info  10台同构服务器，1号60~120秒降级，2号150~200秒宕机，3号重启后慢启动
+ */
+static void load_default_scenario(void)
+{
+    int32_t i, idx;
+    char    ip[32];
+    struct in_addr addr;
+
+    for (i = 0; i < 10; i++) {
+        snprintf(ip, sizeof(ip), "10.0.0.%d", i + 1);
+        inet_aton(ip, &addr);
+        idx = add_backend(addr.s_addr);
+        sim.backends[idx].capacity = 400;
+    }
+
+    sim.faults[0] = (struct sim_fault){.type = SIM_FAULT_BROWNOUT, .backend = 0,
+                                       .start = 60000, .end = 120000, .err = 0.5, .lat_mul = 3.0};
+    sim.faults[1] = (struct sim_fault){.type = SIM_FAULT_DOWN, .backend = 1,
+                                       .start = 150000, .end = 200000, .lat_mul = 1.0};
+    sim.faults[2] = (struct sim_fault){.type = SIM_FAULT_RESTART, .backend = 2,
+                                       .start = 220000, .end = 225000, .warm = 30000, .lat_mul = 1.0};
+    sim.fault_num = 3;
+}
+
+/**
+ * @brief 加载路由调用轨迹
+ * @info  每行一条记录，时间为毫秒:
+ *        <ts> get    <ip>
+ *        <ts> update <ip> <failed> <cost>
+ *        请求到达时间取get记录，没有get记录时用update记录时间减去时延
+ */
+static void load_trace(const char *path)
+{
+    FILE    *fp;
+    char     line[512];
+    char     op[32], ip[64];
+    int32_t  idx, n, failed, cost;
+    uint64_t ts, base = 0;
+    BOOL     has_get = FALSE;
+    struct in_addr addr;
+    struct sim_backend *backend;
+
+    fp = fopen(path, "r");
+    if (NULL == fp) {
+        fprintf(stderr, "open trace (%s) failed, [%m]\n", path);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        failed = cost = 0;
+        n = sscanf(line, "%lu %31s %63s %d %d", &ts, op, ip, &failed, &cost);
+        if (n < 3 || line[0] == '#' || !inet_aton(ip, &addr)) {
+            continue;
+        }
+
+        /* 时间从0开始 */
+        if (!base) {
+            base = ts ? ts : 1;
+        }
+        ts = (ts >= base) ? ts - base : 0;
+
+        idx = add_backend(addr.s_addr);
+        backend = &sim.backends[idx];
+
+        if (!strcmp(op, "get")) {
+            if (!has_get) {
+                has_get = TRUE;
+                sim.arrival_num = 0;
+            }
+        } else if (!strcmp(op, "update") && n == 5) {
+            if (backend->sample_num == backend->sample_size) {
+                backend->sample_size = backend->sample_size ? backend->sample_size * 2 : 1024;
+                backend->samples = realloc(backend->samples, backend->sample_size * sizeof(struct sim_sample));
+                if (NULL == backend->samples) {
+                    fprintf(stderr, "No memory\n");
+                    exit(1);
+                }
+            }
+
+            backend->samples[backend->sample_num++] = (struct sim_sample){.t = ts, .failed = failed, .cost = cost};
+            if (has_get) {
+                continue;
+            }
+            ts = (ts >= (uint64_t)cost) ? ts - cost : 0;
+        } else {
+            continue;
+        }
+
+        if (sim.arrival_num == sim.arrival_size) {
+            sim.arrival_size = sim.arrival_size ? sim.arrival_size * 2 : 4096;
+            sim.arrivals = realloc(sim.arrivals, sim.arrival_size * sizeof(uint64_t));
+            if (NULL == sim.arrivals) {
+                fprintf(stderr, "No memory\n");
+                exit(1);
+            }
+        }
+        sim.arrivals[sim.arrival_num++] = ts;
+    }
+
+    fclose(fp);
+
+    if (!sim.arrival_num) {
+        fprintf(stderr, "no request in trace (%s)\n", path);
+        exit(1);
+    }
+
+    sim.replay   = TRUE;
+    sim.duration = sim.arrivals[sim.arrival_num - 1] + 1;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_sample(const void *a, const void *b)
+{
+    uint64_t x = ((const struct sim_sample *)a)->t;
+    uint64_t y = ((const struct sim_sample *)b)->t;
+    return (x > y) - (x < y);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* 策略参数类型 */
+enum sim_param_type {
+    SIM_PARAM_INT32,
+    SIM_PARAM_FLOAT,
+    SIM_PARAM_UINT16,
+    SIM_PARAM_UINT32,
+};
+
+/* 策略参数表 */
+struct sim_param_desc {
+    const char *key;
+    size_t      offset;
+    int32_t     type;
+};
+
+static const struct sim_param_desc param_descs[] = {
+    {"shaping_request_min",  offsetof(struct shm_servers, shaping_request_min),  SIM_PARAM_INT32},
+    {"success_ratio_base",   offsetof(struct shm_servers, success_ratio_base),   SIM_PARAM_FLOAT},
+    {"success_ratio_min",    offsetof(struct shm_servers, success_ratio_min),    SIM_PARAM_FLOAT},
+    {"resume_weight_ratio",  offsetof(struct shm_servers, resume_weight_ratio),  SIM_PARAM_FLOAT},
+    {"dead_retry_ratio",     offsetof(struct shm_servers, dead_retry_ratio),     SIM_PARAM_FLOAT},
+    {"weight_low_watermark", offsetof(struct shm_servers, weight_low_watermark), SIM_PARAM_FLOAT},
+    {"weight_low_ratio",     offsetof(struct shm_servers, weight_low_ratio),     SIM_PARAM_FLOAT},
+    {"weight_incr_ratio",    offsetof(struct shm_servers, weight_incr_ratio),    SIM_PARAM_FLOAT},
+    {"eject_consecutive",    offsetof(struct shm_servers, eject_consecutive),    SIM_PARAM_UINT16},
+    {"eject_burst",          offsetof(struct shm_servers, eject_burst),          SIM_PARAM_UINT16},
+    {"eject_burst_window",   offsetof(struct shm_servers, eject_burst_window),   SIM_PARAM_UINT16},
+    {"eject_base_time",      offsetof(struct shm_servers, eject_base_time),      SIM_PARAM_UINT16},
+    {"eject_max_time",       offsetof(struct shm_servers, eject_max_time),       SIM_PARAM_UINT32},
+    {"retry_budget_ratio",   offsetof(struct shm_servers, retry_budget_ratio),   SIM_PARAM_FLOAT},
+    {"retry_budget_min",     offsetof(struct shm_servers, retry_budget_min),     SIM_PARAM_UINT32},
+    {"retry_budget_max",     offsetof(struct shm_servers, retry_budget_max),     SIM_PARAM_UINT32},
+    {"conc_limit_min",       offsetof(struct shm_servers, conc_limit_min),       SIM_PARAM_UINT16},
+    {"conc_limit_max",       offsetof(struct shm_servers, conc_limit_max),       SIM_PARAM_UINT16},
+    {"conc_limit_init",      offsetof(struct shm_servers, conc_limit_init),      SIM_PARAM_UINT16},
+    {"conc_reroll_times",    offsetof(struct shm_servers, conc_reroll_times),    SIM_PARAM_UINT16},
+    {"conc_tolerance",       offsetof(struct shm_servers, conc_tolerance),       SIM_PARAM_FLOAT},
+    {"conc_smoothing",       offsetof(struct shm_servers, conc_smoothing),       SIM_PARAM_FLOAT},
+    {"slow_start_window",    offsetof(struct shm_servers, slow_start_window),    SIM_PARAM_UINT16},
+    {"slow_start_floor",     offsetof(struct shm_servers, slow_start_floor),     SIM_PARAM_FLOAT},
+    {"slow_start_aggression",offsetof(struct shm_servers, slow_start_aggression),SIM_PARAM_FLOAT},
+    {"drain_window",         offsetof(struct shm_servers, drain_window),         SIM_PARAM_UINT16},
+    {"policy",               offsetof(struct shm_servers, policy),               SIM_PARAM_INT32},
+};
+
+/* 参数类型对应的字节数 */
+static size_t param_size(int32_t type)
+{
+    return (type == SIM_PARAM_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+/**
+ * @brief 设置默认策略参数，同jsonparser默认值
+ */
+static void init_policy_param(struct shm_servers *param)
+{
+    param->shaping_request_min  = NLB_SHAPING_REQUEST_MIN;
+    param->success_ratio_base   = NLB_SUCCESS_RATIO_BASE;
+    param->success_ratio_min    = NLB_SUCCESS_RATIO_MIN;
+    param->resume_weight_ratio  = NLB_RESUME_WEIGHT_RATIO;
+    param->dead_retry_ratio     = NLB_DEAD_RETRY_RATIO;
+    param->weight_low_watermark = NLB_WEIGHT_LOW_WATERMARK;
+    param->weight_low_ratio     = NLB_WEIGHT_LOW_RATIO;
+    param->weight_incr_ratio    = NLB_WEIGHT_INCR_RATIO;
+    param->eject_consecutive    = NLB_EJECT_CONSECUTIVE;
+    param->eject_burst          = NLB_EJECT_BURST;
+    param->eject_burst_window   = NLB_EJECT_BURST_WINDOW;
+    param->eject_base_time      = NLB_EJECT_BASE_TIME;
+    param->eject_max_time       = NLB_EJECT_MAX_TIME;
+    param->retry_budget_ratio   = NLB_RETRY_BUDGET_RATIO;
+    param->retry_budget_min     = NLB_RETRY_BUDGET_MIN;
+    param->retry_budget_max     = NLB_RETRY_BUDGET_MAX;
+    param->conc_limit_min       = NLB_CONC_LIMIT_MIN;
+    param->conc_limit_max       = NLB_CONC_LIMIT_MAX;
+    param->conc_limit_init      = NLB_CONC_LIMIT_INIT;
+    param->conc_reroll_times    = NLB_CONC_REROLL_TIMES;
+    param->conc_tolerance       = NLB_CONC_TOLERANCE;
+    param->conc_smoothing       = NLB_CONC_SMOOTHING;
+    param->slow_start_window    = NLB_SLOW_START_WINDOW;
+    param->slow_start_floor     = NLB_SLOW_START_FLOOR;
+    param->slow_start_aggression= NLB_SLOW_START_AGGRESSION;
+    param->drain_window         = NLB_DRAIN_WINDOW;
+}
+
+/**
+ * @brief 解析策略参数 "name:key=value,key=value"
+ */
+static void parse_policy(const char *spec)
+{
+    char    buff[1024];
+    char   *pos, *item, *field, *save = NULL;
+    size_t  i, count = sizeof(param_descs) / sizeof(param_descs[0]);
+    struct sim_policy *policy;
+
+    if (sim.policy_num >= SIM_POLICY_MAX) {
+        fprintf(stderr, "too many policies, max %d\n", SIM_POLICY_MAX);
+        exit(1);
+    }
+
+    policy = &sim.policies[sim.policy_num++];
+    memset(policy, 0, sizeof(*policy));
+    init_policy_param(&policy->param);
+
+    snprintf(buff, sizeof(buff), "%s", spec);
+    pos = strchr(buff, ':');
+    if (pos) {
+        *pos++ = '\0';
+    }
+    snprintf(policy->name, sizeof(policy->name), "%.*s", (int)sizeof(policy->name) - 1, buff);
+
+    for (item = pos ? strtok_r(pos, ",", &save) : NULL; item; item = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(item, '=');
+        if (NULL == value) {
+            fprintf(stderr, "invalid policy parameter (%s)\n", item);
+            exit(1);
+        }
+        *value++ = '\0';
+
+        for (i = 0; i < count; i++) {
+            if (!strcmp(item, param_descs[i].key)) {
+                break;
+            }
+        }
+
+        if (i == count) {
+            fprintf(stderr, "unknown policy parameter (%s)\n", item);
+            exit(1);
+        }
+
+        field = (char *)&policy->param + param_descs[i].offset;
+        switch (param_descs[i].type) {
+            case SIM_PARAM_FLOAT:
+                *(float *)field = (float)atof(value);
+                break;
+            case SIM_PARAM_UINT16:
+                *(uint16_t *)field = (uint16_t)strtoul(value, NULL, 10);
+                break;
+            case SIM_PARAM_UINT32:
+                *(uint32_t *)field = (uint32_t)strtoul(value, NULL, 10);
+                break;
+            default:
+                *(int32_t *)field = atoi(value);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief 拷贝业务参数
+ */
+static void apply_policy_param(struct shm_servers *dst, const struct shm_servers *param)
+{
+    size_t i, count = sizeof(param_descs) / sizeof(param_descs[0]);
+
+    for (i = 0; i < count; i++) {
+        memcpy((char *)dst + param_descs[i].offset, (const char *)param + param_descs[i].offset,
+               param_size(param_descs[i].type));
+    }
+}
+
+/* 待完成请求小顶堆: 入堆 */
+static void pending_push(const struct sim_pending *item)
+{
+    uint64_t pos, parent;
+
+    if (pending_num == pending_size) {
+        pending_size = pending_size ? pending_size * 2 : 4096;
+        pendings = realloc(pendings, pending_size * sizeof(struct sim_pending));
+        if (NULL == pendings) {
+            fprintf(stderr, "No memory\n");
+            exit(1);
+        }
+    }
+
+    pos = pending_num++;
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (pendings[parent].t <= item->t) {
+            break;
+        }
+        pendings[pos] = pendings[parent];
+        pos = parent;
+    }
+    pendings[pos] = *item;
+}
+
+/* 待完成请求小顶堆: 出堆 */
+static void pending_pop(struct sim_pending *item)
+{
+    uint64_t pos = 0, child;
+    struct sim_pending last;
+
+    *item = pendings[0];
+    last  = pendings[--pending_num];
+
+    while ((child = pos * 2 + 1) < pending_num) {
+        if (child + 1 < pending_num && pendings[child + 1].t < pendings[child].t) {
+            child++;
+        }
+        if (last.t <= pendings[child].t) {
+            break;
+        }
+        pendings[pos] = pendings[child];
+        pos = child;
+    }
+    pendings[pos] = last;
+}
+
+/**
+ * @brief 记录后端负载，返回最近1秒的qps
+ * @param count 本次记录的请求数，为0时只统计
+ */
+static double backend_load(struct sim_backend *backend, uint64_t now, uint32_t count)
+{
+    uint64_t slot = now / 100;
+    uint32_t i, total = 0;
+
+    if (slot != backend->load_slot_time) {
+        if (slot - backend->load_slot_time >= SIM_LOAD_SLOTS) {
+            memset(backend->load_slots, 0, sizeof(backend->load_slots));
+        } else {
+            for (i = backend->load_slot_time + 1; i <= slot; i++) {
+                backend->load_slots[i % SIM_LOAD_SLOTS] = 0;
+            }
+        }
+        backend->load_slot_time = slot;
+    }
+
+    backend->load_slots[slot % SIM_LOAD_SLOTS] += count;
+
+    for (i = 0; i < SIM_LOAD_SLOTS; i++) {
+        total += backend->load_slots[i];
+    }
+
+    return (double)total;
+}
+
+/**
+ * @brief 回放模式: 从轨迹中取后端在该时刻附近的一次调用结果
+ */
+static void replay_outcome(struct sim_backend *backend, uint64_t now, int32_t *failed, int32_t *cost)
+{
+    uint32_t low = 0, high, lo, hi;
+
+    if (!backend->sample_num) {
+        *failed = 1;
+        *cost   = sim.timeout;
+        return;
+    }
+
+    /* 二分查找第一个不早于窗口起点的记录 */
+    high = backend->sample_num;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (backend->samples[mid].t + SIM_TRACE_WINDOW < now) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    lo = low;
+
+    hi = lo;
+    while (hi < backend->sample_num && backend->samples[hi].t <= now + SIM_TRACE_WINDOW) {
+        hi++;
+    }
+
+    /* 窗口内没有记录，使用最近的一条 */
+    if (lo == hi) {
+        lo = (lo == backend->sample_num) ? lo - 1 : lo;
+        hi = lo + 1;
+    }
+
+    lo += (uint32_t)(sim_rand() % (hi - lo));
+    *failed = backend->samples[lo].failed;
+    *cost   = backend->samples[lo].cost;
+}
+
+/**
+ * @brief 模型模式: 计算后端在该时刻的一次调用结果
+ */
+static void model_outcome(int32_t idx, uint64_t now, int32_t *failed, int32_t *cost)
+{
+    int32_t  i;
+    double   err, lat, cap, load, util;
+    struct sim_backend *backend = &sim.backends[idx];
+    struct sim_fault   *fault;
+
+    err = backend->err_ratio;
+    lat = sim_lognormal(backend->lat_mean, backend->lat_sigma);
+    cap = backend->capacity;
+
+    for (i = 0; i < sim.fault_num; i++) {
+        fault = &sim.faults[i];
+        if (fault->backend != idx || now < fault->start) {
+            continue;
+        }
+
+        /* 重启预热期间，容量从10%线性恢复 */
+        if (fault->type == SIM_FAULT_RESTART && now >= fault->end && now < fault->end + fault->warm && cap > 0) {
+            cap *= 0.1 + 0.9 * (double)(now - fault->end) / fault->warm;
+            continue;
+        }
+
+        if (now >= fault->end) {
+            continue;
+        }
+
+        switch (fault->type) {
+            case SIM_FAULT_BROWNOUT:
+                err = err + (1.0 - err) * fault->err;
+                lat = lat * fault->lat_mul;
+                break;
+            case SIM_FAULT_FLAP:
+                if (((now - fault->start) % fault->period) >= fault->period / 2) {
+                    break;
+                }
+                /* fall through */
+            case SIM_FAULT_DRAIN:
+                if (now < fault->start + fault->kill) {
+                    break;
+                }
+                /* fall through */
+            case SIM_FAULT_DOWN:
+            case SIM_FAULT_RESTART:
+                *failed = 1;
+                *cost   = sim.timeout;
+                return;
+            default:
+                break;
+        }
+    }
+
+    /* 容量模型: 接近容量时排队时延上升，超出容量的请求超时失败 */
+    load = backend_load(backend, now, 1);
+    if (cap > 0) {
+        util = load / cap;
+        if (util >= 1.0) {
+            if (sim_uniform() < 1.0 - 1.0 / util) {
+                *failed = 1;
+                *cost   = sim.timeout;
+                return;
+            }
+            lat *= 10.0;
+        } else {
+            lat *= min(1.0 / (1.0 - util), 10.0);
+        }
+    }
+
+    *failed = (sim_uniform() < err) ? 1 : 0;
+    *cost   = (int32_t)min(lat, (double)sim.timeout);
+}
+
+/**
+ * @brief 初始化业务路由数据，同agent新增业务的处理
+ */
+static void init_route_data(struct api_routedata *rdata, const struct sim_policy *policy)
+{
+    int32_t  i;
+    uint32_t base = 0;
+    size_t   len = sizeof(struct shm_servers) + sizeof(struct server_info) * sim.backend_num;
+    struct shm_servers *servers;
+    struct server_info *server;
+
+    memset(rdata, 0, sizeof(*rdata));
+    snprintf(rdata->name, sizeof(rdata->name), "sim.%s", policy->name);
+    rdata->route_meta      = calloc(1, sizeof(struct shm_meta));
+    rdata->servers_data[0] = calloc(1, len);
+    rdata->servers_data[1] = calloc(1, len);
+    if (!rdata->route_meta || !rdata->servers_data[0] || !rdata->servers_data[1]) {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+
+    servers = rdata->servers_data[0];
+    apply_policy_param(servers, &policy->param);
+    servers->version    = NLB_SHM_VERSION1;
+    servers->server_num = sim.backend_num;
+
+    for (i = 0; i < sim.backend_num; i++) {
+        server = servers->svrs + i;
+        server->server_ip      = sim.backends[i].ip;
+        server->weight_static  = sim.backends[i].weight;
+        server->weight_dynamic = server->weight_static;
+        server->weight_base    = base;
+        server->port_type      = NLB_PORT_TYPE_TCP;
+        server->port_num       = 1;
+        server->port[0]        = 80;
+        base += server->weight_dynamic;
+        servers->weight_static_total += server->weight_static;
+    }
+
+    servers->weight_total     = base;
+    servers->weight_dead_base = base;
+    calc_servers_hash(servers);
+    memcpy(rdata->servers_data[1], servers, len);
+    snprintf(rdata->route_meta->name, sizeof(rdata->route_meta->name), "%s", rdata->name);
+}
+
+/**
+ * @brief 排空服务器的权重上限，同agent按排空节点计算
+ */
+static uint32_t sim_drain_cap(const struct shm_servers *servers, const struct server_info *server)
+{
+    int32_t  i;
+    uint64_t elapsed, window = (uint64_t)servers->drain_window * 1000;
+    struct sim_fault *fault;
+
+    for (i = 0; i < sim.fault_num; i++) {
+        fault = &sim_run_faults[i];
+        if (!fault->draining || sim.backends[fault->backend].ip != server->server_ip) {
+            continue;
+        }
+
+        elapsed = sim_now_us / 1000 - fault->start;
+        return (elapsed >= window) ? 0 : (uint32_t)(1000 - elapsed * 1000 / window);
+    }
+
+    return 1000;
+}
+
+/**
+ * @brief 模拟agent的服务器权重上限，取排空进度和负载权重上限的较小值
+ */
+static uint32_t sim_weight_cap(const struct shm_servers *servers, const struct server_info *server)
+{
+    return min(sim_drain_cap(servers, server), loadaware_weight_cap(servers, server));
+}
+
+/**
+ * @brief 模拟服务端agent的负载上报，CPU使用率按最近1秒qps占容量的比例计算
+ * @info  只有模型模式且设置了容量的后端上报负载
+ */
+static void agent_loadreport(uint64_t now)
+{
+    int32_t  i;
+    uint32_t cpu;
+    struct sim_backend *backend;
+
+    if (sim.replay) {
+        return;
+    }
+
+    for (i = 0; i < sim.backend_num; i++) {
+        backend = &sim.backends[i];
+        if (backend->capacity <= 0) {
+            continue;
+        }
+
+        cpu = (uint32_t)min(backend_load(backend, now, 0) * 100 / backend->capacity, 100.0);
+        loadaware_update(backend->ip, cpu, 0, 0, NULL, 0);
+    }
+}
+
+/**
+ * @brief 模拟agent的排空节点监视，同agent定时降低排空服务器的权重
+ * @info  排空结束后的撤销排空事件在下次调整时处理
+ */
+static void agent_drain(struct api_routedata *rdata, uint64_t now)
+{
+    int32_t  i;
+    BOOL     draining = FALSE;
+    struct shm_meta    *meta = rdata->route_meta;
+    struct shm_servers *cur  = rdata->servers_data[meta->index];
+    size_t len = sizeof(struct shm_servers) + sizeof(struct server_info) * cur->server_num;
+    struct shm_servers *servers;
+
+    for (i = 0; i < sim.fault_num; i++) {
+        if (sim_run_faults[i].type == SIM_FAULT_DRAIN && now >= sim_run_faults[i].start
+            && now < sim_run_faults[i].end) {
+            sim_run_faults[i].draining = TRUE;
+            draining = TRUE;
+        }
+    }
+
+    if (!draining || !check_servers_capped(cur)) {
+        return;
+    }
+
+    servers = malloc(len);
+    if (NULL == servers) {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+
+    memcpy(servers, cur, len);
+    reweight_servers(meta, rdata->servers_data, servers);
+    free(servers);
+}
+
+/**
+ * @brief 模拟一次agent调整，同agent定时更新业务配置的处理
+ */
+static void agent_reshape(struct api_routedata *rdata)
+{
+    int32_t i;
+    struct sim_fault   *fault;
+    struct server_info *server;
+    struct shm_meta    *meta = rdata->route_meta;
+    struct shm_servers *cur  = rdata->servers_data[meta->index];
+    size_t len = sizeof(struct shm_servers) + sizeof(struct server_info) * cur->server_num;
+    struct shm_servers *servers = calloc(1, len);
+
+    if (NULL == servers) {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+
+    copy_servers(servers, cur, servers->shaping_request_min);
+
+    /* 排空结束，处理撤销排空事件，查找服务器需要先计算hash */
+    calc_servers_hash(servers);
+    for (i = 0; i < sim.fault_num; i++) {
+        fault = &sim_run_faults[i];
+        if (fault->draining && sim_now_us / 1000 >= fault->end) {
+            fault->draining = FALSE;
+            server = get_server_by_ip(servers, sim.backends[fault->backend].ip);
+            if (server) {
+                undrain_server(servers, server);
+            }
+        }
+    }
+
+    reshape_servers(meta, rdata->servers_data, servers);
+    free(servers);
+}
+
+/**
+ * @brief 检查故障后端的摘除和恢复状态
+ */
+static void check_faults(struct api_routedata *rdata, struct sim_fault *faults, uint64_t now)
+{
+    int32_t i;
+    struct shm_servers *servers = rdata->servers_data[rdata->route_meta->index];
+    struct server_info *server;
+    struct sim_fault   *fault;
+
+    for (i = 0; i < sim.fault_num; i++) {
+        fault  = &faults[i];
+        server = get_server_by_ip(servers, sim.backends[fault->backend].ip);
+        if (NULL == server || now < fault->start) {
+            continue;
+        }
+
+        if (fault->eject_time < 0 && now < fault->end
+            && (server->dead_time || server->weight_dynamic <= server->weight_static * SIM_EJECT_RATIO)) {
+            fault->eject_time = now - fault->start;
+        }
+
+        if (fault->recover_time < 0 && now >= fault->end
+            && !server->dead_time && server->weight_dynamic >= server->weight_static * SIM_RECOVER_RATIO) {
+            fault->recover_time = now - fault->end;
+        }
+    }
+}
+
+/**
+ * @brief 记录请求结果
+ */
+static void record_result(struct sim_result *result, int32_t failed, int32_t cost)
+{
+    result->requests++;
+    if (failed) {
+        result->errors++;
+    }
+
+    if (result->lat_num == result->lat_size) {
+        result->lat_size = result->lat_size ? result->lat_size * 2 : 65536;
+        result->lats = realloc(result->lats, result->lat_size * sizeof(uint32_t));
+        if (NULL == result->lats) {
+            fprintf(stderr, "No memory\n");
+            exit(1);
+        }
+    }
+    result->lats[result->lat_num++] = (uint32_t)max(cost, 0);
+}
+
+/**
+ * @brief 寻址并发出一次请求，重试时排除上次失败的服务器
+ */
+static void issue_request(struct api_routedata *rdata, struct sim_result *result, uint64_t now,
+                          uint64_t start, int32_t attempt, uint32_t exclude)
+{
+    int32_t idx, ret, failed, cost;
+    struct routeid route;
+    struct sim_pending item;
+
+    /* 真实寻址 */
+    if (attempt) {
+        ret = search_route_exclude(rdata, &exclude, 1, &route);
+    } else {
+        ret = search_route(rdata, &route);
+    }
+
+    idx = (ret < 0) ? -1 : find_backend(route.ip);
+    if (idx < 0) {
+        record_result(result, 1, (int32_t)((now - start) / 1000));
+        return;
+    }
+
+    if (sim.replay) {
+        replay_outcome(&sim.backends[idx], now / 1000, &failed, &cost);
+    } else {
+        model_outcome(idx, now / 1000, &failed, &cost);
+    }
+
+    result->attempts++;
+
+    item.t       = now + (uint64_t)max(cost, 0) * 1000;
+    item.start   = start;
+    item.ip      = route.ip;
+    item.failed  = failed;
+    item.cost    = cost;
+    item.attempt = attempt;
+    pending_push(&item);
+}
+
+/**
+ * @brief 按时间顺序完成所有不晚于now的请求，上报统计
+ * @info  失败的请求在预算允许时立即重试，最终结果才计入时延和错误率
+ */
+static void complete_pendings(struct api_routedata *rdata, struct sim_result *result, uint64_t now_us)
+{
+    struct sim_pending item;
+
+    while (pending_num && pendings[0].t <= now_us) {
+        pending_pop(&item);
+        sim_now_us = item.t;
+        update_route_stat(rdata, item.ip, item.failed, item.cost);
+
+        if (item.failed && item.attempt < sim.retries && item.t < sim.duration * 1000) {
+            if (!acquire_route_retry(rdata)) {
+                issue_request(rdata, result, item.t, item.start, item.attempt + 1, item.ip);
+                continue;
+            }
+            result->denied++;
+        }
+
+        record_result(result, item.failed, (int32_t)((item.t - item.start) / 1000));
+    }
+}
+
+/**
+ * @brief 运行单个策略
+ */
+static void run_policy(const struct sim_policy *policy, struct sim_fault *faults, struct sim_result *result)
+{
+    int32_t  idx;
+    uint64_t n, now, next_arrival, next_reshape, next_drain, next_report;
+    struct api_routedata rdata;
+
+    rng_state   = sim.seed * 0x9E3779B97F4A7C15ULL + 1;
+    pending_num = 0;
+    sim_now_us  = 0;
+    memset(result, 0, sizeof(*result));
+    memcpy(faults, sim.faults, sizeof(struct sim_fault) * sim.fault_num);
+    for (idx = 0; idx < sim.fault_num; idx++) {
+        faults[idx].eject_time   = -1;
+        faults[idx].recover_time = -1;
+        faults[idx].draining     = FALSE;
+    }
+    sim_run_faults = faults;
+    set_weight_cap_handler(sim_weight_cap, loadaware_prepare);
+    loadaware_init();
+    for (idx = 0; idx < sim.backend_num; idx++) {
+        memset(sim.backends[idx].load_slots, 0, sizeof(sim.backends[idx].load_slots));
+        sim.backends[idx].load_slot_time = 0;
+    }
+
+    init_route_data(&rdata, policy);
+
+    next_reshape = sim.interval;
+    next_drain   = NLB_DRAIN_TICK;
+    next_report  = SIM_LOAD_REPORT;
+    next_arrival = 0;
+    for (n = 0; ; n++) {
+        /* 下一个请求到达时间 */
+        if (sim.replay) {
+            if (n >= sim.arrival_num) {
+                break;
+            }
+            now = sim.arrivals[n] * 1000;
+        } else {
+            now = next_arrival;
+            next_arrival += (uint64_t)(-log(1.0 - sim_uniform()) * 1000000.0 / sim.qps);
+        }
+
+        if (now >= sim.duration * 1000) {
+            break;
+        }
+
+        /* agent定时调整，调整前先完成已经结束的请求 */
+        while (next_reshape * 1000 <= now) {
+            complete_pendings(&rdata, result, next_reshape * 1000);
+            sim_now_us = next_reshape * 1000;
+            agent_reshape(&rdata);
+            check_faults(&rdata, faults, next_reshape);
+            next_reshape += sim.interval;
+        }
+
+        while (next_drain * 1000 <= now) {
+            complete_pendings(&rdata, result, next_drain * 1000);
+            sim_now_us = next_drain * 1000;
+            agent_drain(&rdata, next_drain);
+            next_drain += NLB_DRAIN_TICK;
+        }
+
+        while (next_report * 1000 <= now) {
+            sim_now_us = next_report * 1000;
+            agent_loadreport(next_report);
+            next_report += SIM_LOAD_REPORT;
+        }
+
+        complete_pendings(&rdata, result, now);
+        sim_now_us = now;
+        issue_request(&rdata, result, now, now, 0, 0);
+    }
+
+    /* 完成剩余请求，模拟结束后不再重试 */
+    complete_pendings(&rdata, result, UINT64_MAX);
+
+    free(rdata.route_meta);
+    free(rdata.servers_data[0]);
+    free(rdata.servers_data[1]);
+}
+
+/* 计算分位数 */
+static uint32_t percentile(struct sim_result *result, double p)
+{
+    uint64_t idx;
+
+    if (!result->lat_num) {
+        return 0;
+    }
+
+    idx = (uint64_t)(p * (result->lat_num - 1));
+    return result->lats[idx];
+}
+
+static const char *fault_type_str(int32_t type)
+{
+    switch (type) {
+        case SIM_FAULT_BROWNOUT: return "brownout";
+        case SIM_FAULT_DOWN:     return "down";
+        case SIM_FAULT_FLAP:     return "flap";
+        case SIM_FAULT_RESTART:  return "restart";
+        case SIM_FAULT_DRAIN:    return "drain";
+        default:                 return "unkown";
+    }
+}
+
+/**
+ * @brief 输出单个策略的结果
+ */
+static void print_result(const struct sim_policy *policy, struct sim_result *result, struct sim_fault *faults)
+{
+    int32_t i;
+    char    ip[INET_ADDRSTRLEN];
+
+    qsort(result->lats, result->lat_num, sizeof(uint32_t), compare_u32);
+
+    printf("%-16s %10lu %8.3f%% %8u %8u %8u %8u %6.3f %8lu\n", policy->name, result->requests,
+           result->requests ? 100.0 * result->errors / result->requests : 0.0,
+           percentile(result, 0.5), percentile(result, 0.9),
+           percentile(result, 0.99), percentile(result, 0.999),
+           result->requests ? (double)result->attempts / result->requests : 0.0, result->denied);
+
+    for (i = 0; i < sim.fault_num; i++) {
+        inet_ntop(AF_INET, &sim.backends[faults[i].backend].ip, ip, sizeof(ip));
+        printf("    %-8s %-15s [%6lus, %6lus)  eject: ", fault_type_str(faults[i].type), ip,
+               faults[i].start / 1000, faults[i].end / 1000);
+        if (faults[i].eject_time >= 0) {
+            printf("%7ldms", faults[i].eject_time);
+        } else {
+            printf("%9s", "-");
+        }
+        printf("  recover: ");
+        if (faults[i].recover_time >= 0) {
+            printf("%7ldms\n", faults[i].recover_time);
+        } else {
+            printf("%9s\n", "-");
+        }
+    }
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a load balancing policy simulator for nlb.\n");
+    printf(" Usage:  %s [OPTION]\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -s scenario     Backend model scenario file, default built-in scenario\n");
+    printf("        -t trace        Replay recorded getroute/updateroute trace file\n");
+    printf("        -p policy       Policy \"name:key=value,...\", repeatable, default \"default\"\n");
+    printf("        -d seconds      Simulation duration, default 300\n");
+    printf("        -q qps          Request rate, default 1000\n");
+    printf("        -i ms           Agent reshape interval, default 5000\n");
+    printf("        -T ms           Request timeout, default 1000\n");
+    printf("        -r retries      Max retries of a failed request, limited by retry budget, default 0\n");
+    printf("        -S seed         Random seed, default 1\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t  c, i;
+    const char *scenario = NULL;
+    const char *trace    = NULL;
+    struct sim_result result;
+    struct sim_fault  faults[SIM_FAULT_MAX];
+
+    sim.duration = 300000;
+    sim.interval = 5000;
+    sim.timeout  = 1000;
+    sim.qps      = 1000;
+    sim.seed     = 1;
+
+    while ((c = getopt(argc, argv, "hs:t:p:d:q:i:T:r:S:")) != -1) {
+        switch (c) {
+            case 's': scenario = optarg; break;
+            case 't': trace = optarg; break;
+            case 'p': parse_policy(optarg); break;
+            case 'd': sim.duration = (uint64_t)(atof(optarg) * 1000); break;
+            case 'q': sim.qps = atof(optarg); break;
+            case 'i': sim.interval = (uint64_t)atoll(optarg); break;
+            case 'T': sim.timeout = (uint32_t)atoi(optarg); break;
+            case 'r': sim.retries = atoi(optarg); break;
+            case 'S': sim.seed = (uint64_t)atoll(optarg); break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (sim.qps <= 0 || !sim.interval || !sim.duration) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    if (scenario) {
+        load_scenario(scenario);
+    }
+
+    if (trace) {
+        load_trace(trace);
+        qsort(sim.arrivals, sim.arrival_num, sizeof(uint64_t), compare_u64);
+        for (i = 0; i < sim.backend_num; i++) {
+            qsort(sim.backends[i].samples, sim.backends[i].sample_num, sizeof(struct sim_sample), compare_sample);
+        }
+    } else if (!scenario) {
+        load_default_scenario();
+    }
+
+    if (!sim.backend_num) {
+        fprintf(stderr, "no backend\n");
+        exit(1);
+    }
+
+    if (!sim.policy_num) {
+        parse_policy("default");
+    }
+
+    printf("backends: %d  duration: %lus  reshape interval: %lums  mode: %s\n\n",
+           sim.backend_num, sim.duration / 1000, sim.interval, sim.replay ? "replay" : "model");
+    printf("%-16s %10s %9s %8s %8s %8s %8s %6s %8s\n", "policy", "requests", "errors", "p50", "p90", "p99", "p999",
+           "amp", "denied");
+
+    for (i = 0; i < sim.policy_num; i++) {
+        run_policy(&sim.policies[i], faults, &result);
+        print_result(&sim.policies[i], &result, faults);
+        free(result.lats);
+    }
+
+    return 0;
+}
@@ -0,0 +1,535 @@
+
+/**
+ * Tencent is pleased to support the open source community by making MSEC available.
+ *
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ *
+ * Licensed under the GNU General Public License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may
+ * obtain a copy of the License at
+ *
+ *     https://opensource.org/licenses/GPL-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under the
+ * License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific language governing permissions
+ * and limitations under the License.
+ */
+
+
+/**
+ * @filename nlbtop.c
+ * @info     路由数据实时查看工具
+ *           只读映射 /var/nlb/naming 下的meta和servers文件，和API访问方式一致。
+ *           两次采样之间对比每台服务器的success/failed/cost计数，计算QPS、错误率、平均时延，
+ *           并对比按权重计算的选择占比和实际流量占比
+ */
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "commdef.h"
+#include "commtype.h"
+#include "commstruct.h"
+#include "nlbfile.h"
+#include "nlbtime.h"
+#include "utils.h"
+
+#define TOP_SERVICE_MAX     1024        /* 最多查看的业务数 */
+
+/* 排序字段 */
+enum {
+    TOP_SORT_IP     = 0,
+    TOP_SORT_QPS    = 1,
+    TOP_SORT_ERR    = 2,
+    TOP_SORT_LAT    = 3,
+    TOP_SORT_WEIGHT = 4,
+    TOP_SORT_SHARE  = 5,
+};
+
+/* 服务器计数快照 */
+struct top_counter {
+    uint32_t ip;
+    uint32_t success;
+    uint32_t failed;
+    uint64_t cost;
+};
+
+/* 服务器采样结果 */
+struct top_row {
+    struct server_info *server;
+    double   qps;
+    double   err;                       /* 错误率，百分比 */
+    double   lat;                       /* 平均时延，毫秒 */
+    double   wshare;                    /* 按权重计算的选择占比，百分比 */
+    double   share;                     /* 实际流量占比，百分比 */
+    BOOL     dead;
+    BOOL     low;
+};
+
+/* 已加载的业务 */
+struct top_service {
+    char     name[NLB_SERVICE_NAME_LEN];
+    struct shm_meta    *meta;
+    struct shm_servers *servers[2];
+    uint32_t meta_len;
+    uint32_t servers_len[2];
+
+    struct top_counter *prev;           /* 上次采样计数，按IP排序 */
+    uint32_t prev_num;
+    uint32_t prev_index;                /* 上次采样的数据下标 */
+    uint64_t prev_time;                 /* 上次采样时间，毫秒 */
+
+    struct top_row *rows;
+    uint32_t row_num;
+    double   qps;
+};
+
+static struct top_service services[TOP_SERVICE_MAX];
+static int32_t service_num;
+static uint32_t service_skipped;        /* 超出上限未加载的业务数 */
+static const char *filter;
+static int32_t sort_key = TOP_SORT_QPS;
+
+/**
+ * @brief 加载业务路由数据，已加载返回0
+ */
+static int32_t attach_service(const char *name)
+{
+    int32_t i;
+    struct top_service *service;
+
+    for (i = 0; i < service_num; i++) {
+        if (!strcmp(services[i].name, name)) {
+            return 0;
+        }
+    }
+
+    if (service_num >= TOP_SERVICE_MAX) {
+        return -1;
+    }
+
+    service = &services[service_num];
+    memset(service, 0, sizeof(*service));
+    snprintf(service->name, sizeof(service->name), "%s", name);
+
+    service->meta       = attach_meta_data(name, &service->meta_len);
+    service->servers[0] = attach_server_data(name, 0, &service->servers_len[0]);
+    service->servers[1] = attach_server_data(name, 1, &service->servers_len[1]);
+    if (!service->meta || !service->servers[0] || !service->servers[1]) {
+        if (service->meta) {
+            munmap(service->meta, service->meta_len);
+        }
+        for (i = 0; i < 2; i++) {
+            if (service->servers[i]) {
+                munmap(service->servers[i], service->servers_len[i]);
+            }
+        }
+        return -2;
+    }
+
+    service_num++;
+    return 0;
+}
+
+/**
+ * @brief 扫描路由数据目录，加载新出现的业务
+ * @info  目录结构为 /var/nlb/naming/<一级名>/<二级名>/meta.dat
+ */
+static void scan_services(void)
+{
+    DIR  *dir1, *dir2;
+    struct dirent *ent1, *ent2;
+    char  path[NLB_PATH_MAX_LEN];
+    char  name[NLB_SERVICE_NAME_LEN];
+
+    service_skipped = 0;
+
+    dir1 = opendir(NLB_NAME_BASE_PATH);
+    if (NULL == dir1) {
+        return;
+    }
+
+    while ((ent1 = readdir(dir1)) != NULL) {
+        if (ent1->d_name[0] == '.') {
+            continue;
+        }
+
+        if (snprintf(path, sizeof(path), "%s/%s", NLB_NAME_BASE_PATH, ent1->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+
+        dir2 = opendir(path);
+        if (NULL == dir2) {
+            continue;
+        }
+
+        while ((ent2 = readdir(dir2)) != NULL) {
+            if (ent2->d_name[0] == '.') {
+                continue;
+            }
+
+            if (snprintf(name, sizeof(name), "%s.%s", ent1->d_name, ent2->d_name) >= (int)sizeof(name)) {
+                continue;
+            }
+
+            if (filter && NULL == strstr(name, filter)) {
+                continue;
+            }
+
+            if (attach_service(name) == -1) {
+                service_skipped++;
+            }
+        }
+
+        closedir(dir2);
+    }
+
+    closedir(dir1);
+}
+
+static int compare_counter(const void *a, const void *b)
+{
+    uint32_t x = ((const struct top_counter *)a)->ip;
+    uint32_t y = ((const struct top_counter *)b)->ip;
+    return (x > y) - (x < y);
+}
+
+static int compare_row(const void *a, const void *b)
+{
+    const struct top_row *x = a;
+    const struct top_row *y = b;
+    double dx, dy;
+
+    switch (sort_key) {
+        case TOP_SORT_QPS:    dx = x->qps;   dy = y->qps;   break;
+        case TOP_SORT_ERR:    dx = x->err;   dy = y->err;   break;
+        case TOP_SORT_LAT:    dx = x->lat;   dy = y->lat;   break;
+        case TOP_SORT_SHARE:  dx = x->share; dy = y->share; break;
+        case TOP_SORT_WEIGHT:
+            dx = x->server->weight_dynamic;
+            dy = y->server->weight_dynamic;
+            break;
+        default:
+            dx = ntohl(y->server->server_ip);
+            dy = ntohl(x->server->server_ip);
+            break;
+    }
+
+    return (dx < dy) - (dx > dy);
+}
+
+/**
+ * @brief 计算按权重的选择占比
+ * @info  1. 存活机器按动态权重占比分配，死机区域的流量在有重试配额时随机分给死机机器
+ *        2. 成功率低于最小值的机器，流量重新随机分配给所有机器
+ *        只反映共享内存中的权重和死机状态，API进程内按调用情况做的调整不计算在内，
+ *        实际选择以流量占比为准
+ */
+static void calc_weight_share(struct shm_servers *servers, struct top_row *rows)
+{
+    uint32_t i;
+    uint32_t server_num = servers->server_num;
+    uint32_t dead_num   = servers->dead_num;
+    double   dead_share = 0.0, reroll = 0.0;
+    struct server_info *server;
+
+    if (!server_num) {
+        return;
+    }
+
+    if (dead_num == server_num || !servers->weight_dead_base || !servers->weight_total) {
+        for (i = 0; i < server_num; i++) {
+            rows[i].wshare = 1.0 / server_num;
+        }
+        goto REROLL;
+    }
+
+    if (dead_num && servers->dead_retry_times) {
+        dead_share = (double)(servers->weight_total - servers->weight_dead_base) / servers->weight_total;
+    }
+
+    for (i = 0; i < server_num; i++) {
+        server = rows[i].server;
+        if (rows[i].dead) {
+            rows[i].wshare = dead_share / dead_num;
+        } else {
+            rows[i].wshare = (1.0 - dead_share) * server->weight_dynamic / servers->weight_dead_base;
+        }
+    }
+
+REROLL:
+    for (i = 0; i < server_num; i++) {
+        server = rows[i].server;
+        if (server->failed + server->success >= (uint32_t)servers->shaping_request_min
+            && (float)server->success / (server->failed + server->success) < servers->success_ratio_min) {
+            reroll += rows[i].wshare;
+            rows[i].wshare = 0.0;
+        }
+    }
+
+    for (i = 0; i < server_num; i++) {
+        rows[i].wshare = (rows[i].wshare + reroll / server_num) * 100.0;
+    }
+}
+
+/**
+ * @brief 采样一个业务
+ * @info  agent每个调整周期会把计数清零，计数变小或者数据下标切换时，当前计数即为周期内增量
+ */
+static void sample_service(struct top_service *service)
+{
+    uint32_t i, total, success, failed;
+    uint32_t index = service->meta->index;
+    uint64_t now = get_time_ms();
+    uint64_t cost, requests = 0;
+    double   seconds;
+    struct shm_servers *servers = service->servers[index % 2];
+    struct server_info *server;
+    struct top_counter *prev, key;
+    struct top_counter *cur;
+
+    seconds = service->prev_time ? (now - service->prev_time) / 1000.0 : 0.0;
+    if (seconds <= 0.0) {
+        seconds = 1.0;
+    }
+
+    total = min(servers->server_num, (uint32_t)NLB_SERVER_MAX);
+    service->rows = realloc(service->rows, sizeof(struct top_row) * (total ? total : 1));
+    cur = calloc(total ? total : 1, sizeof(struct top_counter));
+    if (NULL == service->rows || NULL == cur) {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+
+    service->row_num = total;
+    service->qps     = 0.0;
+
+    for (i = 0; i < total; i++) {
+        server  = &servers->svrs[i];
+        success = server->success;
+        failed  = server->failed;
+        cost    = server->cost;
+
+        cur[i].ip      = server->server_ip;
+        cur[i].success = success;
+        cur[i].failed  = failed;
+        cur[i].cost    = cost;
+
+        key.ip = server->server_ip;
+        prev = service->prev ? bsearch(&key, service->prev, service->prev_num, sizeof(key), compare_counter) : NULL;
+        if (prev && index == service->prev_index && success >= prev->success && failed >= prev->failed) {
+            success -= prev->success;
+            failed  -= prev->failed;
+            cost    -= prev->cost;
+        }
+
+        memset(&service->rows[i], 0, sizeof(struct top_row));
+        service->rows[i].server = server;
+        service->rows[i].qps    = (success + failed) / seconds;
+        service->rows[i].err    = (success + failed) ? 100.0 * failed / (success + failed) : 0.0;
+        service->rows[i].lat    = (success + failed) ? (double)cost / (success + failed) : 0.0;
+        service->rows[i].dead   = server->dead_time ? TRUE : FALSE;
+        service->rows[i].low    = (server->weight_dynamic < server->weight_static * servers->weight_low_watermark);
+        service->rows[i].share  = success + failed;
+
+        requests += success + failed;
+    }
+
+    for (i = 0; i < total; i++) {
+        service->rows[i].share = requests ? 100.0 * service->rows[i].share / requests : 0.0;
+        service->qps += service->rows[i].qps;
+    }
+
+    calc_weight_share(servers, service->rows);
+
+    qsort(cur, total, sizeof(struct top_counter), compare_counter);
+    free(service->prev);
+    service->prev       = cur;
+    service->prev_num   = total;
+    service->prev_index = index;
+    service->prev_time  = now;
+
+    qsort(service->rows, total, sizeof(struct top_row), compare_row);
+}
+
+/**
+ * @brief 按终端格式输出一个业务
+ */
+static void print_service(struct top_service *service)
+{
+    uint32_t i, dead = 0, low = 0;
+    char     ip[INET_ADDRSTRLEN];
+    struct top_row *row;
+
+    for (i = 0; i < service->row_num; i++) {
+        dead += service->rows[i].dead;
+        low  += service->rows[i].low;
+    }
+
+    printf("\033[1m%s\033[m  servers: %u  dead: %u  low: %u  qps: %.1f\n",
+           service->name, service->row_num, dead, low, service->qps);
+    printf("  %-15s %10s %8s %10s %15s %8s %8s  %s\n",
+           "IP", "QPS", "ERR%", "LAT(ms)", "WEIGHT(dyn/st)", "WSHARE%", "SHARE%", "STATUS");
+
+    for (i = 0; i < service->row_num; i++) {
+        row = &service->rows[i];
+        inet_ntop(AF_INET, &row->server->server_ip, ip, sizeof(ip));
+        printf("  %-15s %10.1f %8.2f %10.2f %7u/%-7u %8.2f %8.2f  %s\n", ip, row->qps, row->err, row->lat,
+               row->server->weight_dynamic, row->server->weight_static, row->wshare, row->share,
+               row->dead ? "DEAD" : (row->low ? "LOW" : "OK"));
+    }
+
+    printf("\n");
+}
+
+/**
+ * @brief 输出JSON字符串，转义引号、反斜杠和控制字符
+ */
+static void print_json_string(const char *str)
+{
+    const unsigned char *p;
+
+    putchar('"');
+    for (p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            printf("\\%c", *p);
+        } else if (*p < 0x20) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief 按JSON格式输出所有业务，便于脚本处理
+ * @info  超出TOP_SERVICE_MAX未加载的业务数通过skipped字段输出
+ */
+static void dump_json(void)
+{
+    int32_t  i;
+    uint32_t j;
+    char     ip[INET_ADDRSTRLEN];
+    struct top_row *row;
+
+    printf("{\"skipped\":%u,\"services\":[", service_skipped);
+    for (i = 0; i < service_num; i++) {
+        printf("%s{\"name\":", i ? "," : "");
+        print_json_string(services[i].name);
+        printf(",\"qps\":%.3f,\"servers\":[", services[i].qps);
+        for (j = 0; j < services[i].row_num; j++) {
+            row = &services[i].rows[j];
+            inet_ntop(AF_INET, &row->server->server_ip, ip, sizeof(ip));
+            printf("%s{\"ip\":\"%s\",\"qps\":%.3f,\"error_ratio\":%.4f,\"latency\":%.3f,"
+                   "\"weight_dynamic\":%u,\"weight_static\":%u,\"weight_share\":%.4f,\"traffic_share\":%.4f,"
+                   "\"status\":\"%s\"}",
+                   j ? "," : "", ip, row->qps, row->err / 100.0, row->lat,
+                   row->server->weight_dynamic, row->server->weight_static,
+                   row->wshare / 100.0, row->share / 100.0,
+                   row->dead ? "dead" : (row->low ? "low" : "ok"));
+        }
+        printf("]}");
+    }
+    printf("]}\n");
+}
+
+static void print_usage(const char *name)
+{
+    printf(" This is a live viewer of nlb route data.\n");
+    printf(" Usage:  %s [OPTION]\n", name);
+    printf("        -h              Print this usage\n");
+    printf("        -s service      Only show services whose name contains this string\n");
+    printf("        -o key          Sort by ip|qps|err|lat|weight|share, default qps\n");
+    printf("        -d seconds      Refresh interval, default 1\n");
+    printf("        -n count        Exit after count refreshes, default forever\n");
+    printf("        -j              Sample once over the interval, dump JSON and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+    int32_t  c, i, count = -1;
+    uint32_t interval = 1;
+    BOOL     json = FALSE;
+
+    while ((c = getopt(argc, argv, "hs:o:d:n:j")) != -1) {
+        switch (c) {
+            case 's':
+                filter = optarg;
+                break;
+            case 'o':
+                if (!strcmp(optarg, "ip"))          sort_key = TOP_SORT_IP;
+                else if (!strcmp(optarg, "qps"))    sort_key = TOP_SORT_QPS;
+                else if (!strcmp(optarg, "err"))    sort_key = TOP_SORT_ERR;
+                else if (!strcmp(optarg, "lat"))    sort_key = TOP_SORT_LAT;
+                else if (!strcmp(optarg, "weight")) sort_key = TOP_SORT_WEIGHT;
+                else if (!strcmp(optarg, "share"))  sort_key = TOP_SORT_SHARE;
+                else {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'd':
+                interval = (uint32_t)atoi(optarg);
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'j':
+                json = TRUE;
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (!interval) {
+        interval = 1;
+    }
+
+    /* 第一次采样作为基准 */
+    scan_services();
+    for (i = 0; i < service_num; i++) {
+        sample_service(&services[i]);
+    }
+
+    while (count != 0) {
+        sleep(interval);
+        scan_services();
+        for (i = 0; i < service_num; i++) {
+            sample_service(&services[i]);
+        }
+
+        if (json) {
+            if (service_skipped) {
+                fprintf(stderr, "%u services skipped, at most %d services are shown, use -s to filter\n",
+                        service_skipped, TOP_SERVICE_MAX);
+            }
+            dump_json();
+            break;
+        }
+
+        printf("\033[H\033[2J");
+        printf("nlbtop - %d services, refresh every %us", service_num, interval);
+        if (service_skipped) {
+            printf(", \033[1m%u services skipped (limit %d), use -s to filter\033[m", service_skipped, TOP_SERVICE_MAX);
+        }
+        printf("\n\n");
+        for (i = 0; i < service_num; i++) {
+            print_service(&services[i]);
+        }
+        fflush(stdout);
+
+        if (count > 0) {
+            count--;
+        }
+    }
+
+    return 0;
+}